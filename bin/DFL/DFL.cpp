@@ -1,4 +1,6 @@
 #include <thread>
+#include <atomic>
+#include <random>
 
 #include <glog/logging.h>
 
@@ -23,6 +25,7 @@
 #include "../transaction_verifier.hpp"
 #include "../reputation_manager.hpp"
 #include "../reputation_sdk.hpp"
+#include "../reputation_plugin.hpp"
 #include "../transaction_storage_for_block.hpp"
 #include "../block_manager.hpp"
 #include "../reputation_dll_test.hpp"
@@ -34,6 +37,7 @@ using model_datatype = float;
 std::shared_ptr<Ml::MlCaffeModel<model_datatype, caffe::SGDSolver>> model_train;
 std::shared_ptr<Ml::MlCaffeModel<model_datatype, caffe::SGDSolver>> model_test;
 std::mutex training_lock;
+std::mutex model_test_lock;
 
 std::shared_ptr<dataset_storage<model_datatype>> main_dataset_storage;  //store machine learning dataset
 std::shared_ptr<transaction_generator> main_transaction_generator;  //generate transactions, receipts
@@ -43,10 +47,70 @@ std::shared_ptr<reputation_manager> main_reputation_manager;        //manage rep
 std::shared_ptr<transaction_storage_for_block> main_transaction_storage_for_block;  //store verified transactions and block cache
 std::shared_ptr<block_manager> main_block_manager;                  //generate blocks, store blocks.
 
-dll_loader<reputation_interface<model_datatype>> reputation_dll;
+reputation_plugin<model_datatype> reputation_dll;
+reputation_node_ids reputation_node_id; //the node ids of the reputation rounds, guarded by the update_model lock
 std::condition_variable exit_cv;
 std::mutex exit_cv_lock;
 
+//the models of a round are evaluated on the same test set, so a model evaluated again in a later stage (or received
+//twice) hits model_evaluation_cache instead of running caffe again. A new test set is drawn after each model update.
+struct round_test_set
+{
+	uint64_t id;
+	std::vector<Ml::tensor_blob_like<model_datatype>> data;
+	std::vector<Ml::tensor_blob_like<model_datatype>> label;
+};
+std::shared_ptr<const round_test_set> current_test_set;
+std::mutex current_test_set_lock;
+Ml::evaluation_cache<model_datatype, std::string> model_evaluation_cache; //keyed by model_sha256, the models come from untrusted peers
+
+//the test set of the current round, drawn on the first use, nullptr if the dataset is empty
+std::shared_ptr<const round_test_set> get_test_set()
+{
+	static uint64_t test_set_counter = 0;
+	std::lock_guard guard(current_test_set_lock);
+	if (!current_test_set)
+	{
+		auto[test_dataset_data, test_dataset_label] = main_dataset_storage->get_random_data(global_var::ml_test_batch_size);
+		if (test_dataset_data.empty()) return nullptr;
+		current_test_set = std::make_shared<const round_test_set>(round_test_set{++test_set_counter, std::move(test_dataset_data), std::move(test_dataset_label)});
+	}
+	return current_test_set;
+}
+
+void next_test_set()
+{
+	std::lock_guard guard(current_test_set_lock);
+	current_test_set.reset();
+}
+
+//the SHA-256 of the layer digests, a peer cannot craft a model with the cache key of another model
+std::string model_sha256(const Ml::caffe_parameter_net<model_datatype>& parameter)
+{
+	std::string layer_digests;
+	const auto& layers = parameter.getLayers();
+	for (size_t layer_index = 0; layer_index < layers.size(); ++layer_index)
+	{
+		const auto& blob = layers[layer_index].getBlob_p();
+		if (!blob) continue;
+		const auto& data = blob->getData();
+		layer_digests += std::to_string(layer_index) + ":" + crypto::sha256::digest_s(reinterpret_cast<const uint8_t*>(data.data()), data.size() * sizeof(model_datatype)).getTextStr_lowercase() + ";";
+	}
+	return crypto::sha256::digest_s(layer_digests).getTextStr_lowercase();
+}
+
+//the accuracy of {parameter} on {test_set}, it is loaded into model_test and evaluated if it is not cached
+float evaluate_model(const Ml::caffe_parameter_net<model_datatype>& parameter, const round_test_set& test_set)
+{
+	return model_evaluation_cache.get_or_evaluate(model_sha256(parameter), test_set.id, [&parameter, &test_set]()
+	{
+		std::lock_guard guard(model_test_lock);
+		model_test->set_parameter(parameter);
+		auto[accuracy, loss] = model_test->evaluation_with_loss(test_set.data, test_set.label);
+		return Ml::evaluation_result<model_datatype>{accuracy, loss};
+	}).accuracy;
+}
+
 void generate_block()
 {
 	std::shared_ptr<profiler_auto> profiler_p;
@@ -98,6 +162,13 @@ void generate_block()
 	std_cout::println(ss.str());
 }
 
+//the random stream of the stochastic rounding, different for each transaction
+uint64_t rounding_seed()
+{
+	static std::atomic<uint64_t> seed(std::random_device{}());
+	return seed++;
+}
+
 void generate_transaction(const std::vector<Ml::tensor_blob_like<model_datatype>> &data, const std::vector<Ml::tensor_blob_like<model_datatype>> &label)
 {
 	std::shared_ptr<profiler_auto> profiler_p;
@@ -110,26 +181,27 @@ void generate_transaction(const std::vector<Ml::tensor_blob_like<model_datatype>
 		std::lock_guard guard(training_lock);
 		net_before = model_train->get_parameter();
 		model_train->train(data, label, false);
-		auto[test_dataset_data, test_dataset_label] = main_dataset_storage->get_random_data(global_var::ml_test_batch_size);
+		net_after = model_train->get_parameter();
 		{
 			std::shared_ptr<profiler_auto> profiler_p;
 			if (global_var::enable_profiler)
 				profiler_p.reset(new profiler_auto("generate_transaction/measure_accuracy"));
-			accuracy = model_train->evaluation(test_dataset_data, test_dataset_label);
+			auto test_set = get_test_set();
+			LOG_IF(FATAL, !test_set) << "empty dataset db after training";
+			accuracy = evaluate_model(net_after, *test_set);
 		}
 		LOG(INFO) << "training complete, accuracy: " << accuracy;
 		std_cout::println("[DFL] training complete, accuracy: " + std::to_string(accuracy));
-		net_after = model_train->get_parameter();
 	}
 	
 	std::string parameter_str;
 	if (global_var::ml_model_stream_type == "compressed")
 	{
-		parameter_str = Ml::model_interpreter<float>::generate_model_stream_by_compress_diff(net_before, net_after, global_var::ml_model_stream_compressed_filter_limit);
+		parameter_str = Ml::model_interpreter<float>::generate_model_stream_by_compress_diff(net_before, net_after, global_var::ml_model_stream_compressed_filter_limit, nullptr, nullptr, global_var::ml_model_stream_codec, rounding_seed(), global_var::ml_model_stream_compression);
 	}
 	else if (global_var::ml_model_stream_type == "normal")
 	{
-		parameter_str = Ml::model_interpreter<float>::generate_model_stream_normal(net_after);
+		parameter_str = Ml::model_interpreter<float>::generate_model_stream_normal(net_after, global_var::ml_model_stream_codec, rounding_seed());
 	}
 	else
 	{
@@ -205,8 +277,13 @@ void receive_transaction(const transaction& trans)
 			profiler_calculate_accuracy.reset(new profiler_auto("receive_transaction/calculate_accuracy"));
 		
 		auto [model_parameter, model_type] = Ml::model_interpreter<model_datatype>::parse_model_stream(trans.content.model_data);
-		auto[test_dataset_data, test_dataset_label] = main_dataset_storage->get_random_data(global_var::ml_test_batch_size);
-		if (test_dataset_data.empty())
+		if (model_parameter.getLayers().empty())
+		{
+			LOG(WARNING) << "cannot parse the model of transaction " << trans.hash_sha256 << ", the transaction is dropped";
+			return;
+		}
+		auto test_set = get_test_set();
+		if (!test_set)
 		{
 			LOG(ERROR) << "empty dataset db, cannot perform accuracy test";
 			return;
@@ -217,13 +294,11 @@ void receive_transaction(const transaction& trans)
 			Ml::caffe_parameter_net<model_datatype> parameter = model_train->get_parameter();
 			auto self_parameter_copy = parameter;
 			self_parameter_copy.patch_weight(model_parameter);
-			model_test->set_parameter(self_parameter_copy);
-			accuracy = model_test->evaluation(test_dataset_data, test_dataset_label);
+			accuracy = evaluate_model(self_parameter_copy, *test_set);
 		}
 		else if (model_type == Ml::model_compress_type::normal)
 		{
-			model_test->set_parameter(model_parameter);
-			accuracy = model_test->evaluation(test_dataset_data, test_dataset_label);
+			accuracy = evaluate_model(model_parameter, *test_set);
 		}
 		else
 		{
@@ -278,37 +353,62 @@ void update_model(std::shared_ptr<std::vector<transaction>> transactions)
 		std::shared_ptr<profiler_auto> profiler_calculate_self_accuracy;
 		if (global_var::enable_profiler)
 			profiler_calculate_self_accuracy.reset(new profiler_auto("update_model/calculate_self_accuracy"));
-		auto[test_dataset_data, test_dataset_label] = main_dataset_storage->get_random_data(global_var::ml_test_batch_size);
-		self_accuracy = model_train->evaluation(test_dataset_data, test_dataset_label);
+		//the current model is usually evaluated in generate_transaction already
+		auto test_set = get_test_set();
+		if (!test_set)
+		{
+			LOG(ERROR) << "empty dataset db, cannot perform accuracy test, skip this model update";
+			return;
+		}
+		self_accuracy = evaluate_model(parameter, *test_set);
 	}
 	
-	std::vector<updated_model<model_datatype>> received_models;
-	received_models.resize(transactions->size());
-	for (int i = 0; i < received_models.size(); ++i)
+	//the round views the parsed models, the node ids are kept across the rounds
+	std::vector<Ml::caffe_parameter_net<model_datatype>> received_models;
+	reputation_round<model_datatype> round;
+	received_models.reserve(transactions->size());
+	for (auto& [name, value] : reputation_map) reputation_node_id.add(name);
+	for (auto& single_transaction : *transactions)
 	{
-		Ml::model_compress_type model_type;
-		std::tie(received_models[i].model_parameter, model_type) = Ml::model_interpreter<model_datatype>::parse_model_stream((*transactions)[i].content.model_data);
-		
-		received_models[i].generator_address = (*transactions)[i].content.creator.node_address;
-		received_models[i].type = model_type;
+		auto [model, model_type] = Ml::model_interpreter<model_datatype>::parse_model_stream(single_transaction.content.model_data);
+		if (model.getLayers().empty())
+		{
+			LOG(WARNING) << "cannot parse the model of transaction " << single_transaction.hash_sha256 << ", skip it";
+			continue;
+		}
+		received_models.push_back(std::move(model));
+		round.types.push_back(model_type);
+		round.generators.push_back(reputation_node_id.add(single_transaction.content.creator.node_address));
 		
 		//set accuracy
 		bool found_flag = false;
-		for (auto& [receipt_hash, receipt]:(*transactions)[i].receipts)
+		double accuracy = 0;
+		for (auto& [receipt_hash, receipt]:single_transaction.receipts)
 		{
 			if (receipt.content.creator.node_address == global_var::address.getTextStr_lowercase())
 			{
 				//find the generated accuracy
 				found_flag = true;
-				received_models[i].accuracy = std::stof(receipt.content.accuracy);
+				accuracy = std::stof(receipt.content.accuracy);
 			}
 		}
 		LOG_IF(WARNING, !found_flag) << "cannot find the receipt to retrieve the accuracy data";
+		round.accuracies.push_back(accuracy);
 	}
 	
-	reputation_dll.get()->update_model(parameter, self_accuracy, received_models, reputation_map);
+	std::vector<double> reputation;
+	reputation_node_id.to_array(reputation_map, reputation);
+	round.models = Ml::robust_aggregation<model_datatype>::flatten(received_models);
+	round.current_model = &parameter;
+	round.self_accuracy = self_accuracy;
+	round.reputation = reputation.data();
+	round.node_count = reputation_node_id.size();
+	round.node_names = &reputation_node_id.names();
+	reputation_dll.update_model(round);
+	reputation_node_id.to_map(reputation, reputation_map);
 	model_train->set_parameter(parameter);
 	main_reputation_manager->update_reputation(reputation_map);
+	next_test_set();
 	
 	//display reputation and accuracy.
 	std_cout::println("[[DEBUG]] REPUTATION:");
@@ -347,19 +447,10 @@ int main(int argc, char **argv)
 	}
 	
 	//load reputation dll
-	if constexpr(std::is_same_v<model_datatype, float>)
-	{
-		auto [status,msg] = reputation_dll.load(*config.get<std::string>("reputation_dll_path"), export_class_name_reputation_float);
-		LOG_IF(FATAL, !status) << "cannot load reputation dll: " << msg;
-	}
-	else if constexpr(std::is_same_v<model_datatype, double>)
 	{
-		auto [status,msg] = reputation_dll.load(*config.get<std::string>("reputation_dll_path"), export_class_name_reputation_double);
+		auto [status,msg] = reputation_dll.load(*config.get<std::string>("reputation_dll_path"));
 		LOG_IF(FATAL, !status) << "cannot load reputation dll: " << msg;
-	}
-	else
-	{
-		LOG(FATAL) << "unknown model datatype";
+		LOG(INFO) << "load " << msg;
 	}
 	
 	//set public key and private key
@@ -380,9 +471,20 @@ int main(int argc, char **argv)
 	//model stream type
 	global_var::ml_model_stream_type = *config.get<std::string>("ml_model_stream_type");
 	global_var::ml_model_stream_compressed_filter_limit = *config.get<float>("ml_model_stream_compressed_filter_limit");
+	const std::string ml_model_stream_codec = *config.get<std::string>("ml_model_stream_codec");
+	const std::unordered_map<std::string, Ml::model_codec> codecs = {{"raw", Ml::model_codec::raw}, {"fp16", Ml::model_codec::fp16}, {"bf16", Ml::model_codec::bf16}, {"int8", Ml::model_codec::int8}, {"int4", Ml::model_codec::int4}};
+	LOG_IF(FATAL, !codecs.contains(ml_model_stream_codec)) << "unknown ml_model_stream_codec: " << ml_model_stream_codec;
+	global_var::ml_model_stream_codec = codecs.at(ml_model_stream_codec);
+	const std::string ml_model_stream_compression = *config.get<std::string>("ml_model_stream_compression");
+	const std::unordered_map<std::string, compression_codec> compressions = {{"lz4", compression_codec::lz4}, {"zstd", compression_codec::zstd}};
+	LOG_IF(FATAL, !compressions.contains(ml_model_stream_compression)) << "unknown ml_model_stream_compression: " << ml_model_stream_compression;
+	global_var::ml_model_stream_compression = Ml::model_interpreter<float>::default_compression();
+	global_var::ml_model_stream_compression.codec = compressions.at(ml_model_stream_compression);
+	global_var::ml_model_stream_compression.level = *config.get<int>("ml_model_stream_compression_level");
 	
 	//enable_profiler
 	global_var::enable_profiler = *config.get<bool>("enable_profiler");
+	reputation_dll.enable_profiler = global_var::enable_profiler;
 	std::shared_ptr<profiler_auto> profiler_p;
 	if (global_var::enable_profiler)
 		profiler_p.reset(new profiler_auto("application_running"));
@@ -18,6 +18,9 @@ configuration_file::json get_default_configuration()
 	output["ml_test_batch_size"] = 100;
 	output["ml_model_stream_type"] = "normal";  //compressed or normal
 	output["ml_model_stream_compressed_filter_limit"] = 0.5;
+	output["ml_model_stream_codec"] = "raw"; //raw, fp16, bf16, int8 or int4, the number format of the weights in the transactions
+	output["ml_model_stream_compression"] = "lz4"; //lz4 or zstd (built with DFL_USE_ZSTD), the compression of the compressed model streams
+	output["ml_model_stream_compression_level"] = 1; //the acceleration of lz4, the level of zstd
 	
 	output["data_storage_service_port"] = 8040;
 	output["data_storage_service_concurrency"] = 2;
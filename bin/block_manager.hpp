@@ -1,6 +1,7 @@
 #pragma once
 
 #include <rocksdb_api.hpp>
+#include <chunk_compression.hpp>
 
 #include "block.hpp"
 #include "transaction.hpp"
@@ -79,7 +80,7 @@ public:
 			std::string genesis_content_db;
 			auto status = _db_blocks->Get(rocksdb::ReadOptions(), "0", &genesis_content_db);
 			LOG_IF(ERROR, !status.ok()) << "[block] failed to access block database";
-			block genesis_block_db = deserialize_wrap<boost::archive::binary_iarchive, block>(genesis_content_db);
+			block genesis_block_db = decode_block(genesis_content_db);
 			if (genesis_block_db.final_hash != _genesis_hash)
 			{
 				LOG(ERROR) << "[block] genesis block mismatch";
@@ -176,9 +177,8 @@ public:
 		auto final_hash_hex = crypto::sha256_digest(*_current_generated_block);
 		_current_generated_block->final_hash = final_hash_hex.getTextStr_lowercase();
 		
-		std::string block_content_db = serialize_wrap<boost::archive::binary_oarchive>(*_current_generated_block).str();
 		block output = *_current_generated_block;
-		auto status = _db_blocks->Put(rocksdb::WriteOptions(), std::to_string(_height), block_content_db);
+		auto status = _db_blocks->Put(rocksdb::WriteOptions(), std::to_string(_height), encode_block(*_current_generated_block));
 		LOG_IF(ERROR, !status.ok()) << "[block] failed to access block database";
 		_height++;
 		
@@ -205,8 +205,7 @@ private:
 	 */
 	void store_block(const block& blk)
 	{
-		std::string block_content_db = serialize_wrap<boost::archive::binary_oarchive>(blk).str();
-		auto status = _db_blocks->Put(rocksdb::WriteOptions(), std::to_string(_height), block_content_db);
+		auto status = _db_blocks->Put(rocksdb::WriteOptions(), std::to_string(_height), encode_block(blk));
 		LOG_IF(ERROR, !status.ok()) << "[block] failed to access block database";
 		_height++;
 		
@@ -239,7 +238,23 @@ private:
 	{
 		std::string last_content_db;
 		auto status = _db_blocks->Get(rocksdb::ReadOptions(), std::to_string(_height - 1), &last_content_db);
-		block last_block_db = deserialize_wrap<boost::archive::binary_iarchive, block>(last_content_db);
+		block last_block_db = decode_block(last_content_db);
 		_previous_block_hash = last_block_db.final_hash;
 	}
+
+	/**
+	 * The blocks are chunk compressed, the blocks stored before are read as they are
+	 */
+	static std::string encode_block(const block& blk)
+	{
+		return chunk_compression::compress(serialize_wrap<boost::archive::binary_oarchive>(blk).str(), chunk_compression::options());
+	}
+
+	static block decode_block(const std::string& content_db)
+	{
+		if (!chunk_compression::is_compressed(content_db)) return deserialize_wrap<boost::archive::binary_iarchive, block>(content_db);
+		auto content = chunk_compression::decompress(content_db);
+		LOG_IF(FATAL, !content) << "[block] corrupted block in database";
+		return deserialize_wrap<boost::archive::binary_iarchive, block>(*content);
+	}
 };
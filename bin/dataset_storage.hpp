@@ -8,6 +8,8 @@
 #include <filesystem>
 #include <condition_variable>
 #include <mutex>
+#include <algorithm>
+#include <stdexcept>
 
 #include <boost/noncopyable.hpp>
 
@@ -16,6 +18,7 @@
 #include <network.hpp>
 #include <ml_layer.hpp>
 #include <boost_serialization_wrapper.hpp>
+#include <chunk_compression.hpp>
 #include <util.hpp>
 
 #include "std_output.hpp"
@@ -26,7 +29,13 @@
 //------------------------------------
 // dataset section
 // key : str{label}-{counter}
-// value : {dataset}(default) epoch(cf:epoch)
+// value : {dataset}(default) epoch(cf:epoch), the dataset is chunk compressed (uncompressed in the databases written before)
+//------------------------------------
+// in-memory index (not stored)
+// label index: labels in first-seen order with an exclusive prefix sum of their counters, a random number in
+//              [0, total) is mapped to {label, counter} by a binary search on the prefix sum.
+// hot tier: the most recently added samples, stored densely as {data, label} rows, keyed by {label index, counter}.
+//           samples found here skip the database read and the deserialization.
 //------------------------------------
 
 template<typename DType>
@@ -56,7 +65,9 @@ public:
 	
 	using reserved_sapce_full_callback = std::function<void(const std::vector<Ml::tensor_blob_like<DType>>&data, const std::vector<Ml::tensor_blob_like<DType>>&label)>;
 	
-	dataset_storage(const std::string &db_path, int reserved_in_memory_size) : _db_path(db_path), _reserved_in_memory_size(reserved_in_memory_size)
+	static constexpr int DEFAULT_HOT_SAMPLE_CAPACITY = 4096;
+	
+	dataset_storage(const std::string &db_path, int reserved_in_memory_size, int hot_sample_capacity = DEFAULT_HOT_SAMPLE_CAPACITY) : _db_path(db_path), _reserved_in_memory_size(reserved_in_memory_size), _hot_capacity(hot_sample_capacity)
 	{
 		rocksdb::Options options;
 		rocksdb::Status status;
@@ -137,31 +148,43 @@ public:
 		//update database
 		CHECK(data.size() == label.size()) << "[dataset_storage] data.size() != label.size()";
 		rocksdb::WriteBatch batch;
-		for (int index = 0; index < label.size(); ++index)
+		std::vector<uint64_t> sample_ids;
+		sample_ids.reserve(label.size());
 		{
-			std::string label_str = label[index].get_str();
-			auto label_iter = _counter_by_label.find(label_str);
-			std::string key;
-			if (label_iter == _counter_by_label.end())
+			std::lock_guard guard(_index_lock);
+			for (int index = 0; index < label.size(); ++index)
 			{
-				//new labels
-				key = label_str + "-0";
-				_counter_by_label[label_str] = 1;
-			}
-			else
-			{
-				//old labels
-				key = label_str + "-" + std::to_string(label_iter->second);
-				label_iter->second++;
+				std::string label_str = label[index].get_str();
+				auto label_iter = _counter_by_label.find(label_str);
+				std::string key;
+				uint32_t label_index, counter;
+				if (label_iter == _counter_by_label.end())
+				{
+					//new labels
+					key = label_str + "-0";
+					_counter_by_label[label_str] = 1;
+					label_index = _label_list.size();
+					_label_list.push_back(label_str);
+					_label_index_by_label[label_str] = label_index;
+					counter = 0;
+				}
+				else
+				{
+					//old labels
+					key = label_str + "-" + std::to_string(label_iter->second);
+					counter = label_iter->second;
+					label_iter->second++;
+					label_index = _label_index_by_label.at(label_str);
+				}
+				sample_ids.push_back(make_sample_id(label_index, counter));
+				dataset_content<DType> content;
+				content.data = data[index];
+				content.label = label[index];
+				batch.Put(_column_family_handles[0], key, encode_sample(content));
+				batch.Put(_column_family_handles[1], key, std::to_string(0));
 			}
-			dataset_content<DType> content;
-			content.data = data[index];
-			content.label = label[index];
-			std::string data_str = serialize_wrap<boost::archive::binary_oarchive>(content).str();
-			batch.Put(_column_family_handles[0], key, data_str);
-			batch.Put(_column_family_handles[1], key, std::to_string(0));
+			update_labels_in_db(batch);
 		}
-		update_labels_in_db(batch);
 		
 		rocksdb::WriteOptions write_options;
 		write_options.sync = true;
@@ -172,6 +195,16 @@ public:
 		}
 		assert(status.ok());
 		
+		//the samples are visible to get_random_data only after they are in the database
+		{
+			std::lock_guard guard(_index_lock);
+			for (int i = 0; i < data.size(); ++i)
+			{
+				insert_data_into_hot_tier(sample_ids[i], data[i], label[i]);
+			}
+			rebuild_label_index();
+		}
+		
 		//update reserved space
 		//int start_loc = data.size() > _reserved_in_memory_size ? data.size() - _reserved_in_memory_size : 0;
 		for (int i = 0; i < data.size(); ++i)
@@ -191,88 +224,80 @@ public:
 	// if the current data in DB < size(arg), the output will contain duplicated data to ensure the size.
 	std::tuple<std::vector<Ml::tensor_blob_like<DType>>, std::vector<Ml::tensor_blob_like<DType>>> get_random_data(int size)
 	{
+		static thread_local std::mt19937 rng(std::random_device{}());
+		
 		std::vector<Ml::tensor_blob_like<DType>> data;
-		data.reserve(size);
 		std::vector<Ml::tensor_blob_like<DType>> label;
-		label.reserve(size);
-		
-		//calculate total size
-		std::vector<std::string> label_str;
-		label_str.reserve(_counter_by_label.size());
-		std::vector<int> label_size;
-		label_size.reserve(_counter_by_label.size());
-		int total_size = 0;
-		for (auto &&pair: _counter_by_label)
-		{
-			total_size += pair.second;
-			label_str.push_back(pair.first);
-			label_size.push_back(pair.second);
-		}
+		data.resize(size);
+		label.resize(size);
 		
-		if (total_size == 0)
-			return {data, label};
-		
-		//generate random index
-		std::vector<int> random_index;
-		random_index.resize(size);
-		std::random_device dev;
-		std::mt19937 rng(dev());
-		std::uniform_int_distribution<int> distribution(0, total_size - 1);
-		for (int i = 0; i < random_index.size(); ++i)
-		{
-			random_index[i] = distribution(rng);
-		}
-		std::vector<int> label_start_loc(label_size.size());
-		for (int label_index = 0; label_index < label_size.size(); ++label_index)
+		//samples not in the hot tier, {output index, key}
+		std::vector<std::tuple<int, std::string>> cold_samples;
 		{
-			label_start_loc[label_index] = 0;
-			for (int i = 0; i < label_index; ++i)
+			std::lock_guard guard(_index_lock);
+			const int64_t total_size = _label_prefix_sum.empty() ? 0 : _label_prefix_sum.back();
+			if (total_size == 0)
+				return {{}, {}};
+			
+			std::uniform_int_distribution<int64_t> distribution(0, total_size - 1);
+			for (int i = 0; i < size; ++i)
 			{
-				label_start_loc[label_index] += label_size[i];
+				if (!draw_sample(distribution(rng), data[i], label[i]))
+				{
+					cold_samples.emplace_back(i, _current_key);
+				}
 			}
 		}
 		
-		//insert data
-		for (auto &&random_number: random_index)
+		//batched read for the samples in the database
+		while (!cold_samples.empty())
 		{
-			std::string value;
-			std::string key;
-			while(true)
+			std::vector<rocksdb::Slice> keys;
+			keys.reserve(cold_samples.size());
+			for (auto &[index, key]: cold_samples)
 			{
-				int label_index = label_start_loc.size() - 1;
-				for (int i = 1; i < label_start_loc.size(); ++i)
+				keys.emplace_back(key);
+			}
+			std::vector<std::string> values;
+			std::vector<rocksdb::Status> status = _db->MultiGet(rocksdb::ReadOptions(), keys, &values);
+			
+			std::vector<std::tuple<int, std::string>> missing_samples;
+			for (int i = 0; i < cold_samples.size(); ++i)
+			{
+				auto &[index, key] = cold_samples[i];
+				if (!status[i].ok())
 				{
-					if (random_number < label_start_loc[i])
-					{
-						label_index = i - 1;
-						break;
-					}
+					missing_samples.emplace_back(index, "");
+					continue;
 				}
-				key = label_str[label_index] + "-" + std::to_string(random_number - label_start_loc[label_index]);
-				rocksdb::Status status = _db->Get(rocksdb::ReadOptions(), key, &value);
-
-				if(status.ok())
+				
+				dataset_content<DType> target;
+				try
 				{
-					break;
+					target = decode_sample(values[i]);
 				}
-				else
+				catch (...)
 				{
-					random_number = distribution(rng);
+					LOG(FATAL) << "[dataset_storage] unable to deserialize data, key: " << key << ", possibly corrupted db";
 				}
+				data[index].swap(target.data);
+				label[index].swap(target.label);
 			}
-
-			dataset_content<DType> target;
-			try
+			
+			//redraw the missing samples, same as the previous retry loop
+			cold_samples.clear();
+			if (missing_samples.empty()) break;
+			std::lock_guard guard(_index_lock);
+			std::uniform_int_distribution<int64_t> distribution(0, _label_prefix_sum.back() - 1);
+			for (auto &[index, key]: missing_samples)
 			{
-				target = deserialize_wrap<boost::archive::binary_iarchive, dataset_content<DType>>(value);
-			}
-			catch (...)
-			{
-				LOG(FATAL) << "[dataset_storage] unable to deserialize data, key: " << key << ", possibly corrupted db";
+				if (!draw_sample(distribution(rng), data[index], label[index]))
+				{
+					cold_samples.emplace_back(index, _current_key);
+				}
 			}
-			data.push_back(target.data);
-			label.push_back(target.label);
 		}
+		
 		return {data, label};
 	}
 	
@@ -291,6 +316,25 @@ private:
 	std::mutex _db_lock;
 
 	std::unordered_map<std::string, int> _counter_by_label;
+	
+	//label index and hot tier, protected by _index_lock
+	std::mutex _index_lock;
+	std::vector<std::string> _label_list;
+	std::unordered_map<std::string, uint32_t> _label_index_by_label; //the position in _label_list
+	std::vector<int64_t> _label_prefix_sum;
+	std::string _current_key;
+	
+	int _hot_capacity;
+	size_t _hot_data_length = 0;
+	size_t _hot_label_length = 0;
+	std::vector<int> _hot_data_shape;
+	std::vector<int> _hot_label_shape;
+	std::vector<DType> _hot_data;
+	std::vector<DType> _hot_label;
+	std::vector<uint64_t> _hot_id_by_slot;
+	std::unordered_map<uint64_t, uint32_t> _hot_slot_by_id;
+	uint32_t _hot_write_loc = 0;
+	
 	int _reserved_in_memory_size;
 	std::vector<Ml::tensor_blob_like<DType>> _reserved_data;
 	std::vector<Ml::tensor_blob_like<DType>> _reserved_label;
@@ -365,6 +409,101 @@ private:
 				exit(-1);
 			}
 		}
+		
+		std::lock_guard guard(_index_lock);
+		_label_list.clear();
+		_label_index_by_label.clear();
+		for (auto &&[label_str, counter]: _counter_by_label)
+		{
+			_label_index_by_label[label_str] = _label_list.size();
+			_label_list.push_back(label_str);
+		}
+		rebuild_label_index();
+	}
+	
+	static uint64_t make_sample_id(uint32_t label_index, uint32_t counter)
+	{
+		return (uint64_t(label_index) << 32) | counter;
+	}
+	
+	static std::string encode_sample(const dataset_content<DType> &content)
+	{
+		return chunk_compression::compress(serialize_wrap<boost::archive::binary_oarchive>(content).str(), chunk_compression::options());
+	}
+	
+	//throws if the value is corrupted
+	static dataset_content<DType> decode_sample(const std::string &value)
+	{
+		if (!chunk_compression::is_compressed(value)) return deserialize_wrap<boost::archive::binary_iarchive, dataset_content<DType>>(value);
+		auto data_str = chunk_compression::decompress(value);
+		if (!data_str) throw std::runtime_error("corrupted sample");
+		return deserialize_wrap<boost::archive::binary_iarchive, dataset_content<DType>>(*data_str);
+	}
+	
+	//call with _index_lock held
+	void rebuild_label_index()
+	{
+		_label_prefix_sum.resize(_label_list.size() + 1);
+		_label_prefix_sum[0] = 0;
+		for (size_t i = 0; i < _label_list.size(); ++i)
+		{
+			_label_prefix_sum[i + 1] = _label_prefix_sum[i] + _counter_by_label[_label_list[i]];
+		}
+	}
+	
+	//call with _index_lock held
+	//return true if the sample is served from the hot tier, otherwise its database key is left in _current_key.
+	bool draw_sample(int64_t random_number, Ml::tensor_blob_like<DType> &data, Ml::tensor_blob_like<DType> &label)
+	{
+		auto iter = std::upper_bound(_label_prefix_sum.begin() + 1, _label_prefix_sum.end(), random_number);
+		const uint32_t label_index = (iter - _label_prefix_sum.begin()) - 1;
+		const uint32_t counter = random_number - _label_prefix_sum[label_index];
+		
+		auto hot_iter = _hot_slot_by_id.find(make_sample_id(label_index, counter));
+		if (hot_iter != _hot_slot_by_id.end())
+		{
+			const uint32_t slot = hot_iter->second;
+			data.getShape() = _hot_data_shape;
+			data.getData().assign(_hot_data.begin() + slot * _hot_data_length, _hot_data.begin() + (slot + 1) * _hot_data_length);
+			label.getShape() = _hot_label_shape;
+			label.getData().assign(_hot_label.begin() + slot * _hot_label_length, _hot_label.begin() + (slot + 1) * _hot_label_length);
+			return true;
+		}
+		
+		_current_key = _label_list[label_index] + "-" + std::to_string(counter);
+		return false;
+	}
+	
+	//call with _index_lock held
+	void insert_data_into_hot_tier(uint64_t sample_id, const Ml::tensor_blob_like<DType> &data, const Ml::tensor_blob_like<DType> &label)
+	{
+		if (_hot_capacity <= 0) return;
+		if (_hot_data.empty())
+		{
+			//the first sample defines the row layout
+			_hot_data_shape = data.getShape();
+			_hot_label_shape = label.getShape();
+			_hot_data_length = data.size();
+			_hot_label_length = label.size();
+			_hot_data.resize(_hot_data_length * _hot_capacity);
+			_hot_label.resize(_hot_label_length * _hot_capacity);
+			_hot_id_by_slot.assign(_hot_capacity, UINT64_MAX);
+			_hot_slot_by_id.reserve(_hot_capacity);
+		}
+		if (data.getShape() != _hot_data_shape || label.getShape() != _hot_label_shape) return;
+		
+		//evict the oldest sample
+		if (_hot_id_by_slot[_hot_write_loc] != UINT64_MAX)
+		{
+			_hot_slot_by_id.erase(_hot_id_by_slot[_hot_write_loc]);
+		}
+		std::copy(data.getData().begin(), data.getData().end(), _hot_data.begin() + _hot_write_loc * _hot_data_length);
+		std::copy(label.getData().begin(), label.getData().end(), _hot_label.begin() + _hot_write_loc * _hot_label_length);
+		_hot_id_by_slot[_hot_write_loc] = sample_id;
+		_hot_slot_by_id[sample_id] = _hot_write_loc;
+		
+		_hot_write_loc++;
+		if (_hot_write_loc == _hot_capacity) _hot_write_loc = 0;
 	}
 	
 	void insert_data_into_reserved_space(const Ml::tensor_blob_like<DType> &data, const Ml::tensor_blob_like<DType> &label)
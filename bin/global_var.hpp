@@ -11,6 +11,8 @@ namespace global_var
 	int ml_test_batch_size;
 	std::string ml_model_stream_type;
 	float ml_model_stream_compressed_filter_limit;
+	Ml::model_codec ml_model_stream_codec;
+	chunk_compression::options ml_model_stream_compression;
 	int estimated_transaction_per_block;
 	bool enable_profiler;
 }
\ No newline at end of file
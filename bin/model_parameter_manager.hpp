@@ -13,13 +13,18 @@
 #include <filesystem>
 #include <ctime>
 #include <algorithm>
+#include <any>
+#include <memory>
+#include <mutex>
+#include <limits>
+#include <cstring>
 
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/text_oarchive.hpp>
-#include <boost/archive/text_iarchive.hpp>
 
 #include <rocksdb_api.hpp>
+#include <lz4.hpp>
+#include <boost_serialization_wrapper.hpp>
 #include <ml_layer.hpp>
 #include "transaction.hpp"
 #include  "../lib/crypto.hpp"
@@ -27,6 +32,16 @@
 #include "time_util.hpp"
 
 
+//------------------------------------
+// key : {node_hash}\0{timestamp, 8 bytes big endian}{sequence, 4 bytes big endian}
+// value : {record type, 1 byte}{payload}
+// record type keyframe : payload = LZ4(binary archive of caffe_parameter_net)
+// record type delta : payload = LZ4(byte-shuffled XOR of the weights against the previous version of the same node)
+//------------------------------------
+// All versions of a node share the key prefix {node_hash}\0 and are sorted by time, so history queries are prefix
+// range scans. A delta can only be decoded from the previous version, therefore the first version of a node and every
+// keyframe_interval-th version after it are stored as keyframes, and decoding starts from the nearest keyframe.
+
 enum model_parameter_storage_hash_mode
 {
     model_parameter_storage_MD5=0,
@@ -37,8 +52,9 @@ class model_parameter_manager {
 
 public:
     static constexpr char const *DB_CF_MODEL_PARAMETERS = "local model parameters";
+    static constexpr int DEFAULT_KEYFRAME_INTERVAL = 16;
 
-    model_parameter_manager(const std::string &model_db_path) : _model_db_path(model_db_path) {
+    model_parameter_manager(const std::string &model_db_path, int keyframe_interval = DEFAULT_KEYFRAME_INTERVAL) : _model_db_path(model_db_path), _keyframe_interval(keyframe_interval) {
         rocksdb::Options options;
         rocksdb::Status status;
 
@@ -86,9 +102,8 @@ public:
 
     void reset_model_parameter_database()
     {
-        rocksdb::Iterator* it=_model_db->NewIterator(rocksdb::ReadOptions());
-
-        std::string temp_key;
+        std::lock_guard guard(_lock);
+        std::unique_ptr<rocksdb::Iterator> it(_model_db->NewIterator(rocksdb::ReadOptions()));
 
         rocksdb::WriteOptions write_options;
         rocksdb::WriteBatch batch;
@@ -96,60 +111,82 @@ public:
 
         for (it->SeekToFirst();it->Valid();it->Next())
         {
-            temp_key=it->key().ToString();
-            batch.Delete(temp_key);
+            batch.Delete(it->key());
         }
 
         rocksdb::Status status=_model_db->Write(write_options,&batch);
         CHECK(status.ok()) << "[model_parameter_manager] failed to reset database in rocksdb";
-
+        _newest_version.clear();
     }
 
     void reset_model_parameter_database(const std::string &node_hash)
     {
-        rocksdb::Iterator* it=_model_db->NewIterator(rocksdb::ReadOptions());
-
-        std::string temp_key;
+        std::lock_guard guard(_lock);
+        const std::string prefix = key_prefix(node_hash);
+        std::unique_ptr<rocksdb::Iterator> it(_model_db->NewIterator(rocksdb::ReadOptions()));
 
         rocksdb::WriteOptions write_options;
         rocksdb::WriteBatch batch;
         write_options.sync = true;
 
-        for (it->SeekToFirst();it->Valid();it->Next())
+        for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next())
         {
-            temp_key=it->key().ToString();
-            std::size_t found=temp_key.find(node_hash);
-            if (found==0) {
-                batch.Delete(temp_key);
-            }
+            batch.Delete(it->key());
         }
 
         rocksdb::Status status=_model_db->Write(write_options,&batch);
         CHECK(status.ok()) << "[model_parameter_manager] failed to reset database in rocksdb";
-
+        _newest_version.erase(node_hash);
     }
 
-
     template<typename model_datatype>
     std::optional<std::vector<std::pair<time_t,Ml::caffe_parameter_net<model_datatype>>>> get_model_parameter_net_history(const std::string &node_hash)
+    {
+        return get_model_parameter_net_history<model_datatype>(node_hash, 0, std::numeric_limits<time_t>::max());
+    }
+
+    // return the versions whose timestamps are in [time_begin, time_end], only the versions from the nearest keyframe
+    // before time_begin are decoded.
+    template<typename model_datatype>
+    std::optional<std::vector<std::pair<time_t,Ml::caffe_parameter_net<model_datatype>>>> get_model_parameter_net_history(const std::string &node_hash, time_t time_begin, time_t time_end)
     {
         std::vector<std::pair<time_t,Ml::caffe_parameter_net<model_datatype>>> output;
 
-        rocksdb::Iterator* it=_model_db->NewIterator(rocksdb::ReadOptions());
-        std::string temp_key;
+        const std::string prefix = key_prefix(node_hash);
+        std::unique_ptr<rocksdb::Iterator> it(_model_db->NewIterator(rocksdb::ReadOptions()));
 
-        for (it->SeekToFirst();it->Valid();it->Next())
+        //find the keyframe at or before time_begin
+        it->Seek(version_key(node_hash, time_begin, 0));
+        if (!it->Valid() || !it->key().starts_with(prefix))
         {
-            temp_key=it->key().ToString();
-            std::size_t found=temp_key.find(node_hash);
-            if (found==0 && temp_key!=node_hash)
+            it->SeekForPrev(version_key(node_hash, time_begin, 0));
+        }
+        while (it->Valid() && it->key().starts_with(prefix) && record_type(it->value()) != record_keyframe)
+        {
+            it->Prev();
+        }
+        if (!it->Valid() || !it->key().starts_with(prefix))
+        {
+            it->Seek(prefix);
+        }
+
+        std::optional<Ml::caffe_parameter_net<model_datatype>> previous;
+        for (; it->Valid() && it->key().starts_with(prefix); it->Next())
+        {
+            time_t timestamp = key_timestamp(it->key());
+            if (timestamp > time_end) break;
+
+            auto net = decode_record<model_datatype>(it->value(), previous);
+            if (!net)
             {
-                auto pair= get_model_parameter_net_from_value<model_datatype>(it->value().ToString());
-                if (pair)
-                {
-                    output.push_back(pair.value());
-                }
+                LOG(WARNING) << "[model_parameter_manager] there is a corrupted record for node: " << node_hash;
+                break;
             }
+            if (timestamp >= time_begin)
+            {
+                output.emplace_back(timestamp, *net);
+            }
+            previous = std::move(net);
         }
 
         if (output.empty())
@@ -159,7 +196,6 @@ public:
         }
         else
         {
-            std::sort(output.begin(),output.end(), timestamp_comparator<Ml::caffe_parameter_net<model_datatype>>);
             return output;
         }
     }
@@ -167,80 +203,65 @@ public:
     template<typename model_datatype>
     std::optional<Ml::caffe_parameter_net<model_datatype>> get_model_parameter_net_newest(const std::string& node_hash)
     {
-        std::string parameter_str;
-
-//        string to string divided to stringstream to caffe_parameter_net
-        std::string newest_key=node_hash;
-        rocksdb::Status status=_model_db->Get(rocksdb::ReadOptions(),newest_key,&parameter_str);
-        if (status.IsNotFound())
+        std::lock_guard guard(_lock);
+        auto newest = load_newest_version<model_datatype>(node_hash);
+        if (!newest)
         {
             LOG(INFO)<<"there is no recording for node: "<<node_hash<<"in the database";
             return std::nullopt;
         }
-        else if (!status.ok())
-        {
-            LOG(WARNING) << "[model_parameter_manager] failed to read data in rocksdb";
-            return std::nullopt;
-        }
-        else
-        {
-            auto pair=get_model_parameter_net_from_value<model_datatype>(parameter_str);
-            if (pair)
-            {
-                return pair.value().second;
-            }
-            else
-            {
-                return std::nullopt;
-            }
-
-        }
+        return deep_copy(newest->net);
     }
 
-
     template<typename model_datatype>
     void update_model_parameter_net(const std::string &node_hash, const Ml::caffe_parameter_net<model_datatype> model_parameter_net,enum model_parameter_storage_hash_mode mode=model_parameter_storage_MD5)
     {
+        std::lock_guard guard(_lock);
+        auto newest = load_newest_version<model_datatype>(node_hash);
 
-//        caffe_parameter_net to stringstream to string
-        std::ostringstream  output;
-        boost::archive::text_oarchive o_archive(output);
-        o_archive<<model_parameter_net;
-
-//        use hash to get the second part of the key
-        std::string temp_key= key_generator(output.str());
-        if (temp_key.empty())
+        //the same content is only stored once
+        if (newest && newest->net == model_parameter_net)
         {
             return;
         }
-        rocksdb::WriteOptions write_options;
-        rocksdb::WriteBatch batch;
-        write_options.sync = true;
-
-        //        add timestamp (in UTC time)
 
+        //keep the keys sorted by time even if the clock goes backward
         time_t now=time_util::get_current_utc_time();
-        std::string timestamp=time_util::time_to_text(now);
-
-        std::string key=node_hash+"_"+temp_key;
-        std::string value=timestamp+"_"+output.str();
-
-        batch.Put(key,value);
-        batch.Delete(node_hash);
-        batch.Put(node_hash,value);
+        uint32_t sequence = 0;
+        if (newest)
+        {
+            now = std::max(now, newest->timestamp);
+            sequence = newest->sequence + 1;
+        }
 
-        rocksdb::Status status=_model_db->Write(write_options,&batch);
+        std::string value;
+        int versions_since_keyframe = 0;
+        if (newest && newest->versions_since_keyframe + 1 < _keyframe_interval && same_structure(newest->net, model_parameter_net))
+        {
+            value = encode_delta(newest->net, model_parameter_net);
+            versions_since_keyframe = newest->versions_since_keyframe + 1;
+        }
+        else
+        {
+            value = encode_keyframe(model_parameter_net);
+        }
 
+        rocksdb::WriteOptions write_options;
+        write_options.sync = true;
+        rocksdb::Status status=_model_db->Put(write_options, version_key(node_hash, now, sequence), value);
         CHECK(status.ok()) << "[model_parameter_manager] failed to put data in rocksdb";
 
+        newest_version<model_datatype> updated;
+        updated.timestamp = now;
+        updated.sequence = sequence;
+        updated.versions_since_keyframe = versions_since_keyframe;
+        updated.net = deep_copy(model_parameter_net);
+        _newest_version[node_hash] = std::move(updated);
     }
 
     template<typename model_datatype>
     void update_model_parameter_net(std::shared_ptr<std::vector<transaction>> transactions)
     {
-        rocksdb::WriteOptions write_options;
-        write_options.sync = true;
-
         for (int i=0; i< transactions->size();i++)
         {
             std::string node_hash=(*transactions)[i].content.creator.node_address;
@@ -250,6 +271,20 @@ public:
     }
 
 private:
+    enum record_type_t : uint8_t
+    {
+        record_keyframe = 0,
+        record_delta = 1,
+    };
+
+    template<typename model_datatype>
+    struct newest_version
+    {
+        time_t timestamp;
+        uint32_t sequence;
+        int versions_since_keyframe;
+        Ml::caffe_parameter_net<model_datatype> net;
+    };
 
 //    index 0 for default, index 1 is for itself, index 2 is for others
     std::vector<rocksdb::ColumnFamilyDescriptor> _model_column_families;
@@ -257,71 +292,237 @@ private:
 
     rocksdb::DB *_model_db;
     std::string _model_db_path;
+    int _keyframe_interval;
 
-    std::string key_generator(const std::string &initial_string, enum model_parameter_storage_hash_mode mode=model_parameter_storage_MD5)
+    //the newest decoded version of each node, the base of the next delta.
+    std::mutex _lock;
+    std::unordered_map<std::string, std::any> _newest_version;
+
+    static std::string key_prefix(const std::string &node_hash)
     {
-        //        use hash to get part of the key
-        std::string temp_key;
-        if (mode==model_parameter_storage_MD5)
-        {
-            crypto::md5 md5_manager;
-            auto temp_output=md5_manager.digest(initial_string);
-            temp_key=temp_output.getTextStr_lowercase();
-        }
-        else if(mode==model_parameter_storage_SHA256)
+        return node_hash + '\0';
+    }
+
+    static std::string version_key(const std::string &node_hash, time_t timestamp, uint32_t sequence)
+    {
+        std::string key = key_prefix(node_hash);
+        uint64_t timestamp_u64 = timestamp;
+        for (int i = 7; i >= 0; --i) key.push_back(char((timestamp_u64 >> (i * 8)) & 0xFF));
+        for (int i = 3; i >= 0; --i) key.push_back(char((sequence >> (i * 8)) & 0xFF));
+        return key;
+    }
+
+    static time_t key_timestamp(const rocksdb::Slice &key)
+    {
+        const auto *p = reinterpret_cast<const uint8_t *>(key.data() + key.size() - 12);
+        uint64_t timestamp = 0;
+        for (int i = 0; i < 8; ++i) timestamp = (timestamp << 8) | p[i];
+        return time_t(timestamp);
+    }
+
+    static uint32_t key_sequence(const rocksdb::Slice &key)
+    {
+        const auto *p = reinterpret_cast<const uint8_t *>(key.data() + key.size() - 4);
+        uint32_t sequence = 0;
+        for (int i = 0; i < 4; ++i) sequence = (sequence << 8) | p[i];
+        return sequence;
+    }
+
+    static uint8_t record_type(const rocksdb::Slice &value)
+    {
+        return value.empty() ? 0xFF : uint8_t(value[0]);
+    }
+
+    static std::string lz4_compress(const char *data, size_t size)
+    {
+        std::string output;
+        output.resize(LZ4::Compress_CalculateDstSize(size));
+        int real_compressed_size = LZ4::Compress(data, size, output.data(), output.size());
+        output.resize(real_compressed_size);
+        return output;
+    }
+
+    static std::optional<std::string> lz4_decompress(const char *data, size_t size)
+    {
+        if (size < 4) return std::nullopt;
+        std::string output;
+        output.resize(LZ4::Decompress_CalculateDstSize(data));
+        int real_decompressed_size = LZ4::Decompress(data, size, output.data());
+        if (real_decompressed_size != output.size()) return std::nullopt;
+        return output;
+    }
+
+    template<typename model_datatype>
+    static Ml::caffe_parameter_net<model_datatype> deep_copy(const Ml::caffe_parameter_net<model_datatype> &net)
+    {
+        Ml::caffe_parameter_net<model_datatype> output = net;
+        for (auto &layer: output.getLayers())
         {
-            crypto::sha256 sha256_manager;
-            auto temp_output=sha256_manager.digest(initial_string);
-            temp_key=temp_output.getTextStr_lowercase();
+            if (layer.getBlob_p()) layer.getBlob_p().reset(new Ml::tensor_blob_like<model_datatype>(*layer.getBlob_p()));
         }
-        else
+        return output;
+    }
+
+    template<typename model_datatype>
+    static bool same_structure(const Ml::caffe_parameter_net<model_datatype> &lhs, const Ml::caffe_parameter_net<model_datatype> &rhs)
+    {
+        auto &lhs_layers = lhs.getLayers();
+        auto &rhs_layers = rhs.getLayers();
+        if (lhs_layers.size() != rhs_layers.size()) return false;
+        for (int i = 0; i < lhs_layers.size(); ++i)
         {
-            std::cout<<"[model_parameter_manager] unknown hash type"<<std::endl;
-            temp_key="";
+            if (bool(lhs_layers[i].getBlob_p()) != bool(rhs_layers[i].getBlob_p())) return false;
+            if (!lhs_layers[i].getBlob_p()) continue;
+            if (lhs_layers[i].getBlob_p()->getShape() != rhs_layers[i].getBlob_p()->getShape()) return false;
+            if (lhs_layers[i].getBlob_p()->size() != rhs_layers[i].getBlob_p()->size()) return false;
         }
-        return temp_key;
+        return true;
     }
 
     template<typename model_datatype>
-    std::optional<std::pair<time_t,Ml::caffe_parameter_net<model_datatype>>> get_model_parameter_net_from_value(const std::string &value)
+    static std::string encode_keyframe(const Ml::caffe_parameter_net<model_datatype> &net)
     {
-        Ml::caffe_parameter_net<model_datatype> net_parameter;
+        auto data_str = serialize_wrap<boost::archive::binary_oarchive>(net).str();
+        return char(record_keyframe) + lz4_compress(data_str.data(), data_str.size());
+    }
 
-//        string slicing
-        std::size_t found=value.find("_");
+    // the XOR of two close floating point numbers has mostly zero high bytes, after grouping the n-th byte of all
+    // weights together the zeros are in long runs that LZ4 compresses well.
+    template<typename model_datatype>
+    static std::string encode_delta(const Ml::caffe_parameter_net<model_datatype> &previous, const Ml::caffe_parameter_net<model_datatype> &current)
+    {
+        using word_t = std::conditional_t<sizeof(model_datatype) == 8, uint64_t, uint32_t>;
+        static_assert(sizeof(model_datatype) == sizeof(word_t));
+        constexpr size_t word_size = sizeof(word_t);
 
-        if (found==std::string::npos)
+        size_t total_count = 0;
+        for (auto &layer: current.getLayers())
         {
-            LOG(WARNING)<<"there is a corrupted value field";
-            return std::nullopt;
+            if (layer.getBlob_p()) total_count += layer.getBlob_p()->size();
         }
-        else
+
+        std::string shuffled(total_count * word_size, '\0');
+        size_t index = 0;
+        for (int layer_index = 0; layer_index < current.getLayers().size(); ++layer_index)
         {
-//        get timestamp
-            time_t timestamp=time_util::text_to_time(value.substr(0,found));
+            auto &current_blob = current.getLayers()[layer_index].getBlob_p();
+            if (!current_blob) continue;
+            auto &current_data = current_blob->getData();
+            auto &previous_data = previous.getLayers()[layer_index].getBlob_p()->getData();
+            for (size_t i = 0; i < current_data.size(); ++i, ++index)
+            {
+                word_t current_word, previous_word;
+                std::memcpy(&current_word, &current_data[i], word_size);
+                std::memcpy(&previous_word, &previous_data[i], word_size);
+                word_t diff = current_word ^ previous_word;
+                for (size_t byte = 0; byte < word_size; ++byte)
+                {
+                    shuffled[byte * total_count + index] = char((diff >> (byte * 8)) & 0xFF);
+                }
+            }
+        }
 
-//        get  model parameter
-            std::string parameter_str=value.substr(found+1,value.size()-found-1);
-            std::stringstream parameter_stream;
-            parameter_stream.str(parameter_str);
-            boost::archive::text_iarchive i_archive(parameter_stream);
-            i_archive >> net_parameter;
+        return char(record_delta) + lz4_compress(shuffled.data(), shuffled.size());
+    }
 
-            std::pair<time_t, Ml::caffe_parameter_net<model_datatype>> output(timestamp,net_parameter);
+    template<typename model_datatype>
+    static std::optional<Ml::caffe_parameter_net<model_datatype>> decode_record(const rocksdb::Slice &value, const std::optional<Ml::caffe_parameter_net<model_datatype>> &previous)
+    {
+        using word_t = std::conditional_t<sizeof(model_datatype) == 8, uint64_t, uint32_t>;
+        constexpr size_t word_size = sizeof(word_t);
 
-            return output;
-        }
+        uint8_t type = record_type(value);
+        if (type != record_keyframe && type != record_delta) return std::nullopt;
+        auto payload = lz4_decompress(value.data() + 1, value.size() - 1);
+        if (!payload) return std::nullopt;
 
+        if (type == record_keyframe)
+        {
+            try
+            {
+                return deserialize_wrap<boost::archive::binary_iarchive, Ml::caffe_parameter_net<model_datatype>>(*payload);
+            }
+            catch (...)
+            {
+                return std::nullopt;
+            }
+        }
 
+        //delta
+        if (!previous) return std::nullopt;
+        auto output = deep_copy(*previous);
+        const size_t total_count = payload->size() / word_size;
+        size_t index = 0;
+        for (auto &layer: output.getLayers())
+        {
+            if (!layer.getBlob_p()) continue;
+            auto &data = layer.getBlob_p()->getData();
+            if (index + data.size() > total_count) return std::nullopt;
+            for (size_t i = 0; i < data.size(); ++i, ++index)
+            {
+                word_t diff = 0;
+                for (size_t byte = 0; byte < word_size; ++byte)
+                {
+                    diff |= word_t(uint8_t((*payload)[byte * total_count + index])) << (byte * 8);
+                }
+                word_t word;
+                std::memcpy(&word, &data[i], word_size);
+                word ^= diff;
+                std::memcpy(&data[i], &word, word_size);
+            }
+        }
+        if (index != total_count) return std::nullopt;
+        return output;
     }
 
-    template<class class_type>
-    static bool timestamp_comparator(const std::pair<time_t,class_type>& pair_1, const std::pair<time_t,class_type>& pair_2)
+    //call with _lock held
+    template<typename model_datatype>
+    newest_version<model_datatype>* load_newest_version(const std::string &node_hash)
     {
-        double difference= difftime(pair_1.first,pair_2.first);
-        return (difference<0);
-    }
+        auto iter = _newest_version.find(node_hash);
+        if (iter != _newest_version.end())
+        {
+            return std::any_cast<newest_version<model_datatype>>(&iter->second);
+        }
 
+        //not cached, decode the last version from the nearest keyframe
+        const std::string prefix = key_prefix(node_hash);
+        std::unique_ptr<rocksdb::Iterator> it(_model_db->NewIterator(rocksdb::ReadOptions()));
+        it->SeekForPrev(node_hash + '\1');
+        if (!it->Valid() || !it->key().starts_with(prefix)) return nullptr;
+        const std::string newest_key = it->key().ToString();
+
+        int versions_since_keyframe = 0;
+        while (it->Valid() && it->key().starts_with(prefix) && record_type(it->value()) != record_keyframe)
+        {
+            versions_since_keyframe++;
+            it->Prev();
+        }
+        if (!it->Valid() || !it->key().starts_with(prefix))
+        {
+            LOG(WARNING) << "[model_parameter_manager] there is no keyframe for node: " << node_hash;
+            return nullptr;
+        }
+
+        std::optional<Ml::caffe_parameter_net<model_datatype>> net;
+        for (; it->Valid() && it->key().compare(newest_key) <= 0; it->Next())
+        {
+            net = decode_record<model_datatype>(it->value(), net);
+            if (!net)
+            {
+                LOG(WARNING) << "[model_parameter_manager] there is a corrupted record for node: " << node_hash;
+                return nullptr;
+            }
+        }
+
+        newest_version<model_datatype> loaded;
+        loaded.timestamp = key_timestamp(newest_key);
+        loaded.sequence = key_sequence(newest_key);
+        loaded.versions_since_keyframe = versions_since_keyframe;
+        loaded.net = std::move(*net);
+        auto [inserted, status] = _newest_version.emplace(node_hash, std::move(loaded));
+        return std::any_cast<newest_version<model_datatype>>(&inserted->second);
+    }
 
 };
 
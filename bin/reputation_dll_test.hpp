@@ -5,9 +5,10 @@
 #include <random>
 
 #include "reputation_sdk.hpp"
+#include "reputation_plugin.hpp"
 
 template<typename DType>
-std::tuple<bool, std::string> reputation_dll_same_reputation_test(dll_loader<reputation_interface<DType>>& reputation_dll, Ml::caffe_parameter_net<DType> net)
+std::tuple<bool, std::string> reputation_dll_same_reputation_test(reputation_plugin<DType>& reputation_dll, Ml::caffe_parameter_net<DType> net)
 {
 	constexpr int node_count = 5;
 	constexpr double accuracy = 0.8;
@@ -35,7 +36,7 @@ std::tuple<bool, std::string> reputation_dll_same_reputation_test(dll_loader<rep
 			reputation_map[std::to_string(i)] = reputation;
 		}
 		
-		reputation_dll.get()->update_model(parameter, self_accuracy, received_models, reputation_map);
+		reputation_dll.update_model(parameter, self_accuracy, received_models, reputation_map);
 		auto ratio_net = parameter.dot_divide(net);
 		self_weight = ratio_net.sum() / ratio_net.size();
 	}
@@ -60,7 +61,7 @@ std::tuple<bool, std::string> reputation_dll_same_reputation_test(dll_loader<rep
 			reputation_map[std::to_string(i)] = reputation;
 		}
 		
-		reputation_dll.get()->update_model(parameter, self_accuracy, received_models, reputation_map);
+		reputation_dll.update_model(parameter, self_accuracy, received_models, reputation_map);
 		
 		//check parameter == average(parameter + received_models)
 		for (int i = 0; i < node_count; ++i)
@@ -76,7 +77,7 @@ std::tuple<bool, std::string> reputation_dll_same_reputation_test(dll_loader<rep
 }
 
 template<typename DType>
-std::tuple<bool, std::string> reputation_dll_same_model_test(dll_loader<reputation_interface<DType>>& reputation_dll, Ml::caffe_parameter_net<DType> net)
+std::tuple<bool, std::string> reputation_dll_same_model_test(reputation_plugin<DType>& reputation_dll, Ml::caffe_parameter_net<DType> net)
 {
 	std::random_device rd;
 	std::uniform_real_distribution distribution(0.1,0.9);
@@ -100,7 +101,7 @@ std::tuple<bool, std::string> reputation_dll_same_model_test(dll_loader<reputati
 		reputation_map[std::to_string(i)] = distribution(rd);
 	}
 	
-	reputation_dll.get()->update_model(parameter, self_accuracy, received_models, reputation_map);
+	reputation_dll.update_model(parameter, self_accuracy, received_models, reputation_map);
 	
 	//check parameter == average(parameter + received_models)
 	auto ratio = parameter.dot_divide(standard);
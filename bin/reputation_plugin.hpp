@@ -0,0 +1,169 @@
+#pragma once
+
+#include <tuple>
+#include <cmath>
+#include <string>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <type_traits>
+
+#include <dll_importer.hpp>
+#include <performance_profiler.hpp>
+
+#include "reputation_sdk.hpp"
+
+/**
+ * The node ids of the reputation rounds of a host. A name gets its id once (the simulators register all nodes at start,
+ * DFL registers the nodes as they appear), the rounds are built with find() and the reputation by id.
+ */
+class reputation_node_ids
+{
+public:
+	uint32_t add(const std::string& name)
+	{
+		auto [iter, inserted] = _ids.emplace(name, uint32_t(_names.size()));
+		if (inserted) _names.push_back(name);
+		return iter->second;
+	}
+
+	[[nodiscard]] std::optional<uint32_t> find(const std::string& name) const
+	{
+		auto iter = _ids.find(name);
+		if (iter == _ids.end()) return std::nullopt;
+		return iter->second;
+	}
+
+	[[nodiscard]] const std::vector<std::string>& names() const
+	{
+		return _names;
+	}
+
+	[[nodiscard]] size_t size() const
+	{
+		return _names.size();
+	}
+
+	//output[node id], NaN for the nodes not in the map, the names in the map must be added
+	void to_array(const std::unordered_map<std::string, double>& reputation, std::vector<double>& output) const
+	{
+		output.assign(_names.size(), NAN);
+		for (const auto& [name, value] : reputation)
+		{
+			auto node_id = find(name);
+			LOG_IF(FATAL, !node_id) << "node " << name << " has no node id";
+			output[*node_id] = value;
+		}
+	}
+
+	//the reputation updated by a round, the nodes still without reputation are not added to the map
+	void to_map(const std::vector<double>& values, std::unordered_map<std::string, double>& reputation) const
+	{
+		for (uint32_t node_id = 0; node_id < values.size(); ++node_id)
+		{
+			if (!std::isnan(values[node_id])) reputation[_names[node_id]] = values[node_id];
+		}
+	}
+
+private:
+	std::unordered_map<std::string, uint32_t> _ids;
+	std::vector<std::string> _names;
+};
+
+/**
+ * The reputation dll of a node: the v2 interface if the dll exports it, otherwise the v1 interface (run by
+ * reputation_v1_adapter for the v2 calls). With enable_profiler, the time of every call is recorded as
+ * "reputation_plugin/update_model" in the performance profiler.
+ */
+template<typename DType>
+class reputation_plugin
+{
+public:
+	bool enable_profiler = false;
+
+	std::tuple<bool, std::string> load(const std::string& dll_path)
+	{
+		static_assert(std::is_same_v<DType, float> || std::is_same_v<DType, double>, "unknown model datatype");
+		constexpr bool is_float = std::is_same_v<DType, float>;
+
+		auto [status_v2, msg_v2] = _dll_v2.load(dll_path, is_float ? export_class_name_reputation_v2_float : export_class_name_reputation_v2_double);
+		if (status_v2)
+		{
+			_version = 2;
+			_interface = _dll_v2.get();
+			return {true, "reputation plugin v2"};
+		}
+
+		auto [status, msg] = _dll_v1.load(dll_path, is_float ? export_class_name_reputation_float : export_class_name_reputation_double);
+		if (!status) return {false, msg};
+		_version = 1;
+		_interface = boost::make_shared<reputation_v1_adapter<DType>>(_dll_v1.get());
+		return {true, "reputation plugin v1"};
+	}
+
+	[[nodiscard]] uint32_t version() const
+	{
+		return _version;
+	}
+
+	void update_model(reputation_round<DType>& round)
+	{
+		auto profiler = start_profiler();
+		_interface->update_model(round);
+	}
+
+	void update_models(reputation_round<DType>* rounds, size_t count)
+	{
+		auto profiler = start_profiler();
+		_interface->update_models(rounds, count);
+	}
+
+	/**
+	 * The call with the v1 arguments, for the dll self-tests (reputation_dll_test.hpp); the hosts build the rounds from
+	 * their parsed models. A v1 plugin gets the arguments as they are, a v2 plugin gets views of the models.
+	 */
+	void update_model(Ml::caffe_parameter_net<DType>& current_model, double self_accuracy, const std::vector<updated_model<DType>>& models, std::unordered_map<std::string, double>& reputation)
+	{
+		if (_version == 1)
+		{
+			auto profiler = start_profiler();
+			_dll_v1.get()->update_model(current_model, self_accuracy, models, reputation);
+			return;
+		}
+
+		reputation_node_ids node_ids;
+		for (const auto& [name, value] : reputation) node_ids.add(name);
+		reputation_round<DType> round;
+		round.current_model = &current_model;
+		round.self_accuracy = self_accuracy;
+		for (const auto& model : models)
+		{
+			round.types.push_back(model.type);
+			round.accuracies.push_back(model.accuracy);
+			round.generators.push_back(node_ids.add(model.generator_address));
+		}
+		round.models = Ml::robust_aggregation<DType>::flatten(models.size(), [&models](size_t index) -> const Ml::caffe_parameter_net<DType>& { return models[index].model_parameter; });
+		std::vector<double> reputation_values;
+		node_ids.to_array(reputation, reputation_values);
+		round.reputation = reputation_values.data();
+		round.node_count = node_ids.size();
+		round.node_names = &node_ids.names();
+
+		update_model(round);
+		node_ids.to_map(reputation_values, reputation);
+	}
+
+private:
+	dll_loader<reputation_interface<DType>> _dll_v1;
+	dll_loader<reputation_interface_v2<DType>> _dll_v2;
+	boost::shared_ptr<reputation_interface_v2<DType>> _interface;
+	uint32_t _version = 0;
+
+	std::shared_ptr<profiler_auto> start_profiler()
+	{
+		std::shared_ptr<profiler_auto> profiler;
+		if (enable_profiler) profiler.reset(new profiler_auto("reputation_plugin/update_model"));
+		return profiler;
+	}
+};
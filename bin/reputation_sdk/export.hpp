@@ -1,10 +1,31 @@
 #pragma once
 
+#include "reputation_sdk.hpp"
+
 #define EXPORT_REPUTATION_API                                                               \
 extern "C" BOOST_SYMBOL_EXPORT reputation_implementation<float> reputation_float;           \
 reputation_implementation<float> reputation_float;                                          \
 extern "C" BOOST_SYMBOL_EXPORT reputation_implementation<double> reputation_double;         \
 reputation_implementation<double> reputation_double;
 
+//for the plugins implementing reputation_interface_v2
+#define EXPORT_REPUTATION_API_V2                                                            \
+extern "C" BOOST_SYMBOL_EXPORT reputation_implementation<float> reputation_v2_float;        \
+reputation_implementation<float> reputation_v2_float;                                       \
+extern "C" BOOST_SYMBOL_EXPORT reputation_implementation<double> reputation_v2_double;      \
+reputation_implementation<double> reputation_v2_double;
+
 constexpr char const* export_class_name_reputation_float = "reputation_float";
-constexpr char const* export_class_name_reputation_double = "reputation_double";
\ No newline at end of file
+constexpr char const* export_class_name_reputation_double = "reputation_double";
+constexpr char const* export_class_name_reputation_v2_float = "reputation_v2_float";
+constexpr char const* export_class_name_reputation_v2_double = "reputation_v2_double";
+
+//the similarity of the models in update_model(), index 0 is current_model and index i + 1 is models[i]
+template<typename DType>
+Ml::model_similarity<DType> model_similarity_with_current(const Ml::caffe_parameter_net<DType>& current_model, const std::vector<updated_model<DType>>& models)
+{
+	return Ml::model_similarity<DType>::compute(models.size() + 1, [&current_model, &models](size_t index) -> const Ml::caffe_parameter_net<DType>&
+	{
+		return index == 0 ? current_model : models[index - 1].model_parameter;
+	});
+}
\ No newline at end of file
@@ -2,9 +2,12 @@
 
 #include <unordered_map>
 #include <string>
+#include <cmath>
+#include <algorithm>
 
 #include <glog/logging.h>
 
+#include <tmt.hpp>
 #include <dll_importer.hpp>
 #include <ml_layer.hpp>
 
@@ -24,4 +27,100 @@ class reputation_interface
 public:
 	virtual void update_model(Ml::caffe_parameter_net<DType>& current_model, double self_accuracy, const std::vector<updated_model<DType>>& models, std::unordered_map<std::string, double>& reputation) = 0;
 	
-};
\ No newline at end of file
+};
+
+/** version 2 of the plugin interface: the received models are read-only views in the flat layout (no model copies)
+ *  and the nodes are integer ids.
+ */
+template<typename DType>
+class reputation_round
+{
+public:
+	//updated by the plugin. It shares the copy-on-write blobs with the parameter cache of the solver, so assign a new
+	//model to it, or detach it first (set_all, patch_weight, random) before writing through the raw blob pointers.
+	Ml::caffe_parameter_net<DType>* current_model = nullptr;
+	double self_accuracy = 0;
+	//received model m: the layers with blobs (in the layer order of current_model) start at models.models[m][layer]
+	typename Ml::robust_aggregation<DType>::flat_models models;
+	std::vector<Ml::model_compress_type> types;
+	std::vector<double> accuracies;
+	std::vector<uint32_t> generators; //the node id of the generator of model m
+	double* reputation = nullptr; //reputation[node id], updated by the plugin, NaN for the nodes without reputation yet
+	size_t node_count = 0;
+	const std::vector<std::string>* node_names = nullptr; //optional, node_names[node id]
+	
+	size_t model_count() const
+	{
+		return models.count();
+	}
+	
+	std::string node_name(uint32_t node_id) const
+	{
+		return node_names ? (*node_names)[node_id] : std::to_string(node_id);
+	}
+};
+
+template<typename DType>
+class reputation_interface_v2
+{
+public:
+	virtual void update_model(reputation_round<DType>& round) = 0;
+	
+	/** independent rounds (such as the nodes updated in the same tick), run on the thread pool by default, so
+	 *  update_model is called concurrently for different rounds. Override it to share work between the rounds.
+	 */
+	virtual void update_models(reputation_round<DType>* rounds, size_t count)
+	{
+		const uint32_t thread_count = uint32_t(std::min<size_t>(count, tmt::AvailableThreadCount()));
+		tmt::ParallelExecution_StepIncremental(thread_count, [this](uint32_t index, uint32_t thread_index, reputation_round<DType>& round)
+		{
+			update_model(round);
+		}, count, rounds);
+	}
+};
+
+//runs a v1 plugin for the v2 calls, the views are copied into caffe_parameter_net with the structure of current_model
+template<typename DType>
+class reputation_v1_adapter : public reputation_interface_v2<DType>
+{
+public:
+	explicit reputation_v1_adapter(boost::shared_ptr<reputation_interface<DType>> v1) : _v1(std::move(v1))
+	{
+	}
+	
+	void update_model(reputation_round<DType>& round) override
+	{
+		std::vector<updated_model<DType>> models(round.model_count());
+		for (size_t m = 0; m < models.size(); ++m)
+		{
+			models[m].model_parameter = *round.current_model;
+			models[m].model_parameter.set_all(0); //copy on write, current_model is not changed
+			size_t segment = 0;
+			for (auto& layer : models[m].model_parameter.getLayers())
+			{
+				if (!layer.getBlob_p()) continue;
+				auto& data = layer.getBlob_p()->getData();
+				std::copy(round.models.models[m][segment], round.models.models[m][segment] + data.size(), data.begin());
+				segment++;
+			}
+			models[m].type = round.types[m];
+			models[m].accuracy = round.accuracies[m];
+			models[m].generator_address = round.node_name(round.generators[m]);
+		}
+		
+		std::unordered_map<std::string, double> reputation;
+		for (uint32_t node_id = 0; node_id < round.node_count; ++node_id)
+		{
+			if (!std::isnan(round.reputation[node_id])) reputation[round.node_name(node_id)] = round.reputation[node_id];
+		}
+		_v1->update_model(*round.current_model, round.self_accuracy, models, reputation);
+		for (uint32_t node_id = 0; node_id < round.node_count; ++node_id)
+		{
+			auto iter = reputation.find(round.node_name(node_id));
+			if (iter != reputation.end()) round.reputation[node_id] = iter->second;
+		}
+	}
+
+private:
+	boost::shared_ptr<reputation_interface<DType>> _v1;
+};
@@ -0,0 +1,23 @@
+#include <reputation_sdk.hpp>
+
+template<typename DType>
+class reputation_implementation : public reputation_interface_v2<DType>
+{
+public:
+	void update_model(reputation_round<DType>& round) override
+	{
+		if (round.model_count() == 0) return;
+		
+		round.current_model->set_all(0); //copy on write, the other copies of current_model are not changed
+		std::vector<DType*> output;
+		for (auto& layer : round.current_model->getLayers())
+		{
+			if (layer.getBlob_p()) output.push_back(layer.getBlob_p()->getData().data());
+		}
+		
+		std::vector<double> weights(round.model_count(), 1.0);
+		Ml::robust_aggregation<DType>::weighted_average_flat(round.models, weights, output);
+	}
+};
+
+EXPORT_REPUTATION_API_V2
@@ -1,6 +1,6 @@
 #include <algorithm>
 #include <reputation_sdk.hpp>
-#include <clustering/hierarchical_clustering.hpp>
+#include <clustering/nn_chain_clustering.hpp>
 
 template<typename DType>
 class reputation_implementation : public reputation_interface<DType>
@@ -39,25 +39,17 @@ public:
 		std::vector<size_t> pass_index;
 		std::vector<size_t> non_pass_index;
 		{
-			std::vector<clustering::data_point_2d<float>> points;
-			points.reserve(models.size());
+			std::vector<double> points;
+			points.reserve(models.size() * 2);
 			for (int i = 0; i < models.size(); ++i)
 			{
-				auto x = models[i].accuracy;
-				auto y = reputation[models[i].generator_address];
-				points.emplace_back(x, y);
+				points.push_back(models[i].accuracy);
+				points.push_back(reputation[models[i].generator_address]);
 			}
 			float majority_ratio = 0.5;
-			clustering::hierarchical_clustering temp(false, 1, majority_ratio);
-			auto history = temp.process(points, 1);
-			auto last_state = history[history.size() - 1];
-			for (auto& operation : last_state.merge_operations)
-			{
-				if (operation.elements_index.size() >= models.size() * majority_ratio)
-				{
-					pass_index = operation.elements_index;
-				}
-			}
+			auto distances = clustering::condensed_distance::euclidean(points.data(), models.size(), 2);
+			auto clusters = clustering::nn_chain_clustering::process(distances, clustering::linkage::ward);
+			pass_index = clusters.majority_cluster(majority_ratio);
 		}
 		
 		for (int i = 0; i < models.size(); ++i)
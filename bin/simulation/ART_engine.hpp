@@ -0,0 +1,216 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+#include <glog/logging.h>
+#include <tmt.hpp>
+#include <counter_rng.hpp>
+#include <sparse_topology.hpp>
+
+//the reputation of a sender moves towards the similarity between its model and the aggregated model
+struct ART_similarity_reputation
+{
+	float learning_rate = 0.1f;
+
+	//the in-edges of one node: {received} values, {pending} 1 if received since the last aggregation, {reputation} to update
+	void operator()(float self_value, const float* received, const float* pending, float* reputation, size_t count) const
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			const float similarity = 1.0f - std::fabs(received[i] - self_value);
+			const float updated = reputation[i] + learning_rate * (similarity - reputation[i]);
+			reputation[i] = pending[i] > 0 ? updated : reputation[i];
+		}
+	}
+};
+
+/** struct of arrays engine of the scalar (ART) simulation.
+ *  A node has a scalar model in [0, 1]; training adds N(0.01, 0.005), the model is sent to the peers, and a node
+ *  aggregates when it has models from {buffer_size} peers: value = (value + sum(reputation * received)) / (1 + sum(reputation)).
+ *
+ *  The nodes and the edges are indices into contiguous arrays: the per-node arrays (value, next train tick, ...) and the
+ *  per-edge arrays (received value, pending flag, reputation) in the order of the transposed CSR topology, so a node
+ *  pulls from its senders and the edges of a node are contiguous. A tick is three passes without branches on the edges,
+ *  which the compiler vectorizes; the sums use a fixed number of lanes, so the result does not depend on the thread count.
+ *  Only the latest model of a sender is kept in the buffer.
+ */
+template<typename ReputationUpdate = ART_similarity_reputation>
+class ART_engine
+{
+public:
+	static constexpr float initial_reputation = 1.0f;
+
+	//topology: the peers of a node receive its models. training_interval_tick and buffer_size: per node
+	ART_engine(const sparse_topology& topology, const std::vector<std::vector<int>>& training_interval_tick, const std::vector<uint32_t>& buffer_size, uint64_t seed, ReputationUpdate reputation_update = {})
+		: _seed(seed), _reputation_update(reputation_update)
+	{
+		const size_t node_count = topology.node_count();
+		LOG_IF(FATAL, training_interval_tick.size() != node_count || buffer_size.size() != node_count) << "the node parameters do not match the topology";
+
+		_value.assign(node_count, 0.0f);
+		_trained.assign(node_count, 0.0f);
+		_next_train_tick.assign(node_count, 0);
+		_buffer_size.resize(node_count);
+		_interval_offsets.assign(1, 0);
+		for (size_t i = 0; i < node_count; ++i)
+		{
+			LOG_IF(FATAL, training_interval_tick[i].empty()) << "node " << i << " has no training interval";
+			_interval.insert(_interval.end(), training_interval_tick[i].begin(), training_interval_tick[i].end());
+			_interval_offsets.push_back(uint32_t(_interval.size()));
+			_buffer_size[i] = float(std::max<uint32_t>(buffer_size[i], 1));
+		}
+
+		auto senders = topology.transposed();
+		_edge_offsets.resize(node_count + 1);
+		_source.reserve(senders.edge_count());
+		for (sparse_topology::node_id i = 0; i < node_count; ++i)
+		{
+			_edge_offsets[i] = senders.edge_begin(i);
+			for (auto sender : senders.peers(i)) _source.push_back(sender);
+		}
+		_edge_offsets[node_count] = senders.edge_count();
+		_received.assign(_source.size(), 0.0f);
+		_pending.assign(_source.size(), 0.0f);
+		_reputation.assign(_source.size(), initial_reputation);
+	}
+
+	//run {tick}, the ticks must be run in order. Above parallel_threshold nodes the passes run on the thread pool
+	void run_tick(int tick)
+	{
+		for_each_block([this, tick](size_t begin, size_t end) { train(tick, begin, end); });
+		for_each_block([this](size_t begin, size_t end) { deliver(begin, end); });
+		for_each_block([this](size_t begin, size_t end) { aggregate(begin, end); });
+	}
+
+	size_t node_count() const
+	{
+		return _value.size();
+	}
+
+	std::span<const float> values() const
+	{
+		return _value;
+	}
+
+	//the senders of {node} and its reputation of them
+	std::span<const uint32_t> senders(uint32_t node) const
+	{
+		return {_source.data() + _edge_offsets[node], _source.data() + _edge_offsets[node + 1]};
+	}
+
+	std::span<const float> reputation(uint32_t node) const
+	{
+		return {_reputation.data() + _edge_offsets[node], _reputation.data() + _edge_offsets[node + 1]};
+	}
+
+	static constexpr size_t parallel_threshold = 1 << 16;
+
+private:
+	static constexpr size_t lane_count = 8;
+	static constexpr size_t block_size = 4096;
+
+	template<typename Function>
+	void for_each_block(Function function)
+	{
+		const size_t node_count = _value.size();
+		if (node_count < parallel_threshold)
+		{
+			function(0, node_count);
+			return;
+		}
+		std::vector<size_t> blocks((node_count + block_size - 1) / block_size);
+		for (size_t i = 0; i < blocks.size(); ++i) blocks[i] = i * block_size;
+		tmt::ParallelExecution_StepIncremental([&function, node_count](uint32_t index, uint32_t thread_index, size_t& begin)
+		{
+			function(begin, std::min(begin + block_size, node_count));
+		}, blocks.size(), blocks.data());
+	}
+
+	void train(int tick, size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			_trained[i] = tick >= _next_train_tick[i] ? 1.0f : 0.0f;
+			if (_trained[i] == 0) continue;
+
+			counter_rng rng(_seed, uint32_t(i), uint32_t(tick), 0);
+			std::uniform_int_distribution<uint32_t> interval_distribution(_interval_offsets[i], _interval_offsets[i + 1] - 1);
+			_next_train_tick[i] += _interval[interval_distribution(rng)];
+			std::normal_distribution<float> train_distribution(0.01f, 0.005f);
+			_value[i] = std::clamp(_value[i] + train_distribution(rng), 0.0f, 1.0f);
+		}
+	}
+
+	//pull the models of the senders trained in this tick
+	void deliver(size_t begin, size_t end)
+	{
+		const uint32_t* source = _source.data();
+		const float* trained = _trained.data();
+		const float* value = _value.data();
+		float* received = _received.data();
+		float* pending = _pending.data();
+		for (size_t e = _edge_offsets[begin]; e < _edge_offsets[end]; ++e)
+		{
+			const float sent = trained[source[e]];
+			received[e] = sent > 0 ? value[source[e]] : received[e];
+			pending[e] = std::max(pending[e], sent);
+		}
+	}
+
+	void aggregate(size_t begin, size_t end)
+	{
+		const float* received = _received.data();
+		const float* reputation = _reputation.data();
+		float* pending = _pending.data();
+		for (size_t i = begin; i < end; ++i)
+		{
+			const size_t edge_begin = _edge_offsets[i], edge_end = _edge_offsets[i + 1];
+			const float count = lane_sum(edge_begin, edge_end, [pending](size_t e) { return pending[e]; });
+			if (count < _buffer_size[i]) continue;
+
+			const float weighted = lane_sum(edge_begin, edge_end, [=](size_t e) { return pending[e] * reputation[e] * received[e]; });
+			const float weight = lane_sum(edge_begin, edge_end, [=](size_t e) { return pending[e] * reputation[e]; });
+			_value[i] = (_value[i] + weighted) / (1.0f + weight);
+			_reputation_update(_value[i], received + edge_begin, pending + edge_begin, _reputation.data() + edge_begin, edge_end - edge_begin);
+			std::fill(pending + edge_begin, pending + edge_end, 0.0f);
+		}
+	}
+
+	//sum in a fixed number of lanes, the compiler can vectorize it without reordering the float additions
+	template<typename Term>
+	static float lane_sum(size_t begin, size_t end, Term term)
+	{
+		float lanes[lane_count] = {};
+		size_t e = begin;
+		for (; e + lane_count <= end; e += lane_count)
+		{
+			for (size_t lane = 0; lane < lane_count; ++lane) lanes[lane] += term(e + lane);
+		}
+		float output = 0;
+		for (; e < end; ++e) output += term(e);
+		for (size_t lane = 0; lane < lane_count; ++lane) output += lanes[lane];
+		return output;
+	}
+
+	uint64_t _seed;
+	ReputationUpdate _reputation_update;
+
+	//per node
+	std::vector<float> _value;
+	std::vector<float> _trained; //1 if trained in the current tick
+	std::vector<int> _next_train_tick;
+	std::vector<float> _buffer_size;
+	std::vector<uint32_t> _interval_offsets; //the training intervals of node i: _interval[_interval_offsets[i]] ... _interval[_interval_offsets[i + 1] - 1]
+	std::vector<int> _interval;
+	std::vector<size_t> _edge_offsets; //the in-edges of node i: _edge_offsets[i] ... _edge_offsets[i + 1] - 1
+
+	//per in-edge
+	std::vector<uint32_t> _source;
+	std::vector<float> _received;
+	std::vector<float> _pending;
+	std::vector<float> _reputation;
+};
@@ -9,6 +9,14 @@ configuration_file::json get_default_simulation_configuration()
 	configuration_file::json output;
 	
 	output["report_time_remaining_per_tick_elapsed"] = 100;
+	output["checkpoint_interval_tick"] = 100; //0 to disable checkpoints, use --resume {output folder} to continue a simulation
+	output["random_seed"] = 0; //0: a random seed, which is printed at start; the same seed and configuration give the same result
+	
+	configuration_file::json shard = configuration_file::json::object();
+	shard["count"] = 1; //>1: the nodes are split over processes forked at start, the records of each are in {output}/shard_{index}
+	shard["numa_pin"] = true; //pin shard i to NUMA node i % NUMA node count
+	shard["ring_capacity_mb"] = 16; //shared memory per (source, target) shard pair
+	output["shard"] = shard;
 	
 	output["ml_solver_proto"] = "../../../dataset/MNIST/lenet_solver_memory.prototxt";
 	output["ml_train_dataset"] = "../../../dataset/MNIST/train-images.idx3-ubyte";
@@ -31,8 +39,8 @@ configuration_file::json get_default_simulation_configuration()
 	node["dataset_mode"] = "default"; //default - randomly choose from dataset, iid - randomly choose from iid labels, non-iid - choose higher frequency labels for specific label
 	node["training_interval_tick"] = configuration_file::json::array({8,9,10,11,12});
 	node["buffer_size"] = 2;
-	node["model_generation_type"] = "compressed"; //normal, compressed
-	node["filter_limit"] = 0.5;
+	node["model_generation_type"] = "compressed"; //normal, compressed, sparse
+	node["filter_limit"] = 0.5; //compressed: the middle range of changes to drop, sparse: the fraction of weights to drop
 	node["node_type"] = "normal";
 	node["non_iid_distribution"] = node_non_iid;
 	
@@ -47,6 +55,18 @@ configuration_file::json get_default_simulation_configuration()
 	
 	output["node_topology"] = configuration_file::json::array({"fully_connect", "average_degree-2", "1->2", "1--2"});
 	
+	configuration_file::json network = configuration_file::json::object();
+	network["enable"] = false; //false: a model is in the buffers of the peers in the tick it is trained
+	network["latency_tick"] = configuration_file::json::array({1.0, 3.0}); //uniform per link
+	network["bandwidth_byte_per_tick"] = configuration_file::json::array({1e6, 5e6}); //uniform per link, 0 for unlimited
+	network["drop_rate"] = 0.0; //probability to lose a model
+	output["network"] = network;
+	
+	configuration_file::json sparse_delta = configuration_file::json::object();
+	sparse_delta["threshold"] = 0.0; //>0: the sparse nodes send the changes of at least this magnitude instead of the top (1 - filter_limit)
+	sparse_delta["error_feedback"] = true; //the changes not sent are accumulated and sent once they are large enough
+	output["sparse_delta"] = sparse_delta;
+	
 	configuration_file::json services = configuration_file::json::object();
 	{
 		configuration_file::json accuracy_service = configuration_file::json::object();
@@ -60,6 +80,12 @@ configuration_file::json get_default_simulation_configuration()
 		weights_service["interval"] = 20;
 		services["weights_diff"] = weights_service;
 	}
+	{
+		configuration_file::json weight_divergence_service = configuration_file::json::object();
+		weight_divergence_service["enable"] = true;
+		weight_divergence_service["interval"] = 20;
+		services["weight_divergence"] = weight_divergence_service;
+	}
 	{
 		configuration_file::json force_broadcast_service = configuration_file::json::object();
 		force_broadcast_service["enable"] = false;
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <numeric>
+#include <map>
+
+#include <glog/logging.h>
+#include <tmt.hpp>
+#include <boost_serialization_wrapper.hpp>
+#include "./node.hpp"
+
+/** ensemble prediction of all nodes on a dataset.
+ *  The dataset is split into chunks, the (node, chunk) pairs are predicted by the thread pool and folded into a running
+ *  probability sum and a vote count per sample, so the memory is O(samples * classes) regardless of the node count.
+ *  The predictions of a chunk are folded in node order (early ones wait in the chunk), so the floating point sums do not
+ *  depend on the thread interleaving.
+ */
+template<typename model_datatype>
+class ensemble_evaluator
+{
+public:
+	//chunk_size should be a multiple of the test batch size, the remainder of a chunk is not predicted by caffe
+	explicit ensemble_evaluator(const std::vector<Ml::tensor_blob_like<model_datatype>>& data, size_t chunk_size = 1000) : _data(data), _chunk_size(chunk_size), _class_count(0)
+	{
+		LOG_IF(FATAL, _chunk_size == 0) << "chunk size must be positive";
+		_chunk_count = (_data.size() + _chunk_size - 1) / _chunk_size;
+		_chunks.reset(new chunk_state[_chunk_count]);
+	}
+
+	//Node: node<model_datatype> or any type with solver->predict(data), thread_count = 0: all available threads
+	template<typename Node>
+	void evaluate(std::vector<Node*>& nodes, uint32_t thread_count = 0)
+	{
+		if (nodes.empty()) return;
+		std::vector<size_t> work(nodes.size() * _chunk_count);
+		std::iota(work.begin(), work.end(), 0);
+		if (thread_count == 0) thread_count = tmt::AvailableThreadCount();
+		tmt::ParallelExecution_StepIncremental(thread_count, [this, &nodes](uint32_t index, uint32_t thread_index, size_t& item)
+		{
+			//chunk major, so the threads predict different nodes at the same time instead of waiting for the lock of one node
+			const size_t node_index = item % nodes.size(), chunk_index = item / nodes.size();
+			const size_t begin = chunk_index * _chunk_size, end = std::min(begin + _chunk_size, _data.size());
+			std::vector<Ml::tensor_blob_like<model_datatype>> chunk(_data.begin() + begin, _data.begin() + end);
+			auto prediction = nodes[node_index]->solver->predict(chunk);
+			LOG_IF(WARNING, prediction.size() != chunk.size()) << "only " << prediction.size() << " of " << chunk.size() << " samples are predicted, the chunk size is not a multiple of the batch size?";
+			fold(node_index, chunk_index, std::move(prediction));
+		}, work.size(), work.data());
+	}
+
+	//the sums of the evaluated nodes, to be merged by the evaluator of another shard on the same data
+	std::string save_sums() const
+	{
+		std::tuple<size_t, std::vector<model_datatype>, std::vector<uint32_t>> sums{_class_count, _probability_sum, _votes};
+		return serialize_wrap<boost::archive::binary_oarchive>(sums).str();
+	}
+
+	//merge the shards in a fixed order, so the sums do not depend on which shard finishes first
+	void merge_sums(const std::string& data)
+	{
+		auto [class_count, probability_sum, votes] = deserialize_wrap<boost::archive::binary_iarchive, std::tuple<size_t, std::vector<model_datatype>, std::vector<uint32_t>>>(data);
+		if (class_count == 0) return;
+		std::call_once(_allocate_flag, [this, class_count = class_count]()
+		{
+			_class_count = class_count;
+			_probability_sum.assign(_data.size() * _class_count, 0);
+			_votes.assign(_data.size() * _class_count, 0);
+		});
+		LOG_IF(FATAL, class_count != _class_count || probability_sum.size() != _probability_sum.size()) << "the merged sums are not computed on the same data";
+		for (size_t i = 0; i < _probability_sum.size(); ++i)
+		{
+			_probability_sum[i] += probability_sum[i];
+			_votes[i] += votes[i];
+		}
+	}
+
+	//the label with the largest probability sum
+	std::vector<Ml::tensor_blob_like<model_datatype>> predicted_labels_by_probability() const
+	{
+		return to_labels(_probability_sum);
+	}
+
+	//the label predicted by most nodes
+	std::vector<Ml::tensor_blob_like<model_datatype>> predicted_labels_by_vote() const
+	{
+		return to_labels(_votes);
+	}
+
+private:
+	struct chunk_state
+	{
+		std::mutex lock;
+		size_t next_node = 0;
+		std::map<size_t, std::vector<Ml::tensor_blob_like<model_datatype>>> pending; //predictions of later nodes
+	};
+
+	void fold(size_t node_index, size_t chunk_index, std::vector<Ml::tensor_blob_like<model_datatype>> prediction)
+	{
+		auto& chunk = _chunks[chunk_index];
+		std::lock_guard guard(chunk.lock);
+		if (node_index != chunk.next_node)
+		{
+			chunk.pending.emplace(node_index, std::move(prediction));
+			return;
+		}
+		const size_t begin = chunk_index * _chunk_size;
+		fold_in_order(begin, prediction);
+		chunk.next_node++;
+		for (auto iter = chunk.pending.begin(); iter != chunk.pending.end() && iter->first == chunk.next_node; iter = chunk.pending.erase(iter))
+		{
+			fold_in_order(begin, iter->second);
+			chunk.next_node++;
+		}
+	}
+
+	//the lock of the chunk must be held
+	void fold_in_order(size_t begin, const std::vector<Ml::tensor_blob_like<model_datatype>>& prediction)
+	{
+		if (prediction.empty()) return;
+		std::call_once(_allocate_flag, [this, &prediction]()
+		{
+			_class_count = prediction[0].getData().size();
+			_probability_sum.assign(_data.size() * _class_count, 0);
+			_votes.assign(_data.size() * _class_count, 0);
+		});
+
+		for (size_t i = 0; i < prediction.size(); ++i)
+		{
+			const auto& probability = prediction[i].getData();
+			model_datatype* probability_sum = _probability_sum.data() + (begin + i) * _class_count;
+			size_t max_label = 0;
+			for (size_t label = 0; label < _class_count; ++label)
+			{
+				probability_sum[label] += probability[label];
+				if (probability[label] > probability[max_label]) max_label = label;
+			}
+			_votes[(begin + i) * _class_count + max_label]++;
+		}
+	}
+
+	template<typename T>
+	std::vector<Ml::tensor_blob_like<model_datatype>> to_labels(const std::vector<T>& score) const
+	{
+		std::vector<Ml::tensor_blob_like<model_datatype>> output(_data.size());
+		for (size_t sample = 0; sample < _data.size(); ++sample)
+		{
+			size_t max_label = 0;
+			for (size_t label = 1; label < _class_count; ++label)
+			{
+				if (score[sample * _class_count + label] > score[sample * _class_count + max_label]) max_label = label;
+			}
+			output[sample].getShape() = {1};
+			output[sample].getData() = {model_datatype(max_label)};
+		}
+		return output;
+	}
+
+	const std::vector<Ml::tensor_blob_like<model_datatype>>& _data;
+	size_t _chunk_size;
+	size_t _chunk_count;
+	size_t _class_count;
+	std::once_flag _allocate_flag;
+	std::unique_ptr<chunk_state[]> _chunks;
+	std::vector<model_datatype> _probability_sum; //sample * class
+	std::vector<uint32_t> _votes; //sample * class
+};
@@ -11,6 +11,7 @@
 #include <vector>
 #include <unordered_map>
 #include "../../lib/ml_layer.hpp"
+#include "./simulation_random.hpp"
 
 enum class dataset_mode_type
 {
@@ -41,9 +42,9 @@ template<typename model_datatype>
 class node
 {
 public:
-	node(std::string _name, size_t buf_size) : name(std::move(_name)), next_train_tick(0), buffer_size(buf_size), planned_buffer_size(buf_size), dataset_mode(dataset_mode_type::unknown), model_generation_type(Ml::model_compress_type::unknown), filter_limit(0.0f), last_measured_accuracy(0.0f), last_measured_tick(0), type(node_type::unknown_node_type)
+	node(std::string _name, size_t buf_size) : name(std::move(_name)), id(0), next_train_tick(0), buffer_size(buf_size), planned_buffer_size(buf_size), dataset_mode(dataset_mode_type::unknown), model_generation_type(Ml::model_compress_type::unknown), filter_limit(0.0f), last_measured_accuracy(0.0f), last_measured_tick(0), type(node_type::unknown_node_type), reputation_stream(-1)
 	{
-		solver.reset(new Ml::MlCaffeModel<model_datatype, caffe::SGDSolver>());
+		solver.reset(new Ml::MlCaffeModelPooled<model_datatype, caffe::SGDSolver>());
 	}
 	
 	virtual ~node()
@@ -64,6 +65,8 @@ public:
 	}
 	
 	std::string name;
+	uint32_t id; //the order in the configuration file, keys the random streams of this node
+	counter_rng rng; //random stream of the node behavior in the current tick, set by the simulator before training
 	dataset_mode_type dataset_mode;
 	node_type type;
 	//std::unordered_map<int, std::tuple<Ml::caffe_parameter_net<model_datatype>, float>> nets_record; //for delayed accuracy testing
@@ -75,13 +78,19 @@ public:
 	size_t buffer_size;
 	size_t planned_buffer_size;
 	
-	std::vector<std::tuple<std::string, Ml::model_compress_type, Ml::caffe_parameter_net<model_datatype>>> parameter_buffer;
+	//{sender, type, model, sparse update}: a sparse_delta model stays in its wire format (the model is empty) until the
+	//buffer is aggregated, then it is applied to the parameter of this node
+	using buffered_model = std::tuple<std::string, Ml::model_compress_type, Ml::caffe_parameter_net<model_datatype>, std::string>;
+	std::vector<buffered_model> parameter_buffer;
 	std::mutex parameter_buffer_lock;
-	std::shared_ptr<Ml::MlCaffeModel<model_datatype, caffe::SGDSolver>> solver;
+	std::shared_ptr<Ml::MlCaffeModelPooled<model_datatype, caffe::SGDSolver>> solver; //only holds the model state, the caffe net is shared by all nodes
 	std::unordered_map<std::string, double> reputation_map;
 	Ml::model_compress_type model_generation_type;
 	float filter_limit;
+	Ml::caffe_parameter_net<model_datatype> sparse_residual; //the changes not sent yet by a sparse_delta node (error feedback)
 	std::shared_ptr<std::ofstream> reputation_output;
+	int reputation_stream; //stream id in the simulation result file
+	std::vector<std::string> reputation_columns; //the node names of the reputation_stream columns
 	
 	std::unordered_map<std::string, node *> peers;
 	std::unordered_map<std::string, node *> planned_peers;
@@ -95,6 +104,16 @@ public:
 	
 	virtual node<model_datatype> *new_node(std::string _name, size_t buf_size) = 0;
 	
+	//state of the derived node types, saved in the simulation checkpoint
+	virtual std::string save_node_specific_state() const
+	{
+		return "";
+	}
+	
+	virtual void load_node_specific_state(const std::string& state)
+	{
+	}
+	
 	static node<model_datatype> *get_node_by_type(const std::string type)
 	{
 		auto iter = RegisteredNodeType.find(type);
@@ -236,7 +255,7 @@ public:
 //		factor.random(0.7,1);
 //		output = output.dot_product(factor);
 		
-		output.random(0,0.001);
+		output.random(0, 0.001, this->rng);
 
 		return {output};
 	}
@@ -273,6 +292,16 @@ public:
 	
 	int turn;
 	
+	std::string save_node_specific_state() const override
+	{
+		return std::to_string(turn);
+	}
+	
+	void load_node_specific_state(const std::string& state) override
+	{
+		if (!state.empty()) turn = std::stoi(state);
+	}
+	
 	void train_model(const std::vector<Ml::tensor_blob_like<model_datatype>> &data, const std::vector<Ml::tensor_blob_like<model_datatype>> &label, bool display) override
 	{
 		this->solver->train(data, label, display);
@@ -291,7 +320,7 @@ public:
 //			auto factor = output;
 //			factor.random(0.7,1);
 //			output = output.dot_product(factor);
-			output.random(0,0.001);
+			output.random(0, 0.001, this->rng);
 		}
 		turn = (turn + 1) % 2;
 		return {output};
@@ -332,7 +361,7 @@ public:
 	{
 		Ml::caffe_parameter_net<model_datatype> output = this->solver->get_parameter();
 		auto factor = output;
-		factor.random(0, 0.1);
+		factor.random(0, 0.1, this->rng);
 		output = output - factor;
 		//output.fix_nan();
 		
@@ -403,14 +432,13 @@ public:
 	void train_model(const std::vector<Ml::tensor_blob_like<model_datatype>> &data, const std::vector<Ml::tensor_blob_like<model_datatype>> &label, bool display) override
 	{
 		std::vector<Ml::tensor_blob_like<model_datatype>> label_duplicate = label;
-		std::default_random_engine generator;
 		std::uniform_int_distribution<int> dist(0, 9);
 		for (int i = 0; i < label_duplicate.size(); ++i)
 		{
 			auto &labels = label_duplicate[i].getData();
 			for (auto &value: labels)
 			{
-				value = dist(generator);
+				value = dist(this->rng);
 			}
 		}
 		this->solver->train(data, label_duplicate, display);
@@ -498,7 +526,7 @@ public:
 		std::vector<Ml::tensor_blob_like<model_datatype>> data_duplicate = data;
 		for (int i = 0; i < data_duplicate.size(); ++i)
 		{
-			data_duplicate[i].random(0.0, 1.0);
+			data_duplicate[i].random(0.0, 1.0, this->rng);
 		}
 		this->solver->train(data_duplicate, label, display);
 	}
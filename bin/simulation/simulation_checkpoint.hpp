@@ -0,0 +1,305 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <optional>
+
+#include <glog/logging.h>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/unordered_map.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/version.hpp>
+
+#include <tmt.hpp>
+#include <boost_serialization_wrapper.hpp>
+#include "./node.hpp"
+#include "./simulation_service.hpp"
+#include "./simulation_random.hpp"
+
+/** checkpoint of simulator_mt
+ *  folder layout:
+ *  {checkpoint}/manifest.bin              : the latest complete checkpoint, replaced atomically (write + rename)
+ *  {checkpoint}/nodes/{name}.{tick}.bin   : node state written at {tick}
+ *
+ *  A node file is only written if the node state changed since the previous checkpoint, otherwise the manifest keeps
+ *  pointing to the older file. Files not referenced by the manifest are deleted after the manifest is written, so a
+ *  crash during a checkpoint always leaves the previous checkpoint usable.
+ *
+ *  The node states are serialized in the tick loop (in parallel) and the files are written by a background thread.
+ */
+
+template<typename model_datatype>
+class node_checkpoint
+{
+public:
+	Ml::caffe_model_state<model_datatype> model_state; //weights, bias, solver iteration and history
+	int next_train_tick;
+	size_t buffer_size;
+	std::unordered_map<std::string, double> reputation_map;
+	std::vector<typename node<model_datatype>::buffered_model> parameter_buffer;
+	std::vector<std::string> peers;
+	std::vector<std::string> planned_peers;
+	float last_measured_accuracy;
+	int last_measured_tick;
+	std::string node_specific_state;
+	Ml::caffe_parameter_net<model_datatype> sparse_residual; //empty in the checkpoints of version 0
+
+	void capture(node<model_datatype>& target)
+	{
+		model_state = target.solver->get_model_state();
+		next_train_tick = target.next_train_tick;
+		buffer_size = target.buffer_size;
+		reputation_map = target.reputation_map;
+		{
+			std::lock_guard guard(target.parameter_buffer_lock);
+			parameter_buffer = target.parameter_buffer;
+		}
+		peers.clear();
+		for (auto& [name, peer]: target.peers) peers.push_back(name);
+		planned_peers.clear();
+		for (auto& [name, peer]: target.planned_peers) planned_peers.push_back(name);
+		last_measured_accuracy = target.last_measured_accuracy;
+		last_measured_tick = target.last_measured_tick;
+		node_specific_state = target.save_node_specific_state();
+		sparse_residual = target.sparse_residual;
+	}
+
+	void restore(node<model_datatype>& target, const std::unordered_map<std::string, node<model_datatype> *>& node_container) const
+	{
+		target.solver->set_model_state(model_state);
+		target.next_train_tick = next_train_tick;
+		target.buffer_size = buffer_size;
+		target.reputation_map = reputation_map;
+		{
+			std::lock_guard guard(target.parameter_buffer_lock);
+			target.parameter_buffer = parameter_buffer;
+		}
+		target.peers.clear();
+		for (auto& name: peers) target.peers.emplace(name, node_container.at(name));
+		target.planned_peers.clear();
+		for (auto& name: planned_peers) target.planned_peers.emplace(name, node_container.at(name));
+		target.last_measured_accuracy = last_measured_accuracy;
+		target.last_measured_tick = last_measured_tick;
+		target.load_node_specific_state(node_specific_state);
+		target.sparse_residual = sparse_residual;
+	}
+
+	template<class Archive>
+	void serialize(Archive & ar, const unsigned int version)
+	{
+		ar & model_state;
+		ar & next_train_tick;
+		ar & buffer_size;
+		ar & reputation_map;
+		if (version >= 2)
+		{
+			ar & parameter_buffer;
+		}
+		else
+		{
+			//the buffered models without the sparse update
+			std::vector<std::tuple<std::string, Ml::model_compress_type, Ml::caffe_parameter_net<model_datatype>>> legacy_buffer;
+			ar & legacy_buffer;
+			parameter_buffer.clear();
+			for (auto& [sender, type, model]: legacy_buffer) parameter_buffer.emplace_back(std::move(sender), type, std::move(model), "");
+		}
+		ar & peers;
+		ar & planned_peers;
+		ar & last_measured_accuracy;
+		ar & last_measured_tick;
+		ar & node_specific_state;
+		if (version >= 1) ar & sparse_residual;
+	}
+};
+
+//BOOST_CLASS_VERSION for the class template
+namespace boost::serialization
+{
+	template<typename model_datatype>
+	struct version<node_checkpoint<model_datatype>>
+	{
+		typedef mpl::int_<2> type;
+		typedef mpl::integral_c_tag tag;
+		BOOST_STATIC_CONSTANT(int, value = version::type::value);
+	};
+}
+
+class simulation_checkpoint_manifest
+{
+public:
+	int tick = -1;
+	uint64_t result_file_size = 0;
+	std::unordered_map<std::string, std::string> node_files; //node name -> file name
+	std::unordered_map<std::string, std::string> service_states; //service name -> state
+	uint64_t random_seed = 0; //the seed of simulation_random, 0 in the checkpoints of version 0
+	std::string network_state; //the models in flight, empty in the checkpoints before version 2
+	uint32_t network_state_version = 2; //see simulation_network::load_state, 1 in the checkpoints before version 3
+
+	template<class Archive>
+	void serialize(Archive & ar, const unsigned int version)
+	{
+		ar & tick;
+		ar & result_file_size;
+		ar & node_files;
+		ar & service_states;
+		if (version >= 1) ar & random_seed;
+		if (version >= 2) ar & network_state;
+		network_state_version = version >= 3 ? 2 : 1;
+	}
+};
+BOOST_CLASS_VERSION(simulation_checkpoint_manifest, 3)
+
+template<typename model_datatype>
+class simulation_checkpoint
+{
+public:
+	explicit simulation_checkpoint(const std::filesystem::path& checkpoint_path) : _checkpoint_path(checkpoint_path)
+	{
+		std::filesystem::create_directories(_checkpoint_path / "nodes");
+		auto manifest = load_manifest();
+		if (manifest)
+		{
+			_manifest = *manifest;
+		}
+	}
+
+	~simulation_checkpoint()
+	{
+		wait();
+	}
+
+	//wait until the previous checkpoint is written
+	void wait()
+	{
+		if (_writer.joinable()) _writer.join();
+	}
+
+	std::optional<simulation_checkpoint_manifest> load_manifest() const
+	{
+		auto manifest_path = _checkpoint_path / "manifest.bin";
+		if (!std::filesystem::exists(manifest_path)) return std::nullopt;
+		std::ifstream input(manifest_path, std::ios::binary);
+		std::stringstream ss;
+		ss << input.rdbuf();
+		return deserialize_wrap<boost::archive::binary_iarchive, simulation_checkpoint_manifest>(ss);
+	}
+
+	/** save the state at the end of {tick}, the node states are serialized before return and written in background.
+	 *  result_file_size: the size of the result file after the records of {tick}, the records after it are dropped on resume.
+	 */
+	void save(int tick, uint64_t result_file_size, std::vector<node<model_datatype>*>& nodes, std::unordered_map<std::string, std::shared_ptr<service<model_datatype>>>& services, std::string network_state = "")
+	{
+		wait();
+
+		//serialize in the tick loop, the simulation can continue after this
+		std::vector<std::string> node_data(nodes.size());
+		std::vector<size_t> node_hash(nodes.size());
+		tmt::ParallelExecution([&node_data, &node_hash](uint32_t index, uint32_t thread_index, node<model_datatype>* single_node)
+		{
+			node_checkpoint<model_datatype> checkpoint;
+			checkpoint.capture(*single_node);
+			node_data[index] = serialize_wrap<boost::archive::binary_oarchive>(checkpoint).str();
+			node_hash[index] = std::hash<std::string>{}(node_data[index]);
+		}, nodes.size(), nodes.data());
+
+		simulation_checkpoint_manifest manifest = _manifest;
+		manifest.tick = tick;
+		manifest.result_file_size = result_file_size;
+		manifest.random_seed = simulation_random::get_seed();
+		manifest.network_state = std::move(network_state);
+		manifest.service_states.clear();
+		for (auto& [name, service_instance]: services)
+		{
+			manifest.service_states[name] = service_instance->save_state();
+		}
+
+		//skip the unchanged nodes
+		std::vector<std::tuple<std::string, std::string>> files_to_write; //{file name, content}
+		for (int i = 0; i < nodes.size(); ++i)
+		{
+			const std::string& name = nodes[i]->name;
+			auto hash_iter = _node_hash.find(name);
+			if (hash_iter != _node_hash.end() && hash_iter->second == node_hash[i] && manifest.node_files.contains(name)) continue;
+			_node_hash[name] = node_hash[i];
+			std::string file_name = name + "." + std::to_string(tick) + ".bin";
+			manifest.node_files[name] = file_name;
+			files_to_write.emplace_back(file_name, std::move(node_data[i]));
+		}
+
+		_writer = std::thread([this, manifest = std::move(manifest), files_to_write = std::move(files_to_write)]() mutable
+		{
+			auto nodes_path = _checkpoint_path / "nodes";
+			tmt::ParallelExecution([&nodes_path](uint32_t index, uint32_t thread_index, std::tuple<std::string, std::string>& file)
+			{
+				auto& [file_name, content] = file;
+				std::ofstream output(nodes_path / file_name, std::ios::binary);
+				output.write(content.data(), content.size());
+			}, files_to_write.size(), files_to_write.data());
+
+			{
+				auto manifest_content = serialize_wrap<boost::archive::binary_oarchive>(manifest).str();
+				std::ofstream output(_checkpoint_path / "manifest.bin.tmp", std::ios::binary);
+				output.write(manifest_content.data(), manifest_content.size());
+			}
+			std::filesystem::rename(_checkpoint_path / "manifest.bin.tmp", _checkpoint_path / "manifest.bin");
+
+			//remove the files not referenced by the manifest
+			std::unordered_map<std::string, bool> referenced;
+			for (auto& [name, file_name]: manifest.node_files) referenced[file_name] = true;
+			for (auto& entry: std::filesystem::directory_iterator(nodes_path))
+			{
+				if (!referenced.contains(entry.path().filename().string()))
+				{
+					std::filesystem::remove(entry.path());
+				}
+			}
+
+			LOG(INFO) << "[checkpoint] checkpoint at tick " << manifest.tick << " is written, " << files_to_write.size() << " of " << manifest.node_files.size() << " nodes changed";
+			_manifest = std::move(manifest);
+		});
+	}
+
+	/** restore {nodes} and return the tick of the checkpoint.
+	 *  node_container: all nodes to resolve the peers, which can be more than {nodes} if the nodes are sharded.
+	 */
+	int restore(const simulation_checkpoint_manifest& manifest, std::vector<node<model_datatype>*>& nodes, std::unordered_map<std::string, node<model_datatype> *>& node_container, std::unordered_map<std::string, std::shared_ptr<service<model_datatype>>>& services)
+	{
+		for (auto* single_node: nodes)
+		{
+			LOG_IF(FATAL, !manifest.node_files.contains(single_node->name)) << "[checkpoint] node " << single_node->name << " is not in the checkpoint";
+		}
+
+		auto nodes_path = _checkpoint_path / "nodes";
+		tmt::ParallelExecution([&manifest, &nodes_path, &node_container](uint32_t index, uint32_t thread_index, node<model_datatype>* single_node)
+		{
+			const std::string& file_name = manifest.node_files.at(single_node->name);
+			std::ifstream input(nodes_path / file_name, std::ios::binary);
+			std::stringstream ss;
+			ss << input.rdbuf();
+			auto content = ss.str();
+			auto checkpoint = deserialize_wrap<boost::archive::binary_iarchive, node_checkpoint<model_datatype>>(content);
+			checkpoint.restore(*single_node, node_container);
+		}, nodes.size(), nodes.data());
+
+		for (auto& [name, service_instance]: services)
+		{
+			auto iter = manifest.service_states.find(name);
+			if (iter != manifest.service_states.end()) service_instance->load_state(iter->second);
+		}
+
+		//the restored files are unchanged until the nodes train again
+		_manifest = manifest;
+		_node_hash.clear();
+		return manifest.tick;
+	}
+
+private:
+	std::filesystem::path _checkpoint_path;
+	std::thread _writer;
+	simulation_checkpoint_manifest _manifest; //the last written manifest
+	std::unordered_map<std::string, size_t> _node_hash; //hash of the last written state of each node
+};
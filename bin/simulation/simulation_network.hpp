@@ -0,0 +1,223 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <tuple>
+#include <random>
+#include <queue>
+#include <mutex>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <optional>
+
+#include <glog/logging.h>
+#include <configure_file.hpp>
+#include <boost_serialization_wrapper.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/unordered_map.hpp>
+#include <boost/serialization/string.hpp>
+#include "./node.hpp"
+#include "./simulation_random.hpp"
+
+/** network between the nodes of simulator_mt.
+ *  Without it, a model is in the buffers of the peers in the tick it is trained. With it, a model is delivered at
+ *  ceil(start + size / bandwidth + latency), start being the time the previous model on the same link is transferred,
+ *  or it is dropped with probability {drop_rate}. The size of a compressed model is its compressed size.
+ *
+ *  The latency and bandwidth of a link (sender -> receiver) are uniformly distributed in the configured ranges and are
+ *  drawn from simulation_random when used, so no per-link table is stored and the same seed gives the same network.
+ *  The models in flight are kept in a priority queue keyed by the arrival tick: send is O(log(in flight)) under one lock.
+ */
+template<typename model_datatype>
+class simulation_network
+{
+public:
+	using model_message = typename node<model_datatype>::buffered_model;
+
+	static constexpr int NO_ARRIVAL = std::numeric_limits<int>::max();
+
+	void apply_config(const configuration_file::json& config)
+	{
+		_enable = config["enable"];
+		_latency_tick = {config["latency_tick"][0], config["latency_tick"][1]};
+		_bandwidth_byte_per_tick = {config["bandwidth_byte_per_tick"][0], config["bandwidth_byte_per_tick"][1]};
+		_drop_rate = config["drop_rate"];
+		LOG_IF(FATAL, _latency_tick[0] < 0 || _latency_tick[1] < _latency_tick[0]) << "invalid network latency range";
+		LOG_IF(FATAL, _bandwidth_byte_per_tick[0] < 0 || _bandwidth_byte_per_tick[1] < _bandwidth_byte_per_tick[0]) << "invalid network bandwidth range";
+		LOG_IF(FATAL, _drop_rate < 0 || _drop_rate > 1) << "invalid network drop rate";
+	}
+
+	bool enabled() const
+	{
+		return _enable;
+	}
+
+	//thread safe, called by the train threads. size_byte: the size of the model on the wire
+	void send(int tick, const node<model_datatype>& sender, const node<model_datatype>& receiver, model_message message, size_t size_byte)
+	{
+		auto arrival_tick = schedule(tick, sender, receiver, size_byte);
+		if (arrival_tick) push(*arrival_tick, receiver.name, std::move(message));
+	}
+
+	//thread safe, the arrival tick of a model sent on the link, nullopt if it is dropped. The link state is kept by the sender's side
+	std::optional<int> schedule(int tick, const node<model_datatype>& sender, const node<model_datatype>& receiver, size_t size_byte)
+	{
+		_sent++;
+		_sent_byte += size_byte;
+
+		auto message_rng = simulation_random::get(sender.id, tick, random_purpose::network, receiver.id);
+		if (_drop_rate > 0 && std::uniform_real_distribution<double>(0, 1)(message_rng) < _drop_rate)
+		{
+			_dropped++;
+			return std::nullopt;
+		}
+
+		auto [latency, bandwidth] = link_property(sender.id, receiver.id);
+		std::lock_guard guard(_lock);
+		double& link_free_at = _link_free_at[(uint64_t(sender.id) << 32) | receiver.id];
+		double finish = std::max(double(tick), link_free_at) + (bandwidth > 0 ? double(size_byte) / bandwidth : 0.0);
+		link_free_at = finish;
+		return int(std::min(std::ceil(finish + latency), double(NO_ARRIVAL - 1)));
+	}
+
+	//thread safe, put a scheduled model in flight
+	void push(int arrival_tick, const std::string& receiver_name, model_message message)
+	{
+		std::lock_guard guard(_lock);
+		_in_flight.push({arrival_tick, _sequence++, receiver_name, std::move(message)});
+	}
+
+	//deliver the models arrived at or before {tick}, deliver_function(receiver name, model_message&&) in sending order
+	template<typename Function>
+	void deliver(int tick, Function deliver_function)
+	{
+		std::lock_guard guard(_lock);
+		while (!_in_flight.empty() && _in_flight.top().arrival_tick <= tick)
+		{
+			//the message is moved out before pop, the heap order only depends on the tick and sequence
+			auto& top = const_cast<in_flight&>(_in_flight.top());
+			deliver_function(top.receiver, std::move(top.message));
+			_in_flight.pop();
+			_delivered++;
+		}
+
+		//the links idle before {tick} are equivalent to new links
+		if (_link_free_at.size() > 2 * _in_flight.size() + 1024)
+		{
+			std::erase_if(_link_free_at, [tick](const auto& item){ return item.second <= tick; });
+		}
+	}
+
+	int next_arrival_tick() const
+	{
+		std::lock_guard guard(_lock);
+		return _in_flight.empty() ? NO_ARRIVAL : _in_flight.top().arrival_tick;
+	}
+
+	//{sent, dropped, delivered, in flight, sent MB} since the previous call
+	std::vector<float> pop_statistics()
+	{
+		std::vector<float> output = {float(_sent.exchange(0)), float(_dropped.exchange(0)), float(_delivered.exchange(0)), 0, float(double(_sent_byte.exchange(0)) / 1e6)};
+		{
+			std::lock_guard guard(_lock);
+			output[3] = float(_in_flight.size());
+		}
+		return output;
+	}
+
+	static std::vector<std::string> statistics_columns()
+	{
+		return {"sent", "dropped", "delivered", "in_flight", "sent_MB"};
+	}
+
+	std::string save_state() const
+	{
+		std::lock_guard guard(_lock);
+		std::vector<std::tuple<int, uint64_t, std::string, model_message>> in_flight_items;
+		auto copy = _in_flight;
+		while (!copy.empty())
+		{
+			auto& top = copy.top();
+			in_flight_items.emplace_back(top.arrival_tick, top.sequence, top.receiver, top.message);
+			copy.pop();
+		}
+		std::tuple<uint64_t, std::vector<std::tuple<int, uint64_t, std::string, model_message>>, std::unordered_map<uint64_t, double>> state{_sequence, in_flight_items, _link_free_at};
+		return serialize_wrap<boost::archive::binary_oarchive>(state).str();
+	}
+
+	//state_version 1: the messages were saved without the sparse update (the checkpoints before manifest version 3)
+	void load_state(const std::string& state, uint32_t state_version = 2)
+	{
+		if (state.empty()) return;
+		if (state_version < 2)
+		{
+			using legacy_message = std::tuple<std::string, Ml::model_compress_type, Ml::caffe_parameter_net<model_datatype>>;
+			auto [sequence, legacy_items, link_free_at] = deserialize_wrap<boost::archive::binary_iarchive, std::tuple<uint64_t, std::vector<std::tuple<int, uint64_t, std::string, legacy_message>>, std::unordered_map<uint64_t, double>>>(state);
+			std::vector<std::tuple<int, uint64_t, std::string, model_message>> in_flight_items;
+			for (auto& [arrival_tick, item_sequence, receiver, message]: legacy_items)
+			{
+				auto& [sender, type, model] = message;
+				in_flight_items.emplace_back(arrival_tick, item_sequence, std::move(receiver), model_message{std::move(sender), type, std::move(model), ""});
+			}
+			restore_in_flight(sequence, std::move(in_flight_items), std::move(link_free_at));
+			return;
+		}
+		auto [sequence, in_flight_items, link_free_at] = deserialize_wrap<boost::archive::binary_iarchive, std::tuple<uint64_t, std::vector<std::tuple<int, uint64_t, std::string, model_message>>, std::unordered_map<uint64_t, double>>>(state);
+		restore_in_flight(sequence, std::move(in_flight_items), std::move(link_free_at));
+	}
+
+private:
+	void restore_in_flight(uint64_t sequence, std::vector<std::tuple<int, uint64_t, std::string, model_message>> in_flight_items, std::unordered_map<uint64_t, double> link_free_at)
+	{
+		std::lock_guard guard(_lock);
+		_sequence = sequence;
+		_link_free_at = std::move(link_free_at);
+		_in_flight = {};
+		for (auto& [arrival_tick, item_sequence, receiver, message]: in_flight_items)
+		{
+			_in_flight.push({arrival_tick, item_sequence, std::move(receiver), std::move(message)});
+		}
+	}
+
+	struct in_flight
+	{
+		int arrival_tick;
+		uint64_t sequence;
+		std::string receiver;
+		model_message message;
+
+		bool operator>(const in_flight& target) const
+		{
+			return std::tie(arrival_tick, sequence) > std::tie(target.arrival_tick, target.sequence);
+		}
+	};
+
+	//{latency tick, bandwidth byte per tick}, bandwidth 0 means unlimited
+	std::tuple<double, double> link_property(uint32_t sender_id, uint32_t receiver_id) const
+	{
+		auto link_rng = simulation_random::get(sender_id, 0, random_purpose::network_link, receiver_id);
+		double latency = uniform(_latency_tick, link_rng);
+		double bandwidth = uniform(_bandwidth_byte_per_tick, link_rng);
+		return {latency, bandwidth};
+	}
+
+	static double uniform(const std::array<double, 2>& range, counter_rng& rng)
+	{
+		if (range[1] <= range[0]) return range[0];
+		return std::uniform_real_distribution<double>(range[0], range[1])(rng);
+	}
+
+	bool _enable = false;
+	std::array<double, 2> _latency_tick = {0, 0};
+	std::array<double, 2> _bandwidth_byte_per_tick = {0, 0};
+	double _drop_rate = 0;
+
+	mutable std::mutex _lock;
+	std::priority_queue<in_flight, std::vector<in_flight>, std::greater<>> _in_flight;
+	std::unordered_map<uint64_t, double> _link_free_at; //(sender id << 32 | receiver id) -> the time the link finishes the last transfer
+	uint64_t _sequence = 0;
+
+	std::atomic<uint64_t> _sent = 0, _dropped = 0, _delivered = 0, _sent_byte = 0;
+};
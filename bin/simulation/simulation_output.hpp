@@ -0,0 +1,541 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+
+#include <glog/logging.h>
+
+/** simulation result file
+ *  All results of a simulation are appended to one binary file instead of one text file per record/node.
+ *
+ *  file     : {header}{chunk}{chunk}...{chunk:index}{trailer}
+ *  header   : magic "DFLSIMR\0", uint32 format version, uint32 reserved
+ *  chunk    : uint32 chunk type, uint32 stream id, uint64 payload size, payload, padding to 8 bytes
+ *  trailer  : uint64 offset of the index chunk, magic "DFLSIDX\0"
+ *
+ *  chunk types:
+ *  stream_definition : uint32 stream type, string name, uint32 column count, string column names...    (string = uint32 length + bytes)
+ *  table_batch       : uint32 row count, uint32 column count, int32 ticks[row count], padding to 8 bytes, float32 values[row count][column count]
+ *  text_batch        : uint32 line count, {int32 tick, string line}...
+ *  index             : uint64 entry count, {uint64 chunk offset, uint32 chunk type, uint32 stream id}...
+ *
+ *  All integers and floats are little endian. Missing values in a table are NaN.
+ *  The index and trailer are only written by close(), a reader must fall back to scanning the chunks if the trailer
+ *  is missing (e.g. the simulator crashed), and a partial chunk at the end of the file is ignored.
+ */
+
+class simulation_output
+{
+public:
+	static constexpr char FILE_MAGIC[8] = {'D', 'F', 'L', 'S', 'I', 'M', 'R', '\0'};
+	static constexpr char INDEX_MAGIC[8] = {'D', 'F', 'L', 'S', 'I', 'D', 'X', '\0'};
+	static constexpr uint32_t FORMAT_VERSION = 1;
+	static constexpr size_t HEADER_SIZE = 16;
+	static constexpr size_t CHUNK_HEADER_SIZE = 16;
+	static constexpr size_t TRAILER_SIZE = 16;
+
+	enum chunk_type : uint32_t
+	{
+		stream_definition = 1,
+		table_batch = 2,
+		text_batch = 3,
+		index = 4
+	};
+
+	enum stream_type : uint32_t
+	{
+		table_stream = 0,
+		text_stream = 1
+	};
+
+	struct stream_info
+	{
+		stream_type type;
+		std::string name;
+		std::vector<std::string> columns;
+	};
+
+	// append: keep the streams and records of an existing file (e.g. resumed simulation), the index of the file is
+	//         dropped and rewritten by close().
+	simulation_output(const std::filesystem::path &path, bool append = false) : _path(path), _closed(false), _stop_writer(false)
+	{
+		if (append && std::filesystem::exists(path))
+		{
+			std::vector<char> content;
+			{
+				std::ifstream input(path, std::ios::binary);
+				content.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+			}
+			size_t valid_size = scan_existing(content);
+			std::filesystem::resize_file(path, valid_size);
+			_file = std::fopen(path.c_str(), "r+b");
+			LOG_IF(FATAL, _file == nullptr) << "[simulation_output] cannot open " << path;
+			std::fseek(_file, 0, SEEK_END);
+			_file_offset = valid_size;
+		}
+		else
+		{
+			_file = std::fopen(path.c_str(), "wb");
+			LOG_IF(FATAL, _file == nullptr) << "[simulation_output] cannot open " << path;
+			std::string header(FILE_MAGIC, sizeof(FILE_MAGIC));
+			append_pod(header, FORMAT_VERSION);
+			append_pod(header, uint32_t(0));
+			std::fwrite(header.data(), 1, header.size(), _file);
+			_file_offset = header.size();
+		}
+		std::setvbuf(_file, nullptr, _IOFBF, 1 << 20);
+
+		_writer = std::thread([this]() { writer_loop(); });
+	}
+
+	~simulation_output()
+	{
+		close();
+	}
+
+	simulation_output(const simulation_output &) = delete;
+	simulation_output &operator=(const simulation_output &) = delete;
+
+	// return the stream id, an existing stream with the same name is reused.
+	int define_table(const std::string &name, const std::vector<std::string> &columns)
+	{
+		return define_stream(table_stream, name, columns);
+	}
+
+	int define_text(const std::string &name)
+	{
+		return define_stream(text_stream, name, {});
+	}
+
+	// thread safe, the row is buffered until commit().
+	void append_row(int stream_id, int tick, const std::vector<float> &values)
+	{
+		std::lock_guard guard(_pending_lock);
+		auto &pending = _pending[stream_id];
+		const auto &stream = _streams[stream_id];
+		CHECK(stream.type == table_stream) << "[simulation_output] " << stream.name << " is not a table";
+		CHECK(values.size() == stream.columns.size()) << "[simulation_output] column count mismatch for " << stream.name;
+		pending.ticks.push_back(tick);
+		pending.values.insert(pending.values.end(), values.begin(), values.end());
+	}
+
+	// thread safe, the line is buffered until commit().
+	void append_text(int stream_id, int tick, const std::string &line)
+	{
+		std::lock_guard guard(_pending_lock);
+		auto &pending = _pending[stream_id];
+		CHECK(_streams[stream_id].type == text_stream) << "[simulation_output] " << _streams[stream_id].name << " is not a text stream";
+		pending.ticks.push_back(tick);
+		pending.lines.push_back(line);
+	}
+
+	// encode the buffered records as one batch per stream and hand them to the writer thread, called once per tick.
+	void commit()
+	{
+		std::string batch;
+		{
+			std::lock_guard guard(_pending_lock);
+			for (auto &[stream_id, pending]: _pending)
+			{
+				if (pending.ticks.empty()) continue;
+				std::string payload;
+				const uint32_t row_count = pending.ticks.size();
+				append_pod(payload, row_count);
+				if (_streams[stream_id].type == table_stream)
+				{
+					append_pod(payload, uint32_t(_streams[stream_id].columns.size()));
+					payload.append(reinterpret_cast<const char *>(pending.ticks.data()), pending.ticks.size() * sizeof(int32_t));
+					pad(payload);
+					payload.append(reinterpret_cast<const char *>(pending.values.data()), pending.values.size() * sizeof(float));
+				}
+				else
+				{
+					for (uint32_t i = 0; i < row_count; ++i)
+					{
+						append_pod(payload, int32_t(pending.ticks[i]));
+						append_string(payload, pending.lines[i]);
+					}
+				}
+				append_chunk(batch, _streams[stream_id].type == table_stream ? table_batch : text_batch, stream_id, payload);
+				pending.ticks.clear();
+				pending.values.clear();
+				pending.lines.clear();
+			}
+		}
+		if (batch.empty()) return;
+
+		{
+			std::lock_guard guard(_queue_lock);
+			_queue.push_back(std::move(batch));
+		}
+		_queue_cv.notify_one();
+	}
+
+	// commit and wait until everything is written, return the size of the file.
+	uint64_t flush()
+	{
+		commit();
+		std::unique_lock lock(_queue_lock);
+		_idle_cv.wait(lock, [this]() { return _queue.empty() && !_writer_busy; });
+		return _file_offset;
+	}
+
+	void close()
+	{
+		if (_closed) return;
+		commit();
+		{
+			std::lock_guard guard(_queue_lock);
+			_stop_writer = true;
+		}
+		_queue_cv.notify_one();
+		_writer.join();
+
+		//index and trailer
+		std::string index_chunk;
+		{
+			std::string payload;
+			append_pod(payload, uint64_t(_index.size()));
+			for (auto &[offset, type, stream_id]: _index)
+			{
+				append_pod(payload, offset);
+				append_pod(payload, type);
+				append_pod(payload, stream_id);
+			}
+			append_chunk(index_chunk, index, 0, payload);
+		}
+		const uint64_t index_offset = _file_offset;
+		append_pod(index_chunk, index_offset);
+		index_chunk.append(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+		std::fwrite(index_chunk.data(), 1, index_chunk.size(), _file);
+		std::fclose(_file);
+		_closed = true;
+	}
+
+	[[nodiscard]] const std::vector<stream_info> &get_streams() const
+	{
+		return _streams;
+	}
+
+private:
+	struct pending_records
+	{
+		std::vector<int32_t> ticks;
+		std::vector<float> values;
+		std::vector<std::string> lines;
+	};
+
+	std::filesystem::path _path;
+	std::FILE *_file;
+	uint64_t _file_offset;
+	bool _closed;
+
+	std::vector<stream_info> _streams;
+	std::unordered_map<std::string, int> _stream_id_by_name;
+	std::mutex _pending_lock;
+	std::unordered_map<int, pending_records> _pending;
+
+	//{chunk offset, chunk type, stream id}, only accessed by the writer thread until it stops
+	std::vector<std::tuple<uint64_t, uint32_t, uint32_t>> _index;
+
+	std::thread _writer;
+	std::mutex _queue_lock;
+	std::condition_variable _queue_cv;
+	std::deque<std::string> _queue;
+	bool _stop_writer;
+	bool _writer_busy = false;
+	std::condition_variable _idle_cv;
+
+	template<typename T>
+	static void append_pod(std::string &target, const T &value)
+	{
+		target.append(reinterpret_cast<const char *>(&value), sizeof(T));
+	}
+
+	static void append_string(std::string &target, const std::string &value)
+	{
+		append_pod(target, uint32_t(value.size()));
+		target.append(value);
+	}
+
+	static void pad(std::string &target)
+	{
+		target.resize((target.size() + 7) / 8 * 8, '\0');
+	}
+
+	static void append_chunk(std::string &target, chunk_type type, uint32_t stream_id, std::string &payload)
+	{
+		pad(payload);
+		append_pod(target, uint32_t(type));
+		append_pod(target, stream_id);
+		append_pod(target, uint64_t(payload.size()));
+		target.append(payload);
+	}
+
+	int define_stream(stream_type type, const std::string &name, const std::vector<std::string> &columns)
+	{
+		std::string chunk;
+		int stream_id;
+		{
+			std::lock_guard guard(_pending_lock);
+			auto iter = _stream_id_by_name.find(name);
+			if (iter != _stream_id_by_name.end())
+			{
+				const auto &stream = _streams[iter->second];
+				LOG_IF(FATAL, stream.type != type || stream.columns != columns) << "[simulation_output] stream " << name << " is redefined with a different layout";
+				return iter->second;
+			}
+			stream_id = _streams.size();
+			_streams.push_back({type, name, columns});
+			_stream_id_by_name.emplace(name, stream_id);
+
+			std::string payload;
+			append_pod(payload, uint32_t(type));
+			append_string(payload, name);
+			append_pod(payload, uint32_t(columns.size()));
+			for (auto &column: columns) append_string(payload, column);
+			append_chunk(chunk, stream_definition, stream_id, payload);
+		}
+		{
+			std::lock_guard guard(_queue_lock);
+			_queue.push_back(std::move(chunk));
+		}
+		_queue_cv.notify_one();
+		return stream_id;
+	}
+
+	void writer_loop()
+	{
+		while (true)
+		{
+			std::deque<std::string> batches;
+			{
+				std::unique_lock lock(_queue_lock);
+				_queue_cv.wait(lock, [this]() { return !_queue.empty() || _stop_writer; });
+				if (_queue.empty() && _stop_writer) break;
+				batches.swap(_queue);
+				_writer_busy = true;
+			}
+
+			for (auto &batch: batches)
+			{
+				//a batch may contain several chunks, record each of them in the index
+				size_t loc = 0;
+				while (loc < batch.size())
+				{
+					uint32_t type, stream_id;
+					uint64_t payload_size;
+					std::memcpy(&type, batch.data() + loc, 4);
+					std::memcpy(&stream_id, batch.data() + loc + 4, 4);
+					std::memcpy(&payload_size, batch.data() + loc + 8, 8);
+					_index.emplace_back(_file_offset + loc, type, stream_id);
+					loc += CHUNK_HEADER_SIZE + payload_size;
+				}
+				std::fwrite(batch.data(), 1, batch.size(), _file);
+				_file_offset += batch.size();
+			}
+			std::fflush(_file);
+			{
+				std::lock_guard guard(_queue_lock);
+				_writer_busy = false;
+			}
+			_idle_cv.notify_all();
+		}
+	}
+
+	//rebuild the streams and the index from an existing file, return the size of the valid part
+	size_t scan_existing(const std::vector<char> &content)
+	{
+		if (content.size() < HEADER_SIZE || std::memcmp(content.data(), FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+		{
+			LOG(FATAL) << "[simulation_output] " << _path << " is not a simulation result file";
+		}
+
+		size_t loc = HEADER_SIZE;
+		while (loc + CHUNK_HEADER_SIZE <= content.size())
+		{
+			uint32_t type, stream_id;
+			uint64_t payload_size;
+			std::memcpy(&type, content.data() + loc, 4);
+			std::memcpy(&stream_id, content.data() + loc + 4, 4);
+			std::memcpy(&payload_size, content.data() + loc + 8, 8);
+			if (loc + CHUNK_HEADER_SIZE + payload_size > content.size()) break; //partial chunk
+			if (type == index) break; //the old index is rewritten by close()
+
+			if (type == stream_definition)
+			{
+				const char *p = content.data() + loc + CHUNK_HEADER_SIZE;
+				stream_info stream;
+				uint32_t stream_type_value, length, column_count;
+				std::memcpy(&stream_type_value, p, 4); p += 4;
+				stream.type = static_cast<stream_type>(stream_type_value);
+				std::memcpy(&length, p, 4); p += 4;
+				stream.name.assign(p, length); p += length;
+				std::memcpy(&column_count, p, 4); p += 4;
+				for (uint32_t i = 0; i < column_count; ++i)
+				{
+					std::memcpy(&length, p, 4); p += 4;
+					stream.columns.emplace_back(p, length); p += length;
+				}
+				LOG_IF(FATAL, stream_id != _streams.size()) << "[simulation_output] corrupted stream definition in " << _path;
+				_stream_id_by_name.emplace(stream.name, stream_id);
+				_streams.push_back(std::move(stream));
+			}
+			_index.emplace_back(loc, type, stream_id);
+			loc += CHUNK_HEADER_SIZE + payload_size;
+		}
+		return loc;
+	}
+};
+
+/** sequential reader of the simulation result file, used by the tools to convert the results to the old text files.
+ */
+class simulation_output_reader
+{
+public:
+	struct table
+	{
+		std::vector<int> ticks;
+		std::vector<float> values; // [row][column]
+	};
+
+	struct text
+	{
+		std::vector<int> ticks;
+		std::vector<std::string> lines;
+	};
+
+	explicit simulation_output_reader(const std::filesystem::path &path)
+	{
+		std::ifstream input(path, std::ios::binary);
+		LOG_IF(FATAL, !input) << "[simulation_output_reader] cannot open " << path;
+		_content.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+		LOG_IF(FATAL, _content.size() < simulation_output::HEADER_SIZE || std::memcmp(_content.data(), simulation_output::FILE_MAGIC, 8) != 0) << "[simulation_output_reader] " << path << " is not a simulation result file";
+
+		size_t loc = simulation_output::HEADER_SIZE;
+		while (loc + simulation_output::CHUNK_HEADER_SIZE <= _content.size())
+		{
+			uint32_t type, stream_id;
+			uint64_t payload_size;
+			std::memcpy(&type, _content.data() + loc, 4);
+			std::memcpy(&stream_id, _content.data() + loc + 4, 4);
+			std::memcpy(&payload_size, _content.data() + loc + 8, 8);
+			if (loc + simulation_output::CHUNK_HEADER_SIZE + payload_size > _content.size()) break;
+			if (type == simulation_output::index) break;
+			const char *p = _content.data() + loc + simulation_output::CHUNK_HEADER_SIZE;
+
+			if (type == simulation_output::stream_definition)
+			{
+				simulation_output::stream_info stream;
+				uint32_t stream_type_value, length, column_count;
+				std::memcpy(&stream_type_value, p, 4); p += 4;
+				stream.type = static_cast<simulation_output::stream_type>(stream_type_value);
+				std::memcpy(&length, p, 4); p += 4;
+				stream.name.assign(p, length); p += length;
+				std::memcpy(&column_count, p, 4); p += 4;
+				for (uint32_t i = 0; i < column_count; ++i)
+				{
+					std::memcpy(&length, p, 4); p += 4;
+					stream.columns.emplace_back(p, length); p += length;
+				}
+				_streams.push_back(std::move(stream));
+				_tables.emplace_back();
+				_texts.emplace_back();
+			}
+			else if (type == simulation_output::table_batch)
+			{
+				uint32_t row_count, column_count;
+				std::memcpy(&row_count, p, 4);
+				std::memcpy(&column_count, p + 4, 4);
+				const char *ticks = p + 8;
+				const char *values = p + ((8 + row_count * sizeof(int32_t) + 7) / 8 * 8);
+				auto &target = _tables.at(stream_id);
+				size_t tick_loc = target.ticks.size(), value_loc = target.values.size();
+				target.ticks.resize(tick_loc + row_count);
+				target.values.resize(value_loc + size_t(row_count) * column_count);
+				for (uint32_t i = 0; i < row_count; ++i)
+				{
+					int32_t tick;
+					std::memcpy(&tick, ticks + i * sizeof(int32_t), 4);
+					target.ticks[tick_loc + i] = tick;
+				}
+				std::memcpy(target.values.data() + value_loc, values, size_t(row_count) * column_count * sizeof(float));
+			}
+			else if (type == simulation_output::text_batch)
+			{
+				uint32_t line_count, length;
+				int32_t tick;
+				std::memcpy(&line_count, p, 4); p += 4;
+				auto &target = _texts.at(stream_id);
+				for (uint32_t i = 0; i < line_count; ++i)
+				{
+					std::memcpy(&tick, p, 4); p += 4;
+					std::memcpy(&length, p, 4); p += 4;
+					target.ticks.push_back(tick);
+					target.lines.emplace_back(p, length); p += length;
+				}
+			}
+			loc += simulation_output::CHUNK_HEADER_SIZE + payload_size;
+		}
+	}
+
+	[[nodiscard]] const std::vector<simulation_output::stream_info> &get_streams() const
+	{
+		return _streams;
+	}
+
+	[[nodiscard]] const table &get_table(int stream_id) const
+	{
+		return _tables.at(stream_id);
+	}
+
+	[[nodiscard]] const text &get_text(int stream_id) const
+	{
+		return _texts.at(stream_id);
+	}
+
+	//write the stream in the old text format: tables as csv with a "tick" column, NaN as an empty cell, and texts as lines.
+	void write_stream(int stream_id, std::ostream &output) const
+	{
+		const auto &stream = _streams.at(stream_id);
+		if (stream.type == simulation_output::table_stream)
+		{
+			const auto &target = _tables[stream_id];
+			output << "tick";
+			for (const auto &column: stream.columns) output << "," << column;
+			output << "\n";
+			const size_t column_count = stream.columns.size();
+			for (size_t row = 0; row < target.ticks.size(); ++row)
+			{
+				output << target.ticks[row];
+				for (size_t column = 0; column < column_count; ++column)
+				{
+					float value = target.values[row * column_count + column];
+					if (std::isnan(value)) output << "," << " ";
+					else output << "," << value;
+				}
+				output << "\n";
+			}
+		}
+		else
+		{
+			for (const auto &line: _texts[stream_id].lines) output << line << "\n";
+		}
+	}
+
+private:
+	std::vector<char> _content;
+	std::vector<simulation_output::stream_info> _streams;
+	std::vector<table> _tables;
+	std::vector<text> _texts;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <random>
+#include <atomic>
+#include <limits>
+
+#include <glog/logging.h>
+#include <counter_rng.hpp>
+
+//each purpose gets independent random streams
+enum class random_purpose : uint32_t
+{
+	topology = 1,
+	model_initialization,
+	train_dataset,
+	test_dataset,
+	training_interval,
+	node_behavior,
+	caffe_solver,
+	service,
+	network, //drop of a message
+	network_link, //latency and bandwidth of a link
+};
+
+/** random numbers of the simulator.
+ *  A stream is keyed by (seed, node id, tick, purpose, index) instead of being drawn from a shared generator, so the
+ *  numbers do not depend on the thread count or the thread interleaving: a run with the same seed and configuration
+ *  gives the same result. Creating a stream is a few integer operations, no random device is read.
+ */
+class simulation_random
+{
+public:
+	//the node id of the streams not belonging to any node, such as the topology
+	static constexpr uint32_t global_id = std::numeric_limits<uint32_t>::max();
+
+	//seed = 0: pick a random seed, the seed in use is returned and should be logged to reproduce the run
+	static uint64_t set_seed(uint64_t seed)
+	{
+		while (seed == 0)
+		{
+			std::random_device dev;
+			seed = (uint64_t(dev()) << 32) | dev();
+		}
+		_seed() = seed;
+		return seed;
+	}
+
+	static uint64_t get_seed()
+	{
+		return _seed();
+	}
+
+	//index: separates the streams used for the same (node, tick, purpose), such as one stream per received model
+	static counter_rng get(uint32_t node_id, int tick, random_purpose purpose, uint32_t index = 0)
+	{
+		LOG_IF(FATAL, index >= (1u << 24)) << "random stream index out of range: " << index;
+		return {_seed(), node_id, uint32_t(tick), (uint32_t(purpose) << 24) | index};
+	}
+
+	//seed for the random generator of caffe (weight fillers, dropout)
+	static unsigned int get_caffe_seed(uint32_t node_id, int tick, random_purpose purpose = random_purpose::caffe_solver)
+	{
+		auto rng = get(node_id, tick, purpose);
+		return rng();
+	}
+
+private:
+	static std::atomic<uint64_t>& _seed()
+	{
+		static std::atomic<uint64_t> seed = 0;
+		return seed;
+	}
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+
+#include <glog/logging.h>
+#include "./node.hpp"
+
+/** event scheduler of simulator_mt
+ *  train events: a timing wheel keyed by node->next_train_tick, events further than the wheel size are kept in an overflow map.
+ *  buffer events: a node becomes a candidate when a model is inserted into its parameter_buffer, or when a service changes
+ *                 its buffer size. Nodes with buffer_size == 0 are always full, so they stay candidates every tick.
+ *  In each tick, only the nodes returned by pop_train_nodes / pop_buffer_nodes need to be visited, which gives the same
+ *  result as checking "tick >= next_train_tick" and "parameter_buffer.size() >= buffer_size" for all nodes.
+ */
+template<typename model_datatype>
+class simulation_scheduler
+{
+public:
+	static constexpr int NO_EVENT = std::numeric_limits<int>::max();
+
+	explicit simulation_scheduler(std::vector<node<model_datatype>*>& nodes, int wheel_size = 64) : _nodes(nodes), _current_tick(0)
+	{
+		LOG_IF(FATAL, wheel_size <= 0 || (wheel_size & (wheel_size - 1)) != 0) << "wheel size must be a power of two";
+		_wheel.resize(wheel_size);
+		_wheel_mask = wheel_size - 1;
+		_buffer_flag = std::make_unique<std::atomic<bool>[]>(_nodes.size());
+		for (uint32_t i = 0; i < _nodes.size(); ++i)
+		{
+			_node_index.emplace(_nodes[i], i);
+			_buffer_flag[i] = false;
+		}
+	}
+
+	//schedule all nodes from {tick}, call it before the first tick and after restoring a checkpoint
+	void reset(int tick)
+	{
+		_current_tick = tick;
+		for (auto& slot: _wheel) slot.clear();
+		_overflow.clear();
+		_buffer_candidates.clear();
+		for (uint32_t i = 0; i < _nodes.size(); ++i)
+		{
+			schedule_train(i, std::max(_nodes[i]->next_train_tick, tick));
+			_buffer_flag[i] = true;
+			_buffer_candidates.push_back(i);
+		}
+	}
+
+	//the nodes to train at {tick}, sorted by node index
+	std::vector<node<model_datatype>*> pop_train_nodes(int tick)
+	{
+		LOG_IF(FATAL, tick < _current_tick) << "scheduler cannot go back in time";
+		//move the ticks between the last popped tick and {tick}, they are empty if the caller follows next_event_tick()
+		while (_current_tick < tick)
+		{
+			LOG_IF(FATAL, !_wheel[_current_tick & _wheel_mask].empty()) << "train events at tick " << _current_tick << " are skipped";
+			_current_tick++;
+			refill_wheel();
+		}
+
+		auto& slot = _wheel[tick & _wheel_mask];
+		std::sort(slot.begin(), slot.end());
+		std::vector<node<model_datatype>*> output;
+		output.reserve(slot.size());
+		for (auto index: slot) output.push_back(_nodes[index]);
+		slot.clear();
+		_train_nodes = std::move(output);
+		return _train_nodes;
+	}
+
+	//the nodes whose buffer might be full, sorted by node index
+	std::vector<node<model_datatype>*> pop_buffer_nodes()
+	{
+		std::vector<uint32_t> candidates;
+		{
+			std::lock_guard guard(_buffer_lock);
+			candidates.swap(_buffer_candidates);
+		}
+		std::sort(candidates.begin(), candidates.end());
+		std::vector<node<model_datatype>*> output;
+		output.reserve(candidates.size());
+		for (auto index: candidates)
+		{
+			_buffer_flag[index] = false;
+			output.push_back(_nodes[index]);
+		}
+		_buffer_nodes = output;
+		return output;
+	}
+
+	//thread safe, call it after inserting a model to the parameter_buffer or changing the buffer size
+	void notify_buffer_changed(node<model_datatype>* target)
+	{
+		uint32_t index = _node_index.at(target);
+		if (_buffer_flag[index].exchange(true)) return;
+		std::lock_guard guard(_buffer_lock);
+		_buffer_candidates.push_back(index);
+	}
+
+	//call it after the train and buffer pass of {tick}, the trained nodes are scheduled at their next_train_tick
+	void finish_tick(int tick)
+	{
+		for (auto* single_node: _train_nodes)
+		{
+			schedule_train(_node_index.at(single_node), std::max(single_node->next_train_tick, tick + 1));
+		}
+		_train_nodes.clear();
+
+		for (auto* single_node: _buffer_nodes)
+		{
+			if (single_node->buffer_size == 0) notify_buffer_changed(single_node);
+		}
+		_buffer_nodes.clear();
+	}
+
+	//the first tick after {tick} with a train event or a buffer candidate, NO_EVENT if none
+	int next_event_tick(int tick) const
+	{
+		{
+			std::lock_guard guard(_buffer_lock);
+			if (!_buffer_candidates.empty()) return tick + 1;
+		}
+
+		const int wheel_size = int(_wheel.size());
+		for (int i = std::max(tick + 1, _current_tick); i < _current_tick + wheel_size; ++i)
+		{
+			if (!_wheel[i & _wheel_mask].empty()) return i;
+		}
+		if (!_overflow.empty()) return _overflow.begin()->first;
+		return NO_EVENT;
+	}
+
+private:
+	void schedule_train(uint32_t index, int tick)
+	{
+		if (tick - _current_tick < int(_wheel.size()))
+		{
+			_wheel[tick & _wheel_mask].push_back(index);
+		}
+		else
+		{
+			_overflow.emplace(tick, index);
+		}
+	}
+
+	//the wheel covers [_current_tick, _current_tick + wheel size)
+	void refill_wheel()
+	{
+		const int last_tick = _current_tick + int(_wheel.size()) - 1;
+		while (!_overflow.empty() && _overflow.begin()->first <= last_tick)
+		{
+			auto [tick, index] = *_overflow.begin();
+			_wheel[tick & _wheel_mask].push_back(index);
+			_overflow.erase(_overflow.begin());
+		}
+	}
+
+	std::vector<node<model_datatype>*>& _nodes;
+	std::unordered_map<node<model_datatype>*, uint32_t> _node_index;
+
+	int _current_tick;
+	std::vector<std::vector<uint32_t>> _wheel;
+	int _wheel_mask;
+	std::multimap<int, uint32_t> _overflow;
+	std::vector<node<model_datatype>*> _train_nodes;
+
+	mutable std::mutex _buffer_lock;
+	std::unique_ptr<std::atomic<bool>[]> _buffer_flag;
+	std::vector<uint32_t> _buffer_candidates;
+	std::vector<node<model_datatype>*> _buffer_nodes;
+};
@@ -4,8 +4,12 @@
 #include <random>
 #include <configure_file.hpp>
 #include <sstream>
+#include <caffe/util/math_functions.hpp>
 #include "./node.hpp"
 #include "./simulation_util.hpp"
+#include "./simulation_output.hpp"
+#include "./simulation_scheduler.hpp"
+#include "./simulation_random.hpp"
 
 enum class record_service_status
 {
@@ -27,14 +31,44 @@ public:
 	{
 		node_vector_container = nullptr;
 		node_container = nullptr;
+		result_output = nullptr;
+		scheduler = nullptr;
 		enable = false;
 	}
 	
+	//set before init_service, all services record their results to the same output file
+	void set_result_output(simulation_output* output)
+	{
+		result_output = output;
+	}
+	
+	//set before init_service, services changing the buffer size of nodes must notify the scheduler
+	void set_scheduler(simulation_scheduler<model_datatype>* _scheduler)
+	{
+		scheduler = _scheduler;
+	}
+	
 	virtual std::tuple<record_service_status, std::string> init_service(const std::filesystem::path& output_path, std::unordered_map<std::string, node<model_datatype> *>&, std::vector<node<model_datatype>*>&) = 0;
 	
 	virtual std::tuple<record_service_status, std::string> process_per_tick(int tick) = 0;
 	
 	virtual std::tuple<record_service_status, std::string> destruction_service() = 0;
+	
+	//the first tick >= {tick} that process_per_tick does something, the simulator skips the ticks without any event
+	virtual int next_active_tick(int tick)
+	{
+		return tick;
+	}
+	
+	//state to save in the simulation checkpoint, empty if the service has no state across ticks
+	virtual std::string save_state()
+	{
+		return "";
+	}
+	
+	virtual void load_state(const std::string& state)
+	{
+	}
 
 protected:
 	void set_node_container(std::unordered_map<std::string, node<model_datatype> *>& map, std::vector<node<model_datatype>*>& vector)
@@ -45,8 +79,16 @@ protected:
 	
 	std::vector<node<model_datatype>*>* node_vector_container;
 	std::unordered_map<std::string, node<model_datatype> *>* node_container;
+	simulation_output* result_output;
+	simulation_scheduler<model_datatype>* scheduler;
 };
 
+//the first multiple of {interval} >= {tick}
+inline int next_multiple_tick(int tick, int interval)
+{
+	return (tick + interval - 1) / interval * interval;
+}
+
 template <typename model_datatype>
 class accuracy_record : public service<model_datatype>
 {
@@ -80,14 +122,13 @@ public:
 		
 		LOG_IF(FATAL, test_dataset == nullptr) << "test_dataset is not set";
 		
-		accuracy_file.reset(new std::ofstream(output_path / "accuracy.csv", std::ios::binary));
-		
-		*accuracy_file << "tick";
+		LOG_IF(FATAL, this->result_output == nullptr) << "result_output is not set";
+		std::vector<std::string> columns;
 		for (auto &single_node : *(this->node_container))
 		{
-			*accuracy_file << "," << single_node.second->name;
+			columns.push_back(single_node.second->name);
 		}
-		*accuracy_file << std::endl;
+		accuracy_stream = this->result_output->define_table("accuracy", columns);
 		
 		//solver for testing
 		size_t solver_for_testing_size = std::thread::hardware_concurrency();
@@ -108,29 +149,30 @@ public:
 		{
 			tmt::ParallelExecution([&tick, this](uint32_t index, uint32_t thread_index, node<model_datatype> *single_node)
 			                       {
-				                       auto[test_data, test_label] = test_dataset->get_random_data(ml_test_batch_size);
+				                       auto test_rng = simulation_random::get(single_node->id, tick, random_purpose::service, accuracy_stream_index);
+				                       auto[test_data, test_label] = test_dataset->get_random_data(ml_test_batch_size, test_rng);
 				                       auto model = single_node->solver->get_parameter();
 				                       solver_for_testing[thread_index].set_parameter(model);
 				                       auto accuracy = solver_for_testing[thread_index].evaluation(test_data, test_label);
 				                       single_node->nets_accuracy_only_record.emplace(tick, accuracy);
 			                       }, this->node_vector_container->size(), this->node_vector_container->data());
 
-			//print accuracy to file
-			*accuracy_file << tick;
+			//record accuracy, NaN for the nodes without accuracy
+			std::vector<float> row;
+			row.reserve(this->node_container->size());
 			for (auto &single_node : *(this->node_container))
 			{
 				auto iter_find = single_node.second->nets_accuracy_only_record.find(tick);
 				if (iter_find != single_node.second->nets_accuracy_only_record.end())
 				{
-					auto accuracy = iter_find->second;
-					*accuracy_file << "," << accuracy;
+					row.push_back(iter_find->second);
 				}
 				else
 				{
-					*accuracy_file << "," << " ";
+					row.push_back(NAN);
 				}
 			}
-			*accuracy_file << std::endl;
+			this->result_output->append_row(accuracy_stream, tick, row);
 		}
 		
 		return {record_service_status::success, ""};
@@ -139,15 +181,20 @@ public:
 	std::tuple<record_service_status, std::string> destruction_service() override
 	{
 		delete[] solver_for_testing;
-		accuracy_file->flush();
-		accuracy_file->close();
 		
 		return {record_service_status::success, ""};
 	}
 	
+	int next_active_tick(int tick) override
+	{
+		if (this->enable == false) return simulation_scheduler<model_datatype>::NO_EVENT;
+		return next_multiple_tick(tick, ml_test_interval_tick);
+	}
+	
 private:
+	static constexpr uint32_t accuracy_stream_index = 0; //index of the random stream of simulation_random::get(..., random_purpose::service, index)
 	Ml::MlCaffeModel<float, caffe::SGDSolver>* solver_for_testing;
-	std::shared_ptr<std::ofstream> accuracy_file;
+	int accuracy_stream;
 };
 
 template <typename model_datatype>
@@ -176,17 +223,17 @@ public:
 		//LOG_IF(FATAL, node_vector_container == nullptr) << "node_vector_container is not set";
 		this->set_node_container(_node_container, _node_vector_container);
 		
-		model_weights_file.reset(new std::ofstream(output_path / "model_weight_diff.csv", std::ios::binary));
-		*model_weights_file << "tick";
-		
+		LOG_IF(FATAL, this->result_output == nullptr) << "result_output is not set";
 		auto weights = (*this->node_vector_container)[0]->solver->get_parameter();
 		auto layers = weights.getLayers();
 		
+		std::vector<std::string> columns;
 		for (auto& single_layer: layers)
 		{
-			*model_weights_file << "," << single_layer.getName();
+			columns.push_back(single_layer.getName());
 		}
-		*model_weights_file << std::endl;
+		model_weights_stream = this->result_output->define_table("model_weight_diff", columns);
+		pair_diff_cache.resize(this->node_vector_container->size());
 		
 		return {record_service_status::success, ""};
 	}
@@ -200,35 +247,42 @@ public:
 			auto weights = (*this->node_vector_container)[0]->solver->get_parameter();
 			auto layers = weights.getLayers();
 			size_t number_of_layers = layers.size();
-			auto* weight_diff_sums = new std::atomic<float>[number_of_layers];
-			for (int i = 0; i < number_of_layers; ++i) weight_diff_sums[i] = 0;
 			
-			tmt::ParallelExecution([&tick, this, &weight_diff_sums,&number_of_layers](uint32_t index, uint32_t thread_index, node<model_datatype> *single_node)
-			                       {
-				                       uint32_t index_next = index + 1;
-				                       const uint32_t total_size = this->node_vector_container->size();
-				                       if (index_next == total_size-1) index_next = 0;
-				                       auto net1 = (*this->node_vector_container)[index]->solver->get_parameter();
-				                       auto net2 = (*this->node_vector_container)[index_next]->solver->get_parameter();
-				                       auto layers1 = net1.getLayers();
-				                       auto layers2 = net2.getLayers();
-				                       for (int i = 0; i < number_of_layers; ++i)
-				                       {
-					                       auto diff = layers1[i] - layers2[i];
-					                       diff.abs();
-					                       auto value = diff.sum();
-					                       weight_diff_sums[i] = weight_diff_sums[i] + value;
-				                       }
-			                       }, this->node_vector_container->size()-1, this->node_vector_container->data());
-			
-			*model_weights_file << tick;
-			for (int i = 0; i < number_of_layers; ++i)
+			//sum of the weight difference between the neighbour nodes, per layer
+			auto weight_diff_sums = Ml::model_reduction<float>::sum_flat(this->node_vector_container->size(), number_of_layers, [this, &number_of_layers](size_t index, float* accumulator)
 			{
-				*model_weights_file << "," << weight_diff_sums[i];
-			}
-			*model_weights_file << std::endl;
+				//node pairs on a ring: {0,1}, {1,2} ... {N-1,0}
+				const uint32_t total_size = this->node_vector_container->size();
+				const uint32_t index_next = (index + 1) % total_size;
+				auto* node1 = (*this->node_vector_container)[index];
+				auto* node2 = (*this->node_vector_container)[index_next];
+				
+				//skip the pairs that did not change since the last record
+				auto& [version1, version2, layer_diff] = pair_diff_cache[index];
+				const uint64_t current_version1 = node1->solver->get_version(), current_version2 = node2->solver->get_version();
+				if (version1 != current_version1 || version2 != current_version2 || layer_diff.size() != number_of_layers)
+				{
+					auto net1 = node1->solver->get_parameter();
+					auto net2 = node2->solver->get_parameter();
+					auto layers1 = net1.getLayers();
+					auto layers2 = net2.getLayers();
+					layer_diff.resize(number_of_layers);
+					for (int i = 0; i < number_of_layers; ++i)
+					{
+						auto diff = layers1[i] - layers2[i];
+						diff.abs();
+						layer_diff[i] = diff.sum();
+					}
+					version1 = current_version1;
+					version2 = current_version2;
+				}
+				for (int i = 0; i < number_of_layers; ++i)
+				{
+					accumulator[i] += layer_diff[i];
+				}
+			});
 			
-			delete[] weight_diff_sums;
+			this->result_output->append_row(model_weights_stream, tick, weight_diff_sums);
 		}
 		
 		return {record_service_status::success, ""};
@@ -236,14 +290,147 @@ public:
 	
 	std::tuple<record_service_status, std::string> destruction_service() override
 	{
-		model_weights_file->flush();
-		model_weights_file->close();
+		return {record_service_status::success, ""};
+	}
+	
+	int next_active_tick(int tick) override
+	{
+		if (this->enable == false) return simulation_scheduler<model_datatype>::NO_EVENT;
+		return next_multiple_tick(tick, ml_model_weight_diff_record_interval_tick);
+	}
+
+private:
+	int model_weights_stream;
+	std::vector<std::tuple<uint64_t, uint64_t, std::vector<float>>> pair_diff_cache; //{version of node, version of next node, diff per layer}
+};
+
+template <typename model_datatype>
+class weight_divergence_record : public service<model_datatype>
+{
+	/** weight divergence of all nodes in O(N * model size) instead of comparing all pairs:
+	 *  sum over all pairs ||a_i - a_j||^2 = N * sum ||a_i - mean||^2
+	 *  The mean and the distances are accumulated in double from the differences, so they stay accurate for converged models.
+	 **/
+public:
+	int interval;
+	
+	weight_divergence_record()
+	{
+		interval = 0;
+	}
+	
+	std::tuple<record_service_status, std::string> apply_config(const configuration_file::json& config) override
+	{
+		this->enable = config["enable"];
+		this->interval = config["interval"];
 		
 		return {record_service_status::success, ""};
 	}
+	
+	std::tuple<record_service_status, std::string> init_service(const std::filesystem::path& output_path, std::unordered_map<std::string, node<model_datatype> *>& _node_container, std::vector<node<model_datatype>*>& _node_vector_container) override
+	{
+		this->set_node_container(_node_container, _node_vector_container);
+		if (this->enable == false) return {record_service_status::skipped, "not enabled"};
+		
+		LOG_IF(FATAL, this->result_output == nullptr) << "result_output is not set";
+		divergence_stream = this->result_output->define_table("weight_divergence", {"rms_pairwise_l2_distance", "rms_l2_distance_to_mean", "max_l2_distance_to_mean"});
+		std::vector<std::string> columns;
+		for (auto* single_node: *(this->node_vector_container))
+		{
+			columns.push_back(single_node->name);
+		}
+		distance_to_mean_stream = this->result_output->define_table("weight_distance_to_mean", columns);
+		
+		return {record_service_status::success, ""};
+	}
+	
+	std::tuple<record_service_status, std::string> process_per_tick(int tick) override
+	{
+		if (this->enable == false) return {record_service_status::skipped, "not enabled"};
+		if (tick % interval != 0) return {record_service_status::success, ""};
+		
+		auto& nodes = *(this->node_vector_container);
+		const size_t node_count = nodes.size();
+		std::vector<Ml::caffe_parameter_net<model_datatype>> parameters(node_count);
+		tmt::ParallelExecution([&parameters](uint32_t index, uint32_t thread_index, node<model_datatype>* single_node)
+		{
+			parameters[index] = single_node->solver->get_parameter();
+		}, node_count, nodes.data());
+		const auto models = Ml::robust_aggregation<model_datatype>::flatten(parameters);
+		
+		//the distances are summed directly as ||a_i - mean||^2 in double, the expanded form ||a_i||^2 - 2 a_i.mean + ||mean||^2
+		//cancels out when the models converge, exactly when the divergence matters
+		std::vector<std::tuple<size_t, size_t, size_t>> blocks; //{segment, begin, end}
+		for (size_t segment = 0; segment < models.sizes.size(); ++segment)
+		{
+			for (size_t begin = 0; begin < models.sizes[segment]; begin += block_size) blocks.emplace_back(segment, begin, std::min(begin + block_size, models.sizes[segment]));
+		}
+		std::vector<std::vector<double>> mean(models.sizes.size());
+		for (size_t segment = 0; segment < models.sizes.size(); ++segment) mean[segment].assign(models.sizes[segment], 0);
+		tmt::ParallelExecution([&models, &mean, &blocks, node_count](uint32_t index, uint32_t thread_index)
+		{
+			const auto [segment, begin, end] = blocks[index];
+			double* target = mean[segment].data();
+			for (size_t model_index = 0; model_index < node_count; ++model_index)
+			{
+				const model_datatype* data = models.models[model_index][segment];
+				for (size_t i = begin; i < end; ++i) target[i] += double(data[i]);
+			}
+			for (size_t i = begin; i < end; ++i) target[i] /= double(node_count);
+		}, blocks.size());
+		
+		std::vector<double> squared_distance_to_mean(node_count);
+		tmt::ParallelExecution([&models, &mean](uint32_t index, uint32_t thread_index, double& output)
+		{
+			output = 0;
+			for (size_t segment = 0; segment < models.sizes.size(); ++segment)
+			{
+				const model_datatype* data = models.models[index][segment];
+				const double* center = mean[segment].data();
+				for (size_t i = 0; i < models.sizes[segment]; ++i)
+				{
+					const double difference = double(data[i]) - center[i];
+					output += difference * difference;
+				}
+			}
+		}, node_count, squared_distance_to_mean.data());
+		
+		double sum_squared_distance_to_mean = 0, max_squared_distance_to_mean = 0;
+		std::vector<float> distance_to_mean_row(node_count);
+		for (size_t i = 0; i < node_count; ++i)
+		{
+			sum_squared_distance_to_mean += squared_distance_to_mean[i];
+			max_squared_distance_to_mean = std::max(max_squared_distance_to_mean, squared_distance_to_mean[i]);
+			distance_to_mean_row[i] = float(std::sqrt(squared_distance_to_mean[i]));
+		}
+		
+		//sum_{i<j} ||a_i - a_j||^2 = N * sum_i ||a_i - mean||^2
+		const double n = double(node_count);
+		double mean_pairwise_squared_distance = 0;
+		if (node_count > 1) mean_pairwise_squared_distance = 2 * sum_squared_distance_to_mean / (n - 1);
+		
+		this->result_output->append_row(divergence_stream, tick, {float(std::sqrt(mean_pairwise_squared_distance)), float(std::sqrt(sum_squared_distance_to_mean / n)), float(std::sqrt(max_squared_distance_to_mean))});
+		this->result_output->append_row(distance_to_mean_stream, tick, distance_to_mean_row);
+		
+		return {record_service_status::success, ""};
+	}
+	
+	std::tuple<record_service_status, std::string> destruction_service() override
+	{
+		return {record_service_status::success, ""};
+	}
+	
+	int next_active_tick(int tick) override
+	{
+		if (this->enable == false) return simulation_scheduler<model_datatype>::NO_EVENT;
+		return next_multiple_tick(tick, interval);
+	}
 
 private:
-	std::shared_ptr<std::ofstream> model_weights_file;
+	static constexpr size_t block_size = 4096;
+	
+	int divergence_stream;
+	int distance_to_mean_stream;
 };
 
 template <typename model_datatype>
@@ -276,21 +463,19 @@ public:
 	{
 		if (this->enable == false) return {record_service_status::skipped, "not enabled"};
 		
-		auto model_sum = (*this->node_vector_container)[0]->solver->get_parameter();
-		model_sum.set_all(0);
 		if (tick % tick_to_broadcast == 0 && tick != 0)
 		{
 			LOG(INFO) << "force_broadcast_model triggered at tick: " << tick;
-			for (auto& node: *(this->node_container))
+			auto& nodes = *(this->node_vector_container);
+			auto model_average = Ml::model_reduction<model_datatype>::average(nodes.size(), [&nodes](size_t index)
 			{
-				model_sum = model_sum + node.second->solver->get_parameter();
-			}
-			model_sum = model_sum / this->node_container->size();
+				return nodes[index]->solver->get_parameter();
+			});
 			
-			for (auto& node: *(this->node_container))
+			tmt::ParallelExecution([&model_average](uint32_t index, uint32_t thread_index, node<model_datatype>* single_node)
 			{
-				node.second->solver->set_parameter(model_sum);
-			}
+				single_node->solver->set_parameter(model_average);
+			}, nodes.size(), nodes.data());
 		}
 		return {record_service_status::success, ""};
 	}
@@ -299,6 +484,12 @@ public:
 	{
 		return {record_service_status::success, ""};
 	}
+	
+	int next_active_tick(int tick) override
+	{
+		if (this->enable == false) return simulation_scheduler<model_datatype>::NO_EVENT;
+		return next_multiple_tick(std::max(tick, 1), tick_to_broadcast);
+	}
 };
 
 template <typename model_datatype>
@@ -324,7 +515,7 @@ public:
 	int ml_test_batch_size;
 	std::vector<int>* ml_dataset_all_possible_labels;
 	
-	std::shared_ptr<std::ofstream> peer_change_file;
+	int peer_change_stream;
 	
 	peer_control_service()
 	{
@@ -376,7 +567,8 @@ public:
 				solver_for_testing[i].load_caffe_model(ml_solver_proto);
 			}
 			
-			peer_change_file.reset(new std::ofstream(output_path / "peer_change_record.txt", std::ios::binary));
+			LOG_IF(FATAL, this->result_output == nullptr) << "result_output is not set";
+			peer_change_stream = this->result_output->define_text("peer_change_record");
 		}
 		
 		return {record_service_status::success, ""};
@@ -390,7 +582,8 @@ public:
 		tmt::ParallelExecution_StepIncremental([&tick, this](uint32_t index, uint32_t thread_index, node<model_datatype> *single_node)
 		                       {
 			                       if (tick - single_node->last_measured_tick < least_peer_change_interval) return;
-			                       auto[test_data, test_label] = get_dataset_by_node_type(*test_dataset, *single_node, ml_test_batch_size, *ml_dataset_all_possible_labels);
+			                       auto test_rng = simulation_random::get(single_node->id, tick, random_purpose::service, accuracy_stream_index);
+			                       auto[test_data, test_label] = get_dataset_by_node_type(*test_dataset, *single_node, ml_test_batch_size, *ml_dataset_all_possible_labels, test_rng);
 			                       auto model = single_node->solver->get_parameter();
 			                       solver_for_testing[thread_index].set_parameter(model);
 			                       auto accuracy = solver_for_testing[thread_index].evaluation(test_data, test_label);
@@ -429,10 +622,11 @@ public:
 				as_peer_count[new_peer_name]++;
 				auto& new_peer = *(this->node_container->at(new_peer_name));
 				new_peer.buffer_size = std::round((float (new_peer.planned_buffer_size) / new_peer.planned_peers.size()) * as_peer_count[new_peer_name]);
+				if (this->scheduler) this->scheduler->notify_buffer_changed(&new_peer);
 				
 				std::stringstream ss;
 				ss << "tick:" << tick << "    " << node_pointer->name << "(accuracy: " << node_pointer->last_measured_accuracy << ") add " << new_peer_name << "(buffer size:" << new_peer.buffer_size << ")";
-				*peer_change_file << ss.str() << std::endl;
+				this->result_output->append_text(peer_change_stream, tick, ss.str());
 				LOG(INFO) << "[peer_control_service]  " << ss.str();
 				last_time_changed[node_pointer->name] = tick;
 			}
@@ -440,9 +634,9 @@ public:
 			if (node_pointer->last_measured_accuracy <= accuracy_threshold_low && node_pointer->peers.size() != 0)
 			{
 				//try delete a peer
-				std::random_device rd;
+				auto delete_rng = simulation_random::get(node_pointer->id, tick, random_purpose::service, delete_peer_stream_index);
 				std::uniform_int_distribution<int> distribution(0, node_pointer->peers.size()-1);
-				int delete_index = distribution(rd);
+				int delete_index = distribution(delete_rng);
 				std::string delete_peer_name;
 				for (const auto& [name, single_peer]: node_pointer->peers)
 				{
@@ -452,9 +646,10 @@ public:
 						as_peer_count[delete_peer_name]--;
 						auto& delete_peer = *(this->node_container->at(delete_peer_name));
 						delete_peer.buffer_size = std::round((float (delete_peer.planned_buffer_size) / delete_peer.planned_peers.size()) * as_peer_count[delete_peer_name]);
+						if (this->scheduler) this->scheduler->notify_buffer_changed(&delete_peer);
 						std::stringstream ss;
 						ss << "tick:" << tick << "    " << node_pointer->name << "(accuracy: " << node_pointer->last_measured_accuracy << ") delete " << delete_peer_name << "(buffer size:" << delete_peer.buffer_size << ")";
-						*peer_change_file << ss.str() << std::endl;
+						this->result_output->append_text(peer_change_stream, tick, ss.str());
 						LOG(INFO) << "[peer_control_service]  " << ss.str();
 						break;
 					}
@@ -471,16 +666,31 @@ public:
 	
 	std::tuple<record_service_status, std::string> destruction_service() override
 	{
-		if (peer_change_file && peer_change_file->is_open())
-		{
-			peer_change_file->flush();
-			peer_change_file->close();
-		}
 		delete[] solver_for_testing;
 		
 		return {record_service_status::success, ""};
 	}
+	
+	int next_active_tick(int tick) override
+	{
+		if (this->enable == false) return simulation_scheduler<model_datatype>::NO_EVENT;
+		return tick; //measures the accuracy every tick
+	}
+	
+	std::string save_state() override
+	{
+		std::tuple<std::unordered_map<std::string, int>, std::unordered_map<std::string, int>> state{last_time_changed, as_peer_count};
+		return serialize_wrap<boost::archive::binary_oarchive>(state).str();
+	}
+	
+	void load_state(const std::string& state) override
+	{
+		if (state.empty()) return;
+		std::tie(last_time_changed, as_peer_count) = deserialize_wrap<boost::archive::binary_iarchive, std::tuple<std::unordered_map<std::string, int>, std::unordered_map<std::string, int>>>(state);
+	}
 
 private:
+	static constexpr uint32_t accuracy_stream_index = 1;
+	static constexpr uint32_t delete_peer_stream_index = 2;
 	Ml::MlCaffeModel<float, caffe::SGDSolver>* solver_for_testing;
 };
\ No newline at end of file
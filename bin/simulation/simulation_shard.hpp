@@ -0,0 +1,319 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <functional>
+#include <cctype>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <limits>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+#include <glog/logging.h>
+#include <configure_file.hpp>
+#include <shared_memory_ring.hpp>
+
+/** shards of simulator_mt: the nodes are partitioned over {count} processes forked from the same configuration.
+ *  Each shard trains, aggregates and records its own nodes with its own thread pool, optionally pinned to a NUMA node,
+ *  so the shards share no locks and no heap. The models sent to the nodes of another shard go through a shared memory
+ *  ring per (source, target) shard, and the shards run the ticks in lock step:
+ *
+ *  train pass (send) -> exchange() (barrier, receive) -> buffer pass -> ... -> agree_min(next tick) (barrier)
+ *
+ *  A receiver thread per shard reads the rings during the train pass, so a sender never waits for the whole tick.
+ *  With count = 1 nothing is forked and all calls are local.
+ */
+class simulation_shard
+{
+public:
+	simulation_shard() : _count(1), _index(0), _ring_capacity(0), _numa_pin(false), _parent_pid(0), _stop(false) {}
+
+	~simulation_shard()
+	{
+		_stop = true;
+		if (_receiver.joinable()) _receiver.join();
+	}
+
+	void apply_config(const configuration_file::json& config)
+	{
+		_count = config["count"];
+		LOG_IF(FATAL, _count == 0) << "shard count must be positive";
+		size_t ring_capacity_mb = config["ring_capacity_mb"];
+		_ring_capacity = 4096;
+		while (_ring_capacity < ring_capacity_mb * 1024 * 1024) _ring_capacity *= 2;
+		_numa_pin = config["numa_pin"];
+	}
+
+	/** fork the other shards, it returns in every shard with index() set.
+	 *  Call it before any thread is created: only the calling thread exists in the children.
+	 */
+	void launch()
+	{
+		if (_count == 1) return;
+
+		//the layout: barrier, the next tick candidates (two rounds), the rings [source][target]
+		const size_t ring_size = (shared_memory_ring::memory_size(_ring_capacity) + 63) / 64 * 64;
+		const size_t barrier_size = (shared_memory_barrier::memory_size() + 63) / 64 * 64;
+		const size_t candidate_size = (2 * _count * sizeof(std::atomic<int>) + 63) / 64 * 64;
+		_memory = std::make_unique<shared_memory>(barrier_size + candidate_size + ring_size * _count * _count);
+
+		_parent_pid = getpid();
+		for (uint32_t index = 1; index < _count; ++index)
+		{
+			pid_t pid = fork();
+			LOG_IF(FATAL, pid < 0) << "cannot fork shard " << index;
+			if (pid == 0)
+			{
+				_index = index;
+				_children.clear();
+				//the shard dies with the first shard, which fails if any other shard dies
+				prctl(PR_SET_PDEATHSIG, SIGKILL);
+				if (getppid() != _parent_pid) _exit(1);
+				break;
+			}
+			_children.push_back(pid);
+		}
+
+		_idle = [this]() { check_alive(); };
+		char* memory = _memory->data();
+		_barrier = std::make_unique<shared_memory_barrier>(memory, _count, _idle);
+		_candidates = reinterpret_cast<std::atomic<int>*>(memory + barrier_size);
+		for (uint32_t source = 0; source < _count; ++source)
+		{
+			for (uint32_t target = 0; target < _count; ++target)
+			{
+				_rings.emplace_back(new shared_memory_ring(memory + barrier_size + candidate_size + ring_size * (source * _count + target), _ring_capacity, _idle));
+			}
+		}
+		_send_locks.reset(new std::mutex[_count]);
+		_received.resize(_count);
+
+		if (_numa_pin) pin_to_numa_node();
+		_receiver = std::thread([this]() { receive_loop(); });
+	}
+
+	uint32_t count() const
+	{
+		return _count;
+	}
+
+	uint32_t index() const
+	{
+		return _index;
+	}
+
+	bool sharded() const
+	{
+		return _count > 1;
+	}
+
+	//the nodes are assigned by contiguous id ranges, so the lattice-like topologies keep most peers in the same shard
+	void assign_nodes(size_t node_count)
+	{
+		_node_count = node_count;
+		LOG_IF(FATAL, _node_count < _count) << "there are " << _node_count << " nodes for " << _count << " shards";
+	}
+
+	uint32_t shard_of(uint32_t node_id) const
+	{
+		if (_count == 1) return 0;
+		return uint32_t(uint64_t(node_id) * _count / _node_count);
+	}
+
+	bool is_local(uint32_t node_id) const
+	{
+		return shard_of(node_id) == _index;
+	}
+
+	//thread safe, the payload is received by {target_shard} in the next exchange()
+	void send(uint32_t target_shard, const std::string& payload)
+	{
+		LOG_IF(FATAL, target_shard == _index || target_shard >= _count) << "invalid target shard " << target_shard;
+		std::lock_guard guard(_send_locks[target_shard]);
+		_rings[_index * _count + target_shard]->write_message(payload);
+	}
+
+	//all shards: wait for the sends of all shards, return the payloads sent to this shard, ordered by the source shard
+	std::vector<std::string> exchange()
+	{
+		if (_count == 1) return {};
+		_barrier->arrive_and_wait();
+
+		std::vector<std::string> output;
+		std::lock_guard guard(_receive_lock);
+		for (uint32_t source = 0; source < _count; ++source)
+		{
+			if (source == _index) continue;
+			auto& ring = *_rings[source * _count + _index];
+			while (ring.has_message()) _received[source].push_back(ring.read_message());
+			for (auto& payload: _received[source]) output.push_back(std::move(payload));
+			_received[source].clear();
+		}
+		//the rings must be empty before any shard sends the payloads of the next round
+		_barrier->arrive_and_wait();
+		return output;
+	}
+
+	//all shards: the minimum of {value} over the shards
+	int agree_min(int value)
+	{
+		if (_count == 1) return value;
+		std::atomic<int>* candidates = _candidates + (_round % 2) * _count;
+		_round++;
+		candidates[_index].store(value, std::memory_order_release);
+		_barrier->arrive_and_wait();
+		int output = std::numeric_limits<int>::max();
+		for (uint32_t index = 0; index < _count; ++index)
+		{
+			output = std::min(output, candidates[index].load(std::memory_order_acquire));
+		}
+		return output;
+	}
+
+	//the first shard waits for the others at exit
+	void wait_children()
+	{
+		_stop = true;
+		if (_receiver.joinable()) _receiver.join();
+		std::lock_guard guard(_children_lock);
+		for (auto pid: _children)
+		{
+			int status = 0;
+			waitpid(pid, &status, 0);
+			LOG_IF(ERROR, !WIFEXITED(status) || WEXITSTATUS(status) != 0) << "shard process " << pid << " exited abnormally, status: " << status;
+		}
+		_children.clear();
+	}
+
+private:
+	void receive_loop()
+	{
+		shared_memory_backoff backoff(_idle);
+		while (!_stop)
+		{
+			bool received = false;
+			{
+				std::lock_guard guard(_receive_lock);
+				for (uint32_t source = 0; source < _count; ++source)
+				{
+					if (source == _index) continue;
+					auto& ring = *_rings[source * _count + _index];
+					while (ring.has_message())
+					{
+						_received[source].push_back(ring.read_message());
+						received = true;
+					}
+				}
+			}
+			if (received)
+			{
+				backoff.reset();
+			}
+			else
+			{
+				backoff.wait();
+			}
+		}
+	}
+
+	//a shard blocked on a dead shard would wait forever, called by the main and the receiver thread
+	void check_alive()
+	{
+		if (_index != 0)
+		{
+			if (getppid() != _parent_pid) _exit(1);
+			return;
+		}
+		std::lock_guard guard(_children_lock);
+		for (auto iter = _children.begin(); iter != _children.end();)
+		{
+			int status = 0;
+			if (waitpid(*iter, &status, WNOHANG) != *iter)
+			{
+				++iter;
+				continue;
+			}
+			//a shard exits normally after the last barrier, which the other shards may still be leaving
+			LOG_IF(FATAL, !WIFEXITED(status) || WEXITSTATUS(status) != 0) << "shard process " << *iter << " exited abnormally, status: " << status;
+			iter = _children.erase(iter);
+		}
+	}
+
+	//pin this process (and the threads it creates later) to the cpus of NUMA node {index % NUMA node count}
+	void pin_to_numa_node()
+	{
+		std::vector<int> numa_nodes;
+		const std::filesystem::path numa_path = "/sys/devices/system/node";
+		if (std::filesystem::exists(numa_path))
+		{
+			for (auto& entry: std::filesystem::directory_iterator(numa_path))
+			{
+				const std::string name = entry.path().filename().string();
+				if (name.rfind("node", 0) == 0 && name.size() > 4 && std::all_of(name.begin() + 4, name.end(), ::isdigit)) numa_nodes.push_back(std::stoi(name.substr(4)));
+			}
+		}
+		if (numa_nodes.empty())
+		{
+			LOG(WARNING) << "[shard] no NUMA information, shard " << _index << " is not pinned";
+			return;
+		}
+		std::sort(numa_nodes.begin(), numa_nodes.end());
+		const int numa_node = numa_nodes[_index % numa_nodes.size()];
+
+		//cpulist: 0-15,32-47
+		std::ifstream cpulist_file(numa_path / ("node" + std::to_string(numa_node)) / "cpulist");
+		std::string cpulist;
+		std::getline(cpulist_file, cpulist);
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		std::stringstream ss(cpulist);
+		std::string range;
+		while (std::getline(ss, range, ','))
+		{
+			if (range.empty()) continue;
+			auto separator = range.find('-');
+			int first = std::stoi(range.substr(0, separator));
+			int last = separator == std::string::npos ? first : std::stoi(range.substr(separator + 1));
+			for (int cpu = first; cpu <= last; ++cpu) CPU_SET(cpu, &cpu_set);
+		}
+		if (CPU_COUNT(&cpu_set) == 0 || sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0)
+		{
+			LOG(WARNING) << "[shard] cannot pin shard " << _index << " to NUMA node " << numa_node;
+			return;
+		}
+		LOG(INFO) << "[shard] shard " << _index << " is pinned to NUMA node " << numa_node << ", cpus: " << cpulist;
+	}
+
+	uint32_t _count;
+	uint32_t _index;
+	size_t _ring_capacity;
+	bool _numa_pin;
+	size_t _node_count = 1;
+
+	pid_t _parent_pid;
+	std::vector<pid_t> _children;
+	std::mutex _children_lock;
+	std::function<void()> _idle;
+	std::unique_ptr<shared_memory> _memory;
+	std::unique_ptr<shared_memory_barrier> _barrier;
+	std::atomic<int>* _candidates = nullptr;
+	uint64_t _round = 0;
+	std::vector<std::unique_ptr<shared_memory_ring>> _rings; //[source * count + target]
+	std::unique_ptr<std::mutex[]> _send_locks; //per target shard, the rings have a single producer
+
+	std::thread _receiver;
+	std::atomic<bool> _stop;
+	std::mutex _receive_lock;
+	std::vector<std::vector<std::string>> _received; //per source shard, in the ring order
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <unordered_map>
+
+#include <glog/logging.h>
+#include <nlohmann/json.hpp>
+#include <sparse_topology.hpp>
+
+#include "./simulation_random.hpp"
+
+/** network topology configuration
+ * you can use fully_connect, average_degree-{degree}, random_regular-{degree}, erdos_renyi-{average degree}, small_world-{degree}-{rewiring probability},
+ * scale_free-{edges per new node}, edge_list-{file}, 1->2, 1--2, the topology items' order in the configuration file determines the order of adding connections.
+ * fully_connect: connect all nodes, and ignore all other topology items.
+ * average_degree-: connect the network to reach the degree for all nodes. If there are previous added topology, average_degree will add connections
+ * 					until reaching the degree and no duplicate connections.
+ * random_regular-, erdos_renyi-, small_world-, scale_free-: add the bilateral connections of a random regular / Erdos-Renyi / Watts-Strogatz / Barabasi-Albert graph.
+ * edge_list-: add the connections in a binary edge list (see sparse_topology), a relative path is relative to the configuration file.
+ * 				The node ids are the order of the nodes in the configuration file.
+ * 1->2: add 2 as the peer of 1.
+ * 1--2: add 2 as the peer of 1 and 1 as the peer of 2.
+ *
+ * node_names: the node names by node id. The random graphs draw from simulation_random (one stream per topology item),
+ * so the same seed and configuration give the same topology in every simulator.
+ */
+inline sparse_topology load_topology_config(const nlohmann::json& node_topology_json, const std::vector<std::string>& node_names, const std::filesystem::path& config_directory)
+{
+	const std::string fully_connect = "fully_connect";
+	const std::string average_degree = "average_degree-";
+	const std::string random_regular = "random_regular-";
+	const std::string erdos_renyi = "erdos_renyi-";
+	const std::string small_world = "small_world-";
+	const std::string scale_free = "scale_free-";
+	const std::string edge_list = "edge_list-";
+	const std::string unidirectional_term = "->";
+	const std::string bilateral_term = "--";
+
+	const size_t node_count = node_names.size();
+	std::unordered_map<std::string, sparse_topology::node_id> node_ids;
+	for (sparse_topology::node_id id = 0; id < node_count; ++id) node_ids.emplace(node_names[id], id);
+
+	std::vector<sparse_topology::edge> edges;
+	auto add_topology = [&edges, node_count](const sparse_topology& topology)
+	{
+		LOG_IF(FATAL, topology.node_count() != node_count) << "the topology has " << topology.node_count() << " nodes, but there are " << node_count << " nodes";
+		auto topology_edges = topology.directed_edges();
+		edges.insert(edges.end(), topology_edges.begin(), topology_edges.end());
+		LOG(INFO) << "network topology: apply " << topology_edges.size() << " connections";
+	};
+	auto starts_with = [](const std::string& str, const std::string& prefix) -> bool
+	{
+		return str.compare(0, prefix.length(), prefix) == 0;
+	};
+	auto find_node = [&node_ids](const std::string& name, const std::string& topology_item_str) -> sparse_topology::node_id
+	{
+		auto iter = node_ids.find(name);
+		LOG_IF(FATAL, iter == node_ids.end()) << name << " is not found in nodes, raw topology: " << topology_item_str;
+		return iter->second;
+	};
+
+	uint32_t topology_item_index = 0;
+	for (auto &topology_item : node_topology_json)
+	{
+		const std::string topology_item_str = topology_item.get<std::string>();
+		auto topology_rng = simulation_random::get(simulation_random::global_id, 0, random_purpose::topology, topology_item_index++);
+		auto unidirectional_loc = topology_item_str.find(unidirectional_term);
+		auto bilateral_loc = topology_item_str.find(bilateral_term);
+
+		if (topology_item_str == fully_connect)
+		{
+			LOG(INFO) << "network topology is fully connect";
+			edges.clear();
+			for (sparse_topology::node_id i = 0; i < node_count; ++i)
+			{
+				for (sparse_topology::node_id j = 0; j < node_count; ++j)
+				{
+					if (i != j) edges.emplace_back(i, j);
+				}
+			}
+			break;
+		}
+		else if (starts_with(topology_item_str, average_degree))
+		{
+			int degree = std::stoi(topology_item_str.substr(average_degree.length()));
+			LOG(INFO) << "network topology is average degree: " << degree;
+			LOG_IF(FATAL, degree > node_count - 1) << "degree > node_count - 1, impossible to reach such large degree";
+			//the filled topology contains the current connections
+			auto current = sparse_topology::from_edges(node_count, edges, true);
+			edges.clear();
+			add_topology(sparse_topology::fill_out_degree(current, degree, topology_rng));
+		}
+		else if (starts_with(topology_item_str, random_regular))
+		{
+			int degree = std::stoi(topology_item_str.substr(random_regular.length()));
+			LOG(INFO) << "network topology is random regular, degree: " << degree;
+			add_topology(sparse_topology::random_regular(node_count, degree, topology_rng));
+		}
+		else if (starts_with(topology_item_str, erdos_renyi))
+		{
+			double degree = std::stod(topology_item_str.substr(erdos_renyi.length()));
+			LOG(INFO) << "network topology is Erdos-Renyi, average degree: " << degree;
+			add_topology(sparse_topology::erdos_renyi(node_count, degree, topology_rng));
+		}
+		else if (starts_with(topology_item_str, small_world))
+		{
+			std::string parameter_str = topology_item_str.substr(small_world.length());
+			auto separator_loc = parameter_str.find('-');
+			LOG_IF(FATAL, separator_loc == std::string::npos) << "small world topology requires small_world-{degree}-{rewiring probability}, raw topology: " << topology_item_str;
+			int degree = std::stoi(parameter_str.substr(0, separator_loc));
+			double beta = std::stod(parameter_str.substr(separator_loc + 1));
+			LOG(INFO) << "network topology is small world, degree: " << degree << ", rewiring probability: " << beta;
+			add_topology(sparse_topology::small_world(node_count, degree, beta, topology_rng));
+		}
+		else if (starts_with(topology_item_str, scale_free))
+		{
+			int edges_per_node = std::stoi(topology_item_str.substr(scale_free.length()));
+			LOG(INFO) << "network topology is scale free, edges per new node: " << edges_per_node;
+			add_topology(sparse_topology::scale_free(node_count, edges_per_node, topology_rng));
+		}
+		else if (starts_with(topology_item_str, edge_list))
+		{
+			std::filesystem::path edge_list_path(topology_item_str.substr(edge_list.length()));
+			if (edge_list_path.is_relative()) edge_list_path = config_directory / edge_list_path;
+			LOG(INFO) << "network topology is loaded from " << edge_list_path;
+			add_topology(sparse_topology::load_edge_list(edge_list_path));
+		}
+		else if (unidirectional_loc != std::string::npos)
+		{
+			auto lhs = find_node(topology_item_str.substr(0, unidirectional_loc), topology_item_str);
+			auto rhs = find_node(topology_item_str.substr(unidirectional_loc + unidirectional_term.length()), topology_item_str);
+			LOG(INFO) << "network topology: unidirectional connect " << node_names[lhs] << " to " << node_names[rhs];
+			edges.emplace_back(lhs, rhs);
+		}
+		else if (bilateral_loc != std::string::npos)
+		{
+			auto lhs = find_node(topology_item_str.substr(0, bilateral_loc), topology_item_str);
+			auto rhs = find_node(topology_item_str.substr(bilateral_loc + bilateral_term.length()), topology_item_str);
+			LOG(INFO) << "network topology: bilateral connect " << node_names[lhs] << " with " << node_names[rhs];
+			edges.emplace_back(lhs, rhs);
+			edges.emplace_back(rhs, lhs);
+		}
+		else
+		{
+			LOG(ERROR) << "unknown topology item: " << topology_item_str;
+		}
+	}
+
+	//the duplicate connections and self loops are removed
+	return sparse_topology::from_edges(node_count, edges, true);
+}
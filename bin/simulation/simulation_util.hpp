@@ -1,11 +1,13 @@
 #pragma once
 
 #include "./node.hpp"
+#include "./simulation_random.hpp"
 
 //return: train_data,train_label
-template<typename model_datatype>
+//rng: use simulation_random::get(...) for reproducible datasets
+template<typename model_datatype, typename RNG>
 std::tuple<std::vector<Ml::tensor_blob_like<model_datatype>>, std::vector<Ml::tensor_blob_like<model_datatype>>>
-get_dataset_by_node_type(Ml::data_converter<model_datatype> &dataset, const node<model_datatype> &target_node, int size, const std::vector<int> &ml_dataset_all_possible_labels)
+get_dataset_by_node_type(Ml::data_converter<model_datatype> &dataset, const node<model_datatype> &target_node, int size, const std::vector<int> &ml_dataset_all_possible_labels, RNG &rng)
 {
 	Ml::tensor_blob_like<model_datatype> label;
 	label.getShape() = {1};
@@ -13,18 +15,16 @@ get_dataset_by_node_type(Ml::data_converter<model_datatype> &dataset, const node
 	if (target_node.dataset_mode == dataset_mode_type::default_dataset)
 	{
 		//iid dataset
-		std::tie(train_data, train_label) = dataset.get_random_data(size);
+		std::tie(train_data, train_label) = dataset.get_random_data(size, rng);
 	}
 	else if (target_node.dataset_mode == dataset_mode_type::iid_dataset)
 	{
-		std::random_device dev;
-		std::mt19937 rng(dev());
 		std::uniform_int_distribution<int> distribution(0, int(ml_dataset_all_possible_labels.size()) - 1);
 		for (int i = 0; i < size; ++i)
 		{
 			int label_int = ml_dataset_all_possible_labels[distribution(rng)];
 			label.getData() = {model_datatype(label_int)};
-			auto[train_data_slice, train_label_slice] = dataset.get_random_data_by_Label(label, 1);
+			auto[train_data_slice, train_label_slice] = dataset.get_random_data_by_Label(label, 1, rng);
 			train_data.insert(train_data.end(), train_data_slice.begin(), train_data_slice.end());
 			train_label.insert(train_label.end(), train_label_slice.begin(), train_label_slice.end());
 		}
@@ -32,9 +32,6 @@ get_dataset_by_node_type(Ml::data_converter<model_datatype> &dataset, const node
 	else if (target_node.dataset_mode == dataset_mode_type::non_iid_dataset)
 	{
 		//non-iid dataset
-		std::random_device dev;
-		std::mt19937 rng(dev());
-		
 		Ml::non_iid_distribution<model_datatype> label_distribution;
 		for (auto &target_label : ml_dataset_all_possible_labels)
 		{
@@ -58,11 +55,32 @@ get_dataset_by_node_type(Ml::data_converter<model_datatype> &dataset, const node
 				LOG(ERROR) << "cannot find the desired label";
 			}
 		}
-		std::tie(train_data, train_label) = dataset.get_random_non_iid_dataset(label_distribution, size);
+		std::tie(train_data, train_label) = dataset.get_random_non_iid_dataset(label_distribution, size, rng);
 	}
 	return {train_data, train_label};
 }
 
+/** the test set of a node in a tick. The nodes of the same default / iid dataset mode draw from the same distribution,
+ *  they share one test set per tick (drawn from a global random stream), so the model broadcast to them is evaluated
+ *  once (see Ml::evaluation_cache). A non-iid node draws its own test set.
+ */
+template<typename model_datatype>
+uint64_t get_test_set_id(const node<model_datatype> &target_node, int tick)
+{
+	const uint32_t owner = target_node.dataset_mode == dataset_mode_type::non_iid_dataset ? target_node.id : simulation_random::global_id - uint32_t(target_node.dataset_mode);
+	return (uint64_t(uint32_t(tick)) << 32) | owner;
+}
+
+//return: test_data,test_label of get_test_set_id(target_node, tick)
+template<typename model_datatype>
+std::tuple<std::vector<Ml::tensor_blob_like<model_datatype>>, std::vector<Ml::tensor_blob_like<model_datatype>>>
+get_test_dataset(Ml::data_converter<model_datatype> &dataset, const node<model_datatype> &target_node, int tick, int size, const std::vector<int> &ml_dataset_all_possible_labels)
+{
+	const bool shared = target_node.dataset_mode != dataset_mode_type::non_iid_dataset;
+	auto rng = shared ? simulation_random::get(simulation_random::global_id, tick, random_purpose::test_dataset, uint32_t(target_node.dataset_mode)) : simulation_random::get(target_node.id, tick, random_purpose::test_dataset);
+	return get_dataset_by_node_type(dataset, target_node, size, ml_dataset_all_possible_labels, rng);
+}
+
 //return <max, min>
 template<typename T>
 std::tuple<T, T> find_max_min(T* data, size_t size)
@@ -8,6 +8,7 @@
 #include <fstream>
 #include <set>
 #include <atomic>
+#include <numeric>
 
 #include <glog/logging.h>
 
@@ -23,6 +24,7 @@
 #include <utility>
 
 #include "../reputation_sdk.hpp"
+#include "../reputation_plugin.hpp"
 #include "./default_simulation_config.hpp"
 #include "./simulation_util.hpp"
 #include "./node.hpp"
@@ -96,7 +98,8 @@ get_dataset_by_node_type(Ml::data_converter<model_datatype> &dataset, const node
 }
 
 std::unordered_map<std::string, node<model_datatype> *> node_container;
-dll_loader<reputation_interface<model_datatype>> reputation_dll;
+reputation_plugin<model_datatype> reputation_dll;
+reputation_node_ids reputation_node_id;
 
 
 int main(int argc, char *argv[])
@@ -157,20 +160,10 @@ int main(int argc, char *argv[])
 	auto ml_reputation_dll_path = *config.get<std::string>("ml_reputation_dll_path");
 	
 	//load reputation dll
-	if constexpr(std::is_same_v<model_datatype, float>)
 	{
-		auto[status, msg] = reputation_dll.load(ml_reputation_dll_path, export_class_name_reputation_float);
+		auto[status, msg] = reputation_dll.load(ml_reputation_dll_path);
 		LOG_IF(FATAL, !status) << "error to load reputation dll: " << msg;
-	}
-	else if constexpr(std::is_same_v<model_datatype, double>)
-	{
-		auto[status, msg] = reputation_dll.load(ml_reputation_dll_path, export_class_name_reputation_double);
-		LOG_IF(FATAL, !status) << "error to load reputation dll: " << msg;
-	}
-	else
-	{
-		LOG(FATAL) << "unknown model datatype";
-		return -1;
+		LOG(INFO) << "load " << msg;
 	}
 	//backup reputation file
 	{
@@ -220,6 +213,7 @@ int main(int argc, char *argv[])
 		}
 		
 		auto[iter, status]=node_container.emplace(node_name, temp_node);
+		reputation_node_id.add(node_name);
 		
 		//load models solver and open reputation_fileS
 		iter->second->solver->load_caffe_model(ml_solver_proto);
@@ -547,20 +541,19 @@ int main(int argc, char *argv[])
 				//add to buffer, and update model if necessary
 				for (auto updating_node : single_node.second->peers)
 				{
-					updating_node->parameter_buffer.emplace_back(single_node.second->name, type, parameter_output);
+					updating_node->parameter_buffer.emplace_back(single_node.second->name, type, parameter_output, "");
 					if (updating_node->parameter_buffer.size() == updating_node->buffer_size)
 					{
 						//update model
 						auto parameter = updating_node->solver->get_parameter();
-						std::vector<updated_model<model_datatype>> received_models;
-						received_models.resize(updating_node->parameter_buffer.size());
-						for (int i = 0; i < received_models.size(); ++i)
+						const auto& buffer = updating_node->parameter_buffer;
+						reputation_round<model_datatype> round;
+						round.models = Ml::robust_aggregation<model_datatype>::flatten(buffer.size(), [&buffer](size_t index) -> const Ml::caffe_parameter_net<model_datatype>& { return std::get<2>(buffer[index]); });
+						round.accuracies.resize(buffer.size());
+						for (const auto& [node_name, type, model, sparse_update] : buffer)
 						{
-							auto[node_name, type, model] = updating_node->parameter_buffer[i];
-							received_models[i].model_parameter = model;
-							received_models[i].type = type;
-							received_models[i].generator_address = node_name;
-							received_models[i].accuracy = 0;
+							round.types.push_back(type);
+							round.generators.push_back(*reputation_node_id.find(node_name));
 						}
 						
 						float self_accuracy = 0;
@@ -570,17 +563,20 @@ int main(int argc, char *argv[])
 							                                 auto[test_data, test_label] = get_dataset_by_node_type(test_dataset, *updating_node, ml_test_batch_size, ml_dataset_all_possible_labels);
 							                                 self_accuracy = updating_node->solver->evaluation(test_data, test_label);
 						                                 });
-						size_t worker = received_models.size() > std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : received_models.size();
-						auto_multi_thread::ParallelExecution(worker, [parameter, &updating_node, &solver_for_testing, &test_dataset, &ml_test_batch_size, &ml_dataset_all_possible_labels](uint32_t index, updated_model<model_datatype> &model)
+						size_t worker = buffer.size() > std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : buffer.size();
+						std::vector<size_t> model_indexes(buffer.size());
+						std::iota(model_indexes.begin(), model_indexes.end(), 0);
+						auto_multi_thread::ParallelExecution(worker, [parameter, &buffer, &round, &updating_node, &solver_for_testing, &test_dataset, &ml_test_batch_size, &ml_dataset_all_possible_labels](uint32_t index, size_t &model_index)
 						{
+							const auto& [node_name, type, model, sparse_update] = buffer[model_index];
 							auto output_model = parameter;
-							if (model.type == Ml::model_compress_type::compressed_by_diff)
+							if (type == Ml::model_compress_type::compressed_by_diff)
 							{
-								output_model.patch_weight(model.model_parameter);
+								output_model.patch_weight(model);
 							}
-							else if (model.type == Ml::model_compress_type::normal)
+							else if (type == Ml::model_compress_type::normal)
 							{
-								output_model = model.model_parameter;
+								output_model = model;
 							}
 							else
 							{
@@ -588,12 +584,20 @@ int main(int argc, char *argv[])
 							}
 							solver_for_testing[index].set_parameter(output_model);
 							auto[test_data, test_label] = get_dataset_by_node_type(test_dataset, *updating_node, ml_test_batch_size, ml_dataset_all_possible_labels);
-							model.accuracy = solver_for_testing[index].evaluation(test_data, test_label);
-						}, received_models.size(), received_models.data());
+							round.accuracies[model_index] = solver_for_testing[index].evaluation(test_data, test_label);
+						}, model_indexes.size(), model_indexes.data());
 						self_accuracy_thread.join();
 						std::cout << (boost::format("tick: %1%, node: %2%, accuracy: %3%") % tick % updating_node->name % self_accuracy).str() << std::endl;
 						auto &reputation_map = updating_node->reputation_map;
-						reputation_dll.get()->update_model(parameter, self_accuracy, received_models, reputation_map);
+						std::vector<double> reputation;
+						reputation_node_id.to_array(reputation_map, reputation);
+						round.current_model = &parameter;
+						round.self_accuracy = self_accuracy;
+						round.reputation = reputation.data();
+						round.node_count = reputation_node_id.size();
+						round.node_names = &reputation_node_id.names();
+						reputation_dll.update_model(round);
+						reputation_node_id.to_map(reputation, reputation_map);
 						updating_node->solver->set_parameter(parameter);
 						
 						//print reputation map
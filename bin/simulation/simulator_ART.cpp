@@ -1,38 +1,21 @@
 #include <random>
 #include <iostream>
-#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <unordered_map>
+#include <chrono>
+#include <numeric>
 
 #include <glog/logging.h>
 #include <configure_file.hpp>
 #include <time_util.hpp>
 #include <tmt.hpp>
+#include <sparse_topology.hpp>
 
-class node_ART
-{
-public:
-	node_ART()
-	{
-		next_train_tick = 0;
-		model = 0.0;
-		name = "empty";
-		buffer_size = 0;
-	}
-	
-	std::string name;
-	std::vector<int> training_interval_tick;
-	std::vector<node_ART*> peers;
-	int next_train_tick;
-	
-	int buffer_size;
-	
-	std::vector<std::tuple<std::string, float>> parameter_buffer;
-	std::mutex parameter_buffer_lock;
-	
-	float model;
-
-};
-
-std::unordered_map<std::string, node_ART*> node_container_ART;
+#include "./ART_engine.hpp"
+#include "./simulation_random.hpp"
+#include "./simulation_topology.hpp"
 
 int main(int argc, char *argv[])
 {
@@ -63,227 +46,92 @@ int main(int argc, char *argv[])
 	
 	auto ml_max_tick = *config.get<int>("ml_max_tick");
 	
-	//load node configurations
+	//0: a random seed, the same seed and configuration give the same result
+	const uint64_t random_seed = simulation_random::set_seed(config_json.contains("random_seed") ? config_json["random_seed"].get<uint64_t>() : 0);
+	LOG(INFO) << "random seed: " << random_seed;
+	std::cout << "random seed: " << random_seed << std::endl;
+	
+	//load node configurations, the node ids are the order in the configuration file
 	auto nodes_json = config_json["nodes"];
-	size_t max_buffer_size = 0;
+	std::vector<std::string> node_names;
+	std::unordered_map<std::string, sparse_topology::node_id> node_ids;
+	std::vector<std::vector<int>> training_interval_tick;
+	std::vector<uint32_t> buffer_size;
 	for (auto &single_node: nodes_json)
 	{
 		const std::string node_name = single_node["name"];
+		if (node_ids.contains(node_name))
 		{
-			auto iter = node_container_ART.find(node_name);
-			if (iter != node_container_ART.end())
-			{
-				LOG(FATAL) << "duplicate node name";
-				return -1;
-			}
+			LOG(FATAL) << "duplicate node name";
+			return -1;
 		}
+		node_ids.emplace(node_name, sparse_topology::node_id(node_names.size()));
+		node_names.push_back(node_name);
 		
-		//name
 		const int buf_size = single_node["buffer_size"];
-		if (buf_size > max_buffer_size) max_buffer_size = buf_size;
-		
-		const std::string node_type = single_node["node_type"];
-		
-		auto* temp_node = new node_ART();
-		temp_node->name = node_name;
-		temp_node->next_train_tick = 0;
-		temp_node->buffer_size = 0;
-		
-		auto[iter, status]=node_container_ART.emplace(node_name, temp_node);
+		buffer_size.push_back(buf_size);
 		
 		//training_interval_tick
+		std::vector<int> intervals;
 		for (auto &el : single_node["training_interval_tick"])
 		{
-			iter->second->training_interval_tick.push_back(el);
+			intervals.push_back(el);
 		}
+		training_interval_tick.push_back(std::move(intervals));
 	}
+	const size_t node_count = node_names.size();
 	
-	//load network topology configuration
+	//load network topology configuration, the same items and random streams as simulator_mt
+	auto topology = load_topology_config(config_json["node_topology"], node_names, std::filesystem::path(config_file_path).parent_path());
+	
+	ART_similarity_reputation reputation_update;
+	if (config_json.contains("ART_reputation_learning_rate")) reputation_update.learning_rate = config_json["ART_reputation_learning_rate"];
+	ART_engine<> engine(topology, training_interval_tick, buffer_size, random_seed, reputation_update);
+	
+	//the statistics of the models every {record_interval} ticks
+	const int record_interval = config_json.contains("ART_record_interval_tick") ? config_json["ART_record_interval_tick"].get<int>() : 100;
+	std::ofstream model_record(output_path / "model.csv");
+	model_record << "tick,mean,min,max" << std::endl;
+	auto record_models = [&engine, &model_record](int tick)
 	{
-		const std::string fully_connect = "fully_connect";
-		const std::string average_degree = "average_degree-";
-		const std::string unidirectional_term = "->";
-		const std::string bilateral_term = "--";
-		
-		auto node_topology_json = config_json["node_topology"];
-		for (auto &topology_item : node_topology_json)
+		auto values = engine.values();
+		auto [min_value, max_value] = std::minmax_element(values.begin(), values.end());
+		double mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+		model_record << tick << "," << mean << "," << *min_value << "," << *max_value << std::endl;
+	};
+	
+	auto start_time = std::chrono::steady_clock::now();
+	for (int tick = 0; tick <= ml_max_tick; ++tick)
+	{
+		engine.run_tick(tick);
+		if (tick % record_interval == 0)
 		{
-			const std::string topology_item_str = topology_item.get<std::string>();
-			auto average_degree_loc = topology_item_str.find(average_degree);
-			auto unidirectional_loc = topology_item_str.find(unidirectional_term);
-			auto bilateral_loc = topology_item_str.find(bilateral_term);
-			
-			auto check_duplicate_peer = [](const node_ART &target_node, const std::string &peer_name) -> bool
-			{
-				bool duplicate = false;
-				for (const auto &current_connections: target_node.peers)
-				{
-					if (peer_name == current_connections->name)
-					{
-						duplicate = true;
-						break;
-					}
-				}
-				return duplicate;
-			};
-			
-			if (topology_item_str == fully_connect)
-			{
-				LOG(INFO) << "network topology is fully connect";
-				
-				for (auto&[node_name, node_inst] : node_container_ART)
-				{
-					for (auto&[target_node_name, target_node_inst] : node_container_ART)
-					{
-						if (node_name != target_node_name)
-						{
-							node_inst->peers.push_back(target_node_inst);
-						}
-					}
-				}
-				break;
-			}
-			else if (average_degree_loc != std::string::npos)
-			{
-				std::string degree_str = topology_item_str.substr(average_degree_loc + average_degree.length());
-				int degree = std::stoi(degree_str);
-				LOG(INFO) << "network topology is average degree: " << degree;
-				LOG_IF(FATAL, degree > node_container_ART.size() - 1) << "degree > node_count - 1, impossible to reach such large degree";
-				
-				std::vector<std::string> node_name_list;
-				node_name_list.reserve(node_container_ART.size());
-				for (const auto&[node_name, node_inst] : node_container_ART)
-				{
-					node_name_list.push_back(node_name);
-				}
-				
-				std::random_device dev;
-				std::mt19937 rng(dev());
-				LOG(INFO) << "network topology average degree process begins";
-				for (auto&[target_node_name, target_node_inst] : node_container_ART)
-				{
-					std::shuffle(std::begin(node_name_list), std::end(node_name_list), rng);
-					for (const std::string &connect_node_name : node_name_list)
-					{
-						//check average degree first to ensure there are already some connects.
-						if (target_node_inst->peers.size() >= degree) break;
-						if (connect_node_name == target_node_name) continue; // connect_node == self
-						if (check_duplicate_peer((*target_node_inst), connect_node_name)) continue; // connection already exists
-						
-						auto &connect_node = node_container_ART.at(connect_node_name);
-						target_node_inst->peers.push_back(connect_node);
-						LOG(INFO) << "network topology average degree process: " << target_node_inst->name << " -> " << connect_node->name;
-					}
-				}
-				LOG(INFO) << "network topology average degree process ends";
-			}
-			else if (unidirectional_loc != std::string::npos)
-			{
-				std::string lhs_node_str = topology_item_str.substr(0, unidirectional_loc);
-				std::string rhs_node_str = topology_item_str.substr(unidirectional_loc + unidirectional_term.length());
-				LOG(INFO) << "network topology: unidirectional connect " << lhs_node_str << " to " << rhs_node_str;
-				auto lhs_node_iter = node_container_ART.find(lhs_node_str);
-				auto rhs_node_iter = node_container_ART.find(rhs_node_str);
-				LOG_IF(FATAL, lhs_node_iter == node_container_ART.end()) << lhs_node_str << " is not found in nodes, raw topology: " << topology_item_str;
-				LOG_IF(FATAL, rhs_node_iter == node_container_ART.end()) << rhs_node_str << " is not found in nodes, raw topology: " << topology_item_str;
-				
-				if (check_duplicate_peer(*(lhs_node_iter->second), rhs_node_str))// connection already exists
-				{
-					LOG(WARNING) << rhs_node_str << " is already a peer of " << lhs_node_str;
-				}
-				else
-				{
-					auto &connect_node = node_container_ART.at(rhs_node_str);
-					lhs_node_iter->second->peers.push_back(connect_node);
-				}
-			}
-			else if (bilateral_loc != std::string::npos)
-			{
-				std::string lhs_node_str = topology_item_str.substr(0, bilateral_loc);
-				std::string rhs_node_str = topology_item_str.substr(bilateral_loc + unidirectional_term.length());
-				LOG(INFO) << "network topology: bilateral connect " << lhs_node_str << " with " << rhs_node_str;
-				auto lhs_node_iter = node_container_ART.find(lhs_node_str);
-				auto rhs_node_iter = node_container_ART.find(rhs_node_str);
-				LOG_IF(FATAL, lhs_node_iter == node_container_ART.end()) << lhs_node_str << " is not found in nodes, raw topology: " << topology_item_str;
-				LOG_IF(FATAL, rhs_node_iter == node_container_ART.end()) << rhs_node_str << " is not found in nodes, raw topology: " << topology_item_str;
-				
-				if (check_duplicate_peer(*(lhs_node_iter->second), rhs_node_str))// connection already exists
-				{
-					LOG(WARNING) << rhs_node_str << " is already a peer of " << lhs_node_str;
-				}
-				else
-				{
-					auto &rhs_connected_node = node_container_ART.at(rhs_node_str);
-					lhs_node_iter->second->peers.push_back(rhs_connected_node);
-				}
-				
-				if (check_duplicate_peer(*(rhs_node_iter->second), lhs_node_str))// connection already exists
-				{
-					LOG(WARNING) << lhs_node_str << " is already a peer of " << rhs_node_str;
-				}
-				else
-				{
-					auto &lhs_connected_node = node_container_ART.at(lhs_node_str);
-					rhs_node_iter->second->peers.push_back(lhs_connected_node);
-				}
-			}
-			else
-			{
-				LOG(ERROR) << "unknown topology item: " << topology_item_str;
-			}
+			record_models(tick);
+			std::cout << "tick: " << tick << " (" << ml_max_tick << ")" << std::endl;
+			LOG(INFO) << "tick: " << tick << " (" << ml_max_tick << ")";
 		}
 	}
-	
-	//node vector container
-	std::vector<node_ART*> node_vector_container_ART;
-	node_vector_container_ART.reserve(node_container_ART.size());
-	for (auto &single_node : node_container_ART)
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
 	{
-		node_vector_container_ART.push_back(single_node.second);
+		std::stringstream log_msg;
+		log_msg << "simulated " << node_count << " nodes for " << ml_max_tick + 1 << " ticks in " << elapsed.count() << "s, " << double(node_count) * (ml_max_tick + 1) / elapsed.count() << " node-ticks/s";
+		std::cout << log_msg.str() << std::endl;
+		LOG(INFO) << log_msg.str();
 	}
 	
-	int tick = 0;
-	while (tick <= ml_max_tick)
+	//the final model and the reputation given to each sender
 	{
-		std::cout << "tick: " << tick << " (" << ml_max_tick << ")" << std::endl;
-		LOG(INFO) << "tick: " << tick << " (" << ml_max_tick << ")";
-		bool exit = false;
-		
-		tmt::ParallelExecution_StepIncremental([&tick](uint32_t index, uint32_t thread_index, node_ART* single_node){
-			if (tick >= single_node->next_train_tick)
-			{
-				std::random_device dev;
-				std::mt19937 rng(dev());
-				std::uniform_int_distribution<int> distribution(0, int(single_node->training_interval_tick.size()) - 1);
-				single_node->next_train_tick += single_node->training_interval_tick[distribution(rng)];
-				
-				////TODO:train
-				std::normal_distribution<float> model_train_distribution(0.01, 0.005);
-				single_node->model = single_node->model + model_train_distribution(rng);
-				if (single_node->model < 0) single_node->model = 0;
-				if (single_node->model > 1) single_node->model = 1;
-				
-				//add ML network to FedAvg buffer
-				for (auto updating_node : single_node->peers)
-				{
-					std::lock_guard guard(updating_node->parameter_buffer_lock);
-					updating_node->parameter_buffer.emplace_back(single_node->name, single_node->model);
-				}
-				
-			}
-		}, node_vector_container_ART.size(), node_vector_container_ART.data());
-		
-		//check fedavg buffer full
-		tmt::ParallelExecution_StepIncremental([&tick](uint32_t index, uint32_t thread_index, node_ART* single_node){
-			if (single_node->parameter_buffer.size() >= single_node->buffer_size)
+		std::ofstream reputation_record(output_path / "reputation.csv");
+		reputation_record << "node,model,sender,reputation" << std::endl;
+		for (uint32_t i = 0; i < node_count; ++i)
+		{
+			auto senders = engine.senders(i);
+			auto reputation = engine.reputation(i);
+			for (size_t j = 0; j < senders.size(); ++j)
 			{
-				////TODO:update model
-				
-				
-				//clear buffer and start new loop
-				single_node->parameter_buffer.clear();
+				reputation_record << node_names[i] << "," << engine.values()[i] << "," << node_names[senders[j]] << "," << reputation[j] << "\n";
 			}
-		}, node_vector_container_ART.size(), node_vector_container_ART.data());
+		}
 	}
 	
 	return 0;
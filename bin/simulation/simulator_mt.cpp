@@ -8,8 +8,11 @@
 #include <unordered_map>
 #include <fstream>
 #include <set>
+#include <map>
 #include <atomic>
 #include <chrono>
+#include <optional>
+#include <numeric>
 
 #include <glog/logging.h>
 
@@ -22,13 +25,23 @@
 #include <ml_layer.hpp>
 #include <thread_pool.hpp>
 #include <dll_importer.hpp>
+#include <sparse_topology.hpp>
 #include <boost/format.hpp>
 #include <utility>
 
 #include "../reputation_sdk.hpp"
+#include "../reputation_plugin.hpp"
 #include "./default_simulation_config.hpp"
 #include "./node.hpp"
 #include "./simulation_service.hpp"
+#include "./simulation_output.hpp"
+#include "./simulation_checkpoint.hpp"
+#include "./simulation_scheduler.hpp"
+#include "./ensemble_evaluator.hpp"
+#include "./simulation_random.hpp"
+#include "./simulation_topology.hpp"
+#include "./simulation_network.hpp"
+#include "./simulation_shard.hpp"
 
 /** assumptions in this simulator:
  *  (1) no transaction transmission time
@@ -39,12 +52,25 @@
 using model_datatype = float;
 
 std::unordered_map<std::string, node<model_datatype> *> node_container;
-dll_loader<reputation_interface<model_datatype>> reputation_dll;
+reputation_plugin<model_datatype> reputation_dll;
+reputation_node_ids reputation_node_id; //all nodes, in the order of node_by_id
+Ml::evaluation_cache<model_datatype> model_evaluation_cache; //shared by all receivers, a broadcast model is evaluated once per test set
 
 
 int main(int argc, char *argv[])
 {
-	constexpr char config_file_path[] = "./simulator_config.json";
+	std::string config_file_path = "./simulator_config.json";
+	
+	//--resume {output folder}: continue the simulation from the last checkpoint in the folder
+	std::optional<std::filesystem::path> resume_path;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::string(argv[i]) == "--resume" && i + 1 < argc)
+		{
+			resume_path = std::filesystem::path(argv[i + 1]);
+			i++;
+		}
+	}
 	
 	//register node types
 	normal_node<model_datatype>::registerNodeType();
@@ -57,20 +83,19 @@ int main(int argc, char *argv[])
 	malicious_data_poisoning_shuffle_label_biased_1_node<model_datatype>::registerNodeType();
 	malicious_data_poisoning_random_data_node<model_datatype>::registerNodeType();
 	
-	//create new folder
-	std::string time_str = time_util::time_to_text(time_util::get_current_utc_time());
-	std::filesystem::path output_path = std::filesystem::current_path() / time_str;
-	std::filesystem::create_directories(output_path);
-	
-	//log file path
-	google::InitGoogleLogging(argv[0]);
-	std::filesystem::path log_path(output_path / "log");
-	if (!std::filesystem::exists(log_path)) std::filesystem::create_directories(log_path);
-	google::SetLogDestination(google::INFO, (log_path.string() + "/").c_str());
-	
-	//reputation folder
-	std::filesystem::path reputation_folder = output_path / "reputation";
-	if (!std::filesystem::exists(reputation_folder)) std::filesystem::create_directories(reputation_folder);
+	//create new folder, or use the folder of the resumed simulation
+	std::filesystem::path output_path;
+	if (resume_path)
+	{
+		output_path = std::filesystem::absolute(*resume_path);
+		config_file_path = (output_path / "simulator_config.json").string();
+	}
+	else
+	{
+		std::string time_str = time_util::time_to_text(time_util::get_current_utc_time());
+		output_path = std::filesystem::current_path() / time_str;
+		std::filesystem::create_directories(output_path);
+	}
 	
 	//load configuration
 	configuration_file config;
@@ -83,7 +108,37 @@ int main(int argc, char *argv[])
 	}
 	auto config_json = config.get_json();
 	//backup configuration file
-	std::filesystem::copy(config_file_path, output_path / "simulator_config.json");
+	if (!resume_path) std::filesystem::copy(config_file_path, output_path / "simulator_config.json");
+	
+	//random seed, picked before the shards are launched so all shards use the same one
+	uint64_t random_seed = simulation_random::set_seed(*config.get<uint64_t>("random_seed"));
+	
+	//shards, the other shards are forked here, so no thread is created before
+	simulation_shard shard;
+	if (config_json.contains("shard")) shard.apply_config(config_json["shard"]);
+	shard.launch();
+	std::filesystem::path shard_output_path = shard.sharded() ? output_path / ("shard_" + std::to_string(shard.index())) : output_path;
+	std::filesystem::create_directories(shard_output_path);
+	
+	//log file path
+	google::InitGoogleLogging(argv[0]);
+	std::filesystem::path log_path(shard_output_path / "log");
+	if (!std::filesystem::exists(log_path)) std::filesystem::create_directories(log_path);
+	google::SetLogDestination(google::INFO, (log_path.string() + "/").c_str());
+	
+	//checkpoint
+	simulation_checkpoint<model_datatype> checkpoint(shard_output_path / "checkpoint");
+	std::optional<simulation_checkpoint_manifest> resume_manifest;
+	if (resume_path)
+	{
+		resume_manifest = checkpoint.load_manifest();
+		LOG_IF(FATAL, !resume_manifest) << "no checkpoint in " << shard_output_path;
+		//drop the records after the checkpoint
+		std::filesystem::resize_file(shard_output_path / "simulation_result.bin", resume_manifest->result_file_size);
+	}
+	
+	//all records (of the shard) are written to one result file, use simulation_result_to_csv to get the csv files
+	simulation_output result_output(shard_output_path / "simulation_result.bin", resume_path.has_value());
 	
 	//update global var
 	auto ml_solver_proto = *config.get<std::string>("ml_solver_proto");
@@ -98,6 +153,12 @@ int main(int argc, char *argv[])
 	auto ml_model_weight_diff_record_interval_tick = *config.get<int>("ml_model_weight_diff_record_interval_tick");
 	
 	auto report_time_remaining_per_tick_elapsed = *config.get<int>("report_time_remaining_per_tick_elapsed");
+	auto checkpoint_interval_tick = *config.get<int>("checkpoint_interval_tick");
+	
+	//a resumed run continues with the seed of the checkpoint
+	if (resume_manifest && resume_manifest->random_seed != 0) random_seed = simulation_random::set_seed(resume_manifest->random_seed);
+	LOG(INFO) << "random seed: " << random_seed;
+	std::cout << "random seed: " << random_seed << std::endl;
 	
 	std::vector<int> ml_dataset_all_possible_labels = *config.get_vec<int>("ml_dataset_all_possible_labels");
 	std::vector<float> ml_non_iid_normal_weight = *config.get_vec<float>("ml_non_iid_normal_weight");
@@ -105,23 +166,14 @@ int main(int argc, char *argv[])
 	auto ml_reputation_dll_path = *config.get<std::string>("ml_reputation_dll_path");
 	
 	//load reputation dll
-	if constexpr(std::is_same_v<model_datatype, float>)
-	{
-		auto[status, msg] = reputation_dll.load(ml_reputation_dll_path, export_class_name_reputation_float);
-		LOG_IF(FATAL, !status) << "error to load reputation dll: " << msg;
-	}
-	else if constexpr(std::is_same_v<model_datatype, double>)
 	{
-		auto[status, msg] = reputation_dll.load(ml_reputation_dll_path, export_class_name_reputation_double);
+		auto[status, msg] = reputation_dll.load(ml_reputation_dll_path);
 		LOG_IF(FATAL, !status) << "error to load reputation dll: " << msg;
-	}
-	else
-	{
-		LOG(FATAL) << "unknown model datatype";
-		return -1;
+		LOG(INFO) << "load " << msg;
 	}
 	
 	//backup reputation file
+	if (!resume_path && shard.index() == 0)
 	{
 		std::filesystem::path ml_reputation_dll(ml_reputation_dll_path);
 		std::filesystem::copy(ml_reputation_dll_path, output_path / ml_reputation_dll.filename());
@@ -129,6 +181,8 @@ int main(int argc, char *argv[])
 	
 	//load node configurations
 	auto nodes_json = config_json["nodes"];
+	std::vector<node<model_datatype>*> node_by_id; //the order in the configuration file, used as node ids by the topology generators
+	shard.assign_nodes(nodes_json.size());
 	for (auto &single_node: nodes_json)
 	{
 		const std::string node_name = single_node["name"];
@@ -162,10 +216,12 @@ int main(int argc, char *argv[])
 		}
 		
 		auto[iter, status] = node_container.emplace(node_name, temp_node);
+		temp_node->id = uint32_t(node_by_id.size());
+		node_by_id.push_back(temp_node);
+		reputation_node_id.add(node_name);
 		
-		//load models solver and open reputation_fileS
-		iter->second->solver->load_caffe_model(ml_solver_proto);
-		iter->second->open_reputation_file(reputation_folder);
+		//load models solver, the nodes of the other shards only exist as peers
+		if (shard.is_local(temp_node->id)) iter->second->solver->load_caffe_model(ml_solver_proto, simulation_random::get_caffe_seed(temp_node->id, 0, random_purpose::model_initialization));
 		
 		//dataset mode
 		const std::string dataset_mode_str = single_node["dataset_mode"];
@@ -197,6 +253,10 @@ int main(int argc, char *argv[])
 		{
 			iter->second->model_generation_type = Ml::model_compress_type::normal;
 		}
+		else if (model_generation_type_str == "sparse")
+		{
+			iter->second->model_generation_type = Ml::model_compress_type::sparse_delta;
+		}
 		else
 		{
 			LOG(FATAL) << "unknown model_generation_type:" << model_generation_type_str;
@@ -256,146 +316,29 @@ int main(int argc, char *argv[])
 		}
 	}
 	
-	//load network topology configuration
-	/** network topology configuration
-	 * you can use fully_connect, average_degree-{degree}, 1->2, 1--2, the topology items' order in the configuration file determines the order of adding connections.
-	 * fully_connect: connect all nodes, and ignore all other topology items.
-	 * average_degree-: connect the network to reach the degree for all nodes. If there are previous added topology, average_degree will add connections
-	 * 					until reaching the degree and no duplicate connections.
-	 * 1->2: add 2 as the peer of 1.
-	 * 1--2: add 2 as the peer of 1 and 1 as the peer of 2.
-	 */
+	//load network topology configuration, the topology items are described in simulation_topology.hpp
 	{
-		const std::string fully_connect = "fully_connect";
-		const std::string average_degree = "average_degree-";
-		const std::string unidirectional_term = "->";
-		const std::string bilateral_term = "--";
-		
-		auto node_topology_json = config_json["node_topology"];
-		for (auto &topology_item : node_topology_json)
+		std::vector<std::string> node_names;
+		for (auto* single_node : node_by_id) node_names.push_back(single_node->name);
+		auto topology = load_topology_config(config_json["node_topology"], node_names, std::filesystem::path(config_file_path).parent_path());
+		for (sparse_topology::node_id id = 0; id < topology.node_count(); ++id)
 		{
-			const std::string topology_item_str = topology_item.get<std::string>();
-			auto average_degree_loc = topology_item_str.find(average_degree);
-			auto unidirectional_loc = topology_item_str.find(unidirectional_term);
-			auto bilateral_loc = topology_item_str.find(bilateral_term);
-			
-			auto check_duplicate_peer = [](const node<model_datatype> &target_node, const std::string &peer_name) -> bool
-			{
-				if (target_node.planned_peers.find(peer_name) == target_node.planned_peers.end())
-					return false;
-				else
-					return true;
-			};
-			
-			if (topology_item_str == fully_connect)
+			for (auto peer : topology.peers(id))
 			{
-				LOG(INFO) << "network topology is fully connect";
-				
-				for (auto&[node_name, node_inst] : node_container)
-				{
-					for (auto&[target_node_name, target_node_inst] : node_container)
-					{
-						if (node_name != target_node_name)
-						{
-							node_inst->planned_peers.emplace(target_node_inst->name, target_node_inst);
-						}
-					}
-				}
-				break;
-			}
-			else if (average_degree_loc != std::string::npos)
-			{
-				std::string degree_str = topology_item_str.substr(average_degree_loc + average_degree.length());
-				int degree = std::stoi(degree_str);
-				LOG(INFO) << "network topology is average degree: " << degree;
-				LOG_IF(FATAL, degree > node_container.size() - 1) << "degree > node_count - 1, impossible to reach such large degree";
-				
-				std::vector<std::string> node_name_list;
-				node_name_list.reserve(node_container.size());
-				for (const auto&[node_name, node_inst] : node_container)
-				{
-					node_name_list.push_back(node_name);
-				}
-				
-				std::random_device dev;
-				std::mt19937 rng(dev());
-				LOG(INFO) << "network topology average degree process begins";
-				for (auto&[target_node_name, target_node_inst] : node_container)
-				{
-					std::shuffle(std::begin(node_name_list), std::end(node_name_list), rng);
-					for (const std::string &connect_node_name : node_name_list)
-					{
-						//check average degree first to ensure there are already some connects.
-						if (target_node_inst->planned_peers.size() >= degree) break;
-						if (connect_node_name == target_node_name) continue; // connect_node == self
-						if (check_duplicate_peer((*target_node_inst), connect_node_name)) continue; // connection already exists
-						
-						auto &connect_node = node_container.at(connect_node_name);
-						target_node_inst->planned_peers.emplace(connect_node->name, connect_node);
-						LOG(INFO) << "network topology average degree process: " << target_node_inst->name << " -> " << connect_node->name;
-					}
-				}
-				LOG(INFO) << "network topology average degree process ends";
-			}
-			else if (unidirectional_loc != std::string::npos)
-			{
-				std::string lhs_node_str = topology_item_str.substr(0, unidirectional_loc);
-				std::string rhs_node_str = topology_item_str.substr(unidirectional_loc + unidirectional_term.length());
-				LOG(INFO) << "network topology: unidirectional connect " << lhs_node_str << " to " << rhs_node_str;
-				auto lhs_node_iter = node_container.find(lhs_node_str);
-				auto rhs_node_iter = node_container.find(rhs_node_str);
-				LOG_IF(FATAL, lhs_node_iter == node_container.end()) << lhs_node_str << " is not found in nodes, raw topology: " << topology_item_str;
-				LOG_IF(FATAL, rhs_node_iter == node_container.end()) << rhs_node_str << " is not found in nodes, raw topology: " << topology_item_str;
-				
-				if (check_duplicate_peer(*(lhs_node_iter->second), rhs_node_str))// connection already exists
-				{
-					LOG(WARNING) << rhs_node_str << " is already a peer of " << lhs_node_str;
-				}
-				else
-				{
-					auto &connect_node = node_container.at(rhs_node_str);
-					lhs_node_iter->second->planned_peers.emplace(connect_node->name, connect_node);
-				}
-			}
-			else if (bilateral_loc != std::string::npos)
-			{
-				std::string lhs_node_str = topology_item_str.substr(0, bilateral_loc);
-				std::string rhs_node_str = topology_item_str.substr(bilateral_loc + unidirectional_term.length());
-				LOG(INFO) << "network topology: bilateral connect " << lhs_node_str << " with " << rhs_node_str;
-				auto lhs_node_iter = node_container.find(lhs_node_str);
-				auto rhs_node_iter = node_container.find(rhs_node_str);
-				LOG_IF(FATAL, lhs_node_iter == node_container.end()) << lhs_node_str << " is not found in nodes, raw topology: " << topology_item_str;
-				LOG_IF(FATAL, rhs_node_iter == node_container.end()) << rhs_node_str << " is not found in nodes, raw topology: " << topology_item_str;
-				
-				if (check_duplicate_peer(*(lhs_node_iter->second), rhs_node_str))// connection already exists
-				{
-					LOG(WARNING) << rhs_node_str << " is already a peer of " << lhs_node_str;
-				}
-				else
-				{
-					auto &rhs_connected_node = node_container.at(rhs_node_str);
-					lhs_node_iter->second->planned_peers.emplace(rhs_connected_node->name, rhs_connected_node);
-				}
-				
-				if (check_duplicate_peer(*(rhs_node_iter->second), lhs_node_str))// connection already exists
-				{
-					LOG(WARNING) << lhs_node_str << " is already a peer of " << rhs_node_str;
-				}
-				else
-				{
-					auto &lhs_connected_node = node_container.at(lhs_node_str);
-					rhs_node_iter->second->planned_peers.emplace(lhs_connected_node->name, lhs_connected_node);
-				}
-			}
-			else
-			{
-				LOG(ERROR) << "unknown topology item: " << topology_item_str;
+				node_by_id[id]->planned_peers.emplace(node_by_id[peer]->name, node_by_id[peer]);
 			}
 		}
 	}
 	
+	//the nodes of this shard, all nodes if there is one shard
+	std::unordered_map<std::string, node<model_datatype> *> local_node_container;
+	for (auto* single_node : node_by_id)
+	{
+		if (shard.is_local(single_node->id)) local_node_container.emplace(single_node->name, single_node);
+	}
+	
 	//load node reputation
-	for (auto &target_node : node_container)
+	for (auto &target_node : local_node_container)
 	{
 		for (auto &reputation_node : node_container)
 		{
@@ -412,46 +355,79 @@ int main(int argc, char *argv[])
 	Ml::data_converter<model_datatype> test_dataset;
 	test_dataset.load_dataset_mnist(ml_test_dataset, ml_test_dataset_label);
 	
-	std::ofstream drop_rate(output_path / "drop_rate.txt", std::ios::binary);
-	std::mutex drop_rate_lock;
+	const int drop_rate_stream = result_output.define_text("drop_rate");
 	
-	//print reputation first line
-	for (auto &single_node : node_container)
+	//define reputation records, the columns are the other nodes in the configuration order, so a resumed simulation
+	//reuses the same columns; the rows are filled by column name
+	for (auto &single_node : local_node_container)
 	{
-		*single_node.second->reputation_output << "tick";
-		for (auto &reputation_item: single_node.second->reputation_map)
+		auto& columns = single_node.second->reputation_columns;
+		for (auto* reputation_node : node_by_id)
 		{
-			*single_node.second->reputation_output << "," << reputation_item.first;
+			if (reputation_node != single_node.second) columns.push_back(reputation_node->name);
 		}
-		*single_node.second->reputation_output << std::endl;
+		single_node.second->reputation_stream = result_output.define_table("reputation/" + single_node.second->name + "_reputation", columns);
 	}
 	
 
 	
-	//node vector container
+	//node vector container, the local nodes in the configuration order
 	std::vector<node<model_datatype>*> node_pointer_vector_container;
-	node_pointer_vector_container.reserve(node_container.size());
-	for (auto &single_node : node_container)
+	node_pointer_vector_container.reserve(local_node_container.size());
+	for (auto* single_node : node_by_id)
 	{
-		node_pointer_vector_container.push_back(single_node.second);
+		if (shard.is_local(single_node->id)) node_pointer_vector_container.push_back(single_node);
 	}
 	
 	//caffe solver for fedAvg process
-	size_t solver_for_testing_size = std::thread::hardware_concurrency();
+	size_t solver_for_testing_size = tmt::AvailableThreadCount();
 	auto* solver_for_testing = new Ml::MlCaffeModel<float, caffe::SGDSolver>[solver_for_testing_size];
 	for (int i = 0; i < solver_for_testing_size; ++i)
 	{
 		solver_for_testing[i].load_caffe_model(ml_solver_proto);
 	}
 	
+	//only the nodes with pending train or buffer events are visited in each tick
+	simulation_scheduler<model_datatype> scheduler(node_pointer_vector_container);
+	
+	//network between the nodes, disabled if the configuration file is older than the network model
+	simulation_network<model_datatype> network;
+	if (config_json.contains("network")) network.apply_config(config_json["network"]);
+	int network_stream = -1;
+	if (network.enabled()) network_stream = result_output.define_table("network", simulation_network<model_datatype>::statistics_columns());
+	
+	//sparse model updates, the nodes of model_generation_type "sparse" keep the (1 - filter_limit) largest changes of each layer
+	model_datatype sparse_delta_threshold = 0;
+	bool sparse_delta_error_feedback = true;
+	if (config_json.contains("sparse_delta"))
+	{
+		sparse_delta_threshold = config_json["sparse_delta"]["threshold"];
+		sparse_delta_error_feedback = config_json["sparse_delta"]["error_feedback"];
+	}
+	
 	//services
 	std::unordered_map<std::string, std::shared_ptr<service<model_datatype>>> services;
 	services.emplace("accuracy", new accuracy_record<model_datatype>());
 	services.emplace("weights_diff", new model_weights_record<model_datatype>());
+	services.emplace("weight_divergence", new weight_divergence_record<model_datatype>());
 	services.emplace("force_broadcast_average", new force_broadcast_model<model_datatype>());
 	services.emplace("peer_control_service", new peer_control_service<model_datatype>());
 	auto services_json = config_json["services"];
 	LOG_IF(FATAL, services_json.is_null()) << "services are not defined in configuration file";
+	if (shard.sharded())
+	{
+		//the services below change the models or peers of nodes in any shard, the others record the nodes of each shard
+		for (const std::string name : {"force_broadcast_average", "peer_control_service"})
+		{
+			LOG_IF(WARNING, services_json[name]["enable"] == true) << name << " is not supported with shards, it is disabled";
+			services_json[name]["enable"] = false;
+		}
+	}
+	for (auto& [name, service_instance]: services)
+	{
+		service_instance->set_result_output(&result_output);
+		service_instance->set_scheduler(&scheduler);
+	}
 	
 	//accuracy service
 	{
@@ -462,7 +438,7 @@ int main(int argc, char *argv[])
 		std::static_pointer_cast<accuracy_record<model_datatype>>(service_iter->second)->ml_test_batch_size = ml_test_batch_size;
 		
 		service_iter->second->apply_config(services_json["accuracy"]);
-		service_iter->second->init_service(output_path, node_container, node_pointer_vector_container);
+		service_iter->second->init_service(shard_output_path, local_node_container, node_pointer_vector_container);
 	}
 	
 	//weights record
@@ -470,7 +446,15 @@ int main(int argc, char *argv[])
 		auto service_iter = services.find("weights_diff");
 		
 		service_iter->second->apply_config(services_json["weights_diff"]);
-		service_iter->second->init_service(output_path, node_container, node_pointer_vector_container);
+		service_iter->second->init_service(shard_output_path, local_node_container, node_pointer_vector_container);
+	}
+	
+	//weight divergence, disabled if the configuration file is older than this service
+	{
+		auto service_iter = services.find("weight_divergence");
+		
+		if (services_json.contains("weight_divergence")) service_iter->second->apply_config(services_json["weight_divergence"]);
+		service_iter->second->init_service(shard_output_path, local_node_container, node_pointer_vector_container);
 	}
 	
 	//force_broadcast
@@ -478,7 +462,7 @@ int main(int argc, char *argv[])
 		auto service_iter = services.find("force_broadcast_average");
 		
 		service_iter->second->apply_config(services_json["force_broadcast_average"]);
-		service_iter->second->init_service(output_path, node_container, node_pointer_vector_container);
+		service_iter->second->init_service(shard_output_path, local_node_container, node_pointer_vector_container);
 	}
 	
 	//peer_control_service
@@ -491,7 +475,7 @@ int main(int argc, char *argv[])
 		std::static_pointer_cast<peer_control_service<model_datatype>>(service_iter->second)->ml_dataset_all_possible_labels = &ml_dataset_all_possible_labels;
 		
 		service_iter->second->apply_config(services_json["peer_control_service"]);
-		service_iter->second->init_service(output_path, node_container, node_pointer_vector_container);
+		service_iter->second->init_service(shard_output_path, local_node_container, node_pointer_vector_container);
 	}
 	
 	////////////  BEGIN SIMULATION  ////////////
@@ -499,17 +483,29 @@ int main(int argc, char *argv[])
 		auto last_time_point = std::chrono::system_clock::now();
 		
 		int tick = 0;
+		if (resume_manifest)
+		{
+			tick = checkpoint.restore(*resume_manifest, node_pointer_vector_container, node_container, services) + 1;
+			network.load_state(resume_manifest->network_state, resume_manifest->network_state_version);
+			LOG_IF(FATAL, shard.agree_min(tick) != tick || -shard.agree_min(-tick) != tick) << "the checkpoints of the shards are at different ticks";
+			LOG(INFO) << "resume simulation from tick " << tick;
+		}
+		scheduler.reset(tick);
+		int last_report_tick = tick;
+		
 		while (tick <= ml_max_tick)
 		{
 			std::cout << "tick: " << tick << " (" << ml_max_tick << ")" << std::endl;
 			LOG(INFO) << "tick: " << tick << " (" << ml_max_tick << ")";
 			
-			if (tick != 0 && tick % report_time_remaining_per_tick_elapsed == 0)
+			//ticks without events are skipped, so report by the elapsed ticks
+			if (tick - last_report_tick >= report_time_remaining_per_tick_elapsed)
 			{
 				auto now = std::chrono::system_clock::now();
 				std::chrono::duration<float, std::milli> time_elapsed_ms = now - last_time_point;
 				last_time_point = now;
-				float speed_ms_per_tick = time_elapsed_ms.count() / float(report_time_remaining_per_tick_elapsed);
+				float speed_ms_per_tick = time_elapsed_ms.count() / float(tick - last_report_tick);
+				last_report_tick = tick;
 				std::chrono::milliseconds time_remain_ms(int(float(ml_max_tick - tick) * speed_ms_per_tick));
 				std::time_t est_finish_time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now() + time_remain_ms);
 				std::tm est_finish_time_tm = *std::localtime(&est_finish_time);
@@ -519,16 +515,21 @@ int main(int argc, char *argv[])
 			bool exit = false;
 			
 			//train the model
-			tmt::ParallelExecution_StepIncremental([&drop_rate_lock, &drop_rate, &tick, &train_dataset, &ml_train_batch_size, &ml_dataset_all_possible_labels](uint32_t index, uint32_t thread_index, node<model_datatype>* single_node){
+			auto train_nodes = scheduler.pop_train_nodes(tick);
+			tmt::ParallelExecution_StepIncremental([&result_output, &drop_rate_stream, &scheduler, &network, &shard, &sparse_delta_threshold, &sparse_delta_error_feedback, &tick, &train_dataset, &ml_train_batch_size, &ml_dataset_all_possible_labels](uint32_t index, uint32_t thread_index, node<model_datatype>* single_node){
 				if (tick >= single_node->next_train_tick)
 				{
 					std::vector<Ml::tensor_blob_like<model_datatype>> train_data, train_label;
-					std::tie(train_data, train_label) = get_dataset_by_node_type(train_dataset, *single_node, ml_train_batch_size, ml_dataset_all_possible_labels);
+					auto dataset_rng = simulation_random::get(single_node->id, tick, random_purpose::train_dataset);
+					std::tie(train_data, train_label) = get_dataset_by_node_type(train_dataset, *single_node, ml_train_batch_size, ml_dataset_all_possible_labels, dataset_rng);
 					
-					std::random_device dev;
-					std::mt19937 rng(dev());
+					auto interval_rng = simulation_random::get(single_node->id, tick, random_purpose::training_interval);
 					std::uniform_int_distribution<int> distribution(0, int(single_node->training_interval_tick.size()) - 1);
-					single_node->next_train_tick += single_node->training_interval_tick[distribution(rng)];
+					single_node->next_train_tick += single_node->training_interval_tick[distribution(interval_rng)];
+					
+					//the caffe random generator is per thread, reseed it so the training does not depend on the thread
+					caffe::Caffe::set_random_seed(simulation_random::get_caffe_seed(single_node->id, tick));
+					single_node->rng = simulation_random::get(single_node->id, tick, random_purpose::node_behavior);
 					
 					auto parameter_before = single_node->solver->get_parameter();
 					single_node->train_model(train_data, train_label, true);
@@ -542,6 +543,8 @@ int main(int argc, char *argv[])
 					auto parameter_output = parameter_after;
 					
 					Ml::model_compress_type type;
+					size_t model_size_byte;
+					std::string sparse_update; //the wire format of a sparse model, it is applied by the receivers when they aggregate
 					if (single_node->model_generation_type == Ml::model_compress_type::compressed_by_diff)
 					{
 						//drop models
@@ -549,93 +552,251 @@ int main(int argc, char *argv[])
 						auto compressed_model = Ml::model_compress::compress_by_diff_get_model(parameter_before, parameter_after, single_node->filter_limit, &total_weight, &dropped_count);
 						std::string compress_model_str = Ml::model_compress::compress_by_diff_lz_compress(compressed_model);
 						{
-							std::lock_guard guard(drop_rate_lock);
+							std::stringstream drop_rate;
 							drop_rate << "node:" << single_node->name << "    tick:" << tick << "    drop:" << ((float) dropped_count) / float(total_weight) << "(" << dropped_count << "/" << total_weight << ")"
-							          << "    compressed_size:" << compress_model_str.size() << std::endl;
+							          << "    compressed_size:" << compress_model_str.size();
+							result_output.append_text(drop_rate_stream, tick, drop_rate.str());
 						}
 						parameter_output = compressed_model;
 						type = Ml::model_compress_type::compressed_by_diff;
+						model_size_byte = compress_model_str.size();
+					}
+					else if (single_node->model_generation_type == Ml::model_compress_type::sparse_delta)
+					{
+						size_t total_weight = 0, kept_count = 0;
+						sparse_update = Ml::model_compress::compress_by_sparse_delta(parameter_before, parameter_after, 1.0f - single_node->filter_limit, sparse_delta_threshold, sparse_delta_error_feedback ? &single_node->sparse_residual : nullptr, &total_weight, &kept_count);
+						{
+							const size_t dropped_count = total_weight - kept_count;
+							std::stringstream drop_rate;
+							drop_rate << "node:" << single_node->name << "    tick:" << tick << "    drop:" << ((float) dropped_count) / float(total_weight) << "(" << dropped_count << "/" << total_weight << ")"
+							          << "    compressed_size:" << sparse_update.size();
+							result_output.append_text(drop_rate_stream, tick, drop_rate.str());
+						}
+						parameter_output = {};
+						type = Ml::model_compress_type::sparse_delta;
+						model_size_byte = sparse_update.size();
 					}
 					else
 					{
 						type = Ml::model_compress_type::normal;
+						model_size_byte = parameter_output.size() * sizeof(model_datatype);
 					}
 					
 					//add ML network to FedAvg buffer
+					std::map<uint32_t, std::vector<std::tuple<std::string, int>>> remote_receivers; //target shard -> (receiver, arrival tick)
 					for (auto [updating_node_name, updating_node] : single_node->peers)
 					{
+						const uint32_t target_shard = shard.shard_of(updating_node->id);
+						if (target_shard != shard.index())
+						{
+							int arrival_tick = -1; //-1: into the buffer in this tick
+							if (network.enabled())
+							{
+								auto scheduled_tick = network.schedule(tick, *single_node, *updating_node, model_size_byte);
+								if (!scheduled_tick) continue;
+								arrival_tick = *scheduled_tick;
+							}
+							remote_receivers[target_shard].emplace_back(updating_node->name, arrival_tick);
+							continue;
+						}
+						if (network.enabled())
+						{
+							network.send(tick, *single_node, *updating_node, {single_node->name, type, parameter_output, sparse_update}, model_size_byte);
+							continue;
+						}
 						std::lock_guard guard(updating_node->parameter_buffer_lock);
-						updating_node->parameter_buffer.emplace_back(single_node->name, type, parameter_output);
+						updating_node->parameter_buffer.emplace_back(single_node->name, type, parameter_output, sparse_update);
+						scheduler.notify_buffer_changed(updating_node);
+					}
+					
+					//one message per target shard with the model once, the receiving shard fans it out to the receivers
+					if (!remote_receivers.empty())
+					{
+						//a sparse model is sent in its wire format
+						const Ml::model_compress_type payload_type = type;
+						const std::string model_payload = type == Ml::model_compress_type::sparse_delta ? sparse_update : Ml::model_container<model_datatype>::write(parameter_output);
+						for (auto& [target_shard, receivers] : remote_receivers)
+						{
+							std::tuple<std::vector<std::tuple<std::string, int>>, std::string, Ml::model_compress_type, std::string> shard_message{std::move(receivers), single_node->name, payload_type, model_payload};
+							shard.send(target_shard, serialize_wrap<boost::archive::binary_oarchive>(shard_message).str());
+						}
 					}
 				}
-			}, node_pointer_vector_container.size(), node_pointer_vector_container.data());
+			}, train_nodes.size(), train_nodes.data());
 			
-			//check fedavg buffer full
-			tmt::ParallelExecution_StepIncremental([&tick,&test_dataset,&ml_test_batch_size,&ml_dataset_all_possible_labels,&solver_for_testing](uint32_t index, uint32_t thread_index, node<model_datatype>* single_node){
-				if (single_node->parameter_buffer.size() >= single_node->buffer_size)
+			//the models from the other shards, all shards exchange in every tick
+			for (auto& payload : shard.exchange())
+			{
+				auto [receivers, sender_name, payload_type, model_payload] = deserialize_wrap<boost::archive::binary_iarchive, std::tuple<std::vector<std::tuple<std::string, int>>, std::string, Ml::model_compress_type, std::string>>(payload);
+				std::optional<Ml::caffe_parameter_net<model_datatype>> model; //decoded once, the copies for the receivers share the blobs
+				if (payload_type != Ml::model_compress_type::sparse_delta)
+				{
+					//the shards are on the same host, the checksum is skipped
+					auto view = Ml::model_container_view<model_datatype>::open(model_payload, false);
+					LOG_IF(FATAL, !view) << "corrupted model from shard, sender: " << sender_name;
+					model = view->to_net();
+				}
+				for (auto& [receiver_name, arrival_tick] : receivers)
 				{
-					//update model
-					auto parameter = single_node->solver->get_parameter();
-					std::vector<updated_model<model_datatype>> received_models;
-					received_models.resize(single_node->parameter_buffer.size());
-					for (int i = 0; i < received_models.size(); ++i)
+					auto* receiver = node_container.at(receiver_name);
+					typename simulation_network<model_datatype>::model_message message;
+					if (model) message = {sender_name, payload_type, *model, ""};
+					else message = {sender_name, payload_type, {}, model_payload};
+					if (arrival_tick >= 0)
 					{
-						auto[node_name, type, model] = single_node->parameter_buffer[i];
-						received_models[i].model_parameter = model;
-						received_models[i].type = type;
-						received_models[i].generator_address = node_name;
-						received_models[i].accuracy = 0;
+						network.push(arrival_tick, receiver_name, std::move(message));
+						continue;
 					}
+					std::lock_guard guard(receiver->parameter_buffer_lock);
+					receiver->parameter_buffer.emplace_back(std::move(message));
+					scheduler.notify_buffer_changed(receiver);
+				}
+			}
+			
+			//the models arrived in this tick, including the ones sent in this tick without latency
+			if (network.enabled())
+			{
+				network.deliver(tick, [&scheduler](const std::string& receiver_name, typename simulation_network<model_datatype>::model_message&& message)
+				{
+					auto* receiver = node_container.at(receiver_name);
+					std::lock_guard guard(receiver->parameter_buffer_lock);
+					receiver->parameter_buffer.emplace_back(std::move(message));
+					scheduler.notify_buffer_changed(receiver);
+				});
+				result_output.append_row(network_stream, tick, network.pop_statistics());
+			}
+			
+			//check fedavg buffer full, the nodes with full buffers are updated by one reputation call
+			struct buffer_update
+			{
+				node<model_datatype>* updating_node = nullptr;
+				Ml::caffe_parameter_net<model_datatype> parameter;
+				std::vector<double> reputation;
+				std::vector<Ml::caffe_parameter_net<model_datatype>> sparse_models; //the sparse_delta models applied to parameter
+				reputation_round<model_datatype> round;
+			};
+			auto buffer_nodes = scheduler.pop_buffer_nodes();
+			std::vector<buffer_update> updates(buffer_nodes.size());
+			tmt::ParallelExecution_StepIncremental([&tick,&test_dataset,&ml_test_batch_size,&ml_dataset_all_possible_labels,&solver_for_testing,&solver_for_testing_size](uint32_t index, uint32_t thread_index, node<model_datatype>* single_node, buffer_update& update){
+				if (single_node->parameter_buffer.size() >= single_node->buffer_size)
+				{
+					//the models are inserted by the train threads in any order, sort them by sender to get a reproducible order
+					std::stable_sort(single_node->parameter_buffer.begin(), single_node->parameter_buffer.end(), [](const auto& lhs, const auto& rhs){
+						return std::get<0>(lhs) < std::get<0>(rhs);
+					});
+					
+					update.updating_node = single_node;
+					update.parameter = single_node->solver->get_parameter();
+					const auto& parameter = update.parameter;
+					const auto& buffer = single_node->parameter_buffer;
+					auto& round = update.round;
+					auto& sparse_models = update.sparse_models;
+					round.accuracies.resize(buffer.size());
+					sparse_models.resize(buffer.size());
+					
+					//all models are evaluated on the test set of this tick, the test set is drawn only if a result is not cached
+					const uint64_t test_set_id = get_test_set_id(*single_node, tick);
+					auto evaluate = [&single_node, &test_dataset, &ml_test_batch_size, &ml_dataset_all_possible_labels, &tick](auto& solver)
+					{
+						auto[test_data, test_label] = get_test_dataset(test_dataset, *single_node, tick, ml_test_batch_size, ml_dataset_all_possible_labels);
+						auto[accuracy, loss] = solver.evaluation_with_loss(test_data, test_label);
+						return typename Ml::evaluation_cache<model_datatype>::result{accuracy, loss};
+					};
 					
 					float self_accuracy = 0;
-					std::thread self_accuracy_thread([&single_node, &test_dataset, &ml_test_batch_size, &self_accuracy, &ml_dataset_all_possible_labels]()
+					std::thread self_accuracy_thread([&single_node, &self_accuracy, &parameter, &evaluate, test_set_id]()
 					                                 {
-						                                 //auto [test_data, test_label] = test_dataset.get_random_data(ml_test_batch_size);
-						                                 auto[test_data, test_label] = get_dataset_by_node_type(test_dataset, *single_node, ml_test_batch_size, ml_dataset_all_possible_labels);
-						                                 self_accuracy = single_node->solver->evaluation(test_data, test_label);
+						                                 self_accuracy = model_evaluation_cache.get_or_evaluate(parameter, test_set_id, [&](){ return evaluate(*single_node->solver); }).accuracy;
 					                                 });
-					size_t worker = received_models.size() > std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : received_models.size();
-					auto_multi_thread::ParallelExecution_with_thread_index(worker, [parameter, &single_node, &solver_for_testing, &test_dataset, &ml_test_batch_size, &ml_dataset_all_possible_labels](uint32_t index, uint32_t thread_index, updated_model<model_datatype> &model)
+					size_t worker = std::min<size_t>(buffer.size(), solver_for_testing_size);
+					std::vector<size_t> model_indexes(buffer.size());
+					std::iota(model_indexes.begin(), model_indexes.end(), 0);
+					auto_multi_thread::ParallelExecution_with_thread_index(worker, [&parameter, &buffer, &round, &sparse_models, &solver_for_testing, &evaluate, test_set_id](uint32_t index, uint32_t thread_index, size_t &model_index)
 					{
+						const auto& [node_name, type, model, sparse_update] = buffer[model_index];
 						auto output_model = parameter;
-						if (model.type == Ml::model_compress_type::compressed_by_diff)
+						if (type == Ml::model_compress_type::compressed_by_diff)
 						{
-							output_model.patch_weight(model.model_parameter);
+							output_model.patch_weight(model);
 						}
-						else if (model.type == Ml::model_compress_type::normal)
+						else if (type == Ml::model_compress_type::sparse_delta)
 						{
-							output_model = model.model_parameter;
+							//only the kept weights are visited, the layers they touch are copied on write
+							CHECK(Ml::model_compress::decompress_by_sparse_delta(output_model, sparse_update)) << "malformed sparse update from " << node_name;
+							sparse_models[model_index] = output_model;
+						}
+						else if (type == Ml::model_compress_type::normal)
+						{
+							output_model = model;
 						}
 						else
 						{
 							LOG(FATAL) << "unknown model type";
 						}
-						solver_for_testing[thread_index].set_parameter(output_model);
-						auto[test_data, test_label] = get_dataset_by_node_type(test_dataset, *single_node, ml_test_batch_size, ml_dataset_all_possible_labels);
-						model.accuracy = solver_for_testing[thread_index].evaluation(test_data, test_label);
-					}, received_models.size(), received_models.data());
+						round.accuracies[model_index] = model_evaluation_cache.get_or_evaluate(output_model, test_set_id, [&]()
+						{
+							solver_for_testing[thread_index].set_parameter(output_model);
+							return evaluate(solver_for_testing[thread_index]);
+						}).accuracy;
+					}, model_indexes.size(), model_indexes.data());
 					self_accuracy_thread.join();
+					
+					//the round views the models in the buffer, a sparse model is given to the plugin as the applied model
+					round.models = Ml::robust_aggregation<model_datatype>::flatten(buffer.size(), [&buffer, &sparse_models](size_t index) -> const Ml::caffe_parameter_net<model_datatype>&
+					{
+						return std::get<1>(buffer[index]) == Ml::model_compress_type::sparse_delta ? sparse_models[index] : std::get<2>(buffer[index]);
+					});
+					for (const auto& [node_name, type, model, sparse_update] : buffer)
+					{
+						round.types.push_back(type == Ml::model_compress_type::sparse_delta ? Ml::model_compress_type::normal : type);
+						round.generators.push_back(*reputation_node_id.find(node_name));
+					}
 					single_node->last_measured_accuracy = self_accuracy;
 					single_node->last_measured_tick = tick;
 					std::string log_msg = (boost::format("tick: %1%, node: %2%, accuracy: %3%") % tick % single_node->name % self_accuracy).str();
 					std::cout << log_msg << std::endl;
 					LOG(INFO) << log_msg;
-					auto &reputation_map = single_node->reputation_map;
-					reputation_dll.get()->update_model(parameter, self_accuracy, received_models, reputation_map);
-					single_node->solver->set_parameter(parameter);
-					
-					//print reputation map
-					*single_node->reputation_output << tick;
-					for (const auto &reputation_pair : reputation_map)
-					{
-						*single_node->reputation_output << "," << reputation_pair.second;
-					}
-					*single_node->reputation_output << std::endl;
 					
-					//clear buffer and start new loop
-					single_node->parameter_buffer.clear();
+					reputation_node_id.to_array(single_node->reputation_map, update.reputation);
+					round.current_model = &update.parameter;
+					round.self_accuracy = self_accuracy;
+					round.reputation = update.reputation.data();
+					round.node_count = reputation_node_id.size();
+					round.node_names = &reputation_node_id.names();
+				}
+			}, buffer_nodes.size(), buffer_nodes.data(), updates.data());
+			
+			//the rounds point to the parameters and reputation in updates, which is not resized from here
+			std::vector<buffer_update*> updated;
+			std::vector<reputation_round<model_datatype>> rounds;
+			for (auto& update : updates)
+			{
+				if (update.updating_node == nullptr) continue;
+				updated.push_back(&update);
+				rounds.push_back(std::move(update.round));
+			}
+			if (!rounds.empty()) reputation_dll.update_models(rounds.data(), rounds.size());
+			
+			tmt::ParallelExecution_StepIncremental([&tick,&result_output](uint32_t index, uint32_t thread_index, buffer_update* update){
+				auto* single_node = update->updating_node;
+				auto &reputation_map = single_node->reputation_map;
+				reputation_node_id.to_map(update->reputation, reputation_map);
+				single_node->solver->set_parameter(update->parameter);
+				
+				//record reputation map, NaN for the nodes without reputation
+				std::vector<float> reputation_row;
+				reputation_row.reserve(single_node->reputation_columns.size());
+				for (const auto &column : single_node->reputation_columns)
+				{
+					auto iter = reputation_map.find(column);
+					reputation_row.push_back(iter == reputation_map.end() ? NAN : float(iter->second));
 				}
-			}, node_pointer_vector_container.size(), node_pointer_vector_container.data());
+				result_output.append_row(single_node->reputation_stream, tick, reputation_row);
+				
+				//clear buffer and start new loop, the round views it until here
+				single_node->parameter_buffer.clear();
+			}, updated.size(), updated.data());
+			scheduler.finish_tick(tick);
 			
 			//services
 			for (auto& [name, service_instance]: services)
@@ -643,8 +804,25 @@ int main(int argc, char *argv[])
 				service_instance->process_per_tick(tick);
 			}
 			
-			tick++;
+			//one record batch per tick
+			result_output.commit();
+			
+			if (checkpoint_interval_tick > 0 && tick % checkpoint_interval_tick == 0 && tick != 0)
+			{
+				checkpoint.save(tick, result_output.flush(), node_pointer_vector_container, services, network.save_state());
+			}
+			
 			if (exit) break;
+			
+			//jump to the next tick with any event
+			int next_tick = scheduler.next_event_tick(tick);
+			for (auto& [name, service_instance]: services)
+			{
+				next_tick = std::min(next_tick, service_instance->next_active_tick(tick + 1));
+			}
+			next_tick = std::min(next_tick, network.next_arrival_tick());
+			if (checkpoint_interval_tick > 0) next_tick = std::min(next_tick, next_multiple_tick(tick + 1, checkpoint_interval_tick));
+			tick = shard.agree_min(next_tick);
 		}
 	}
 	
@@ -664,74 +842,37 @@ int main(int argc, char *argv[])
 		auto whole_train = train_dataset.get_whole_dataset();
 		auto whole_test = test_dataset.get_whole_dataset();
 		
-		std::vector<std::vector<Ml::tensor_blob_like<model_datatype>>> network_output_train; // 0: node index, 1: data index
-		std::vector<std::vector<Ml::tensor_blob_like<model_datatype>>> network_output_test; // 0: node index, 1: data index
-		network_output_train.resize(node_pointer_vector_container.size());
-		for (int i = 0; i < network_output_train.size(); ++i)
+		//ensemble prediction of all nodes, streamed in chunks
+		auto log_accuracy = [](const std::string& title, const std::vector<Ml::tensor_blob_like<model_datatype>>& real_y, const std::vector<Ml::tensor_blob_like<model_datatype>>& predict_y)
 		{
-			network_output_train[i].resize(std::get<0>(whole_train).size());
-		}
-		network_output_test.resize(node_pointer_vector_container.size());
-		for (int i = 0; i < network_output_test.size(); ++i)
-		{
-			network_output_test[i].resize(std::get<0>(whole_test).size());
-		}
-		tmt::ParallelExecution_StepIncremental([&whole_train, &whole_test, &network_output_test, &network_output_train](uint32_t index, uint32_t thread_index, node<model_datatype>* single_node){
-			{
-				std::vector<Ml::tensor_blob_like<model_datatype>> whole_train_x = std::get<0>(whole_train);
-				std::vector<Ml::tensor_blob_like<model_datatype>> predict_train_y = single_node->solver->predict(whole_train_x);
-				network_output_train[index] = predict_train_y;
-			}
-			{
-				std::vector<Ml::tensor_blob_like<model_datatype>> whole_test_x = std::get<0>(whole_test);
-				std::vector<Ml::tensor_blob_like<model_datatype>> predict_test_y = single_node->solver->predict(whole_test_x);
-				network_output_test[index] = predict_test_y;
-			}
-		}, node_pointer_vector_container.size(), node_pointer_vector_container.data());
-		
-		std::vector<Ml::tensor_blob_like<model_datatype>> network_prob_train, network_prob_test;
-		network_prob_train = network_output_train[0];
-		network_prob_test = network_output_test[0];
-		for (int node_index = 1; node_index < network_output_train.size(); ++node_index) // starts from 1 because index 0 is the inital value
-		{
-			for (int sample_index = 0; sample_index < network_output_train[0].size(); ++sample_index)
-			{
-				network_prob_train[sample_index] = network_prob_train[sample_index] + network_output_train[node_index][sample_index];
-			}
-		}
-		for (int node_index = 1; node_index < network_output_test.size(); ++node_index) // starts from 1 because index 0 is the inital value
-		{
-			for (int sample_index = 0; sample_index < network_output_test[0].size(); ++sample_index)
-			{
-				network_prob_test[sample_index] = network_prob_test[sample_index] + network_output_test[node_index][sample_index];
-			}
-		}
-		
-		//find the largest value
-		{
-			auto predict_y_train = Ml::MlModel<model_datatype>::get_labels_from_probability(network_prob_train);
-			const std::vector<Ml::tensor_blob_like<model_datatype>>& whole_train_y = std::get<1>(whole_train);
-			int correct_count = Ml::MlModel<model_datatype>::count_correct_based_on_prediction(whole_train_y, predict_y_train);
+			int correct_count = Ml::MlModel<model_datatype>::count_correct_based_on_prediction(real_y, predict_y);
 			std::stringstream log_msg;
-			log_msg << "whole train dataset, total:" << whole_train_y.size() << "  correct:" << correct_count << "  accuracy:" << float(correct_count) / whole_train_y.size();
+			log_msg << title << ", total:" << real_y.size() << "  correct:" << correct_count << "  accuracy:" << float(correct_count) / real_y.size();
 			std::cout << log_msg.str() << std::endl;
 			LOG(INFO) << log_msg.str();
-		}
+		};
+		auto report_ensemble = [&node_pointer_vector_container, &log_accuracy, &shard](const std::string& dataset_name, const std::vector<Ml::tensor_blob_like<model_datatype>>& whole_x, const std::vector<Ml::tensor_blob_like<model_datatype>>& whole_y)
 		{
-			auto predict_y_test = Ml::MlModel<model_datatype>::get_labels_from_probability(network_prob_test);
-			const std::vector<Ml::tensor_blob_like<model_datatype>>& whole_test_y = std::get<1>(whole_test);
-			int correct_count = Ml::MlModel<model_datatype>::count_correct_based_on_prediction(whole_test_y, predict_y_test);
-			std::stringstream log_msg;
-			log_msg << "whole test dataset, total:" << whole_test_y.size() << "  correct:" << correct_count << "  accuracy:" << float(correct_count) / whole_test_y.size();
-			std::cout << log_msg.str() << std::endl;
-			LOG(INFO) << log_msg.str();
-		}
+			ensemble_evaluator<model_datatype> evaluator(whole_x);
+			evaluator.evaluate(node_pointer_vector_container);
+			
+			//the first shard reports the ensemble of all shards
+			if (shard.index() != 0) shard.send(0, evaluator.save_sums());
+			auto shard_sums = shard.exchange();
+			if (shard.index() != 0) return;
+			for (auto& sums : shard_sums) evaluator.merge_sums(sums);
+			log_accuracy("whole " + dataset_name + " dataset", whole_y, evaluator.predicted_labels_by_probability());
+			log_accuracy("whole " + dataset_name + " dataset (majority vote)", whole_y, evaluator.predicted_labels_by_vote());
+		};
+		report_ensemble("train", std::get<0>(whole_train), std::get<1>(whole_train));
+		report_ensemble("test", std::get<0>(whole_test), std::get<1>(whole_test));
 	}
 	
 	delete[] solver_for_testing;
 	
-	drop_rate.flush();
-	drop_rate.close();
+	result_output.close();
+	checkpoint.wait();
+	if (shard.index() == 0) shard.wait_children();
 	
 	return 0;
 }
@@ -3,6 +3,7 @@
 
 #include "rocksdb_api.hpp"
 #include "boost_serialization_wrapper.hpp"
+#include "chunk_compression.hpp"
 
 #include "../block.hpp"
 
@@ -49,6 +50,12 @@ int main(int argc, char* argv[])
 	for (auto [height, block_str]: block_container)
 	{
 		std::filesystem::path output_block_file_path = output_path / (std::to_string(height) + ".json");
+		if (chunk_compression::is_compressed(block_str))
+		{
+			auto content = chunk_compression::decompress(block_str);
+			CHECK(content) << "corrupted block at height " << height;
+			block_str = *content;
+		}
 		block target_block = deserialize_wrap<boost::archive::binary_iarchive, block>(block_str);
 		i_json_serialization::json output_json = target_block.to_json();
 		
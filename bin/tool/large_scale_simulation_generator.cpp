@@ -8,6 +8,7 @@
 #include <set>
 #include <glog/logging.h>
 #include <configure_file.hpp>
+#include <sparse_topology.hpp>
 
 configuration_file::json get_default_simulation_configuration()
 {
@@ -22,6 +23,8 @@ configuration_file::json get_default_simulation_configuration()
 	
 	output["node_peer_connection_count"] = 8;
 	output["node_peer_connection_type"] = "--";
+	output["node_topology_type"] = "random_regular"; //for "--" connections: random_regular, erdos_renyi, small_world, scale_free
+	output["small_world_rewiring_probability"] = 0.1;
 	configuration_file::json malicious_node;
 	malicious_node["malicious_random_strategy"] = 1;
 	malicious_node["malicious_strategy_1"] = 1;
@@ -48,6 +51,8 @@ int main(int argc, char* argv[])
 	float filter_limit = *my_config.get<float>("filter_limit");
 	int node_peer_connection_count = *my_config.get<int>("node_peer_connection_count");
 	std::string node_peer_connection_type = *my_config.get<std::string>("node_peer_connection_type");
+	std::string node_topology_type = *my_config.get<std::string>("node_topology_type");
+	double small_world_rewiring_probability = *my_config.get<double>("small_world_rewiring_probability");
 	auto special_node = my_config_json["special_node"];
 	std::cout << "node_count: " << node_count << std::endl;
 	std::cout << "buffer_size: " << buffer_size << std::endl;
@@ -55,6 +60,7 @@ int main(int argc, char* argv[])
 	std::cout << "model_generation_type: " << model_generation_type << std::endl;
 	std::cout << "filter_limit: " << filter_limit << std::endl;
 	std::cout << "node_peer_connection_count: " << node_peer_connection_count << std::endl;
+	std::cout << "node_topology_type: " << node_topology_type << std::endl;
 	
 	if (node_peer_connection_count % 2 != 0 && node_peer_connection_type == "--")
 	{
@@ -68,6 +74,12 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 	
+	if (node_topology_type != "random_regular" && node_topology_type != "erdos_renyi" && node_topology_type != "small_world" && node_topology_type != "scale_free")
+	{
+		std::cout << "unknown node_topology_type: " << node_topology_type << std::endl;
+		return -1;
+	}
+	
 	{
 		////set nodes
 		configuration_file config;
@@ -131,60 +143,39 @@ int main(int argc, char* argv[])
 		}
 		
 		////set node topology
-		std::vector<int> node_list_ex_self;
-		node_list_ex_self.resize(node_count-1);
-		for (int i = 0; i < node_list_ex_self.size(); ++i)
-		{
-			node_list_ex_self[i] = i;
-		}
-		std::vector<std::vector<int>> node_connections;
-		node_connections.resize(node_count);
+		//the topology is written to a binary edge list next to the configuration file, the node ids are the node names
 		std::random_device rd;
 		std::mt19937 g(rd());
-		for (int i = 0; i < node_count; ++i)
+		sparse_topology topology;
+		if (node_peer_connection_type == "->")
 		{
-			std::shuffle(node_list_ex_self.begin(), node_list_ex_self.end(), g);
-			int count = node_peer_connection_count;
-			auto iter = node_list_ex_self.begin();
-			while (count --)
-			{
-				node_connections[i].push_back(*iter);
-				iter++;
-			}
-			
-			for (auto &peer : node_connections[i])
-			{
-				if (peer >= i)
-				{
-					peer++;
-				}
-			}
+			topology = sparse_topology::random_out_degree(node_count, node_peer_connection_count, g);
+		}
+		else if (node_topology_type == "random_regular")
+		{
+			topology = sparse_topology::random_regular(node_count, node_peer_connection_count, g);
+		}
+		else if (node_topology_type == "erdos_renyi")
+		{
+			topology = sparse_topology::erdos_renyi(node_count, node_peer_connection_count, g);
+		}
+		else if (node_topology_type == "small_world")
+		{
+			topology = sparse_topology::small_world(node_count, node_peer_connection_count, small_world_rewiring_probability, g);
 		}
+		else if (node_topology_type == "scale_free")
+		{
+			//each new node adds {count/2} bilateral connections, so the average degree is close to {count}
+			topology = sparse_topology::scale_free(node_count, node_peer_connection_count / 2, g);
+		}
+		
+		const std::string edge_list_file_name = "topology.bin";
+		topology.save_edge_list(config_file_path.parent_path() / edge_list_file_name);
+		std::cout << "topology: " << topology.edge_count() << " connections are written to " << (config_file_path.parent_path() / edge_list_file_name) << std::endl;
 		
 		auto& node_topology_json = config_json["node_topology"];
 		node_topology_json.clear();
-		for (int i = 0; i < node_count; ++i)
-		{
-			std::cout << std::to_string(i) << node_peer_connection_type << "{";
-			if (node_peer_connection_type == "--")
-			{
-				for (int j = 0; j < node_peer_connection_count/2; ++j)
-				{
-					std::cout << std::to_string(node_connections[i][j]) << ", ";
-					node_topology_json.push_back(std::to_string(i) + node_peer_connection_type + std::to_string(node_connections[i][j]));
-				}
-			}
-			else
-			{
-				for (int j = 0; j < node_peer_connection_count; ++j)
-				{
-					std::cout << std::to_string(node_connections[i][j]) << ", ";
-					node_topology_json.push_back(std::to_string(i) + node_peer_connection_type + std::to_string(node_connections[i][j]));
-				}
-			}
-			std::cout << "}" << std::endl;
-
-		}
+		node_topology_json.push_back("edge_list-" + edge_list_file_name);
 		
 		config_json["ml_delayed_test_accuracy"] = false;
 		
@@ -0,0 +1,33 @@
+#include <filesystem>
+#include <iostream>
+#include <fstream>
+
+#include "../simulation/simulation_output.hpp"
+
+// convert simulation_result.bin to the csv/txt files written by the old simulator, run in the simulation output folder
+// usage: simulation_result_to_csv [simulation_result.bin]
+int main(int argc, char *argv[])
+{
+	auto current_path = std::filesystem::current_path();
+	std::filesystem::path result_path = argc > 1 ? std::filesystem::path(argv[1]) : current_path / "simulation_result.bin";
+	if (!std::filesystem::exists(result_path))
+	{
+		std::cout << result_path.string() << " does not exist" << std::endl;
+		return -1;
+	}
+	auto output_folder = result_path.parent_path();
+	
+	simulation_output_reader reader(result_path);
+	const auto& streams = reader.get_streams();
+	for (int stream_id = 0; stream_id < streams.size(); ++stream_id)
+	{
+		const auto& stream = streams[stream_id];
+		std::filesystem::path output_file = output_folder / (stream.name + (stream.type == simulation_output::table_stream ? ".csv" : ".txt"));
+		std::filesystem::create_directories(output_file.parent_path());
+		std::ofstream output(output_file, std::ios::binary);
+		reader.write_stream(stream_id, output);
+		std::cout << "write " << output_file.string() << std::endl;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,462 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+#include <string_view>
+
+#include <lz4.h>
+#if DFL_USE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#include <glog/logging.h>
+#include <tmt.hpp>
+
+enum class compression_codec : uint8_t
+{
+	none = 0,
+	lz4, //level: the LZ4 acceleration, 1 is the default, higher is faster
+	zstd, //level: the zstd level, 1 to 19, requires DFL_USE_ZSTD
+
+	compression_codec_last_index
+};
+
+//applied to each chunk before the codec, for dense arrays of fixed size numbers such as float weights. Data with long
+//runs of equal values (the NaN of compressed_by_diff, the zero pixels of a sample) compresses better without a filter
+enum class compression_filter : uint8_t
+{
+	none = 0,
+	byte_shuffle, //the n-th byte of all elements together, the exponent bytes of floats are in long similar runs
+	bit_shuffle, //byte_shuffle, then the bits of every 8 bytes of a byte plane are transposed
+
+	compression_filter_last_index
+};
+
+/** a dictionary for small, similar payloads such as the model updates of consecutive rounds.
+ *  For zstd, the dictionary is trained from the samples; for LZ4 (or if the training fails) it is the last 64 KB of
+ *  the samples, LZ4 uses them as history. The compressed data stores the dictionary id, the same dictionary must be
+ *  passed to decompress.
+ */
+class compression_dictionary
+{
+public:
+	static constexpr size_t max_lz4_size = 64 * 1024;
+
+	compression_dictionary() : _id(0) {}
+
+	explicit compression_dictionary(std::string content) : _content(std::move(content)), _id(content_id(_content)) {}
+
+	static compression_dictionary train(const std::vector<std::string>& samples, compression_codec codec = compression_codec::lz4, size_t capacity = 112 * 1024)
+	{
+		std::string concatenated;
+		for (const auto& sample : samples) concatenated += sample;
+#if DFL_USE_ZSTD
+		if (codec == compression_codec::zstd)
+		{
+			std::vector<size_t> sample_sizes;
+			for (const auto& sample : samples) sample_sizes.push_back(sample.size());
+			std::string trained(capacity, '\0');
+			size_t trained_size = ZDICT_trainFromBuffer(trained.data(), trained.size(), concatenated.data(), sample_sizes.data(), unsigned(sample_sizes.size()));
+			if (!ZDICT_isError(trained_size))
+			{
+				trained.resize(trained_size);
+				return compression_dictionary(std::move(trained));
+			}
+			LOG(WARNING) << "[compression dictionary] training failed: " << ZDICT_getErrorName(trained_size) << ", the last samples are used";
+		}
+#endif
+		const size_t size = std::min({concatenated.size(), capacity, max_lz4_size});
+		return compression_dictionary(concatenated.substr(concatenated.size() - size));
+	}
+
+	const std::string& content() const
+	{
+		return _content;
+	}
+
+	uint32_t id() const
+	{
+		return _id;
+	}
+
+	bool empty() const
+	{
+		return _content.empty();
+	}
+
+private:
+	//FNV-1a, 0 is no dictionary
+	static uint32_t content_id(const std::string& content)
+	{
+		if (content.empty()) return 0;
+		uint32_t output = 2166136261u;
+		for (char c : content) output = (output ^ uint8_t(c)) * 16777619u;
+		return output == 0 ? 1 : output;
+	}
+
+	std::string _content;
+	uint32_t _id;
+};
+
+/** chunked compression for the models, blocks and dataset samples.
+ *  The input is split into chunks of {chunk_size} bytes which are filtered and compressed independently, on the tmt
+ *  threads if there are several chunks, so both directions scale with the cores and a corrupted chunk does not affect
+ *  the others. A chunk that does not compress is stored as is.
+ *
+ *  format: header | compressed size of each chunk (uint32, the top bit set if stored) | chunks
+ */
+class chunk_compression
+{
+public:
+	struct options
+	{
+		compression_codec codec = compression_codec::lz4;
+		int level = 1;
+		compression_filter filter = compression_filter::none;
+		uint8_t element_size = 4; //of the filter
+		uint32_t chunk_size = 256 * 1024;
+		const compression_dictionary* dictionary = nullptr;
+	};
+
+	static constexpr char magic[4] = {'D', 'F', 'L', 'Z'};
+	static constexpr uint8_t version = 1;
+
+	//below this size the chunks are compressed on the calling thread
+	static constexpr size_t parallel_threshold = 1024 * 1024;
+
+	//the largest output decompress() allocates by default, the header may come from a peer
+	static constexpr uint64_t default_max_raw_size = uint64_t(1) << 30;
+
+	static std::string compress(const char* data, size_t size, const options& option)
+	{
+		LOG_IF(FATAL, option.codec >= compression_codec::compression_codec_last_index || option.filter >= compression_filter::compression_filter_last_index) << "[chunk compression] invalid options";
+		LOG_IF(FATAL, option.element_size == 0 || option.chunk_size < option.element_size || option.chunk_size >= stored_flag) << "[chunk compression] invalid chunk or element size";
+#if !DFL_USE_ZSTD
+		LOG_IF(FATAL, option.codec == compression_codec::zstd) << "[chunk compression] zstd is not available, build with DFL_USE_ZSTD";
+#endif
+		//the chunks are whole elements, so the filters do not cross them
+		const uint32_t chunk_size = option.chunk_size / option.element_size * option.element_size;
+		const size_t chunk_count = (size + chunk_size - 1) / chunk_size;
+		LOG_IF(FATAL, chunk_count > UINT32_MAX) << "[chunk compression] too many chunks";
+		const std::string* dictionary = option.dictionary != nullptr && !option.dictionary->empty() ? &option.dictionary->content() : nullptr;
+
+		std::vector<std::string> chunks(chunk_count);
+		for_each_chunk(size, chunk_count, [&](size_t index)
+		{
+			const size_t begin = index * chunk_size;
+			const size_t chunk_raw_size = std::min<size_t>(chunk_size, size - begin);
+			chunks[index] = compress_chunk(data + begin, chunk_raw_size, option, dictionary);
+		});
+
+		header head{};
+		std::memcpy(head.magic, magic, sizeof(magic));
+		head.version = version;
+		head.codec = uint8_t(option.codec);
+		head.filter = uint8_t(option.filter);
+		head.element_size = option.element_size;
+		head.chunk_size = chunk_size;
+		head.dictionary_id = dictionary != nullptr ? option.dictionary->id() : 0;
+		head.raw_size = size;
+
+		size_t total_size = sizeof(head) + chunk_count * sizeof(uint32_t);
+		for (const auto& chunk : chunks) total_size += chunk.size() - sizeof(uint32_t);
+		std::string output;
+		output.reserve(total_size);
+		output.append(reinterpret_cast<const char*>(&head), sizeof(head));
+		for (const auto& chunk : chunks) output.append(chunk.data(), sizeof(uint32_t));
+		for (const auto& chunk : chunks) output.append(chunk.data() + sizeof(uint32_t), chunk.size() - sizeof(uint32_t));
+		return output;
+	}
+
+	static std::string compress(const std::string& data, const options& option)
+	{
+		return compress(data.data(), data.size(), option);
+	}
+
+	//nullopt if the data is corrupted, the output is larger than {max_raw_size}, or the codec or the dictionary is not available
+	static std::optional<std::string> decompress(const char* data, size_t size, const compression_dictionary* dictionary = nullptr, uint64_t max_raw_size = default_max_raw_size)
+	{
+		if (!is_compressed(data, size))
+		{
+			LOG(WARNING) << "[chunk compression] not chunk compressed data";
+			return std::nullopt;
+		}
+		header head;
+		std::memcpy(&head, data, sizeof(head));
+		if (head.version != version || head.codec >= uint8_t(compression_codec::compression_codec_last_index) || head.filter >= uint8_t(compression_filter::compression_filter_last_index) || head.element_size == 0 || head.chunk_size == 0 || head.chunk_size >= stored_flag)
+		{
+			LOG(WARNING) << "[chunk compression] unsupported version or options";
+			return std::nullopt;
+		}
+#if !DFL_USE_ZSTD
+		if (compression_codec(head.codec) == compression_codec::zstd)
+		{
+			LOG(WARNING) << "[chunk compression] zstd is not available, build with DFL_USE_ZSTD";
+			return std::nullopt;
+		}
+#endif
+		const std::string* dictionary_content = nullptr;
+		if (head.dictionary_id != 0)
+		{
+			if (dictionary == nullptr || dictionary->id() != head.dictionary_id)
+			{
+				LOG(WARNING) << "[chunk compression] the dictionary " << head.dictionary_id << " is required";
+				return std::nullopt;
+			}
+			dictionary_content = &dictionary->content();
+		}
+
+		//the raw size is checked before the output is allocated, the chunk count is rounded up without overflow
+		if (head.raw_size > max_raw_size)
+		{
+			LOG(WARNING) << "[chunk compression] the raw size " << head.raw_size << " exceeds the limit " << max_raw_size;
+			return std::nullopt;
+		}
+		const uint64_t chunk_count = head.raw_size / head.chunk_size + (head.raw_size % head.chunk_size != 0 ? 1 : 0);
+		if (chunk_count > (size - sizeof(head)) / sizeof(uint32_t) || head.raw_size > chunk_count * head.chunk_size)
+		{
+			LOG(WARNING) << "[chunk compression] truncated chunk table";
+			return std::nullopt;
+		}
+		std::vector<size_t> offsets(chunk_count + 1);
+		offsets[0] = sizeof(head) + chunk_count * sizeof(uint32_t);
+		for (size_t i = 0; i < chunk_count; ++i)
+		{
+			uint32_t chunk_entry;
+			std::memcpy(&chunk_entry, data + sizeof(head) + i * sizeof(uint32_t), sizeof(chunk_entry));
+			offsets[i + 1] = offsets[i] + (chunk_entry & ~stored_flag);
+		}
+		if (offsets[chunk_count] != size)
+		{
+			LOG(WARNING) << "[chunk compression] truncated chunks";
+			return std::nullopt;
+		}
+
+		options option;
+		option.codec = compression_codec(head.codec);
+		option.filter = compression_filter(head.filter);
+		option.element_size = head.element_size;
+		std::string output(head.raw_size, '\0');
+		std::vector<uint8_t> valid(chunk_count, 0);
+		for_each_chunk(head.raw_size, chunk_count, [&](size_t index)
+		{
+			uint32_t chunk_entry;
+			std::memcpy(&chunk_entry, data + sizeof(head) + index * sizeof(uint32_t), sizeof(chunk_entry));
+			const size_t begin = index * head.chunk_size;
+			const size_t chunk_raw_size = std::min<size_t>(head.chunk_size, head.raw_size - begin);
+			valid[index] = decompress_chunk(data + offsets[index], offsets[index + 1] - offsets[index], (chunk_entry & stored_flag) != 0, output.data() + begin, chunk_raw_size, option, dictionary_content);
+		});
+		if (std::find(valid.begin(), valid.end(), 0) != valid.end())
+		{
+			LOG(WARNING) << "[chunk compression] corrupted chunk";
+			return std::nullopt;
+		}
+		return output;
+	}
+
+	static std::optional<std::string> decompress(const std::string& data, const compression_dictionary* dictionary = nullptr, uint64_t max_raw_size = default_max_raw_size)
+	{
+		return decompress(data.data(), data.size(), dictionary, max_raw_size);
+	}
+
+	//whether {data} starts with the chunk compression header, to read the values written before it
+	static bool is_compressed(const char* data, size_t size)
+	{
+		return size >= sizeof(header) && std::memcmp(data, magic, sizeof(magic)) == 0;
+	}
+
+	static bool is_compressed(const std::string& data)
+	{
+		return is_compressed(data.data(), data.size());
+	}
+
+	static void shuffle(const char* input, char* output, size_t element_count, size_t element_size)
+	{
+		for (size_t i = 0; i < element_count; ++i)
+		{
+			for (size_t byte = 0; byte < element_size; ++byte) output[byte * element_count + i] = input[i * element_size + byte];
+		}
+	}
+
+	static void unshuffle(const char* input, char* output, size_t element_count, size_t element_size)
+	{
+		for (size_t i = 0; i < element_count; ++i)
+		{
+			for (size_t byte = 0; byte < element_size; ++byte) output[i * element_size + byte] = input[byte * element_count + i];
+		}
+	}
+
+	//transpose the 8x8 bit matrix of every 8 bytes, the remaining bytes are not changed. It is its own inverse
+	static void transpose_bits(char* data, size_t size)
+	{
+		for (size_t i = 0; i + 8 <= size; i += 8)
+		{
+			uint64_t x;
+			std::memcpy(&x, data + i, sizeof(x));
+			uint64_t t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+			x = x ^ t ^ (t << 7);
+			t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+			x = x ^ t ^ (t << 14);
+			t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+			x = x ^ t ^ (t << 28);
+			std::memcpy(data + i, &x, sizeof(x));
+		}
+	}
+
+private:
+	struct header
+	{
+		char magic[4];
+		uint8_t version;
+		uint8_t codec;
+		uint8_t filter;
+		uint8_t element_size;
+		uint32_t chunk_size;
+		uint32_t dictionary_id;
+		uint64_t raw_size;
+	};
+	static_assert(sizeof(header) == 24);
+
+	static constexpr uint32_t stored_flag = 0x80000000u;
+
+	template<typename Function>
+	static void for_each_chunk(size_t size, size_t chunk_count, Function function)
+	{
+		if (chunk_count <= 1 || size < parallel_threshold)
+		{
+			for (size_t i = 0; i < chunk_count; ++i) function(i);
+			return;
+		}
+		const uint32_t thread_count = std::min<uint32_t>(tmt::AvailableThreadCount(), uint32_t(chunk_count));
+		tmt::ParallelExecution(thread_count, [&function](uint32_t index, uint32_t thread_index)
+		{
+			function(index);
+		}, uint32_t(chunk_count));
+	}
+
+	//the chunk with its compressed size (uint32) in front, the top bit set if stored
+	static std::string compress_chunk(const char* data, size_t size, const options& option, const std::string* dictionary)
+	{
+		std::string filtered;
+		if (option.filter != compression_filter::none)
+		{
+			const size_t element_count = size / option.element_size;
+			filtered.resize(size);
+			shuffle(data, filtered.data(), element_count, option.element_size);
+			std::memcpy(filtered.data() + element_count * option.element_size, data + element_count * option.element_size, size - element_count * option.element_size);
+			if (option.filter == compression_filter::bit_shuffle)
+			{
+				for (size_t byte = 0; byte < option.element_size; ++byte) transpose_bits(filtered.data() + byte * element_count, element_count);
+			}
+			data = filtered.data();
+		}
+
+		std::string output(sizeof(uint32_t), '\0');
+		size_t compressed_size = 0;
+		if (option.codec == compression_codec::lz4)
+		{
+			output.resize(sizeof(uint32_t) + LZ4_compressBound(int(size)));
+			char* destination = output.data() + sizeof(uint32_t);
+			const int capacity = int(output.size() - sizeof(uint32_t));
+			int result;
+			if (dictionary != nullptr)
+			{
+				LZ4_stream_t* stream = LZ4_createStream();
+				LZ4_loadDict(stream, dictionary->data(), int(dictionary->size()));
+				result = LZ4_compress_fast_continue(stream, data, destination, int(size), capacity, std::max(option.level, 1));
+				LZ4_freeStream(stream);
+			}
+			else
+			{
+				result = LZ4_compress_fast(data, destination, int(size), capacity, std::max(option.level, 1));
+			}
+			compressed_size = result > 0 ? size_t(result) : size;
+		}
+#if DFL_USE_ZSTD
+		else if (option.codec == compression_codec::zstd)
+		{
+			output.resize(sizeof(uint32_t) + ZSTD_compressBound(size));
+			ZSTD_CCtx* context = ZSTD_createCCtx();
+			const size_t result = dictionary != nullptr
+			                      ? ZSTD_compress_usingDict(context, output.data() + sizeof(uint32_t), output.size() - sizeof(uint32_t), data, size, dictionary->data(), dictionary->size(), option.level)
+			                      : ZSTD_compressCCtx(context, output.data() + sizeof(uint32_t), output.size() - sizeof(uint32_t), data, size, option.level);
+			ZSTD_freeCCtx(context);
+			compressed_size = ZSTD_isError(result) ? size : result;
+		}
+#endif
+		else
+		{
+			compressed_size = size;
+		}
+
+		uint32_t chunk_entry = uint32_t(compressed_size);
+		if (compressed_size >= size)
+		{
+			output.resize(sizeof(uint32_t));
+			output.append(data, size);
+			chunk_entry = uint32_t(size) | stored_flag;
+		}
+		else
+		{
+			output.resize(sizeof(uint32_t) + compressed_size);
+		}
+		std::memcpy(output.data(), &chunk_entry, sizeof(chunk_entry));
+		return output;
+	}
+
+	static bool decompress_chunk(const char* data, size_t size, bool stored, char* output, size_t raw_size, const options& option, const std::string* dictionary)
+	{
+		std::string filtered;
+		char* destination = output;
+		if (option.filter != compression_filter::none)
+		{
+			filtered.resize(raw_size);
+			destination = filtered.data();
+		}
+
+		if (stored)
+		{
+			if (size != raw_size) return false;
+			std::memcpy(destination, data, size);
+		}
+		else if (option.codec == compression_codec::lz4)
+		{
+			const int result = dictionary != nullptr
+			                   ? LZ4_decompress_safe_usingDict(data, destination, int(size), int(raw_size), dictionary->data(), int(dictionary->size()))
+			                   : LZ4_decompress_safe(data, destination, int(size), int(raw_size));
+			if (result != int(raw_size)) return false;
+		}
+#if DFL_USE_ZSTD
+		else if (option.codec == compression_codec::zstd)
+		{
+			ZSTD_DCtx* context = ZSTD_createDCtx();
+			const size_t result = dictionary != nullptr
+			                      ? ZSTD_decompress_usingDict(context, destination, raw_size, data, size, dictionary->data(), dictionary->size())
+			                      : ZSTD_decompressDCtx(context, destination, raw_size, data, size);
+			ZSTD_freeDCtx(context);
+			if (ZSTD_isError(result) || result != raw_size) return false;
+		}
+#endif
+		else
+		{
+			return false;
+		}
+
+		if (option.filter != compression_filter::none)
+		{
+			const size_t element_count = raw_size / option.element_size;
+			if (option.filter == compression_filter::bit_shuffle)
+			{
+				for (size_t byte = 0; byte < option.element_size; ++byte) transpose_bits(filtered.data() + byte * element_count, element_count);
+			}
+			unshuffle(filtered.data(), output, element_count, option.element_size);
+			std::memcpy(output + element_count * option.element_size, filtered.data() + element_count * option.element_size, raw_size - element_count * option.element_size);
+		}
+		return true;
+	}
+};
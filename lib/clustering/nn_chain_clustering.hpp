@@ -0,0 +1,328 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+#include <tmt.hpp>
+
+namespace clustering
+{
+	enum class linkage
+	{
+		single,
+		complete,
+		average,
+		ward,
+	};
+
+	/** the distances of the pairs (i, j), i < j, of {size} points in row order, size * (size - 1) / 2 values.
+	 */
+	class condensed_distance
+	{
+	public:
+		static constexpr size_t tile_rows = 8;
+		static constexpr size_t tile_dimension = 1024;
+
+		explicit condensed_distance(size_t size = 0) : _size(size)
+		{
+			_data.resize(size > 1 ? size * (size - 1) / 2 : 0, 0);
+		}
+
+		double& operator()(size_t i, size_t j)
+		{
+			return _data[index(i, j)];
+		}
+
+		double operator()(size_t i, size_t j) const
+		{
+			return _data[index(i, j)];
+		}
+
+		[[nodiscard]] size_t size() const
+		{
+			return _size;
+		}
+
+		/** the Euclidean distances between the rows (each row has {dimension} values), from the Gram matrix of the rows:
+		 *  |x - y|^2 = x.x + y.y - 2 x.y. The Gram matrix is computed in tiles of tile_rows x tile_rows rows and
+		 *  tile_dimension columns, so the rows of a tile stay in the cache, the tiles are computed in parallel.
+		 *  thread_count = 0: use all hardware threads.
+		 */
+		template <typename DType>
+		static condensed_distance euclidean(const std::vector<const DType*>& rows, size_t dimension, uint32_t thread_count = 0)
+		{
+			const size_t count = rows.size();
+			const auto gram = gram_matrix(rows, dimension, thread_count);
+			condensed_distance output(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				for (size_t j = i + 1; j < count; ++j)
+				{
+					output(i, j) = std::sqrt(std::max(0.0, gram[i * count + i] + gram[j * count + j] - 2 * gram[i * count + j]));
+				}
+			}
+			return output;
+		}
+
+		//points: count x dimension, row major
+		template <typename DType>
+		static condensed_distance euclidean(const DType* points, size_t count, size_t dimension, uint32_t thread_count = 0)
+		{
+			std::vector<const DType*> rows(count);
+			for (size_t i = 0; i < count; ++i) rows[i] = points + i * dimension;
+			return euclidean(rows, dimension, thread_count);
+		}
+
+		//the upper triangle (with the diagonal) of rows x rows^T, count x count, row major
+		template <typename DType>
+		static std::vector<double> gram_matrix(const std::vector<const DType*>& rows, size_t dimension, uint32_t thread_count = 0)
+		{
+			const size_t count = rows.size();
+			const size_t tile_count = (count + tile_rows - 1) / tile_rows;
+			std::vector<std::pair<size_t, size_t>> tasks;
+			for (size_t tile_i = 0; tile_i < tile_count; ++tile_i)
+			{
+				for (size_t tile_j = tile_i; tile_j < tile_count; ++tile_j) tasks.emplace_back(tile_i, tile_j);
+			}
+
+			std::vector<double> output(count * count, 0);
+			if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+			thread_count = uint32_t(std::max<size_t>(1, std::min<size_t>(thread_count, tasks.size())));
+			tmt::ParallelExecution(thread_count, [&rows, &tasks, &output, count, dimension](uint32_t index, uint32_t thread_index)
+			{
+				const auto [tile_i, tile_j] = tasks[index];
+				const size_t begin_i = tile_i * tile_rows, end_i = std::min(begin_i + tile_rows, count);
+				const size_t begin_j = tile_j * tile_rows, end_j = std::min(begin_j + tile_rows, count);
+				double tile[tile_rows][tile_rows] = {};
+				for (size_t begin = 0; begin < dimension; begin += tile_dimension)
+				{
+					const size_t size = std::min(tile_dimension, dimension - begin);
+					for (size_t i = begin_i; i < end_i; ++i)
+					{
+						for (size_t j = std::max(i, begin_j); j < end_j; ++j)
+						{
+							tile[i - begin_i][j - begin_j] += dot(rows[i] + begin, rows[j] + begin, size);
+						}
+					}
+				}
+				//each task writes its own tile
+				for (size_t i = begin_i; i < end_i; ++i)
+				{
+					for (size_t j = std::max(i, begin_j); j < end_j; ++j) output[i * count + j] = tile[i - begin_i][j - begin_j];
+				}
+			}, tasks.size());
+			return output;
+		}
+
+	private:
+		size_t _size;
+		std::vector<double> _data;
+
+		[[nodiscard]] size_t index(size_t i, size_t j) const
+		{
+			if (i > j) std::swap(i, j);
+			return i * (2 * _size - i - 1) / 2 + (j - i - 1);
+		}
+
+		//independent partial sums, so the compiler vectorizes the loop without reordering a single sum
+		template <typename DType>
+		static double dot(const DType* lhs, const DType* rhs, size_t size)
+		{
+			constexpr size_t lane_count = 8;
+			double lanes[lane_count] = {};
+			size_t i = 0;
+			for (; i + lane_count <= size; i += lane_count)
+			{
+				for (size_t lane = 0; lane < lane_count; ++lane) lanes[lane] += double(lhs[i + lane]) * double(rhs[i + lane]);
+			}
+			for (; i < size; ++i) lanes[0] += double(lhs[i]) * double(rhs[i]);
+			return std::accumulate(lanes, lanes + lane_count, 0.0);
+		}
+	};
+
+	/** the merges of an agglomerative clustering of point_count points, in the order of the distance.
+	 *  The clusters 0 ... point_count - 1 are the points, merge k creates the cluster point_count + k (as scipy linkage).
+	 */
+	class dendrogram
+	{
+	public:
+		struct merge
+		{
+			size_t lhs;
+			size_t rhs;
+			double distance;
+			size_t size;
+		};
+
+		size_t point_count = 0;
+		std::vector<merge> merges;
+
+		//the points in {cluster}
+		[[nodiscard]] std::vector<size_t> elements(size_t cluster) const
+		{
+			std::vector<size_t> output, pending = {cluster};
+			while (!pending.empty())
+			{
+				const size_t current = pending.back();
+				pending.pop_back();
+				if (current < point_count)
+				{
+					output.push_back(current);
+					continue;
+				}
+				pending.push_back(merges[current - point_count].rhs);
+				pending.push_back(merges[current - point_count].lhs);
+			}
+			return output;
+		}
+
+		//the cluster label (0 ... cluster_count - 1) of each point after the first point_count - cluster_count merges
+		[[nodiscard]] std::vector<size_t> labels(size_t cluster_count) const
+		{
+			cluster_count = std::clamp<size_t>(cluster_count, 1, std::max<size_t>(point_count, 1));
+			std::vector<size_t> parent(point_count + merges.size());
+			std::iota(parent.begin(), parent.end(), 0);
+			auto find = [&parent](size_t cluster)
+			{
+				while (parent[cluster] != cluster) cluster = parent[cluster] = parent[parent[cluster]];
+				return cluster;
+			};
+			for (size_t k = 0; k + cluster_count < point_count; ++k)
+			{
+				parent[find(merges[k].lhs)] = point_count + k;
+				parent[find(merges[k].rhs)] = point_count + k;
+			}
+
+			std::vector<size_t> output(point_count), label_of_root(parent.size(), std::numeric_limits<size_t>::max());
+			size_t next_label = 0;
+			for (size_t i = 0; i < point_count; ++i)
+			{
+				auto& label = label_of_root[find(i)];
+				if (label == std::numeric_limits<size_t>::max()) label = next_label++;
+				output[i] = label;
+			}
+			return output;
+		}
+
+		//the points of the first cluster with more than ratio * point_count points
+		[[nodiscard]] std::vector<size_t> majority_cluster(double ratio) const
+		{
+			for (size_t k = 0; k < merges.size(); ++k)
+			{
+				if (double(merges[k].size) > ratio * double(point_count)) return elements(point_count + k);
+			}
+			std::vector<size_t> output(point_count);
+			std::iota(output.begin(), output.end(), 0);
+			return output;
+		}
+	};
+
+	/** agglomerative clustering by the nearest-neighbor-chain algorithm, O(N^2) time on the condensed distances.
+	 *  The distances are updated in place by the Lance-Williams formula of the linkage, for ward the input distances
+	 *  are Euclidean. Only reducible linkages are supported, so centroid / median linkage is not available here.
+	 */
+	class nn_chain_clustering
+	{
+	public:
+		static dendrogram process(condensed_distance distances, linkage method)
+		{
+			const size_t count = distances.size();
+			dendrogram output;
+			output.point_count = count;
+			if (count < 2) return output;
+
+			std::vector<size_t> size(count, 1);
+			std::vector<size_t> active(count);
+			std::iota(active.begin(), active.end(), 0);
+			std::vector<dendrogram::merge> merges;
+			merges.reserve(count - 1);
+			std::vector<size_t> chain;
+			chain.reserve(count);
+
+			for (size_t step = 0; step < count - 1; ++step)
+			{
+				if (chain.empty()) chain.push_back(active.front());
+
+				size_t x, y;
+				double distance;
+				while (true)
+				{
+					x = chain.back();
+					//prefer the previous point on the chain on ties, so the chain ends
+					y = chain.size() > 1 ? chain[chain.size() - 2] : count;
+					distance = y != count ? distances(x, y) : std::numeric_limits<double>::infinity();
+					for (size_t i: active)
+					{
+						if (i == x) continue;
+						const double current = distances(x, i);
+						if (current < distance)
+						{
+							distance = current;
+							y = i;
+						}
+					}
+					if (chain.size() > 1 && y == chain[chain.size() - 2]) break;
+					chain.push_back(y);
+				}
+				chain.resize(chain.size() - 2);
+
+				//the merged cluster is stored in y
+				if (x > y) std::swap(x, y);
+				merges.push_back({x, y, distance, size[x] + size[y]});
+				active.erase(std::find(active.begin(), active.end(), x));
+				for (size_t i: active)
+				{
+					if (i == y) continue;
+					distances(i, y) = lance_williams(method, distances(i, x), distances(i, y), distance, size[i], size[x], size[y]);
+				}
+				size[y] += size[x];
+			}
+
+			//sort by distance and name the clusters by the merge order, the merges at the same distance keep their order
+			std::stable_sort(merges.begin(), merges.end(), [](const dendrogram::merge& lhs, const dendrogram::merge& rhs)
+			{
+				return lhs.distance < rhs.distance;
+			});
+			std::vector<size_t> parent(2 * count - 1);
+			std::iota(parent.begin(), parent.end(), 0);
+			auto find = [&parent](size_t cluster)
+			{
+				while (parent[cluster] != cluster) cluster = parent[cluster] = parent[parent[cluster]];
+				return cluster;
+			};
+			output.merges.reserve(merges.size());
+			for (size_t k = 0; k < merges.size(); ++k)
+			{
+				const size_t lhs = find(merges[k].lhs), rhs = find(merges[k].rhs);
+				parent[lhs] = parent[rhs] = count + k;
+				output.merges.push_back({std::min(lhs, rhs), std::max(lhs, rhs), merges[k].distance, merges[k].size});
+			}
+			return output;
+		}
+
+	private:
+		//the distance from cluster k to the union of clusters i and j
+		static double lance_williams(linkage method, double distance_ki, double distance_kj, double distance_ij, size_t size_k, size_t size_i, size_t size_j)
+		{
+			switch (method)
+			{
+				case linkage::single:
+					return std::min(distance_ki, distance_kj);
+				case linkage::complete:
+					return std::max(distance_ki, distance_kj);
+				case linkage::average:
+					return (double(size_i) * distance_ki + double(size_j) * distance_kj) / double(size_i + size_j);
+				case linkage::ward:
+				{
+					const double squared = (double(size_i + size_k) * distance_ki * distance_ki + double(size_j + size_k) * distance_kj * distance_kj - double(size_k) * distance_ij * distance_ij) / double(size_i + size_j + size_k);
+					return std::sqrt(std::max(0.0, squared));
+				}
+			}
+			return std::numeric_limits<double>::quiet_NaN();
+		}
+	};
+}
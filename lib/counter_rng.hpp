@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+/** counter based random number generator (Philox4x32-10, Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+ *  The output is a pure function of (key, counter), so a generator for any (seed, stream) can be created in O(1) without
+ *  any shared state, and independent streams never overlap. Each stream has 2^32 blocks of four 32-bit numbers.
+ *  It satisfies UniformRandomBitGenerator, so it can be used with the std distributions and std::shuffle.
+ */
+class counter_rng
+{
+public:
+	using result_type = uint32_t;
+
+	counter_rng() : counter_rng(0, 0, 0, 0) {}
+
+	//{stream0, stream1, stream2} select an independent stream of {seed}
+	counter_rng(uint64_t seed, uint32_t stream0, uint32_t stream1, uint32_t stream2) : _key{uint32_t(seed), uint32_t(seed >> 32)}, _counter{0, stream0, stream1, stream2}, _output{}, _output_index(4)
+	{
+	}
+
+	static constexpr result_type min()
+	{
+		return std::numeric_limits<result_type>::min();
+	}
+
+	static constexpr result_type max()
+	{
+		return std::numeric_limits<result_type>::max();
+	}
+
+	result_type operator()()
+	{
+		if (_output_index == 4)
+		{
+			_output = philox(_counter, _key);
+			_counter[0]++;
+			_output_index = 0;
+		}
+		return _output[_output_index++];
+	}
+
+	void discard(unsigned long long count)
+	{
+		while (count--) (*this)();
+	}
+
+private:
+	static constexpr uint32_t multiplier_0 = 0xD2511F53;
+	static constexpr uint32_t multiplier_1 = 0xCD9E8D57;
+	static constexpr uint32_t weyl_0 = 0x9E3779B9;
+	static constexpr uint32_t weyl_1 = 0xBB67AE85;
+
+	static std::array<uint32_t, 4> philox(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key)
+	{
+		for (int round = 0; round < 10; ++round)
+		{
+			const uint64_t product_0 = uint64_t(multiplier_0) * counter[0];
+			const uint64_t product_1 = uint64_t(multiplier_1) * counter[2];
+			counter = {uint32_t(product_1 >> 32) ^ counter[1] ^ key[0], uint32_t(product_1), uint32_t(product_0 >> 32) ^ counter[3] ^ key[1], uint32_t(product_0)};
+			key[0] += weyl_0;
+			key[1] += weyl_1;
+		}
+		return counter;
+	}
+
+	std::array<uint32_t, 2> _key;
+	std::array<uint32_t, 4> _counter;
+	std::array<uint32_t, 4> _output;
+	int _output_index;
+};
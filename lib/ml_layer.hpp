@@ -1,6 +1,13 @@
 #pragma once
 
 #include "./ml_layer/caffe.hpp"
+#include "./ml_layer/caffe_pool.hpp"
 #include "./ml_layer/data_convert.hpp"
 #include "./ml_layer/fed_avg_buffer.hpp"
-#include "./ml_layer/model_compress.hpp"
\ No newline at end of file
+#include "./ml_layer/model_compress.hpp"
+#include "./ml_layer/model_quantization.hpp"
+#include "./ml_layer/model_container.hpp"
+#include "./ml_layer/model_reduction.hpp"
+#include "./ml_layer/robust_aggregation.hpp"
+#include "./ml_layer/model_similarity.hpp"
+#include "./ml_layer/evaluation_cache.hpp"
\ No newline at end of file
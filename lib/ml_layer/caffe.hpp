@@ -90,7 +90,9 @@ namespace Ml
 			{
 				THROW_NOT_IMPLEMENTED;
 			}
+			std::lock_guard guard(_model_lock);
 			net_parameter.toNet(*(_caffe_solver->net()));
+			_version++;
 		}
 		
 		void load_caffe_model(const std::string& proto_file_path)
@@ -103,26 +105,35 @@ namespace Ml
 			}
 			//_caffe_solver.reset(new SolverType<DType>(solver_param));
 			_caffe_solver.reset(new Ml::caffe_solver_ext<float, SolverType>(solver_param));
+			_version++;
 		}
 		
 		void train(const std::vector<tensor_blob_like<DType>>& data, const std::vector<tensor_blob_like<DType>>& label, bool display = true) override
 		{
 			std::lock_guard guard(_model_lock);
 			_caffe_solver->TrainDataset(data, label, display);
+			_version++;
 		}
 		
 		DType evaluation(const std::vector<tensor_blob_like<DType>>& data, const std::vector<tensor_blob_like<DType>>& label) override
+		{
+			return std::get<0>(evaluation_with_loss(data, label));
+		}
+		
+		//{accuracy, loss}
+		std::tuple<DType, DType> evaluation_with_loss(const std::vector<tensor_blob_like<DType>>& data, const std::vector<tensor_blob_like<DType>>& label)
 		{
 			std::lock_guard guard(_model_lock);
 			std::vector<std::tuple<DType,DType>> results = _caffe_solver->TestDataset(data, label);
-			DType output_accuracy = 0;
+			DType output_accuracy = 0, output_loss = 0;
 			for (int i = 0; i < results.size(); ++i)
 			{
 				DType accuracy, loss;
 				std::tie(accuracy, loss) = results[i];
 				output_accuracy += accuracy;
+				output_loss += loss;
 			}
-			return output_accuracy / results.size();
+			return {output_accuracy / results.size(), output_loss / results.size()};
 		}
 		
 		std::vector<tensor_blob_like<DType>> predict(const std::vector<tensor_blob_like<DType>>& data) override
@@ -164,23 +175,37 @@ namespace Ml
 			return _caffe_solver;
 		}
 		
+		//the parameter is cached until the model changes, the copies share the blobs (copy on write, see caffe_parameter_layer)
 		caffe_parameter_net<DType> get_parameter()
 		{
-			Ml::caffe_parameter_net<DType> output;
-			output.fromNet(*getNet());
-			return output;
+			std::lock_guard guard(_model_lock);
+			if (_parameter_cache_version != _version)
+			{
+				_parameter_cache.fromNet(*getNet());
+				_parameter_cache_version = _version;
+			}
+			return _parameter_cache;
 		}
 		
 		void set_parameter(const caffe_parameter_net<DType>& parameter)
 		{
 			std::lock_guard guard(_model_lock);
 			parameter.toNet(*getNet());
+			_version++;
+			_parameter_cache = parameter;
+			_parameter_cache_version = _version;
 		}
 		
 		void set_parameter(const caffe_parameter_net<DType>&& parameter)
+		{
+			set_parameter(parameter);
+		}
+		
+		//increased by every change of the model, a model with the same version has the same parameter
+		uint64_t get_version()
 		{
 			std::lock_guard guard(_model_lock);
-			parameter.toNet(*getNet());
+			return _version;
 		}
 		
 		int get_iter() override
@@ -188,6 +213,21 @@ namespace Ml
 			return _caffe_solver->iter();
 		}
 		
+		caffe_model_state<DType> get_model_state(bool with_history = true)
+		{
+			std::lock_guard guard(_model_lock);
+			caffe_model_state<DType> output;
+			_caffe_solver->ExportModelState(output, with_history);
+			return output;
+		}
+		
+		void set_model_state(const caffe_model_state<DType>& state, bool with_history = true)
+		{
+			std::lock_guard guard(_model_lock);
+			_caffe_solver->ImportModelState(state, with_history);
+			_version++;
+		}
+		
 	private:
 		boost::shared_ptr<caffe::Net<DType>> getNet()
 		{
@@ -206,5 +246,8 @@ namespace Ml
 		//boost::shared_ptr<caffe::Solver<DType>> _caffe_solver;
 		boost::shared_ptr<Ml::caffe_solver_ext<DType, SolverType>> _caffe_solver;
 		std::mutex _model_lock;
+		uint64_t _version = 1;
+		caffe_parameter_net<DType> _parameter_cache;
+		uint64_t _parameter_cache_version = 0;
 	};
 }
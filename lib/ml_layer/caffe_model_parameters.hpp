@@ -159,14 +159,24 @@ namespace Ml
 	    void set_all(DType value)
 	    {
 		    if (!_blob_p) return;
+		    detach();
 	    	_blob_p->set_all(value);
 	    }
 	    
 	    void random(DType min, DType max)
 	    {
 		    if (!_blob_p) return;
+		    detach();
 		    _blob_p->random(min, max);
 	    }
+	    
+	    template <typename RNG>
+	    void random(DType min, DType max, RNG& rng)
+	    {
+		    if (!_blob_p) return;
+		    detach();
+		    _blob_p->random(min, max, rng);
+	    }
 	
 	    DType sum()
 	    {
@@ -177,7 +187,10 @@ namespace Ml
 	    void abs()
 	    {
 		    if (!this->_blob_p->empty())
-		    	_blob_p->abs();
+		    {
+			    detach();
+			    _blob_p->abs();
+		    }
 	    }
 	
 	    size_t size()
@@ -189,23 +202,45 @@ namespace Ml
 	    void patch_weight(const caffe_parameter_layer<DType>& patch, DType ignore = NAN)
 	    {
 		    if (!_blob_p) return;
+		    detach();
 		    _blob_p->patch_weight(*patch._blob_p, ignore);
 	    }
-	
+
+	    //set the weights at {index} to {value}, the sparse counterpart of patch_weight
+	    void patch_weight(const uint32_t* index, const DType* value, size_t count)
+	    {
+		    if (!_blob_p || count == 0) return;
+		    detach();
+		    auto& data = _blob_p->getData();
+		    for (size_t i = 0; i < count; ++i)
+		    {
+			    data[index[i]] = value[i];
+		    }
+	    }
+
 	    void regulate_weights(DType min, DType max)
 	    {
 		    if (!_blob_p) return;
+		    detach();
 		    _blob_p->regulate_weights(min, max);
 		}
 	
 	    void fix_nan()
 	    {
 		    if (!_blob_p) return;
+		    detach();
 		    _blob_p->fix_nan();
 		}
         
     private:
         friend class boost::serialization::access;
+	
+	    //copies of a layer share the blob, the modifying functions copy the blob first if it is shared (copy on write).
+	    //writing the data via getBlob_p() directly also changes the other copies.
+	    void detach()
+	    {
+		    if (_blob_p.use_count() > 1) _blob_p.reset(new tensor_blob_like<DType>(*_blob_p));
+	    }
 
         std::string _name;
         std::string _type;
@@ -361,6 +396,15 @@ namespace Ml
 			    single_layer.random(min, max);
 		    }
 	    }
+	    
+	    template <typename RNG>
+	    void random(DType min, DType max, RNG& rng)
+	    {
+		    for (auto& single_layer: _layers)
+		    {
+			    single_layer.random(min, max, rng);
+		    }
+	    }
 	
 	    DType sum()
 	    {
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <thread>
+#include <vector>
+
+#include "./caffe.hpp"
+
+namespace Ml
+{
+	/** a small pool of caffe solvers shared by many models with the same solver proto.
+	 *  A solver is created on the first demand, up to max_size, and blocks when all solvers are leased.
+	 */
+	template <typename DType, template <typename> class SolverType>
+	class caffe_solver_pool
+	{
+	public:
+		using model = MlCaffeModel<DType, SolverType>;
+
+		class lease
+		{
+		public:
+			lease(caffe_solver_pool* pool, model* solver) : _pool(pool), _solver(solver) {}
+
+			lease(const lease&) = delete;
+			lease& operator=(const lease&) = delete;
+
+			lease(lease&& target) noexcept : _pool(target._pool), _solver(target._solver)
+			{
+				target._solver = nullptr;
+			}
+
+			~lease()
+			{
+				if (_solver) _pool->release(_solver);
+			}
+
+			model* operator->() const
+			{
+				return _solver;
+			}
+
+			model& operator*() const
+			{
+				return *_solver;
+			}
+
+		private:
+			caffe_solver_pool* _pool;
+			model* _solver;
+		};
+
+		//max_size = 0: two solvers per hardware thread, the simulator evaluates the current model in a separate thread while testing the received models
+		explicit caffe_solver_pool(std::string proto_file_path, size_t max_size = 0) : _proto_file_path(std::move(proto_file_path)), _max_size(max_size)
+		{
+			if (_max_size == 0) _max_size = std::thread::hardware_concurrency() * 2;
+		}
+
+		//the pool shared by all models using {proto_file_path}
+		static std::shared_ptr<caffe_solver_pool> get_pool(const std::string& proto_file_path)
+		{
+			static std::mutex pools_lock;
+			static std::unordered_map<std::string, std::shared_ptr<caffe_solver_pool>> pools;
+			std::lock_guard guard(pools_lock);
+			auto& pool = pools[proto_file_path];
+			if (!pool) pool.reset(new caffe_solver_pool(proto_file_path));
+			return pool;
+		}
+
+		lease acquire()
+		{
+			std::unique_lock guard(_lock);
+			if (_free.empty() && _solvers.size() < _max_size)
+			{
+				auto* solver = new model();
+				solver->load_caffe_model(_proto_file_path);
+				_solvers.emplace_back(solver);
+				return lease(this, solver);
+			}
+			_free_cv.wait(guard, [this](){return !_free.empty();});
+			model* solver = _free.back();
+			_free.pop_back();
+			return lease(this, solver);
+		}
+
+		//the state of a newly initialized model, the weights are filled by the fillers in the proto
+		//random_seed: seed of the fillers for a reproducible initialization, otherwise the caffe random generator of this thread is used
+		caffe_model_state<DType> create_model_state(std::optional<unsigned int> random_seed = std::nullopt) const
+		{
+			if (random_seed) caffe::Caffe::set_random_seed(*random_seed);
+			model solver;
+			solver.load_caffe_model(_proto_file_path);
+			return solver.get_model_state();
+		}
+
+		GENERATE_GET(_proto_file_path, get_proto_file_path);
+
+	private:
+		void release(model* solver)
+		{
+			{
+				std::lock_guard guard(_lock);
+				_free.push_back(solver);
+			}
+			_free_cv.notify_one();
+		}
+
+		std::string _proto_file_path;
+		size_t _max_size;
+		std::mutex _lock;
+		std::condition_variable _free_cv;
+		std::vector<std::unique_ptr<model>> _solvers;
+		std::vector<model*> _free;
+	};
+
+	/** a caffe model that only owns its caffe_model_state (weights, bias and solver history), the caffe net is leased
+	 *  from a caffe_solver_pool for each operation. It has the same interface as MlCaffeModel.
+	 *  Each operation copies the full state into the leased solver, so the result does not depend on which solver is leased.
+	 */
+	template <typename DType, template <typename> class SolverType>
+	class MlCaffeModelPooled : public MlModel<DType>
+	{
+	public:
+		using pool_type = caffe_solver_pool<DType, SolverType>;
+
+		std::stringstream serialization(serialization_type type) override
+		{
+			std::lock_guard guard(_model_lock);
+			auto solver = lease_with_state(false);
+			return solver->serialization(type);
+		}
+
+		void deserialization(serialization_type type, std::stringstream & ss) override
+		{
+			std::lock_guard guard(_model_lock);
+			auto solver = lease_with_state(false);
+			solver->deserialization(type, ss);
+			store_state(*solver, false);
+			_version++;
+		}
+
+		void load_caffe_model(const std::string& proto_file_path, std::optional<unsigned int> random_seed = std::nullopt)
+		{
+			auto pool = pool_type::get_pool(proto_file_path);
+			auto state = pool->create_model_state(random_seed);
+			std::lock_guard guard(_model_lock);
+			_pool = pool;
+			_state = std::move(state);
+			_version++;
+		}
+
+		void train(const std::vector<tensor_blob_like<DType>>& data, const std::vector<tensor_blob_like<DType>>& label, bool display = true) override
+		{
+			std::lock_guard guard(_model_lock);
+			auto solver = lease_with_state(true);
+			solver->train(data, label, display);
+			store_state(*solver, true);
+			_version++;
+		}
+
+		DType evaluation(const std::vector<tensor_blob_like<DType>>& data, const std::vector<tensor_blob_like<DType>>& label) override
+		{
+			std::lock_guard guard(_model_lock);
+			auto solver = lease_with_state(false);
+			return solver->evaluation(data, label);
+		}
+
+		std::tuple<DType, DType> evaluation_with_loss(const std::vector<tensor_blob_like<DType>>& data, const std::vector<tensor_blob_like<DType>>& label)
+		{
+			std::lock_guard guard(_model_lock);
+			auto solver = lease_with_state(false);
+			return solver->evaluation_with_loss(data, label);
+		}
+
+		std::vector<tensor_blob_like<DType>> predict(const std::vector<tensor_blob_like<DType>>& data) override
+		{
+			std::lock_guard guard(_model_lock);
+			auto solver = lease_with_state(false);
+			return solver->predict(data);
+		}
+
+		std::string get_network_structure_info() override
+		{
+			auto solver = get_pool()->acquire();
+			return solver->get_network_structure_info();
+		}
+
+		model_type get_model_type() override
+		{
+			return model_type::model_type_caffe;
+		}
+
+		int get_iter() override
+		{
+			std::lock_guard guard(_model_lock);
+			return _state.iter;
+		}
+
+		//the parameter is cached until the model changes, so reading an unchanged model does not lease a solver
+		caffe_parameter_net<DType> get_parameter()
+		{
+			std::lock_guard guard(_model_lock);
+			if (_parameter_cache_version != _version)
+			{
+				auto solver = lease_with_state(false);
+				_parameter_cache = solver->get_parameter();
+				_parameter_cache_version = _version;
+			}
+			return _parameter_cache;
+		}
+
+		void set_parameter(const caffe_parameter_net<DType>& parameter)
+		{
+			std::lock_guard guard(_model_lock);
+			auto solver = lease_with_state(false);
+			solver->set_parameter(parameter);
+			store_state(*solver, false);
+			_version++;
+			_parameter_cache = parameter;
+			_parameter_cache_version = _version;
+		}
+
+		//increased by every change of the model, a model with the same version has the same parameter
+		uint64_t get_version()
+		{
+			std::lock_guard guard(_model_lock);
+			return _version;
+		}
+
+		caffe_model_state<DType> get_model_state(bool with_history = true)
+		{
+			std::lock_guard guard(_model_lock);
+			caffe_model_state<DType> output;
+			output.iter = _state.iter;
+			output.parameter = _state.parameter;
+			if (with_history) output.history = _state.history;
+			return output;
+		}
+
+		void set_model_state(const caffe_model_state<DType>& state, bool with_history = true)
+		{
+			std::lock_guard guard(_model_lock);
+			CHECK(state.parameter.size() == _state.parameter.size()) << "model state size mismatch, different solver proto?";
+			_state.iter = state.iter;
+			_state.parameter = state.parameter;
+			if (with_history) _state.history = state.history;
+			_version++;
+		}
+
+	private:
+		const std::shared_ptr<pool_type>& get_pool() const
+		{
+			if (!_pool)
+			{
+				throw std::logic_error("caffe model is not loaded yet, use load_caffe_model() to load a model first");
+			}
+			return _pool;
+		}
+
+		//lease a solver and copy this model into it, the history is only required for training
+		typename pool_type::lease lease_with_state(bool with_history)
+		{
+			auto solver = get_pool()->acquire();
+			solver->set_model_state(_state, with_history);
+			return solver;
+		}
+
+		void store_state(MlCaffeModel<DType, SolverType>& solver, bool with_history)
+		{
+			auto state = solver.get_model_state(with_history);
+			_state.iter = state.iter;
+			_state.parameter = std::move(state.parameter);
+			if (with_history) _state.history = std::move(state.history);
+		}
+
+		std::shared_ptr<pool_type> _pool;
+		caffe_model_state<DType> _state;
+		std::mutex _model_lock;
+		uint64_t _version = 1;
+		caffe_parameter_net<DType> _parameter_cache;
+		uint64_t _parameter_cache_version = 0;
+	};
+}
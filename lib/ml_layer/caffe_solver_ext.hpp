@@ -1,9 +1,11 @@
 #pragma once
 
 #include <cmath>
+#include <cstring>
 #include <glog/logging.h>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/serialization/vector.hpp>
 
 #include <caffe/layers/memory_data_layer.hpp>
 #include <caffe/solver.hpp>
@@ -14,6 +16,25 @@
 
 namespace Ml
 {
+	//all learnable parameters (including bias) and the solver history (e.g. momentum) in flat arrays, in the order of
+	//net->learnable_params(). It is the complete state to continue training a model in another solver with the same proto.
+	template <typename DType>
+	class caffe_model_state
+	{
+	public:
+		int iter = 0;
+		std::vector<DType> parameter;
+		std::vector<DType> history;
+		
+		template<class Archive>
+		void serialize(Archive & ar, const unsigned int version)
+		{
+			ar & iter;
+			ar & parameter;
+			ar & history;
+		}
+	};
+	
 	template <typename DType, template <typename> class SolverType>
 	class caffe_solver_ext : public SolverType<DType>
 	{
@@ -186,6 +207,20 @@ namespace Ml
 			return output;
 		}
 		
+		void ExportModelState(caffe_model_state<DType>& state, bool with_history) const
+		{
+			state.iter = this->iter_;
+			ExportBlobs(this->net_->learnable_params(), state.parameter);
+			if (with_history) ExportBlobs(this->history_, state.history);
+		}
+		
+		void ImportModelState(const caffe_model_state<DType>& state, bool with_history)
+		{
+			this->iter_ = state.iter;
+			ImportBlobs(state.parameter, this->net_->learnable_params());
+			if (with_history) ImportBlobs(state.history, this->history_);
+		}
+		
 		bool checkValidFirstLayer_memoryLayer()
 		{
 			auto& test_first_layer = this->test_nets().data()->get()->layers()[0];
@@ -196,6 +231,34 @@ namespace Ml
 		}
 		
 	private:
+		template <typename BlobContainer>
+		static void ExportBlobs(const BlobContainer& blobs, std::vector<DType>& output)
+		{
+			size_t total = 0;
+			for (const auto& blob: blobs) total += blob->count();
+			output.resize(total);
+			size_t offset = 0;
+			for (const auto& blob: blobs)
+			{
+				std::memcpy(output.data() + offset, blob->cpu_data(), blob->count() * sizeof(DType));
+				offset += blob->count();
+			}
+		}
+		
+		template <typename BlobContainer>
+		static void ImportBlobs(const std::vector<DType>& input, const BlobContainer& blobs)
+		{
+			size_t total = 0;
+			for (const auto& blob: blobs) total += blob->count();
+			CHECK(total == input.size()) << "model state size mismatch, different solver proto?";
+			size_t offset = 0;
+			for (const auto& blob: blobs)
+			{
+				std::memcpy(blob->mutable_cpu_data(), input.data() + offset, blob->count() * sizeof(DType));
+				offset += blob->count();
+			}
+		}
+		
 		void TrainDataset_Step(int iter, int average_loss, bool display = true)
 		{
 			const int start_iter = this->iter_;
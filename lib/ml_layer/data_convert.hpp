@@ -121,11 +121,24 @@ namespace Ml{
         //return: <data,label>
         std::tuple<std::vector<tensor_blob_like<DType>>, std::vector<tensor_blob_like<DType>>> get_random_data(int size)
         {
-	        return _get_random_data(size, _data, _label);
+	        return get_random_data(size, default_rng());
         }
 	
+	    //rng: any UniformRandomBitGenerator, use a seeded one for reproducible datasets
+	    template <typename RNG>
+	    std::tuple<std::vector<tensor_blob_like<DType>>, std::vector<tensor_blob_like<DType>>> get_random_data(int size, RNG& rng)
+	    {
+		    return _get_random_data(size, _data, _label, rng);
+	    }
+	
 	    //return: <data,label>
 	    std::tuple<std::vector<tensor_blob_like<DType>>, std::vector<tensor_blob_like<DType>>> get_random_data_by_Label(const tensor_blob_like<DType>& arg_label, int size)
+	    {
+		    return get_random_data_by_Label(arg_label, size, default_rng());
+	    }
+	
+	    template <typename RNG>
+	    std::tuple<std::vector<tensor_blob_like<DType>>, std::vector<tensor_blob_like<DType>>> get_random_data_by_Label(const tensor_blob_like<DType>& arg_label, int size, RNG& rng)
 	    {
         	//does not exist key
         	const std::string key_str = arg_label.get_str();
@@ -137,11 +150,9 @@ namespace Ml{
 			
 		    std::vector<tensor_blob_like<DType>> data,label;
 		    data.resize(size);label.resize(size);
+		    std::uniform_int_distribution<int> distribution(0, iter->second.size()-1);
 		    for (int i = 0; i < size; ++i)
 		    {
-			    std::random_device dev;
-			    std::mt19937 rng(dev());
-			    std::uniform_int_distribution<int> distribution(0, iter->second.size()-1);
 			    int dice = distribution(rng);
 			    data[i] = iter->second[dice];
 			    label[i] = arg_label;
@@ -152,6 +163,12 @@ namespace Ml{
 	    //please ensure the dataset is larger than the size*100 to ensure the best randomness.
 	    //return: <data,label>
 	    std::tuple<std::vector<tensor_blob_like<DType>>, std::vector<tensor_blob_like<DType>>> get_random_non_iid_dataset(const non_iid_distribution<DType>& distribution, int size, int enlargement_factor = 100)
+	    {
+		    return get_random_non_iid_dataset(distribution, size, default_rng(), enlargement_factor);
+	    }
+	
+	    template <typename RNG>
+	    std::tuple<std::vector<tensor_blob_like<DType>>, std::vector<tensor_blob_like<DType>>> get_random_non_iid_dataset(const non_iid_distribution<DType>& distribution, int size, RNG& rng, int enlargement_factor = 100)
 	    {
         	float total_weight = 0.0;
         	auto& distribution_map = distribution.get();
@@ -164,11 +181,11 @@ namespace Ml{
 		    {
 		    	tensor_blob_like<DType> label_blob;
 			    label_blob = deserialize_wrap<boost::archive::binary_iarchive, tensor_blob_like<DType>>(iter->first);
-			    auto [data,label] = get_random_data_by_Label(label_blob, iter->second / total_weight * size * enlargement_factor);
+			    auto [data,label] = get_random_data_by_Label(label_blob, iter->second / total_weight * size * enlargement_factor, rng);
 			    data_pool.insert(data_pool.end(), data.begin(), data.end());
 			    label_pool.insert(label_pool.end(), label.begin(), label.end());
 		    }
-		    return _get_random_data(size, data_pool, label_pool);
+		    return _get_random_data(size, data_pool, label_pool, rng);
 	    }
 	
 	    std::tuple<const std::vector<tensor_blob_like<DType>>&, const std::vector<tensor_blob_like<DType>>& > get_whole_dataset()
@@ -182,17 +199,23 @@ namespace Ml{
 	
         std::unordered_map<std::string, std::vector<tensor_blob_like<DType>>> _container_by_label;
 	
+	    //seeded once per thread, the samples do not read the random device
+	    static std::mt19937& default_rng()
+	    {
+		    thread_local std::mt19937 rng(std::random_device{}());
+		    return rng;
+	    }
+	
 	    //return: <data,label>
-	    std::tuple<std::vector<tensor_blob_like<DType>>, std::vector<tensor_blob_like<DType>>> _get_random_data(int size, const std::vector<tensor_blob_like<DType>>& data_pool, const std::vector<tensor_blob_like<DType>>& label_pool)
+	    template <typename RNG>
+	    std::tuple<std::vector<tensor_blob_like<DType>>, std::vector<tensor_blob_like<DType>>> _get_random_data(int size, const std::vector<tensor_blob_like<DType>>& data_pool, const std::vector<tensor_blob_like<DType>>& label_pool, RNG& rng)
 	    {
 		    const int& total_size = data_pool.size();
 		    std::vector<tensor_blob_like<DType>> data,label;
 		    data.resize(size);label.resize(size);
+		    std::uniform_int_distribution<int> distribution(0,total_size-1);
 		    for (int i = 0; i < size; ++i)
 		    {
-			    std::random_device dev;
-			    std::mt19937 rng(dev());
-			    std::uniform_int_distribution<int> distribution(0,total_size-1);
 			    int dice = distribution(rng);
 			    data[i] = data_pool[dice];
 			    label[i] = label_pool[dice];
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <list>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <unordered_map>
+
+#include <glog/logging.h>
+#include "./caffe_model_parameters.hpp"
+#include "./model_container.hpp"
+
+namespace Ml
+{
+	template <typename DType>
+	struct evaluation_result
+	{
+		DType accuracy;
+		DType loss;
+	};
+
+	/** the evaluation results of (model content, test set) pairs.
+	 *  A model is keyed by the hash of its weights, so the same weights received by many nodes (a broadcast) or
+	 *  evaluated again in a later stage are evaluated once on a test set. The test set id is chosen by the caller: the
+	 *  same id must always mean the same samples, such as a test set drawn deterministically per round.
+	 *  get_or_evaluate() runs the evaluation once per key even if many threads ask for the key at the same time, the
+	 *  other threads wait for the result. The oldest entries are dropped beyond {capacity} entries.
+	 *  ModelKey = uint64_t keys the models by content_hash, a fast checksum for the models of the simulators. The models
+	 *  from untrusted peers should be keyed by a cryptographic hash (such as a SHA-256 string computed by the caller),
+	 *  a crafted model colliding with the checksum of another would get its cached accuracy.
+	 */
+	template <typename DType, typename ModelKey = uint64_t>
+	class evaluation_cache
+	{
+	public:
+		using result = evaluation_result<DType>;
+
+		explicit evaluation_cache(size_t capacity = 4096) : _capacity(capacity)
+		{
+			LOG_IF(FATAL, _capacity == 0) << "[evaluation_cache] the capacity must be larger than 0";
+		}
+
+		//the hash of the weights (the layer structure is not hashed), the layers without blobs are skipped
+		static uint64_t content_hash(const caffe_parameter_net<DType>& model)
+		{
+			uint64_t output = 0;
+			const auto& layers = model.getLayers();
+			for (size_t layer_index = 0; layer_index < layers.size(); ++layer_index)
+			{
+				const auto& blob = layers[layer_index].getBlob_p();
+				if (!blob) continue;
+				const auto& data = blob->getData();
+				const uint64_t layer_hash = model_container_format::checksum(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(DType));
+				output = hash_combine(output, hash_combine(layer_index, layer_hash));
+			}
+			return output;
+		}
+
+		//evaluate() returns result, it is called only if the result is not in the cache
+		template <typename Evaluate>
+		result get_or_evaluate(const ModelKey& model_hash, uint64_t test_set_id, Evaluate evaluate)
+		{
+			const key target{model_hash, test_set_id};
+			std::promise<result> promise;
+			std::shared_future<result> cached;
+			uint64_t generation = 0;
+			{
+				std::lock_guard guard(_lock);
+				auto iter = _results.find(target);
+				if (iter != _results.end())
+				{
+					cached = iter->second.future;
+					_hit_count++;
+				}
+				else
+				{
+					_miss_count++;
+					generation = ++_generation;
+					_order.push_back(target);
+					_results.emplace(target, entry{promise.get_future().share(), generation, std::prev(_order.end())});
+					while (_order.size() > _capacity)
+					{
+						//the threads waiting on a dropped entry hold their own copy of the future
+						_results.erase(_order.front());
+						_order.pop_front();
+					}
+				}
+			}
+			//wait for the thread evaluating it, outside the lock
+			if (cached.valid()) return cached.get();
+
+			try
+			{
+				const result output = evaluate();
+				promise.set_value(output);
+				return output;
+			}
+			catch (...)
+			{
+				//the waiting threads get the exception, the next call evaluates it again; the entry may have been dropped
+				//and added again by another thread meanwhile, which is kept
+				promise.set_exception(std::current_exception());
+				std::lock_guard guard(_lock);
+				auto iter = _results.find(target);
+				if (iter != _results.end() && iter->second.generation == generation)
+				{
+					_order.erase(iter->second.order);
+					_results.erase(iter);
+				}
+				throw;
+			}
+		}
+
+		template <typename Evaluate>
+		result get_or_evaluate(const caffe_parameter_net<DType>& model, uint64_t test_set_id, Evaluate evaluate)
+		{
+			static_assert(std::is_same_v<ModelKey, uint64_t>, "the model key is computed by the caller");
+			return get_or_evaluate(content_hash(model), test_set_id, evaluate);
+		}
+
+		void clear()
+		{
+			std::lock_guard guard(_lock);
+			_results.clear();
+			_order.clear();
+		}
+
+		size_t size()
+		{
+			std::lock_guard guard(_lock);
+			return _results.size();
+		}
+
+		[[nodiscard]] uint64_t hit_count() const
+		{
+			return _hit_count;
+		}
+
+		[[nodiscard]] uint64_t miss_count() const
+		{
+			return _miss_count;
+		}
+
+	private:
+		struct key
+		{
+			ModelKey model_hash;
+			uint64_t test_set_id;
+
+			bool operator==(const key& target) const
+			{
+				return model_hash == target.model_hash && test_set_id == target.test_set_id;
+			}
+		};
+
+		struct key_hash
+		{
+			size_t operator()(const key& target) const
+			{
+				return size_t(hash_combine(std::hash<ModelKey>{}(target.model_hash), target.test_set_id));
+			}
+		};
+
+		static uint64_t hash_combine(uint64_t lhs, uint64_t rhs)
+		{
+			return lhs ^ (rhs + 0x9E3779B97F4A7C15ull + (lhs << 6) + (lhs >> 2));
+		}
+
+		struct entry
+		{
+			std::shared_future<result> future;
+			uint64_t generation; //tells a failed entry from the same key added again
+			typename std::list<key>::iterator order;
+		};
+
+		size_t _capacity;
+		std::mutex _lock;
+		std::unordered_map<key, entry, key_hash> _results;
+		std::list<key> _order; //insertion order, the front is dropped first
+		uint64_t _generation = 0;
+		std::atomic<uint64_t> _hit_count = 0;
+		std::atomic<uint64_t> _miss_count = 0;
+	};
+}
@@ -6,87 +6,122 @@
 
 #include <vector>
 #include <optional>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <glog/logging.h>
 #include "util.hpp"
+#include "caffe_model_parameters.hpp"
 
 namespace Ml
 {
+	/** ring buffer of the latest {size} models with their weights (such as the reputation of the sender).
+	 *  A running weighted sum is kept beside the buffer: add() adds the new model and subtracts the evicted one, so
+	 *  average() and average_ignore() are one pass over the accumulators instead of over all buffered models.
+	 *  The accumulators are flat double arrays (the layers one after another); a NaN value is not added to the sum,
+	 *  it is counted instead, so the NaN (dropped) weights of the compressed models are skipped by average_ignore().
+	 *  Infinity is counted like NaN: added to the sum it would leave NaN (inf - inf) there after the model is evicted.
+	 */
 	template <typename T>
 	class fed_avg_buffer
 	{
 	public:
+		using DType = typename T::DataType;
+		static_assert(std::is_same_v<T, caffe_parameter_net<DType>>);
+
 		fed_avg_buffer(size_t size) : _size(size)
 		{
 			_data.resize(_size);
+			_weights.resize(_size, 0);
 			_current_write_loc = 0;
 			_current_size = 0;
+			_total_weight = 0;
 		}
-		
-		void add(const T& target)
+
+		void add(const T& target, double weight = 1.0)
 		{
+			if (_layer_offsets.empty()) init_accumulators(target);
+			if (_current_size == _size)
+			{
+				accumulate(_data[_current_write_loc], _weights[_current_write_loc], -1);
+			}
+			accumulate(target, weight, 1);
 			_data[_current_write_loc] = target;
+			_weights[_current_write_loc] = weight;
 			move_to_next(_current_write_loc);
-			
+
 			if (_current_size != _size) _current_size++;
 		}
-		
+
+		//the weighted average, NaN where a buffered model is NaN or infinite
 		T average()
 		{
-			T output = _data[0] - _data[0];
-			for (int i = 0; i < _current_size; ++i)
+			if (_current_size == 0) throw std::logic_error("no data is in the buffer");
+			const double inverse_weight = 1.0 / _total_weight;
+			return from_accumulators([inverse_weight](double sum, double weight, uint32_t nan_count)
 			{
-				output = output + _data[i];
-			}
-			output = output / _current_size;
-			return output;
+				return nan_count == 0 ? DType(sum * inverse_weight) : DType(NAN);
+			});
 		}
-		
-		T average_ignore(typename T::DataType ignore = NAN)
+
+		//the weighted average of the weights other than {ignore}, NaN where all buffered models are {ignore}
+		//ignore = NaN: the infinite weights are ignored as well
+		T average_ignore(DType ignore = NAN)
 		{
-			static_assert(std::is_same_v<T, caffe_parameter_net<typename T::DataType>>);
-			caffe_parameter_net<typename T::DataType> output = _data[0] - _data[0], counter = _data[0] - _data[0];
-			output.set_all(0);
-			counter.set_all(0);
-			
-			if (_current_size == 0)
+			if (_current_size == 0) throw std::logic_error("no data is in the buffer");
+			if (ignore != ignore)
 			{
-				//error because there is no data in the buffer
-				throw std::logic_error("no data is in the buffer");
+				//by the count, the weight sum of the evicted models is not exactly 0
+				const uint32_t model_count = uint32_t(_current_size);
+				return from_accumulators([model_count](double sum, double weight, uint32_t nan_count)
+				{
+					return nan_count < model_count ? DType(sum / weight) : DType(NAN);
+				});
 			}
-			
-			for (size_t model_index = 0; model_index < _current_size; ++model_index)
+
+			//a value other than NaN is not tracked by the accumulators
+			T output = _data[0];
+			output.set_all(0);
+			for (size_t layer_index = 0; layer_index < output.getLayers().size(); ++layer_index)
 			{
-				auto& model = _data[model_index];
-				for (size_t layer_index = 0; layer_index < model.getLayers().size(); ++layer_index )
+				if (_layer_offsets[layer_index + 1] == _layer_offsets[layer_index]) continue;
+				auto& output_data = output.getLayers()[layer_index].getBlob_p()->getData();
+				std::vector<double> sum(output_data.size(), 0), weight(output_data.size(), 0);
+				for (size_t model_index = 0; model_index < _current_size; ++model_index)
 				{
-					auto& layer = model.getLayers()[layer_index];
-					auto& layer_output = output.getLayers()[layer_index];
-					auto& layer_counter = counter.getLayers()[layer_index];
-					for (size_t weight_index = 0; weight_index < layer.getBlob_p()->getData().size(); ++weight_index)
+					const auto& data = _data[model_index].getLayers()[layer_index].getBlob_p()->getData();
+					for (size_t i = 0; i < data.size(); ++i)
 					{
-						auto& blob_data = layer.getBlob_p()->getData()[weight_index];
-						auto& blob_data_output = layer_output.getBlob_p()->getData()[weight_index];
-						auto& blob_data_counter = layer_counter.getBlob_p()->getData()[weight_index];
-						
-						if (blob_data == ignore) continue;
-						blob_data_output += blob_data;
-						blob_data_counter ++;
+						if (data[i] == ignore) continue;
+						sum[i] += _weights[model_index] * data[i];
+						weight[i] += _weights[model_index];
 					}
 				}
+				for (size_t i = 0; i < output_data.size(); ++i) output_data[i] = weight[i] != 0 ? DType(sum[i] / weight[i]) : DType(NAN);
 			}
-			output = output.dot_divide(counter);
-			
 			return output;
 		}
-		
+
 		GENERATE_GET(_data,getData);
+		GENERATE_GET(_weights,getWeights);
 		GENERATE_GET(_current_size,getSize);
-		
+
 	private:
 		std::vector<T> _data;
+		std::vector<double> _weights;
 		size_t _current_write_loc;
 		size_t _current_size;
 		size_t _size;
-		
+
+		//running sums over the buffered models
+		std::vector<size_t> _layer_offsets;
+		std::vector<double> _sum; //weight * value of the finite values
+		std::vector<double> _weight_sum; //weight of the finite values
+		std::vector<uint32_t> _nan_count; //NaN and infinity
+		double _total_weight;
+
 		void move_to_next(size_t& value)
 		{
 			value++;
@@ -96,6 +131,76 @@ namespace Ml
 				value = 0;
 			}
 		}
+
+		void init_accumulators(const T& target)
+		{
+			size_t flat_size = 0;
+			for (const auto& layer: target.getLayers())
+			{
+				_layer_offsets.push_back(flat_size);
+				flat_size += layer.getBlob_p() ? layer.getBlob_p()->getData().size() : 0;
+			}
+			_layer_offsets.push_back(flat_size);
+			_sum.assign(flat_size, 0);
+			_weight_sum.assign(flat_size, 0);
+			_nan_count.assign(flat_size, 0);
+		}
+
+		//sign: 1 to add the model, -1 to remove it
+		void accumulate(const T& target, double weight, int sign)
+		{
+			const auto& layers = target.getLayers();
+			LOG_IF(FATAL, layers.size() + 1 != _layer_offsets.size()) << "[fed_avg_buffer] the models have different structures";
+			const double signed_weight = weight * sign;
+			for (size_t layer_index = 0; layer_index < layers.size(); ++layer_index)
+			{
+				const size_t offset = _layer_offsets[layer_index], count = _layer_offsets[layer_index + 1] - offset;
+				if (count == 0) continue;
+				const auto& data = layers[layer_index].getBlob_p()->getData();
+				LOG_IF(FATAL, data.size() != count) << "[fed_avg_buffer] the models have different structures";
+				accumulate_kernel(data.data(), signed_weight, sign, _sum.data() + offset, _weight_sum.data() + offset, _nan_count.data() + offset, count);
+			}
+			_total_weight += signed_weight;
+		}
+
+		//branch free on the bits, so the compiler vectorizes it (a float comparison with NaN is a branch for gcc)
+		static void accumulate_kernel(const DType* data, double weight, int sign, double* sum, double* weight_sum, uint32_t* nan_count, size_t count)
+		{
+			using word_t = std::conditional_t<sizeof(DType) == 8, uint64_t, uint32_t>;
+			static_assert(sizeof(DType) == sizeof(word_t));
+			constexpr word_t magnitude_mask = word_t(-1) >> 1;
+			constexpr word_t infinity = sizeof(DType) == 8 ? word_t(0x7ff0000000000000ull) : word_t(0x7f800000u);
+			const uint32_t nan_step = uint32_t(sign);
+			for (size_t i = 0; i < count; ++i)
+			{
+				word_t bits;
+				std::memcpy(&bits, data + i, sizeof(bits));
+				const word_t nan = (bits & magnitude_mask) >= infinity; //NaN or infinity
+				const word_t value_bits = bits & (nan - 1); //0 if not finite
+				DType value;
+				std::memcpy(&value, &value_bits, sizeof(value));
+				sum[i] += weight * double(value);
+				weight_sum[i] += weight * double(1 - nan);
+				nan_count[i] += nan_step & (0 - uint32_t(nan));
+			}
+		}
+
+		//output(sum, weight_sum, nan_count) of every weight
+		template <typename Output>
+		T from_accumulators(Output output_function)
+		{
+			T output = _data[0];
+			output.set_all(0); //copy on write, the buffered model is not changed
+			auto& layers = output.getLayers();
+			for (size_t layer_index = 0; layer_index < layers.size(); ++layer_index)
+			{
+				const size_t offset = _layer_offsets[layer_index], count = _layer_offsets[layer_index + 1] - offset;
+				if (count == 0) continue;
+				DType* data = layers[layer_index].getBlob_p()->getData().data();
+				for (size_t i = 0; i < count; ++i) data[i] = output_function(_sum[offset + i], _weight_sum[offset + i], _nan_count[offset + i]);
+			}
+			return output;
+		}
 	};
-	
+
 }
@@ -1,11 +1,20 @@
 #pragma once
 
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 #include <glog/logging.h>
 
 #include <lz4.hpp>
+#include <chunk_compression.hpp>
 #include <boost_serialization_wrapper.hpp>
 #include "tensor_blob_like.hpp"
 #include "caffe_model_parameters.hpp"
+#include "model_quantization.hpp"
+#include "model_container.hpp"
 
 namespace Ml
 {
@@ -59,6 +68,11 @@ namespace Ml
 		static std::string compress_by_diff_lz_compress(const Ml::caffe_parameter_net<DType>& diff_model)
 		{
 			auto data_str = serialize_wrap<boost::archive::binary_oarchive>(diff_model).str();
+			return lz_compress(data_str);
+		}
+		
+		static std::string lz_compress(const std::string& data_str)
+		{
 			int max_compressed_size = LZ4::Compress_CalculateDstSize(data_str.size());
 			char* compressed_output = new char[max_compressed_size];
 			int real_compressed_size = LZ4::Compress(data_str.data(), data_str.size(), compressed_output, max_compressed_size);
@@ -68,6 +82,18 @@ namespace Ml
 			return output;
 		}
 		
+		static std::string lz_decompress(const std::string& data)
+		{
+			int decompress_size = LZ4::Decompress_CalculateDstSize(data.data());
+			char* decompress_content = new char[decompress_size];
+			int real_decompressed_size = LZ4::Decompress(data.data(), data.size(), decompress_content);
+			LOG_IF(WARNING, real_decompressed_size!=decompress_size) << "[model decompress] real_decompressed_size not as expected";
+			std::string output(decompress_content, decompress_size);
+			delete[] decompress_content;
+			
+			return output;
+		}
+		
 		template<typename DType>
 		static std::string compress_by_diff(const Ml::caffe_parameter_net<DType>& net_before, const Ml::caffe_parameter_net<DType>& net_after, float filter_limit, size_t* total_weight_count = nullptr, size_t* dropped_weight_count = nullptr)
 		{
@@ -79,19 +105,196 @@ namespace Ml
 		template<typename DType>
 		static Ml::caffe_parameter_net<DType> decompress_by_diff(const std::string& data)
 		{
-			int decompress_size = LZ4::Decompress_CalculateDstSize(data.data());
-			char* decompress_content = new char[decompress_size];
-			int real_decompressed_size = LZ4::Decompress(data.data(), data.size(), decompress_content);
-			LOG_IF(WARNING, real_decompressed_size!=decompress_size) << "[model decompress] real_decompressed_size not as expected";
-			std::stringstream ss;
-			ss.write(decompress_content, decompress_size);
-			auto output = deserialize_wrap<boost::archive::binary_iarchive, Ml::caffe_parameter_net<DType>>(ss);
-			delete[] decompress_content;
+			return deserialize_wrap<boost::archive::binary_iarchive, Ml::caffe_parameter_net<DType>>(lz_decompress(data));
+		}
+	
+		/** sparse update: the largest weight changes of each layer as an (index, value) list.
+		 *  A layer keeps its ceil(keep_ratio * size) largest changes (top-k), or the changes of at least {threshold} if the
+		 *  threshold is positive. The values are the weights of net_after, so the update patches the model of the receiver
+		 *  like compress_by_diff, but the size and the decoding cost scale with the kept weights instead of the model size.
+		 *  residual: error feedback. The changes not sent are accumulated and sent once they are large enough, pass the
+		 *  same net for all updates of a sender, an empty net starts from zero.
+		 *
+		 *  format: varint layer count, per layer: varint layer size, varint kept count, the kept indices as varint gaps, the values.
+		 */
+		template<typename DType>
+		static std::string compress_by_sparse_delta(const Ml::caffe_parameter_net<DType>& net_before, const Ml::caffe_parameter_net<DType>& net_after, float keep_ratio, DType threshold = 0, Ml::caffe_parameter_net<DType>* residual = nullptr, size_t* total_weight_count = nullptr, size_t* kept_weight_count = nullptr)
+		{
+			auto net_diff = net_after - net_before;
+			if (residual != nullptr && !residual->getLayers().empty()) net_diff = net_diff + *residual;
 			
+			if (total_weight_count != nullptr) *total_weight_count = 0;
+			if (kept_weight_count != nullptr) *kept_weight_count = 0;
+			
+			auto& layers = net_diff.getLayers();
+			const auto& layers_after = net_after.getLayers();
+			std::string output;
+			append_varint(output, layers.size());
+			std::vector<uint32_t> kept_index;
+			std::vector<DType> kept_value;
+			for (int i = 0; i < layers.size(); ++i)
+			{
+				const size_t size = layers[i].size();
+				append_varint(output, size);
+				kept_index.clear();
+				if (size > 0) select_changes(layers[i].getBlob_p()->getData(), keep_ratio, threshold, kept_index);
+				append_varint(output, kept_index.size());
+				
+				uint32_t next_index = 0;
+				for (auto index: kept_index)
+				{
+					append_varint(output, index - next_index);
+					next_index = index + 1;
+				}
+				const auto& data_after = layers_after[i].getBlob_p()->getData();
+				kept_value.resize(kept_index.size());
+				for (size_t j = 0; j < kept_index.size(); ++j)
+				{
+					kept_value[j] = data_after[kept_index[j]];
+				}
+				output.append(reinterpret_cast<const char*>(kept_value.data()), kept_value.size() * sizeof(DType));
+				
+				//the sent changes leave the residual
+				if (residual != nullptr)
+				{
+					std::fill(kept_value.begin(), kept_value.end(), 0);
+					layers[i].patch_weight(kept_index.data(), kept_value.data(), kept_index.size());
+				}
+				
+				if (total_weight_count != nullptr) *total_weight_count += size;
+				if (kept_weight_count != nullptr) *kept_weight_count += kept_index.size();
+			}
+			if (residual != nullptr) *residual = std::move(net_diff);
+			
+			return output;
+		}
+		
+		//apply a sparse update to {model}, only the kept weights are visited
+		//return false if the update is malformed or does not match the model structure, the model is not changed then
+		template<typename DType>
+		static bool decompress_by_sparse_delta(Ml::caffe_parameter_net<DType>& model, const std::string& data)
+		{
+			auto& layers = model.getLayers();
+			std::vector<size_t> layer_sizes(layers.size());
+			for (size_t i = 0; i < layers.size(); ++i) layer_sizes[i] = layers[i].size();
+			const bool valid = parse_sparse_delta<DType>(data, layer_sizes, [&layers](size_t layer, const std::vector<uint32_t>& index, const std::vector<DType>& value)
+			{
+				layers[layer].patch_weight(index.data(), value.data(), index.size());
+			});
+			LOG_IF(WARNING, !valid) << "[sparse delta] corrupted update or the update does not match the model structure";
+			return valid;
+		}
+		
+		//the sparse update as a compress_by_diff patch: the shape of {reference}, NaN for the weights not kept; an empty model if the update is malformed
+		template<typename DType>
+		static Ml::caffe_parameter_net<DType> sparse_delta_to_patch(const Ml::caffe_parameter_net<DType>& reference, const std::string& data)
+		{
+			auto output = reference * DType(NAN);
+			if (!decompress_by_sparse_delta(output, data)) return {};
 			return output;
 		}
 	
 	private:
+		//the indices of the kept changes in ascending order
+		template<typename DType>
+		static void select_changes(const std::vector<DType>& diff, float keep_ratio, DType threshold, std::vector<uint32_t>& output)
+		{
+			if (threshold > 0)
+			{
+				for (uint32_t i = 0; i < diff.size(); ++i)
+				{
+					if (std::abs(diff[i]) >= threshold) output.push_back(i);
+				}
+				return;
+			}
+			
+			const size_t keep_count = std::min(diff.size(), size_t(std::ceil(double(keep_ratio) * double(diff.size()))));
+			if (keep_count == 0) return;
+			output.resize(diff.size());
+			std::iota(output.begin(), output.end(), 0);
+			if (keep_count < diff.size())
+			{
+				//the ties are broken by the index, so the selection does not depend on the nth_element implementation
+				std::nth_element(output.begin(), output.begin() + keep_count, output.end(), [&diff](uint32_t lhs, uint32_t rhs)
+				{
+					const DType lhs_magnitude = std::abs(diff[lhs]), rhs_magnitude = std::abs(diff[rhs]);
+					return lhs_magnitude > rhs_magnitude || (lhs_magnitude == rhs_magnitude && lhs < rhs);
+				});
+				output.resize(keep_count);
+			}
+			std::sort(output.begin(), output.end());
+		}
+		
+		/** function(layer index, kept indices, kept values) for each layer.
+		 *  The update comes from a peer: the layer count and sizes must be {layer_sizes}, and every count is checked against
+		 *  the layer size and the remaining bytes before anything is allocated. The first pass only validates, so function is
+		 *  called only if the whole update is valid. return false if it is not.
+		 */
+		template<typename DType, typename Function>
+		static bool parse_sparse_delta(const std::string& data, const std::vector<size_t>& layer_sizes, Function function)
+		{
+			std::vector<uint32_t> index;
+			std::vector<DType> value;
+			for (bool apply : {false, true})
+			{
+				const char* position = data.data();
+				const char* end = data.data() + data.size();
+				uint64_t layer_count;
+				if (!read_varint(position, end, layer_count) || layer_count != layer_sizes.size()) return false;
+				for (uint64_t layer = 0; layer < layer_count; ++layer)
+				{
+					uint64_t size, count;
+					if (!read_varint(position, end, size) || !read_varint(position, end, count)) return false;
+					//a kept weight takes at least one index byte and a value
+					if (size != layer_sizes[layer] || count > size || count > size_t(end - position) / (1 + sizeof(DType))) return false;
+					if (apply) index.resize(count);
+					uint64_t next_index = 0;
+					for (uint64_t i = 0; i < count; ++i)
+					{
+						uint64_t gap;
+						if (!read_varint(position, end, gap) || gap >= size - next_index) return false;
+						next_index += gap;
+						if (apply) index[i] = uint32_t(next_index);
+						next_index++;
+					}
+					if (size_t(end - position) < count * sizeof(DType)) return false;
+					if (apply)
+					{
+						value.resize(count);
+						std::memcpy(value.data(), position, count * sizeof(DType));
+						function(size_t(layer), index, value);
+					}
+					position += count * sizeof(DType);
+				}
+				if (position != end) return false;
+			}
+			return true;
+		}
+		
+		static void append_varint(std::string& output, uint64_t value)
+		{
+			while (value >= 0x80)
+			{
+				output.push_back(char(value | 0x80));
+				value >>= 7;
+			}
+			output.push_back(char(value));
+		}
+		
+		//return false if the varint is truncated or longer than 64 bits
+		static bool read_varint(const char*& position, const char* end, uint64_t& output)
+		{
+			output = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				if (position == end) return false;
+				const auto byte = uint8_t(*position++);
+				output |= uint64_t(byte & 0x7f) << shift;
+				if ((byte & 0x80) == 0) return true;
+			}
+			return false;
+		}
+		
 		//return <max, min>
 		template<typename T>
 		static std::tuple<T, T> find_max_min(T* data, size_t size)
@@ -112,45 +315,134 @@ namespace Ml
 	{
 		unknown = 0,
 		normal,
-		compressed_by_diff
+		compressed_by_diff,
+		sparse_delta
 		
 	};
 	
+	//the serialization of the raw models in a model stream, stored in the model stream trailer
+	enum class model_stream_format : uint8_t
+	{
+		boost_archive = 0, //the streams before the model container
+		container
+	};
+	
 	template<typename DType>
 	class model_interpreter
 	{
 	public:
 		constexpr static int identifier_size = 4;
 		
-		static std::string generate_model_stream_by_compress_diff(const Ml::caffe_parameter_net<DType>& net_before, const Ml::caffe_parameter_net<DType>& net_after, float filter_limit, size_t* total_weight_count = nullptr, size_t* dropped_weight_count = nullptr)
+		//the compression of the compressed_by_diff streams: LZ4 chunks, not shuffled since the dropped weights are long NaN runs
+		static chunk_compression::options default_compression()
+		{
+			chunk_compression::options output;
+			output.codec = compression_codec::lz4;
+			output.filter = compression_filter::none;
+			output.element_size = sizeof(DType);
+			return output;
+		}
+		
+		//codec: the number format of the weights, seed: the random stream of the stochastic rounding
+		static std::string generate_model_stream_by_compress_diff(const Ml::caffe_parameter_net<DType>& net_before, const Ml::caffe_parameter_net<DType>& net_after, float filter_limit, size_t* total_weight_count = nullptr, size_t* dropped_weight_count = nullptr, model_codec codec = model_codec::raw, uint64_t seed = 0, const chunk_compression::options& compression = default_compression())
+		{
+			std::string output;
+			auto diff_model = model_compress::compress_by_diff_get_model(net_before, net_after, filter_limit, total_weight_count, dropped_weight_count);
+			if (codec == model_codec::raw)
+			{
+				output = chunk_compression::compress(model_container<DType>::write(diff_model), compression);
+			}
+			else
+			{
+				//the quantized weights are not DType, they are not shuffled
+				auto quantized_compression = compression;
+				quantized_compression.filter = compression_filter::none;
+				output = chunk_compression::compress(model_quantization<DType>::encode(diff_model, codec, seed), quantized_compression);
+			}
+			append_identifier(output, compressed_by_diff, codec, codec == model_codec::raw ? model_stream_format::container : model_stream_format::boost_archive, true);
+			return output;
+		}
+		
+		static std::string generate_model_stream_by_sparse_delta(const Ml::caffe_parameter_net<DType>& net_before, const Ml::caffe_parameter_net<DType>& net_after, float keep_ratio, DType threshold = 0, Ml::caffe_parameter_net<DType>* residual = nullptr, size_t* total_weight_count = nullptr, size_t* kept_weight_count = nullptr)
 		{
-			std::string output = model_compress::compress_by_diff(net_before, net_after, filter_limit, total_weight_count, dropped_weight_count);
-			append_identifier(output, compressed_by_diff);
+			std::string output = model_compress::compress_by_sparse_delta(net_before, net_after, keep_ratio, threshold, residual, total_weight_count, kept_weight_count);
+			append_identifier(output, sparse_delta);
 			return output;
 		}
 		
-		static std::string generate_model_stream_normal(const Ml::caffe_parameter_net<DType>& net)
+		static std::string generate_model_stream_normal(const Ml::caffe_parameter_net<DType>& net, model_codec codec = model_codec::raw, uint64_t seed = 0)
 		{
-			auto output = serialize_wrap<boost::archive::binary_oarchive>(net).str();
-			append_identifier(output, normal);
+			std::string output;
+			if (codec == model_codec::raw)
+			{
+				output = model_container<DType>::write(net);
+			}
+			else
+			{
+				output = model_quantization<DType>::encode(net, codec, seed);
+			}
+			append_identifier(output, normal, codec, codec == model_codec::raw ? model_stream_format::container : model_stream_format::boost_archive);
 			return output;
 		}
 		
-		static std::tuple<Ml::caffe_parameter_net<DType>,model_compress_type> parse_model_stream(const std::string& data)
+		//reference: the model of the receiver, required by sparse_delta streams, which are returned as compressed_by_diff patches
+		//dictionary: required by the streams compressed with a dictionary
+		static std::tuple<Ml::caffe_parameter_net<DType>,model_compress_type> parse_model_stream(const std::string& data, const Ml::caffe_parameter_net<DType>* reference = nullptr, const compression_dictionary* dictionary = nullptr)
 		{
 			assert(data.size() > identifier_size);
 			model_compress_type type = unknown;
+			model_codec codec = model_codec::raw;
+			model_stream_format format = model_stream_format::boost_archive;
+			bool chunk_compressed = false;
 			Ml::caffe_parameter_net<DType> output_model;
-			parse_identifier(data, type);
-			std::stringstream ss;
-			ss.write(data.data(), data.size() - identifier_size);
-			if (type == normal)
+			parse_identifier(data, type, codec, format, chunk_compressed);
+			const auto decompress = [&data, chunk_compressed, dictionary]()
+			{
+				if (!chunk_compressed) return model_compress::lz_decompress(data.substr(0, data.size() - identifier_size));
+				auto output = chunk_compression::decompress(data.data(), data.size() - identifier_size, dictionary);
+				return output ? std::move(*output) : std::string();
+			};
+			if (codec >= model_codec::model_codec_last_index)
+			{
+				LOG(WARNING) << "unknown model stream codec";
+			}
+			else if (type == normal && codec != model_codec::raw)
+			{
+				auto decoded = model_quantization<DType>::decode(data.substr(0, data.size() - identifier_size));
+				if (decoded) output_model = std::move(*decoded);
+			}
+			else if (type == normal && format == model_stream_format::container)
+			{
+				auto view = view_model_stream(data);
+				if (view) output_model = view->to_net();
+			}
+			else if (type == normal)
 			{
+				std::stringstream ss;
+				ss.write(data.data(), data.size() - identifier_size);
 				output_model = deserialize_wrap<boost::archive::binary_iarchive, Ml::caffe_parameter_net<DType>>(ss);
 			}
+			else if(type == compressed_by_diff && codec != model_codec::raw)
+			{
+				auto payload = decompress();
+				auto decoded = payload.empty() ? std::nullopt : model_quantization<DType>::decode(payload);
+				if (decoded) output_model = std::move(*decoded);
+			}
+			else if(type == compressed_by_diff && format == model_stream_format::container)
+			{
+				auto container = decompress();
+				auto view = model_container_view<DType>::open(container);
+				if (view) output_model = view->to_net();
+			}
 			else if(type == compressed_by_diff)
 			{
-				output_model = model_compress::decompress_by_diff<DType>(ss.str());
+				output_model = model_compress::decompress_by_diff<DType>(data.substr(0, data.size() - identifier_size));
+			}
+			else if(type == sparse_delta)
+			{
+				if (reference == nullptr) LOG(WARNING) << "a sparse_delta model stream requires the model of the receiver";
+				else output_model = model_compress::sparse_delta_to_patch(*reference, data.substr(0, data.size() - identifier_size));
+				type = compressed_by_diff;
 			}
 			else
 			{
@@ -160,12 +452,29 @@ namespace Ml
 			return {output_model, type};
 		}
 	
+		//the model of a normal raw stream in place, without copying the weights; nullopt for the other streams
+		static std::optional<model_container_view<DType>> view_model_stream(const std::string& data, bool verify_checksum = true)
+		{
+			if (data.size() <= identifier_size) return std::nullopt;
+			model_compress_type type = unknown;
+			model_codec codec = model_codec::raw;
+			model_stream_format format = model_stream_format::boost_archive;
+			bool chunk_compressed = false;
+			parse_identifier(data, type, codec, format, chunk_compressed);
+			if (type != normal || codec != model_codec::raw || format != model_stream_format::container) return std::nullopt;
+			return model_container_view<DType>::open(data.data(), data.size() - identifier_size, verify_checksum);
+		}
+	
 	private:
-		static void append_identifier(std::string& data, model_compress_type type)
+		//identifier: type, codec, format (0 in the streams before the codecs and the container), 1 if chunk compressed (0: a single LZ4 block)
+		static void append_identifier(std::string& data, model_compress_type type, model_codec codec = model_codec::raw, model_stream_format format = model_stream_format::boost_archive, bool chunk_compressed = false)
 		{
 			char identifier[identifier_size];
 			std::memset(identifier, 0, identifier_size);
 			identifier[0] = type;
+			identifier[1] = char(codec);
+			identifier[2] = char(format);
+			identifier[3] = char(chunk_compressed);
 			data.reserve(data.size() + identifier_size);
 			for (char i : identifier)
 			{
@@ -173,11 +482,14 @@ namespace Ml
 			}
 		}
 		
-		static void parse_identifier(const std::string& data, model_compress_type& type)
+		static void parse_identifier(const std::string& data, model_compress_type& type, model_codec& codec, model_stream_format& format, bool& chunk_compressed)
 		{
 			char identifier[identifier_size];
 			std::memcpy(identifier, &data[data.size()-4], identifier_size);
 			type = model_compress_type(identifier[0]);
+			codec = model_codec(uint8_t(identifier[1]));
+			format = model_stream_format(uint8_t(identifier[2]));
+			chunk_compressed = identifier[3] == 1;
 		}
 		
 	};
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <bit>
+#include <span>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <functional>
+
+#include <glog/logging.h>
+#include "caffe_model_parameters.hpp"
+
+namespace Ml
+{
+	static_assert(std::endian::native == std::endian::little, "the model container stores the tensors in little endian");
+
+	/** flat model container, the wire format of the models.
+	 *  layout: header | layer table | net name, layer names, types and shapes | tensors
+	 *  The tensors are the raw weights, each aligned to 64 bytes from the start of the container, so a received buffer
+	 *  or a mmap'ed database value is used in place by model_container_view without deserialization. The checksum
+	 *  covers everything after the header.
+	 */
+	struct model_container_header
+	{
+		char magic[4];
+		uint16_t version;
+		uint16_t dtype_size;
+		uint32_t layer_count;
+		uint32_t name_size; //the net name, at the start of the string area
+		uint64_t string_size;
+		uint64_t total_size;
+		uint64_t checksum;
+	};
+
+	struct model_container_layer
+	{
+		uint64_t data_offset; //from the start of the container
+		uint64_t element_count;
+		uint32_t name_offset; //from the start of the string area
+		uint32_t name_size;
+		uint32_t type_offset;
+		uint32_t type_size;
+		uint32_t shape_offset; //int32 dimensions, 4-byte aligned
+		uint32_t shape_rank;
+	};
+
+	class model_container_format
+	{
+	public:
+		static constexpr char magic[4] = {'D', 'F', 'L', 'M'};
+		static constexpr uint16_t version = 1;
+		static constexpr size_t alignment = 64;
+
+		static size_t align(size_t offset, size_t target_alignment = alignment)
+		{
+			return (offset + target_alignment - 1) / target_alignment * target_alignment;
+		}
+
+		//four independent multiply-rotate lanes over 8-byte words, not cryptographic: the transactions are signed
+		static uint64_t checksum(const char* data, size_t size)
+		{
+			constexpr uint64_t prime_1 = 0x9E3779B185EBCA87ull, prime_2 = 0xC2B2AE3D27D4EB4Full;
+			uint64_t lanes[4] = {prime_1 + prime_2, prime_2, 0, 0 - prime_1};
+			size_t i = 0;
+			for (; i + 32 <= size; i += 32)
+			{
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					uint64_t word;
+					std::memcpy(&word, data + i + lane * 8, sizeof(word));
+					lanes[lane] = std::rotl(lanes[lane] + word * prime_2, 31) * prime_1;
+				}
+			}
+			uint64_t output = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18) + size;
+			for (; i < size; ++i)
+			{
+				output = std::rotl(output ^ (uint8_t(data[i]) * prime_1), 11) * prime_2;
+			}
+			output ^= output >> 33;
+			output *= prime_2;
+			output ^= output >> 29;
+			return output;
+		}
+	};
+
+	template<typename DType>
+	class model_container_view;
+
+	template<typename DType>
+	class model_container
+	{
+	public:
+		struct layer_info
+		{
+			std::string name;
+			std::string type;
+			std::vector<int> shape;
+			size_t element_count;
+		};
+
+		//the layers of {net}, for writing a net stored elsewhere in the same layout
+		static std::vector<layer_info> layout(const caffe_parameter_net<DType>& net)
+		{
+			std::vector<layer_info> output;
+			for (const auto& layer: net.getLayers())
+			{
+				const auto& blob = layer.getBlob_p();
+				output.push_back({layer.getName(), layer.getType(), blob ? blob->getShape() : std::vector<int>(), blob ? blob->getData().size() : 0});
+			}
+			return output;
+		}
+
+		static std::string write(const caffe_parameter_net<DType>& net)
+		{
+			const auto& layers = net.getLayers();
+			return write_layers(net.getName(), layout(net), [&layers](size_t index) { return layers[index].getBlob_p()->getData().data(); });
+		}
+
+		//{flat}: the tensors of {layers} one after another, such as a flat parameter arena, each tensor is copied once
+		static std::string write(const std::string& net_name, const std::vector<layer_info>& layers, const DType* flat)
+		{
+			std::vector<size_t> offsets;
+			size_t offset = 0;
+			for (const auto& layer: layers)
+			{
+				offsets.push_back(offset);
+				offset += layer.element_count;
+			}
+			return write_layers(net_name, layers, [flat, &offsets](size_t index) { return flat + offsets[index]; });
+		}
+
+	private:
+		//get_data(layer index) returns the tensor of the layer
+		template<typename GetData>
+		static std::string write_layers(const std::string& net_name, const std::vector<layer_info>& layers, GetData get_data)
+		{
+			//the string area: net name, then the name, type and shape of each layer
+			std::vector<model_container_layer> table(layers.size());
+			std::string strings = net_name;
+			for (size_t i = 0; i < layers.size(); ++i)
+			{
+				table[i].name_offset = uint32_t(strings.size());
+				table[i].name_size = uint32_t(layers[i].name.size());
+				strings += layers[i].name;
+				table[i].type_offset = uint32_t(strings.size());
+				table[i].type_size = uint32_t(layers[i].type.size());
+				strings += layers[i].type;
+				strings.resize(model_container_format::align(strings.size(), sizeof(int32_t)), '\0');
+				table[i].shape_offset = uint32_t(strings.size());
+				table[i].shape_rank = uint32_t(layers[i].shape.size());
+				for (int dimension: layers[i].shape)
+				{
+					const int32_t value = dimension;
+					strings.append(reinterpret_cast<const char*>(&value), sizeof(value));
+				}
+			}
+
+			const size_t string_begin = sizeof(model_container_header) + table.size() * sizeof(model_container_layer);
+			size_t offset = model_container_format::align(string_begin + strings.size());
+			for (size_t i = 0; i < layers.size(); ++i)
+			{
+				table[i].data_offset = offset;
+				table[i].element_count = layers[i].element_count;
+				offset = model_container_format::align(offset + layers[i].element_count * sizeof(DType));
+			}
+
+			std::string output(offset, '\0');
+			model_container_header header{};
+			std::memcpy(header.magic, model_container_format::magic, sizeof(header.magic));
+			header.version = model_container_format::version;
+			header.dtype_size = sizeof(DType);
+			header.layer_count = uint32_t(layers.size());
+			header.name_size = uint32_t(net_name.size());
+			header.string_size = strings.size();
+			header.total_size = output.size();
+			std::memcpy(output.data() + sizeof(header), table.data(), table.size() * sizeof(model_container_layer));
+			std::memcpy(output.data() + string_begin, strings.data(), strings.size());
+			for (size_t i = 0; i < layers.size(); ++i)
+			{
+				if (layers[i].element_count > 0) std::memcpy(output.data() + table[i].data_offset, get_data(i), layers[i].element_count * sizeof(DType));
+			}
+			header.checksum = model_container_format::checksum(output.data() + sizeof(header), output.size() - sizeof(header));
+			std::memcpy(output.data(), &header, sizeof(header));
+			return output;
+		}
+	};
+
+	/** read only view of a model container in a buffer owned by the caller.
+	 *  open() checks the header, the bounds of every entry and, if asked, the checksum; the accessors do not copy.
+	 *  The buffer must be aligned to alignof(DType), which std::string and mmap buffers are.
+	 */
+	template<typename DType>
+	class model_container_view
+	{
+	public:
+		static std::optional<model_container_view> open(const char* data, size_t size, bool verify_checksum = true)
+		{
+			model_container_view output(data);
+			if (size < sizeof(model_container_header))
+			{
+				LOG(WARNING) << "[model container] truncated header";
+				return std::nullopt;
+			}
+			std::memcpy(&output._header, data, sizeof(model_container_header));
+			const auto& header = output._header;
+			if (std::memcmp(header.magic, model_container_format::magic, sizeof(header.magic)) != 0 || header.version != model_container_format::version)
+			{
+				LOG(WARNING) << "[model container] not a model container of version " << model_container_format::version;
+				return std::nullopt;
+			}
+			if (header.dtype_size != sizeof(DType) || reinterpret_cast<uintptr_t>(data) % alignof(DType) != 0)
+			{
+				LOG(WARNING) << "[model container] the tensors are not " << sizeof(DType) << "-byte values in an aligned buffer";
+				return std::nullopt;
+			}
+			//the layer table and the string area must be in the buffer, checked without overflow for any header value
+			if (header.total_size != size || header.layer_count > (size - sizeof(model_container_header)) / sizeof(model_container_layer))
+			{
+				LOG(WARNING) << "[model container] truncated container";
+				return std::nullopt;
+			}
+			const size_t string_begin = sizeof(model_container_header) + size_t(header.layer_count) * sizeof(model_container_layer);
+			if (header.string_size > size - string_begin || header.name_size > header.string_size)
+			{
+				LOG(WARNING) << "[model container] truncated container";
+				return std::nullopt;
+			}
+			if (verify_checksum && model_container_format::checksum(data + sizeof(model_container_header), size - sizeof(model_container_header)) != header.checksum)
+			{
+				LOG(WARNING) << "[model container] checksum mismatch";
+				return std::nullopt;
+			}
+
+			output._strings = data + string_begin;
+			output._layers.resize(header.layer_count);
+			std::memcpy(output._layers.data(), data + sizeof(model_container_header), output._layers.size() * sizeof(model_container_layer));
+			for (const auto& layer: output._layers)
+			{
+				const bool strings_valid = uint64_t(layer.name_offset) + layer.name_size <= header.string_size && uint64_t(layer.type_offset) + layer.type_size <= header.string_size
+				                           && layer.shape_offset % sizeof(int32_t) == 0 && uint64_t(layer.shape_offset) + uint64_t(layer.shape_rank) * sizeof(int32_t) <= header.string_size;
+				const bool data_valid = layer.data_offset % model_container_format::alignment == 0 && layer.data_offset <= size && layer.element_count <= (size - layer.data_offset) / sizeof(DType);
+				if (!strings_valid || !data_valid)
+				{
+					LOG(WARNING) << "[model container] corrupted layer table";
+					return std::nullopt;
+				}
+			}
+			return output;
+		}
+
+		static std::optional<model_container_view> open(const std::string& data, bool verify_checksum = true)
+		{
+			return open(data.data(), data.size(), verify_checksum);
+		}
+
+		std::string_view net_name() const
+		{
+			return {_strings, _header.name_size};
+		}
+
+		size_t layer_count() const
+		{
+			return _layers.size();
+		}
+
+		std::string_view name(size_t layer) const
+		{
+			return {_strings + _layers[layer].name_offset, _layers[layer].name_size};
+		}
+
+		std::string_view type(size_t layer) const
+		{
+			return {_strings + _layers[layer].type_offset, _layers[layer].type_size};
+		}
+
+		std::span<const int32_t> shape(size_t layer) const
+		{
+			return {reinterpret_cast<const int32_t*>(_strings + _layers[layer].shape_offset), _layers[layer].shape_rank};
+		}
+
+		std::span<const DType> data(size_t layer) const
+		{
+			return {reinterpret_cast<const DType*>(_data + _layers[layer].data_offset), _layers[layer].element_count};
+		}
+
+		//copy into a caffe_parameter_net, for the code working on nets
+		caffe_parameter_net<DType> to_net() const
+		{
+			caffe_parameter_net<DType> output;
+			output.getName() = std::string(net_name());
+			auto& layers = output.getLayers();
+			layers.resize(layer_count());
+			for (size_t i = 0; i < layers.size(); ++i)
+			{
+				layers[i].getName() = std::string(name(i));
+				layers[i].getType() = std::string(type(i));
+				layers[i].getBlob_p().reset(new tensor_blob_like<DType>());
+				auto shape_view = shape(i);
+				layers[i].getBlob_p()->getShape().assign(shape_view.begin(), shape_view.end());
+				auto data_view = data(i);
+				layers[i].getBlob_p()->getData().assign(data_view.begin(), data_view.end());
+			}
+			return output;
+		}
+
+	private:
+		explicit model_container_view(const char* data) : _data(data), _strings(nullptr), _header{} {}
+
+		const char* _data;
+		const char* _strings;
+		model_container_header _header;
+		std::vector<model_container_layer> _layers;
+	};
+}
@@ -0,0 +1,321 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <tuple>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+
+#include <glog/logging.h>
+#include <counter_rng.hpp>
+#include <boost_serialization_wrapper.hpp>
+#include "caffe_model_parameters.hpp"
+
+namespace Ml
+{
+	//the number format of the weights in a model stream, the values are stored in the model stream trailer
+	enum class model_codec : uint8_t
+	{
+		raw = 0, //DType, boost serialized
+		fp16,
+		bf16,
+		int8, //per layer scale, round to nearest
+		int4, //per layer scale, stochastic rounding
+
+		model_codec_last_index
+	};
+
+	/** quantized model payloads.
+	 *  The layer names and shapes are serialized without the weights, followed by one quantized buffer per layer.
+	 *  fp16 and bf16 keep NaN (the dropped weights of compress_by_diff), int8 and int4 reserve the lowest code for it.
+	 *  The int8 scale is max(|w|) / 127 per layer; int4 uses max(|w|) / 7 and rounds stochastically, so the quantization
+	 *  error is unbiased and averages out over the aggregated models. The random stream is keyed by {seed} and the layer.
+	 *  decode() checks the payload of every layer against its size, a corrupted or unknown payload gives nullopt.
+	 */
+	template<typename DType>
+	class model_quantization
+	{
+	public:
+		static std::string encode(const caffe_parameter_net<DType>& net, model_codec codec, uint64_t seed = 0)
+		{
+			LOG_IF(FATAL, codec == model_codec::raw || codec >= model_codec::model_codec_last_index) << "invalid quantization codec: " << int(codec);
+
+			auto structure = net;
+			std::vector<uint64_t> sizes;
+			std::vector<std::string> payloads;
+			auto& layers = structure.getLayers();
+			const auto& source_layers = net.getLayers();
+			for (int i = 0; i < layers.size(); ++i)
+			{
+				const auto& blob = source_layers[i].getBlob_p();
+				const size_t size = blob ? blob->getData().size() : 0;
+				sizes.push_back(size);
+				payloads.emplace_back();
+				if (size == 0) continue;
+
+				//the structure keeps the shape only, the blob is replaced so the copies of the net are not changed
+				auto shape = blob->getShape();
+				layers[i].getBlob_p().reset(new tensor_blob_like<DType>());
+				layers[i].getBlob_p()->getShape() = std::move(shape);
+
+				const DType* data = blob->getData().data();
+				auto& payload = payloads.back();
+				switch (codec)
+				{
+					case model_codec::fp16:
+						payload.resize(size * sizeof(uint16_t));
+						to_fp16(data, reinterpret_cast<uint16_t*>(payload.data()), size);
+						break;
+					case model_codec::bf16:
+						payload.resize(size * sizeof(uint16_t));
+						to_bf16(data, reinterpret_cast<uint16_t*>(payload.data()), size);
+						break;
+					case model_codec::int8:
+						payload = to_int8(data, size);
+						break;
+					case model_codec::int4:
+						payload = to_int4(data, size, counter_rng(seed, uint32_t(i), 0, 0));
+						break;
+					default:
+						break;
+				}
+			}
+
+			std::tuple<caffe_parameter_net<DType>, uint8_t, std::vector<uint64_t>, std::vector<std::string>> content{structure, uint8_t(codec), sizes, payloads};
+			return serialize_wrap<boost::archive::binary_oarchive>(content).str();
+		}
+
+		//nullopt with a warning if the payload is corrupted, it may come from a peer
+		static std::optional<caffe_parameter_net<DType>> decode(const std::string& data)
+		{
+			std::tuple<caffe_parameter_net<DType>, uint8_t, std::vector<uint64_t>, std::vector<std::string>> content;
+			try
+			{
+				content = deserialize_wrap<boost::archive::binary_iarchive, decltype(content)>(data);
+			}
+			catch (const std::exception& e)
+			{
+				LOG(WARNING) << "[quantization] corrupted model payload: " << e.what();
+				return std::nullopt;
+			}
+			auto& [net, codec_value, sizes, payloads] = content;
+			const auto codec = model_codec(codec_value);
+			if (codec == model_codec::raw || codec >= model_codec::model_codec_last_index)
+			{
+				LOG(WARNING) << "[quantization] unknown codec: " << int(codec_value);
+				return std::nullopt;
+			}
+			auto& layers = net.getLayers();
+			if (sizes.size() != layers.size() || payloads.size() != layers.size())
+			{
+				LOG(WARNING) << "[quantization] corrupted model payload";
+				return std::nullopt;
+			}
+			for (int i = 0; i < layers.size(); ++i)
+			{
+				if (sizes[i] == 0) continue;
+				const auto& payload = payloads[i];
+				//the size is checked against the payload before the layer is allocated
+				if (!layers[i].getBlob_p() || !payload_matches(codec, payload.size(), sizes[i]))
+				{
+					LOG(WARNING) << "[quantization] corrupted layer " << i << ", " << sizes[i] << " weights in " << payload.size() << " bytes";
+					return std::nullopt;
+				}
+				auto& output = layers[i].getBlob_p()->getData();
+				output.resize(sizes[i]);
+				switch (codec)
+				{
+					case model_codec::fp16:
+						from_fp16(reinterpret_cast<const uint16_t*>(payload.data()), output.data(), sizes[i]);
+						break;
+					case model_codec::bf16:
+						from_bf16(reinterpret_cast<const uint16_t*>(payload.data()), output.data(), sizes[i]);
+						break;
+					case model_codec::int8:
+						from_int8(payload, output.data(), sizes[i]);
+						break;
+					case model_codec::int4:
+						from_int4(payload, output.data(), sizes[i]);
+						break;
+					default:
+						break;
+				}
+			}
+			return std::move(net);
+		}
+
+		static float half_to_float(uint16_t value)
+		{
+			const uint32_t sign = uint32_t(value & 0x8000) << 16;
+			const uint32_t exponent = (value >> 10) & 0x1f, mantissa = value & 0x3ff;
+			uint32_t bits;
+			if (exponent == 0)
+			{
+				//zero and subnormal: mantissa * 2^-24
+				const float magnitude = float(mantissa) * (1.0f / 16777216.0f);
+				std::memcpy(&bits, &magnitude, sizeof(bits));
+			}
+			else if (exponent == 31)
+			{
+				bits = 0x7f800000 | (mantissa << 13);
+			}
+			else
+			{
+				bits = ((exponent + 112) << 23) | (mantissa << 13);
+			}
+			bits |= sign;
+			float output;
+			std::memcpy(&output, &bits, sizeof(output));
+			return output;
+		}
+
+		//round to nearest even
+		static uint16_t float_to_half(float value)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			const uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+			const uint32_t magnitude_bits = bits & 0x7fffffff;
+			if (magnitude_bits > 0x7f800000) return sign | 0x7e00; //NaN
+			if (magnitude_bits >= 0x477ff000) return sign | 0x7c00; //inf, and the values rounded above 65504
+			if (magnitude_bits < 0x38800000)
+			{
+				//below 2^-14: subnormal, the unit is 2^-24
+				float magnitude;
+				std::memcpy(&magnitude, &magnitude_bits, sizeof(magnitude));
+				return sign | uint16_t(std::nearbyint(magnitude * 16777216.0f));
+			}
+			const uint32_t rounded = magnitude_bits + 0xfff + ((magnitude_bits >> 13) & 1);
+			return sign | uint16_t((rounded - 0x38000000) >> 13);
+		}
+
+	private:
+		//the payload of {size} weights is {payload_size} bytes, without overflow for a corrupted size
+		static bool payload_matches(model_codec codec, uint64_t payload_size, uint64_t size)
+		{
+			switch (codec)
+			{
+				case model_codec::fp16:
+				case model_codec::bf16:
+					return payload_size % sizeof(uint16_t) == 0 && payload_size / sizeof(uint16_t) == size;
+				case model_codec::int8:
+					return payload_size >= sizeof(float) && payload_size - sizeof(float) == size;
+				case model_codec::int4:
+					return payload_size >= sizeof(float) && payload_size - sizeof(float) == size / 2 + size % 2;
+				default:
+					return false;
+			}
+		}
+
+		static void to_fp16(const DType* input, uint16_t* output, size_t size)
+		{
+			for (size_t i = 0; i < size; ++i) output[i] = float_to_half(float(input[i]));
+		}
+
+		static void from_fp16(const uint16_t* input, DType* output, size_t size)
+		{
+			for (size_t i = 0; i < size; ++i) output[i] = DType(half_to_float(input[i]));
+		}
+
+		//bfloat16 is the upper half of a float, rounded to nearest even
+		static void to_bf16(const DType* input, uint16_t* output, size_t size)
+		{
+			for (size_t i = 0; i < size; ++i)
+			{
+				const float value = float(input[i]);
+				uint32_t bits;
+				std::memcpy(&bits, &value, sizeof(bits));
+				const uint32_t rounded = (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+				output[i] = uint16_t(value != value ? (bits >> 16) | 0x40 : rounded);
+			}
+		}
+
+		static void from_bf16(const uint16_t* input, DType* output, size_t size)
+		{
+			for (size_t i = 0; i < size; ++i)
+			{
+				const uint32_t bits = uint32_t(input[i]) << 16;
+				float value;
+				std::memcpy(&value, &bits, sizeof(value));
+				output[i] = DType(value);
+			}
+		}
+
+		//the largest finite magnitude, NaN is skipped
+		static float max_magnitude(const DType* input, size_t size)
+		{
+			float output = 0;
+			for (size_t i = 0; i < size; ++i)
+			{
+				const float magnitude = std::fabs(float(input[i]));
+				output = magnitude > output ? magnitude : output;
+			}
+			return output;
+		}
+
+		//payload: float scale, int8 per weight, -128 is NaN
+		static std::string to_int8(const DType* input, size_t size)
+		{
+			const float max_value = max_magnitude(input, size);
+			const float scale = max_value > 0 ? max_value / 127.0f : 1.0f;
+			const float inverse_scale = 1.0f / scale;
+			std::string output(sizeof(float) + size, '\0');
+			std::memcpy(output.data(), &scale, sizeof(float));
+			auto* code = reinterpret_cast<int8_t*>(output.data() + sizeof(float));
+			for (size_t i = 0; i < size; ++i)
+			{
+				const float value = float(input[i]) * inverse_scale;
+				const float rounded = std::clamp(value + (value >= 0 ? 0.5f : -0.5f), -127.0f, 127.0f); //not converted if NaN
+				code[i] = value != value ? int8_t(-128) : int8_t(rounded);
+			}
+			return output;
+		}
+
+		static void from_int8(const std::string& payload, DType* output, size_t size)
+		{
+			float scale;
+			std::memcpy(&scale, payload.data(), sizeof(float));
+			const auto* code = reinterpret_cast<const int8_t*>(payload.data() + sizeof(float));
+			for (size_t i = 0; i < size; ++i)
+			{
+				output[i] = code[i] == -128 ? DType(NAN) : DType(float(code[i]) * scale);
+			}
+		}
+
+		//payload: float scale, two 4-bit codes per byte (the even index in the low half), -8 is NaN
+		static std::string to_int4(const DType* input, size_t size, counter_rng rng)
+		{
+			const float max_value = max_magnitude(input, size);
+			const float scale = max_value > 0 ? max_value / 7.0f : 1.0f;
+			const float inverse_scale = 1.0f / scale;
+			std::string output(sizeof(float) + (size + 1) / 2, '\0');
+			std::memcpy(output.data(), &scale, sizeof(float));
+			auto* code = reinterpret_cast<uint8_t*>(output.data() + sizeof(float));
+			for (size_t i = 0; i < size; ++i)
+			{
+				//floor(x + u), u uniform in [0, 1): x is rounded up with probability frac(x)
+				const float value = float(input[i]) * inverse_scale;
+				const float uniform = float(rng() >> 8) * (1.0f / 16777216.0f);
+				const int quantized = value != value ? -8 : int(std::clamp(std::floor(value + uniform), -7.0f, 7.0f));
+				code[i / 2] |= uint8_t((quantized & 0xf) << ((i % 2) * 4));
+			}
+			return output;
+		}
+
+		static void from_int4(const std::string& payload, DType* output, size_t size)
+		{
+			float scale;
+			std::memcpy(&scale, payload.data(), sizeof(float));
+			const auto* code = reinterpret_cast<const uint8_t*>(payload.data() + sizeof(float));
+			for (size_t i = 0; i < size; ++i)
+			{
+				//sign extend the 4-bit code
+				const int quantized = int(int8_t(uint8_t(code[i / 2] >> ((i % 2) * 4)) << 4)) >> 4;
+				output[i] = quantized == -8 ? DType(NAN) : DType(float(quantized) * scale);
+			}
+		}
+	};
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include <tmt.hpp>
+#include "./caffe_model_parameters.hpp"
+#include "./tensor_blob_like.hpp"
+
+namespace Ml
+{
+	/** parallel sum of a collection of models (or any items with a fixed flat layout).
+	 *  The items are split into at most leaf_count contiguous segments, each segment is summed into its own flat
+	 *  accumulator, then the accumulators are merged pairwise as a binary tree (log2(segments) parallel rounds).
+	 *  The segments do not depend on the thread count, so the result is bit-identical for any number of threads.
+	 */
+	template <typename DType>
+	class model_reduction
+	{
+	public:
+		static constexpr size_t leaf_count = 16;
+
+		/** accumulate(index, DType* accumulator) adds the item {index} to the flat accumulator of size {flat_size}.
+		 *  thread_count = 0: use all hardware threads.
+		 */
+		template <typename Accumulate>
+		static std::vector<DType> sum_flat(size_t count, size_t flat_size, Accumulate accumulate, uint32_t thread_count = 0)
+		{
+			if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+			const uint32_t segment_count = uint32_t(std::max<size_t>(1, std::min(leaf_count, count)));
+			thread_count = std::max<uint32_t>(1, std::min(thread_count, segment_count));
+
+			std::vector<std::vector<DType>> accumulators(segment_count);
+			tmt::ParallelExecution(thread_count, [count, flat_size, segment_count, &accumulate](uint32_t index, uint32_t thread_index, std::vector<DType>& accumulator)
+			{
+				accumulator.assign(flat_size, 0);
+				const size_t begin = count * index / segment_count, end = count * (index + 1) / segment_count;
+				for (size_t item = begin; item < end; ++item)
+				{
+					accumulate(item, accumulator.data());
+				}
+			}, segment_count, accumulators.data());
+
+			for (uint32_t step = 1; step < segment_count; step *= 2)
+			{
+				const uint32_t pair_count = (segment_count + 2 * step - 1) / (2 * step);
+				tmt::ParallelExecution(std::min(thread_count, pair_count), [step, segment_count, &accumulators](uint32_t index, uint32_t thread_index, std::vector<DType>&)
+				{
+					const uint32_t lhs = index * 2 * step, rhs = lhs + step;
+					if (rhs >= segment_count) return;
+					auto& lhs_data = accumulators[lhs];
+					const auto& rhs_data = accumulators[rhs];
+					for (size_t i = 0; i < lhs_data.size(); ++i) lhs_data[i] += rhs_data[i];
+				}, pair_count, accumulators.data());
+			}
+
+			return std::move(accumulators[0]);
+		}
+
+		//sum of get_model(0) ... get_model(count - 1), get_model returns caffe_parameter_net<DType> (or a reference to it)
+		template <typename GetModel>
+		static caffe_parameter_net<DType> sum(size_t count, GetModel get_model, uint32_t thread_count = 0)
+		{
+			return reduce(count, get_model, DType(1), thread_count);
+		}
+
+		template <typename GetModel>
+		static caffe_parameter_net<DType> average(size_t count, GetModel get_model, uint32_t thread_count = 0)
+		{
+			return reduce(count, get_model, DType(count), thread_count);
+		}
+
+		//element-wise sum of get_blobs(0) ... get_blobs(count - 1), get_blobs returns std::vector<tensor_blob_like<DType>> with the same shapes
+		template <typename GetBlobs>
+		static std::vector<tensor_blob_like<DType>> sum_blobs(size_t count, GetBlobs get_blobs, uint32_t thread_count = 0)
+		{
+			LOG_IF(FATAL, count == 0) << "no blobs to reduce";
+			std::vector<tensor_blob_like<DType>> output = get_blobs(0);
+			std::vector<size_t> offsets;
+			size_t flat_size = 0;
+			for (auto& blob: output)
+			{
+				offsets.push_back(flat_size);
+				flat_size += blob.getData().size();
+			}
+
+			auto flat = sum_flat(count, flat_size, [&get_blobs, &offsets](size_t index, DType* accumulator)
+			{
+				const auto& blobs = get_blobs(index);
+				for (size_t blob_index = 0; blob_index < blobs.size(); ++blob_index)
+				{
+					const auto& data = blobs[blob_index].getData();
+					DType* target = accumulator + offsets[blob_index];
+					for (size_t i = 0; i < data.size(); ++i) target[i] += data[i];
+				}
+			}, thread_count);
+
+			for (size_t blob_index = 0; blob_index < output.size(); ++blob_index)
+			{
+				auto& data = output[blob_index].getData();
+				std::copy(flat.begin() + offsets[blob_index], flat.begin() + offsets[blob_index] + data.size(), data.begin());
+			}
+			return output;
+		}
+
+	private:
+		template <typename GetModel>
+		static caffe_parameter_net<DType> reduce(size_t count, GetModel get_model, DType divisor, uint32_t thread_count)
+		{
+			LOG_IF(FATAL, count == 0) << "no models to reduce";
+			caffe_parameter_net<DType> output = get_model(0);
+			output.set_all(0); //copy on write, the blobs of model 0 are not changed
+
+			auto& layers = output.getLayers();
+			std::vector<size_t> offsets;
+			size_t flat_size = 0;
+			for (auto& layer: layers)
+			{
+				offsets.push_back(flat_size);
+				flat_size += layer.getBlob_p()->getData().size();
+			}
+
+			auto flat = sum_flat(count, flat_size, [&get_model, &offsets](size_t index, DType* accumulator)
+			{
+				const caffe_parameter_net<DType>& model = get_model(index);
+				const auto& model_layers = model.getLayers();
+				for (size_t layer_index = 0; layer_index < model_layers.size(); ++layer_index)
+				{
+					const auto& data = model_layers[layer_index].getBlob_p()->getData();
+					DType* target = accumulator + offsets[layer_index];
+					for (size_t i = 0; i < data.size(); ++i) target[i] += data[i];
+				}
+			}, thread_count);
+
+			for (size_t layer_index = 0; layer_index < layers.size(); ++layer_index)
+			{
+				auto& data = layers[layer_index].getBlob_p()->getData();
+				for (size_t i = 0; i < data.size(); ++i) data[i] = flat[offsets[layer_index] + i] / divisor;
+			}
+			return output;
+		}
+	};
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+#include <glog/logging.h>
+#include <tmt.hpp>
+#include "./caffe_model_parameters.hpp"
+#include "./robust_aggregation.hpp"
+
+namespace Ml
+{
+	/** cosine similarity, L2 distance and sign agreement between all pairs of a set of models.
+	 *  All pairs are computed in one pass, as a GEMM of the models with their transpose: the models are split into
+	 *  tiles of tile_models models and the parameters into chunks of chunk_size values, a pair of tiles accumulates
+	 *  the dot products (in double) and the matching signs of a chunk while the chunks of both tiles are in the cache.
+	 *  The norms are the diagonal of the dot products, they are computed once and shared by all the pairs. The squared
+	 *  distance is accumulated directly in the same pass, ||a||^2 + ||b||^2 - 2 a.b cancels for near identical models.
+	 *  The models should be complete, the NaN (dropped) weights of compressed_by_diff models make the pairs NaN.
+	 */
+	template <typename DType>
+	class model_similarity
+	{
+	public:
+		using flat_models = typename robust_aggregation<DType>::flat_models;
+		static constexpr size_t tile_models = 8;
+		static constexpr size_t chunk_size = 1024;
+
+		size_t count = 0;
+		size_t parameter_count = 0;
+		std::vector<double> norm;
+		//count x count, row major
+		std::vector<double> dot;
+		std::vector<double> cosine; //0 if one model is all 0
+		std::vector<double> l2;
+		std::vector<double> sign_agreement; //the ratio of the parameters of the same sign (-, 0, +)
+
+		//thread_count = 0: use all hardware threads
+		static model_similarity compute_flat(const flat_models& models, uint32_t thread_count = 0)
+		{
+			model_similarity output;
+			const size_t count = models.count();
+			output.count = count;
+			output.parameter_count = models.parameter_count();
+			output.dot.assign(count * count, 0);
+			std::vector<double> squared_distance(count * count, 0);
+			std::vector<uint64_t> same_sign(count * count, 0);
+
+			const size_t tile_count = (count + tile_models - 1) / tile_models;
+			std::vector<std::pair<size_t, size_t>> tasks;
+			for (size_t tile_i = 0; tile_i < tile_count; ++tile_i)
+			{
+				for (size_t tile_j = tile_i; tile_j < tile_count; ++tile_j) tasks.emplace_back(tile_i, tile_j);
+			}
+			if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+			thread_count = uint32_t(std::max<size_t>(1, std::min<size_t>(thread_count, tasks.size())));
+			tmt::ParallelExecution(thread_count, [&models, &tasks, &output, &squared_distance, &same_sign, count](uint32_t index, uint32_t thread_index)
+			{
+				const auto [tile_i, tile_j] = tasks[index];
+				const size_t begin_i = tile_i * tile_models, end_i = std::min(begin_i + tile_models, count);
+				const size_t begin_j = tile_j * tile_models, end_j = std::min(begin_j + tile_models, count);
+				double tile_dot[tile_models][tile_models] = {};
+				double tile_squared_distance[tile_models][tile_models] = {};
+				uint64_t tile_same_sign[tile_models][tile_models] = {};
+				for (size_t segment = 0; segment < models.sizes.size(); ++segment)
+				{
+					for (size_t begin = 0; begin < models.sizes[segment]; begin += chunk_size)
+					{
+						const size_t size = std::min(chunk_size, models.sizes[segment] - begin);
+						for (size_t i = begin_i; i < end_i; ++i)
+						{
+							const DType* lhs = models.models[i][segment] + begin;
+							for (size_t j = std::max(i, begin_j); j < end_j; ++j)
+							{
+								pair_statistics(lhs, models.models[j][segment] + begin, size, tile_dot[i - begin_i][j - begin_j], tile_squared_distance[i - begin_i][j - begin_j], tile_same_sign[i - begin_i][j - begin_j]);
+							}
+						}
+					}
+				}
+				//each task writes its own tile
+				for (size_t i = begin_i; i < end_i; ++i)
+				{
+					for (size_t j = std::max(i, begin_j); j < end_j; ++j)
+					{
+						output.dot[i * count + j] = output.dot[j * count + i] = tile_dot[i - begin_i][j - begin_j];
+						squared_distance[i * count + j] = squared_distance[j * count + i] = tile_squared_distance[i - begin_i][j - begin_j];
+						same_sign[i * count + j] = same_sign[j * count + i] = tile_same_sign[i - begin_i][j - begin_j];
+					}
+				}
+			}, tasks.size());
+
+			output.norm.resize(count);
+			for (size_t i = 0; i < count; ++i) output.norm[i] = std::sqrt(output.dot[i * count + i]);
+			output.cosine.resize(count * count);
+			output.l2.resize(count * count);
+			output.sign_agreement.resize(count * count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				for (size_t j = 0; j < count; ++j)
+				{
+					const size_t k = i * count + j;
+					const double norm_product = output.norm[i] * output.norm[j];
+					output.cosine[k] = norm_product == 0 ? 0 : output.dot[k] / norm_product;
+					output.l2[k] = std::sqrt(squared_distance[k]);
+					output.sign_agreement[k] = output.parameter_count == 0 ? 1 : double(same_sign[k]) / double(output.parameter_count);
+				}
+			}
+			return output;
+		}
+
+		//get_model(index) returns caffe_parameter_net<DType> (or a reference to it), the layers without blobs are skipped
+		template <typename GetModel>
+		static model_similarity compute(size_t count, GetModel get_model, uint32_t thread_count = 0)
+		{
+			//the copies share the blobs, they keep the models returned by value alive
+			std::vector<caffe_parameter_net<DType>> models;
+			models.reserve(count);
+			for (size_t i = 0; i < count; ++i) models.push_back(get_model(i));
+			return compute_flat(robust_aggregation<DType>::flatten(models), thread_count);
+		}
+
+	private:
+		static int sign(DType value)
+		{
+			return int(value > 0) - int(value < 0);
+		}
+
+		//independent partial sums, so the compiler vectorizes the loop without reordering a single sum
+		static void pair_statistics(const DType* lhs, const DType* rhs, size_t size, double& dot, double& squared_distance, uint64_t& same_sign)
+		{
+			constexpr size_t lane_count = 8;
+			double dot_lanes[lane_count] = {};
+			double squared_distance_lanes[lane_count] = {};
+			uint32_t same_sign_lanes[lane_count] = {};
+			size_t i = 0;
+			for (; i + lane_count <= size; i += lane_count)
+			{
+				for (size_t lane = 0; lane < lane_count; ++lane)
+				{
+					const double difference = double(lhs[i + lane]) - double(rhs[i + lane]);
+					dot_lanes[lane] += double(lhs[i + lane]) * double(rhs[i + lane]);
+					squared_distance_lanes[lane] += difference * difference;
+					same_sign_lanes[lane] += uint32_t(sign(lhs[i + lane]) == sign(rhs[i + lane]));
+				}
+			}
+			for (; i < size; ++i)
+			{
+				const double difference = double(lhs[i]) - double(rhs[i]);
+				dot_lanes[0] += double(lhs[i]) * double(rhs[i]);
+				squared_distance_lanes[0] += difference * difference;
+				same_sign_lanes[0] += uint32_t(sign(lhs[i]) == sign(rhs[i]));
+			}
+			dot += std::accumulate(dot_lanes, dot_lanes + lane_count, 0.0);
+			squared_distance += std::accumulate(squared_distance_lanes, squared_distance_lanes + lane_count, 0.0);
+			same_sign += std::accumulate(same_sign_lanes, same_sign_lanes + lane_count, uint64_t(0));
+		}
+	};
+}
@@ -0,0 +1,441 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+#include <glog/logging.h>
+#include <tmt.hpp>
+#include "./caffe_model_parameters.hpp"
+
+namespace Ml
+{
+	/** Byzantine-robust aggregation rules: coordinate-wise median, trimmed mean, Krum / Multi-Krum and geometric median.
+	 *  The kernels work on the flat layout (each model is a list of contiguous segments, such as the layers of a
+	 *  caffe_parameter_net or the buffer of a model_container) and split the parameters into blocks of block_size
+	 *  values, so one block of all the models stays in the cache:
+	 *  - median / trimmed mean transpose a block so the values of one parameter are contiguous, then nth_element them.
+	 *  - Krum and the geometric median sum the distances block by block, each block of a model is reused for all the
+	 *    other models while it is in the cache.
+	 *  The sums are split into at most leaf_count fixed ranges of blocks, so the results do not depend on the thread count.
+	 *  median and trimmed mean skip NaN (the dropped weights of compressed_by_diff models), the distance based rules
+	 *  require the models to be complete.
+	 */
+	template <typename DType>
+	class robust_aggregation
+	{
+	public:
+		static constexpr size_t block_size = 256;
+		static constexpr size_t leaf_count = 16;
+
+		//segment s of model m starts at models[m][s] and has sizes[s] values
+		struct flat_models
+		{
+			std::vector<size_t> sizes;
+			std::vector<std::vector<const DType*>> models;
+
+			size_t count() const
+			{
+				return models.size();
+			}
+
+			size_t parameter_count() const
+			{
+				return std::accumulate(sizes.begin(), sizes.end(), size_t(0));
+			}
+		};
+
+		/** coordinate-wise median, NaN if the parameter is NaN in all models.
+		 *  output[s] receives segment s, thread_count = 0: use all hardware threads.
+		 */
+		static void median_flat(const flat_models& models, const std::vector<DType*>& output, uint32_t thread_count = 0)
+		{
+			reduce_columns(models, output, [](DType* first, DType* last)
+			{
+				return median_of(first, drop_nan(first, last));
+			}, thread_count);
+		}
+
+		//coordinate-wise mean after removing the trim_ratio (0 <= trim_ratio < 0.5) smallest and largest values
+		static void trimmed_mean_flat(const flat_models& models, double trim_ratio, const std::vector<DType*>& output, uint32_t thread_count = 0)
+		{
+			LOG_IF(FATAL, trim_ratio < 0 || trim_ratio >= 0.5) << "[robust_aggregation] trim ratio must be in [0, 0.5)";
+			reduce_columns(models, output, [trim_ratio](DType* first, DType* last)
+			{
+				return trimmed_mean_of(first, drop_nan(first, last), trim_ratio);
+			}, thread_count);
+		}
+
+		//output = sum(weights[m] * model m) / sum(weights), the models of weight 0 are not read
+		static void weighted_average_flat(const flat_models& models, const std::vector<double>& weights, const std::vector<DType*>& output, uint32_t thread_count = 0)
+		{
+			check_layout(models, output);
+			LOG_IF(FATAL, weights.size() != models.count()) << "[robust_aggregation] the weight count does not match the model count";
+			std::vector<size_t> selected;
+			double total_weight = 0;
+			for (size_t m = 0; m < weights.size(); ++m)
+			{
+				if (weights[m] == 0) continue;
+				selected.push_back(m);
+				total_weight += weights[m];
+			}
+			LOG_IF(FATAL, selected.empty()) << "[robust_aggregation] all weights are 0";
+
+			const auto blocks = split_blocks(models.sizes);
+			thread_count = resolve_thread_count(thread_count, blocks.size());
+			tmt::ParallelExecution(thread_count, [&models, &weights, &output, &blocks, &selected, total_weight](uint32_t index, uint32_t thread_index)
+			{
+				const auto& [segment, begin, end] = blocks[index];
+				double sum[block_size] = {};
+				for (size_t m: selected)
+				{
+					const DType* data = models.models[m][segment] + begin;
+					const double weight = weights[m];
+					for (size_t i = 0; i < end - begin; ++i) sum[i] += weight * double(data[i]);
+				}
+				DType* target = output[segment] + begin;
+				for (size_t i = 0; i < end - begin; ++i) target[i] = DType(sum[i] / total_weight);
+			}, blocks.size());
+		}
+
+		//the squared Euclidean distances between all pairs of models, distances[i * count + j]
+		static std::vector<double> pairwise_squared_distances(const flat_models& models, uint32_t thread_count = 0)
+		{
+			const size_t count = models.count();
+			const auto blocks = split_blocks(models.sizes);
+			auto distances = sum_blocks(blocks, count * count, [&models, count](const block& current, double* accumulator)
+			{
+				const auto& [segment, begin, end] = current;
+				for (size_t i = 0; i < count; ++i)
+				{
+					const DType* lhs = models.models[i][segment] + begin;
+					for (size_t j = i + 1; j < count; ++j)
+					{
+						accumulator[i * count + j] += squared_distance(lhs, models.models[j][segment] + begin, end - begin);
+					}
+				}
+			}, thread_count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				for (size_t j = 0; j < i; ++j) distances[i * count + j] = distances[j * count + i];
+			}
+			return distances;
+		}
+
+		/** the select_count models of the lowest Krum score (the sum of the squared distances to the closest
+		 *  count - byzantine_count - 2 other models), select_count = 1 is Krum, select_count > 1 is Multi-Krum.
+		 */
+		static std::vector<size_t> krum_select(const std::vector<double>& distances, size_t count, size_t byzantine_count, size_t select_count = 1)
+		{
+			LOG_IF(FATAL, count <= byzantine_count + 2) << "[robust_aggregation] Krum needs more than byzantine_count + 2 models";
+			LOG_IF(FATAL, distances.size() != count * count) << "[robust_aggregation] the distance matrix does not match the model count";
+			const size_t neighbour_count = count - byzantine_count - 2;
+			std::vector<double> scores(count), row(count - 1);
+			for (size_t i = 0; i < count; ++i)
+			{
+				size_t row_size = 0;
+				for (size_t j = 0; j < count; ++j)
+				{
+					if (j != i) row[row_size++] = distances[i * count + j];
+				}
+				std::nth_element(row.begin(), row.begin() + neighbour_count - 1, row.end());
+				scores[i] = std::accumulate(row.begin(), row.begin() + neighbour_count, 0.0);
+			}
+
+			std::vector<size_t> output(count);
+			std::iota(output.begin(), output.end(), 0);
+			std::stable_sort(output.begin(), output.end(), [&scores](size_t lhs, size_t rhs)
+			{
+				return scores[lhs] < scores[rhs];
+			});
+			output.resize(std::clamp<size_t>(select_count, 1, count));
+			return output;
+		}
+
+		//Krum / Multi-Krum: the average of the selected models, returns the selected models
+		static std::vector<size_t> krum_flat(const flat_models& models, size_t byzantine_count, size_t select_count, const std::vector<DType*>& output, uint32_t thread_count = 0)
+		{
+			auto selected = krum_select(pairwise_squared_distances(models, thread_count), models.count(), byzantine_count, select_count);
+			std::vector<double> weights(models.count(), 0);
+			for (size_t m: selected) weights[m] = 1;
+			weighted_average_flat(models, weights, output, thread_count);
+			return selected;
+		}
+
+		//the Euclidean distance of each model to {point}
+		static std::vector<double> distances_to(const flat_models& models, const std::vector<DType*>& point, uint32_t thread_count = 0)
+		{
+			check_layout(models, point);
+			const size_t count = models.count();
+			const auto blocks = split_blocks(models.sizes);
+			auto distances = sum_blocks(blocks, count, [&models, &point, count](const block& current, double* accumulator)
+			{
+				const auto& [segment, begin, end] = current;
+				const DType* center = point[segment] + begin;
+				for (size_t m = 0; m < count; ++m)
+				{
+					accumulator[m] += squared_distance(models.models[m][segment] + begin, center, end - begin);
+				}
+			}, thread_count);
+			for (auto& distance: distances) distance = std::sqrt(distance);
+			return distances;
+		}
+
+		/** geometric median by Weiszfeld iterations, starting from the mean. It stops when the sum of the distances
+		 *  improves by less than tolerance (relative) or after max_iterations, returns the iteration count.
+		 */
+		static size_t geometric_median_flat(const flat_models& models, const std::vector<DType*>& output, size_t max_iterations = 100, double tolerance = 1e-6, uint32_t thread_count = 0)
+		{
+			const size_t count = models.count();
+			std::vector<double> weights(count, 1.0);
+			weighted_average_flat(models, weights, output, thread_count);
+
+			double previous_objective = std::numeric_limits<double>::infinity();
+			size_t iteration = 0;
+			for (; iteration < max_iterations; ++iteration)
+			{
+				const auto distances = distances_to(models, output, thread_count);
+				const double objective = std::accumulate(distances.begin(), distances.end(), 0.0);
+				if (objective == 0 || previous_objective - objective <= tolerance * objective) break;
+				previous_objective = objective;
+
+				//a model at the current point would get an infinite weight
+				const double min_distance = objective * std::numeric_limits<float>::epsilon() / double(count);
+				for (size_t m = 0; m < count; ++m) weights[m] = 1.0 / std::max(distances[m], min_distance);
+				weighted_average_flat(models, weights, output, thread_count);
+			}
+			return iteration;
+		}
+
+		//the flat layout of the models, one segment per layer with a blob; the models must outlive the result
+		static flat_models flatten(const std::vector<caffe_parameter_net<DType>>& models)
+		{
+			return flatten(models.size(), [&models](size_t index) -> const caffe_parameter_net<DType>& { return models[index]; });
+		}
+
+		//get_model(index) returns a reference to caffe_parameter_net<DType>, so the models stay in place
+		template <typename GetModel>
+		static flat_models flatten(size_t count, GetModel get_model)
+		{
+			flat_models output;
+			if (count == 0) return output;
+			output.models.resize(count);
+			const auto& first_layers = get_model(0).getLayers();
+			for (size_t layer_index = 0; layer_index < first_layers.size(); ++layer_index)
+			{
+				if (!first_layers[layer_index].getBlob_p()) continue;
+				const size_t size = first_layers[layer_index].getBlob_p()->getData().size();
+				output.sizes.push_back(size);
+				for (size_t m = 0; m < count; ++m)
+				{
+					const auto& layers = get_model(m).getLayers();
+					LOG_IF(FATAL, layers.size() != first_layers.size() || !layers[layer_index].getBlob_p() || layers[layer_index].getBlob_p()->getData().size() != size)
+						<< "[robust_aggregation] the models have different structures";
+					output.models[m].push_back(layers[layer_index].getBlob_p()->getData().data());
+				}
+			}
+			return output;
+		}
+
+		/** the rules on caffe_parameter_net, get_model(index) returns caffe_parameter_net<DType> (or a reference to it).
+		 *  The layers without blobs are skipped.
+		 */
+		template <typename GetModel>
+		static caffe_parameter_net<DType> median(size_t count, GetModel get_model, uint32_t thread_count = 0)
+		{
+			return aggregate(count, get_model, [thread_count](const flat_models& models, const std::vector<DType*>& output)
+			{
+				median_flat(models, output, thread_count);
+			});
+		}
+
+		template <typename GetModel>
+		static caffe_parameter_net<DType> trimmed_mean(size_t count, GetModel get_model, double trim_ratio, uint32_t thread_count = 0)
+		{
+			return aggregate(count, get_model, [trim_ratio, thread_count](const flat_models& models, const std::vector<DType*>& output)
+			{
+				trimmed_mean_flat(models, trim_ratio, output, thread_count);
+			});
+		}
+
+		template <typename GetModel>
+		static caffe_parameter_net<DType> krum(size_t count, GetModel get_model, size_t byzantine_count, size_t select_count = 1, uint32_t thread_count = 0)
+		{
+			return aggregate(count, get_model, [byzantine_count, select_count, thread_count](const flat_models& models, const std::vector<DType*>& output)
+			{
+				krum_flat(models, byzantine_count, select_count, output, thread_count);
+			});
+		}
+
+		template <typename GetModel>
+		static caffe_parameter_net<DType> geometric_median(size_t count, GetModel get_model, size_t max_iterations = 100, double tolerance = 1e-6, uint32_t thread_count = 0)
+		{
+			return aggregate(count, get_model, [max_iterations, tolerance, thread_count](const flat_models& models, const std::vector<DType*>& output)
+			{
+				geometric_median_flat(models, output, max_iterations, tolerance, thread_count);
+			});
+		}
+
+	private:
+		struct block
+		{
+			size_t segment;
+			size_t begin;
+			size_t end;
+		};
+
+		static uint32_t resolve_thread_count(uint32_t thread_count, size_t task_count)
+		{
+			if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+			return uint32_t(std::max<size_t>(1, std::min<size_t>(thread_count, task_count)));
+		}
+
+		static std::vector<block> split_blocks(const std::vector<size_t>& sizes)
+		{
+			std::vector<block> output;
+			for (size_t segment = 0; segment < sizes.size(); ++segment)
+			{
+				for (size_t begin = 0; begin < sizes[segment]; begin += block_size)
+				{
+					output.push_back({segment, begin, std::min(begin + block_size, sizes[segment])});
+				}
+			}
+			return output;
+		}
+
+		static void check_layout(const flat_models& models, const std::vector<DType*>& output)
+		{
+			LOG_IF(FATAL, models.count() == 0) << "[robust_aggregation] no models to aggregate";
+			LOG_IF(FATAL, output.size() != models.sizes.size()) << "[robust_aggregation] the output does not match the segments";
+			for (const auto& model: models.models)
+			{
+				LOG_IF(FATAL, model.size() != models.sizes.size()) << "[robust_aggregation] the models have different structures";
+			}
+		}
+
+		//accumulate(block, accumulator) for all blocks, each of the at most leaf_count ranges of blocks has its own accumulator
+		template <typename Accumulate>
+		static std::vector<double> sum_blocks(const std::vector<block>& blocks, size_t accumulator_size, Accumulate accumulate, uint32_t thread_count)
+		{
+			const uint32_t range_count = uint32_t(std::max<size_t>(1, std::min(leaf_count, blocks.size())));
+			std::vector<std::vector<double>> accumulators(range_count);
+			tmt::ParallelExecution(resolve_thread_count(thread_count, range_count), [&blocks, accumulator_size, range_count, &accumulate](uint32_t index, uint32_t thread_index, std::vector<double>& accumulator)
+			{
+				accumulator.assign(accumulator_size, 0);
+				const size_t begin = blocks.size() * index / range_count, end = blocks.size() * (index + 1) / range_count;
+				for (size_t i = begin; i < end; ++i) accumulate(blocks[i], accumulator.data());
+			}, range_count, accumulators.data());
+
+			for (uint32_t range = 1; range < range_count; ++range)
+			{
+				for (size_t i = 0; i < accumulator_size; ++i) accumulators[0][i] += accumulators[range][i];
+			}
+			return std::move(accumulators[0]);
+		}
+
+		//reduce(first, last) of the values of each parameter, the range can be reordered
+		template <typename Reduce>
+		static void reduce_columns(const flat_models& models, const std::vector<DType*>& output, Reduce reduce, uint32_t thread_count)
+		{
+			check_layout(models, output);
+			const size_t count = models.count();
+			const auto blocks = split_blocks(models.sizes);
+			thread_count = resolve_thread_count(thread_count, blocks.size());
+			std::vector<std::vector<DType>> columns(thread_count, std::vector<DType>(block_size * count));
+			tmt::ParallelExecution(thread_count, [&models, &output, &blocks, &columns, &reduce, count](uint32_t index, uint32_t thread_index)
+			{
+				const auto& [segment, begin, end] = blocks[index];
+				DType* column = columns[thread_index].data();
+				//transpose, each model is read sequentially
+				for (size_t m = 0; m < count; ++m)
+				{
+					const DType* data = models.models[m][segment] + begin;
+					for (size_t i = 0; i < end - begin; ++i) column[i * count + m] = data[i];
+				}
+				DType* target = output[segment] + begin;
+				for (size_t i = 0; i < end - begin; ++i) target[i] = reduce(column + i * count, column + (i + 1) * count);
+			}, blocks.size());
+		}
+
+		//independent partial sums, so the compiler vectorizes the loop without reordering a single sum
+		static double squared_distance(const DType* lhs, const DType* rhs, size_t size)
+		{
+			constexpr size_t lane_count = 8;
+			double lanes[lane_count] = {};
+			size_t i = 0;
+			for (; i + lane_count <= size; i += lane_count)
+			{
+				for (size_t lane = 0; lane < lane_count; ++lane)
+				{
+					const double diff = double(lhs[i + lane]) - double(rhs[i + lane]);
+					lanes[lane] += diff * diff;
+				}
+			}
+			for (; i < size; ++i)
+			{
+				const double diff = double(lhs[i]) - double(rhs[i]);
+				lanes[0] += diff * diff;
+			}
+			return std::accumulate(lanes, lanes + lane_count, 0.0);
+		}
+
+		//moves NaN to the end, returns the end of the other values
+		static DType* drop_nan(DType* first, DType* last)
+		{
+			return std::partition(first, last, [](DType value)
+			{
+				return value == value;
+			});
+		}
+
+		static DType median_of(DType* first, DType* last)
+		{
+			const size_t size = last - first;
+			if (size == 0) return DType(NAN);
+			DType* middle = first + size / 2;
+			std::nth_element(first, middle, last);
+			if (size % 2 == 1) return *middle;
+			const DType lower = *std::max_element(first, middle);
+			return DType((double(lower) + double(*middle)) / 2);
+		}
+
+		static DType trimmed_mean_of(DType* first, DType* last, double trim_ratio)
+		{
+			const size_t size = last - first;
+			if (size == 0) return DType(NAN);
+			const size_t trim = size_t(trim_ratio * double(size));
+			if (trim > 0)
+			{
+				std::nth_element(first, first + trim, last);
+				std::nth_element(first + trim, last - trim, last);
+			}
+			double sum = 0;
+			for (DType* value = first + trim; value != last - trim; ++value) sum += double(*value);
+			return DType(sum / double(size - 2 * trim));
+		}
+
+		template <typename GetModel, typename Aggregate>
+		static caffe_parameter_net<DType> aggregate(size_t count, GetModel get_model, Aggregate aggregate_function)
+		{
+			LOG_IF(FATAL, count == 0) << "[robust_aggregation] no models to aggregate";
+			//the copies share the blobs, they keep the models returned by value alive
+			std::vector<caffe_parameter_net<DType>> inputs;
+			inputs.reserve(count);
+			for (size_t i = 0; i < count; ++i) inputs.push_back(get_model(i));
+
+			const flat_models models = flatten(inputs);
+			caffe_parameter_net<DType> output = inputs[0];
+			output.set_all(0); //copy on write, the input blobs are not changed
+			std::vector<DType*> output_data;
+			for (auto& layer: output.getLayers())
+			{
+				if (layer.getBlob_p()) output_data.push_back(layer.getBlob_p()->getData().data());
+			}
+			aggregate_function(models, output_data);
+			return output;
+		}
+	};
+}
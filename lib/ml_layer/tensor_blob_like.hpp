@@ -163,11 +163,17 @@ namespace Ml {
         
         void random(DType min, DType max)
         {
-        	std::random_device rd;
+	        thread_local std::mt19937 rng(std::random_device{}());
+	        random(min, max, rng);
+        }
+        
+        template <typename RNG>
+        void random(DType min, DType max, RNG& rng)
+        {
         	std::uniform_real_distribution distribution(min, max);
 	        for (auto& single_value: _data)
 	        {
-		        single_value = distribution(rd);
+		        single_value = distribution(rng);
 	        }
         }
         
@@ -7,6 +7,7 @@
 #include <fstream>
 #include <string>
 #include <utility>
+#include <mutex>
 
 class global_profiler_recorder
 {
@@ -43,6 +44,7 @@ private:
 	friend class profiler_abs;
 	static global_profiler_recorder* _instance;
 	std::unordered_map<std::string, std::vector<record>> _performance_record;
+	std::mutex _performance_record_lock;
 	
 	using time_point = std::chrono::high_resolution_clock::time_point;
 	std::string serializeTimePoint( const time_point& time, const std::string& format)
@@ -107,6 +109,7 @@ private:
 	
 	void add_record(const std::string& name, const std::chrono::time_point<std::chrono::high_resolution_clock>& start, const std::chrono::time_point<std::chrono::high_resolution_clock>& stop)
 	{
+		std::lock_guard guard(_performance_record_lock); //the records may come from the worker threads
 		if (_performance_record.find(name) == _performance_record.end())
 		{
 			_performance_record.emplace(name, std::vector<record>());
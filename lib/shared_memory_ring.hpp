@@ -0,0 +1,223 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <glog/logging.h>
+
+/** memory shared between a process and the children it forks.
+ *  It is an anonymous shared mapping, so it must be created before fork() and nothing has to be cleaned up if a
+ *  process crashes. A new mapping is zero filled, the structures below rely on it.
+ */
+class shared_memory
+{
+public:
+	explicit shared_memory(size_t size) : _size(size)
+	{
+		_data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		LOG_IF(FATAL, _data == MAP_FAILED) << "cannot map " << _size << " bytes of shared memory: " << std::strerror(errno);
+	}
+
+	~shared_memory()
+	{
+		munmap(_data, _size);
+	}
+
+	shared_memory(const shared_memory&) = delete;
+	shared_memory& operator=(const shared_memory&) = delete;
+
+	char* data()
+	{
+		return static_cast<char*>(_data);
+	}
+
+	size_t size() const
+	{
+		return _size;
+	}
+
+private:
+	void* _data;
+	size_t _size;
+};
+
+//spin first, then sleep; idle() is called while sleeping, such as to check whether the other processes are alive
+class shared_memory_backoff
+{
+public:
+	explicit shared_memory_backoff(const std::function<void()>& idle) : _idle(idle), _count(0) {}
+
+	void wait()
+	{
+		_count++;
+		if (_count < 64) return;
+		if (_count < 128)
+		{
+			std::this_thread::yield();
+			return;
+		}
+		if (_idle && _count % 1024 == 0) _idle();
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+
+	void reset()
+	{
+		_count = 0;
+	}
+
+private:
+	const std::function<void()>& _idle;
+	uint32_t _count;
+};
+
+/** single producer single consumer byte ring in shared memory.
+ *  A message is a 8-byte length and the payload, a message can be larger than the ring: the producer blocks until the
+ *  consumer frees space, so the consumer must read while the producer writes.
+ */
+class shared_memory_ring
+{
+public:
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring requires address free atomics");
+
+	static size_t memory_size(size_t capacity)
+	{
+		return sizeof(header) + capacity;
+	}
+
+	//capacity must be a power of two, the memory must be zero filled
+	shared_memory_ring(char* memory, size_t capacity, std::function<void()> idle = {}) : _header(reinterpret_cast<header*>(memory)), _buffer(memory + sizeof(header)), _capacity(capacity), _idle(std::move(idle))
+	{
+		LOG_IF(FATAL, _capacity == 0 || (_capacity & (_capacity - 1)) != 0) << "ring capacity must be a power of two: " << _capacity;
+	}
+
+	//producer only
+	void write_message(const std::string& message)
+	{
+		const uint64_t size = message.size();
+		write(reinterpret_cast<const char*>(&size), sizeof(size));
+		write(message.data(), message.size());
+	}
+
+	//consumer only, true if at least the length of a message is in the ring
+	bool has_message() const
+	{
+		return _header->head.load(std::memory_order_acquire) - _header->tail.load(std::memory_order_relaxed) >= sizeof(uint64_t);
+	}
+
+	//consumer only, blocks until the whole message is written
+	std::string read_message()
+	{
+		uint64_t size;
+		read(reinterpret_cast<char*>(&size), sizeof(size));
+		std::string output(size, '\0');
+		read(output.data(), size);
+		return output;
+	}
+
+private:
+	struct header
+	{
+		alignas(64) std::atomic<uint64_t> head; //bytes written
+		alignas(64) std::atomic<uint64_t> tail; //bytes read
+	};
+
+	void write(const char* data, size_t size)
+	{
+		shared_memory_backoff backoff(_idle);
+		uint64_t head = _header->head.load(std::memory_order_relaxed);
+		while (size > 0)
+		{
+			const uint64_t free_space = _capacity - (head - _header->tail.load(std::memory_order_acquire));
+			if (free_space == 0)
+			{
+				backoff.wait();
+				continue;
+			}
+			const size_t offset = head & (_capacity - 1);
+			const size_t length = std::min<size_t>({size, free_space, _capacity - offset});
+			std::memcpy(_buffer + offset, data, length);
+			data += length;
+			size -= length;
+			head += length;
+			_header->head.store(head, std::memory_order_release);
+		}
+	}
+
+	void read(char* data, size_t size)
+	{
+		shared_memory_backoff backoff(_idle);
+		uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+		while (size > 0)
+		{
+			const uint64_t available = _header->head.load(std::memory_order_acquire) - tail;
+			if (available == 0)
+			{
+				backoff.wait();
+				continue;
+			}
+			const size_t offset = tail & (_capacity - 1);
+			const size_t length = std::min<size_t>({size, available, _capacity - offset});
+			std::memcpy(data, _buffer + offset, length);
+			data += length;
+			size -= length;
+			tail += length;
+			_header->tail.store(tail, std::memory_order_release);
+		}
+	}
+
+	header* _header;
+	char* _buffer;
+	size_t _capacity;
+	std::function<void()> _idle;
+};
+
+//barrier of a fixed number of processes in shared memory (sense reversing)
+class shared_memory_barrier
+{
+public:
+	static_assert(std::atomic<uint32_t>::is_always_lock_free, "the barrier requires address free atomics");
+
+	static size_t memory_size()
+	{
+		return sizeof(state);
+	}
+
+	//the memory must be zero filled
+	shared_memory_barrier(char* memory, uint32_t count, std::function<void()> idle = {}) : _state(reinterpret_cast<state*>(memory)), _count(count), _idle(std::move(idle))
+	{
+	}
+
+	void arrive_and_wait()
+	{
+		const uint32_t generation = _state->generation.load(std::memory_order_acquire);
+		if (_state->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == _count)
+		{
+			_state->arrived.store(0, std::memory_order_relaxed);
+			_state->generation.store(generation + 1, std::memory_order_release);
+			return;
+		}
+		shared_memory_backoff backoff(_idle);
+		while (_state->generation.load(std::memory_order_acquire) == generation)
+		{
+			backoff.wait();
+		}
+	}
+
+private:
+	struct state
+	{
+		alignas(64) std::atomic<uint32_t> arrived;
+		alignas(64) std::atomic<uint32_t> generation;
+	};
+
+	state* _state;
+	uint32_t _count;
+	std::function<void()> _idle;
+};
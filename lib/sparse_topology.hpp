@@ -0,0 +1,515 @@
+#pragma once
+
+#include <vector>
+#include <random>
+#include <string>
+#include <span>
+#include <cmath>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <filesystem>
+
+#include <glog/logging.h>
+
+/** sparse network topology with integer node ids (0 ... node_count - 1), stored as a CSR adjacency:
+ *  the peers of node i are _targets[_offsets[i]] ... _targets[_offsets[i + 1] - 1], sorted, without duplicates and self loops.
+ *  All generators run in O(N*k), an undirected graph is stored with both directions.
+ */
+class sparse_topology
+{
+public:
+	using node_id = uint32_t;
+	using edge = std::pair<node_id, node_id>;
+
+	sparse_topology() : _offsets(1, 0) {}
+
+	explicit sparse_topology(size_t node_count) : _offsets(node_count + 1, 0) {}
+
+	//directed: edge (a, b) adds b as a peer of a; undirected: b is a peer of a and a is a peer of b
+	static sparse_topology from_edges(size_t node_count, const std::vector<edge>& edges, bool directed)
+	{
+		sparse_topology output(node_count);
+		auto& offsets = output._offsets;
+		for (const auto& [lhs, rhs] : edges)
+		{
+			LOG_IF(FATAL, lhs >= node_count || rhs >= node_count) << "node id out of range: " << lhs << "-" << rhs << ", node count: " << node_count;
+			offsets[lhs + 1]++;
+			if (!directed) offsets[rhs + 1]++;
+		}
+		for (size_t i = 0; i < node_count; ++i) offsets[i + 1] += offsets[i];
+
+		//counting sort by source
+		std::vector<node_id> targets(offsets[node_count]);
+		std::vector<size_t> position(offsets.begin(), offsets.end() - 1);
+		for (const auto& [lhs, rhs] : edges)
+		{
+			targets[position[lhs]++] = rhs;
+			if (!directed) targets[position[rhs]++] = lhs;
+		}
+
+		//sort the peers of each node, remove duplicates and self loops, then compact
+		size_t write = 0, begin = 0;
+		for (size_t i = 0; i < node_count; ++i)
+		{
+			const size_t end = offsets[i + 1];
+			std::sort(targets.begin() + begin, targets.begin() + end);
+			offsets[i] = write;
+			for (size_t j = begin; j < end; ++j)
+			{
+				if (targets[j] == i) continue;
+				if (write > offsets[i] && targets[write - 1] == targets[j]) continue;
+				targets[write++] = targets[j];
+			}
+			begin = end;
+		}
+		offsets[node_count] = write;
+		targets.resize(write);
+		targets.shrink_to_fit();
+		output._targets = std::move(targets);
+		return output;
+	}
+
+	/** every node gets random distinct peers until it has {degree} peers, the peers in {base} are kept.
+	 *  This is the "average_degree" topology of the simulator, the result is directed.
+	 */
+	template <typename RNG>
+	static sparse_topology fill_out_degree(const sparse_topology& base, size_t degree, RNG& rng)
+	{
+		const size_t node_count = base.node_count();
+		LOG_IF(FATAL, node_count > 0 && degree > node_count - 1) << "degree > node_count - 1, impossible to reach such large degree";
+		std::vector<edge> edges;
+		edges.reserve(std::max(base.edge_count(), node_count * degree));
+		std::uniform_int_distribution<node_id> pick(0, node_count == 0 ? 0 : node_id(node_count - 1));
+		std::vector<node_id> candidates;
+		for (node_id i = 0; i < node_count; ++i)
+		{
+			auto peers = base.peers(i);
+			const size_t edge_begin = edges.size();
+			for (auto peer : peers) edges.emplace_back(i, peer);
+			if (peers.size() >= degree) continue;
+
+			auto is_peer = [&](node_id target) -> bool
+			{
+				if (std::binary_search(peers.begin(), peers.end(), target)) return true;
+				for (size_t j = edge_begin + peers.size(); j < edges.size(); ++j)
+				{
+					if (edges[j].second == target) return true;
+				}
+				return false;
+			};
+
+			if (degree * 2 <= node_count)
+			{
+				//sparse: rejection sampling, at least half of the candidates are accepted
+				while (edges.size() - edge_begin < degree)
+				{
+					node_id target = pick(rng);
+					if (target == i || is_peer(target)) continue;
+					edges.emplace_back(i, target);
+				}
+			}
+			else
+			{
+				//dense: partial shuffle of all the remaining candidates
+				candidates.clear();
+				for (node_id target = 0; target < node_count; ++target)
+				{
+					if (target != i && !std::binary_search(peers.begin(), peers.end(), target)) candidates.push_back(target);
+				}
+				const size_t need = degree - peers.size();
+				for (size_t j = 0; j < need; ++j)
+				{
+					std::uniform_int_distribution<size_t> pick_candidate(j, candidates.size() - 1);
+					std::swap(candidates[j], candidates[pick_candidate(rng)]);
+					edges.emplace_back(i, candidates[j]);
+				}
+			}
+		}
+		return from_edges(node_count, edges, true);
+	}
+
+	template <typename RNG>
+	static sparse_topology random_out_degree(size_t node_count, size_t degree, RNG& rng)
+	{
+		return fill_out_degree(sparse_topology(node_count), degree, rng);
+	}
+
+	/** undirected random regular graph, every node has exactly {degree} peers.
+	 *  The configuration model pairs the shuffled degree stubs, then self loops and multi-edges are removed by
+	 *  random edge switches, which keep the degree of all nodes.
+	 */
+	template <typename RNG>
+	static sparse_topology random_regular(size_t node_count, size_t degree, RNG& rng)
+	{
+		LOG_IF(FATAL, node_count > 0 && degree > node_count - 1) << "degree > node_count - 1, impossible to reach such large degree";
+		LOG_IF(FATAL, (node_count * degree) % 2 != 0) << "node_count * degree must be even for a random regular graph";
+		if (degree * 2 > node_count)
+		{
+			//dense: the edge switches rarely succeed, use the complement of a sparse random regular graph
+			auto complement = random_regular(node_count, node_count - 1 - degree, rng);
+			std::vector<edge> edges;
+			edges.reserve(node_count * degree / 2);
+			for (node_id i = 0; i < node_count; ++i)
+			{
+				auto peers = complement.peers(i);
+				for (node_id target = i + 1; target < node_count; ++target)
+				{
+					if (!std::binary_search(peers.begin(), peers.end(), target)) edges.emplace_back(i, target);
+				}
+			}
+			return from_edges(node_count, edges, false);
+		}
+
+		std::vector<node_id> stubs(node_count * degree);
+		for (size_t i = 0; i < stubs.size(); ++i) stubs[i] = node_id(i / degree);
+		std::shuffle(stubs.begin(), stubs.end(), rng);
+
+		std::vector<edge> edges;
+		edges.reserve(stubs.size() / 2);
+		edge_hash_set edge_set(stubs.size() / 2);
+		std::vector<edge> bad_edges;
+		for (size_t i = 0; i < stubs.size(); i += 2)
+		{
+			node_id lhs = stubs[i], rhs = stubs[i + 1];
+			if (lhs == rhs || !edge_set.insert(lhs, rhs))
+			{
+				bad_edges.emplace_back(lhs, rhs);
+			}
+			else
+			{
+				edges.emplace_back(lhs, rhs);
+			}
+		}
+
+		//switch (a, b) + (c, d) -> (a, c) + (b, d)
+		size_t attempts = 0;
+		const size_t max_attempts = 1000 + 1000 * bad_edges.size();
+		while (!bad_edges.empty())
+		{
+			LOG_IF(FATAL, edges.empty() || ++attempts > max_attempts) << "cannot generate a random regular graph, the degree is too large?";
+			auto [a, b] = bad_edges.back();
+			std::uniform_int_distribution<size_t> pick(0, edges.size() - 1);
+			const size_t index = pick(rng);
+			auto [c, d] = edges[index];
+			if (rng() & 1) std::swap(c, d);
+			if (a == c || b == d || edge_key(a, c) == edge_key(b, d)) continue;
+			if (edge_set.contains(a, c) || edge_set.contains(b, d)) continue;
+
+			edge_set.erase(c, d);
+			edge_set.insert(a, c);
+			edge_set.insert(b, d);
+			edges[index] = {a, c};
+			edges.emplace_back(b, d);
+			bad_edges.pop_back();
+		}
+		return from_edges(node_count, edges, false);
+	}
+
+	//undirected G(n, p) with p = average_degree / (n - 1), the gaps between edges are geometrically distributed (Batagelj & Brandes)
+	template <typename RNG>
+	static sparse_topology erdos_renyi(size_t node_count, double average_degree, RNG& rng)
+	{
+		std::vector<edge> edges;
+		if (node_count < 2) return from_edges(node_count, edges, false);
+		const double p = average_degree / double(node_count - 1);
+		if (p <= 0) return from_edges(node_count, edges, false);
+		edges.reserve(size_t(average_degree * double(node_count) / 2 * 1.1) + 16);
+		if (p >= 1)
+		{
+			for (node_id v = 1; v < node_count; ++v)
+				for (node_id w = 0; w < v; ++w)
+					edges.emplace_back(v, w);
+			return from_edges(node_count, edges, false);
+		}
+
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		const double log_q = std::log(1.0 - p);
+		int64_t v = 1, w = -1;
+		while (v < int64_t(node_count))
+		{
+			w += 1 + int64_t(std::floor(std::log(1.0 - uniform(rng)) / log_q));
+			while (w >= v && v < int64_t(node_count))
+			{
+				w -= v;
+				v++;
+			}
+			if (v < int64_t(node_count)) edges.emplace_back(node_id(v), node_id(w));
+		}
+		return from_edges(node_count, edges, false);
+	}
+
+	//undirected Watts-Strogatz graph: a ring where each node connects to {degree}/2 neighbours on each side, then each edge is rewired with probability {beta}
+	template <typename RNG>
+	static sparse_topology small_world(size_t node_count, size_t degree, double beta, RNG& rng)
+	{
+		LOG_IF(FATAL, degree % 2 != 0) << "the degree of a small world graph must be even";
+		LOG_IF(FATAL, node_count > 0 && degree > node_count - 1) << "degree > node_count - 1, impossible to reach such large degree";
+		std::vector<edge> edges;
+		edges.reserve(node_count * degree / 2);
+		edge_hash_set edge_set(node_count * degree / 2);
+		std::vector<size_t> node_degree(node_count, degree);
+		for (node_id i = 0; i < node_count; ++i)
+		{
+			for (size_t j = 1; j <= degree / 2; ++j)
+			{
+				node_id target = node_id((i + j) % node_count);
+				edges.emplace_back(i, target);
+				edge_set.insert(i, target);
+			}
+		}
+
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		std::uniform_int_distribution<node_id> pick(0, node_count == 0 ? 0 : node_id(node_count - 1));
+		for (auto& [source, target] : edges)
+		{
+			if (uniform(rng) >= beta) continue;
+			//a node already connected to all other nodes cannot be rewired
+			if (node_degree[source] >= node_count - 1) continue;
+			node_id new_target;
+			do
+			{
+				new_target = pick(rng);
+			} while (new_target == source || edge_set.contains(source, new_target));
+			edge_set.erase(source, target);
+			edge_set.insert(source, new_target);
+			node_degree[target]--;
+			node_degree[new_target]++;
+			target = new_target;
+		}
+		return from_edges(node_count, edges, false);
+	}
+
+	//undirected Barabasi-Albert graph, each new node connects to {edges_per_node} distinct existing nodes chosen by degree
+	template <typename RNG>
+	static sparse_topology scale_free(size_t node_count, size_t edges_per_node, RNG& rng)
+	{
+		LOG_IF(FATAL, edges_per_node == 0 || edges_per_node >= node_count) << "scale free graph requires 0 < edges_per_node < node_count";
+		std::vector<edge> edges;
+		edges.reserve(node_count * edges_per_node);
+		//each node appears once per connected edge, so a uniform pick is proportional to the degree
+		std::vector<node_id> repeated_nodes;
+		repeated_nodes.reserve(2 * node_count * edges_per_node);
+		std::vector<node_id> targets(edges_per_node);
+		for (size_t i = 0; i < edges_per_node; ++i) targets[i] = node_id(i);
+
+		for (size_t source = edges_per_node; source < node_count; ++source)
+		{
+			for (auto target : targets)
+			{
+				edges.emplace_back(node_id(source), target);
+				repeated_nodes.push_back(target);
+				repeated_nodes.push_back(node_id(source));
+			}
+
+			std::uniform_int_distribution<size_t> pick(0, repeated_nodes.size() - 1);
+			targets.clear();
+			while (targets.size() < edges_per_node)
+			{
+				node_id target = repeated_nodes[pick(rng)];
+				if (std::find(targets.begin(), targets.end(), target) == targets.end()) targets.push_back(target);
+			}
+		}
+		return from_edges(node_count, edges, false);
+	}
+
+	/** binary edge list:
+	 *  "DFLT" | uint32 version | uint32 directed | uint64 node_count | uint64 edge_count | edge_count * (uint32 source, uint32 target)
+	 *  the integers are in the host byte order.
+	 */
+	static void write_edge_list(const std::filesystem::path& path, size_t node_count, const std::vector<edge>& edges, bool directed)
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		LOG_IF(FATAL, !file) << "cannot open " << path;
+		file.write(edge_list_magic, 4);
+		write_integer<uint32_t>(file, edge_list_version);
+		write_integer<uint32_t>(file, directed ? 1 : 0);
+		write_integer<uint64_t>(file, node_count);
+		write_integer<uint64_t>(file, edges.size());
+		std::vector<node_id> buffer;
+		buffer.reserve(edges.size() * 2);
+		for (const auto& [lhs, rhs] : edges)
+		{
+			buffer.push_back(lhs);
+			buffer.push_back(rhs);
+		}
+		file.write(reinterpret_cast<const char*>(buffer.data()), std::streamsize(buffer.size() * sizeof(node_id)));
+		LOG_IF(FATAL, !file) << "failed to write " << path;
+	}
+
+	static sparse_topology load_edge_list(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		LOG_IF(FATAL, !file) << "cannot open " << path;
+		char magic[4];
+		file.read(magic, 4);
+		LOG_IF(FATAL, !file || std::memcmp(magic, edge_list_magic, 4) != 0) << path << " is not a binary edge list";
+		const auto version = read_integer<uint32_t>(file);
+		LOG_IF(FATAL, version != edge_list_version) << "unknown edge list version " << version << " in " << path;
+		const bool directed = read_integer<uint32_t>(file) != 0;
+		const auto node_count = read_integer<uint64_t>(file);
+		const auto edge_count = read_integer<uint64_t>(file);
+		LOG_IF(FATAL, !file) << path << " is truncated";
+		LOG_IF(FATAL, node_count > uint64_t(std::numeric_limits<node_id>::max()) + 1) << "node count " << node_count << " in " << path << " exceeds the node id range";
+		//check the edge count against the file size before allocating the buffer for it
+		const auto header_end = file.tellg();
+		file.seekg(0, std::ios::end);
+		const uint64_t remaining = uint64_t(file.tellg() - header_end);
+		file.seekg(header_end);
+		LOG_IF(FATAL, edge_count > remaining / (2 * sizeof(node_id))) << path << " is truncated: " << edge_count << " edges in " << remaining << " bytes";
+		std::vector<node_id> buffer(edge_count * 2);
+		file.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(buffer.size() * sizeof(node_id)));
+		LOG_IF(FATAL, !file) << path << " is truncated";
+
+		std::vector<edge> edges(edge_count);
+		for (size_t i = 0; i < edge_count; ++i) edges[i] = {buffer[2 * i], buffer[2 * i + 1]};
+		return from_edges(node_count, edges, directed);
+	}
+
+	//all (node, peer) pairs as a directed edge list
+	void save_edge_list(const std::filesystem::path& path) const
+	{
+		write_edge_list(path, node_count(), directed_edges(), true);
+	}
+
+	std::vector<edge> directed_edges() const
+	{
+		std::vector<edge> output;
+		output.reserve(_targets.size());
+		for (node_id i = 0; i < node_count(); ++i)
+		{
+			for (auto peer : peers(i)) output.emplace_back(i, peer);
+		}
+		return output;
+	}
+
+	std::span<const node_id> peers(node_id node) const
+	{
+		return {_targets.data() + _offsets[node], _targets.data() + _offsets[node + 1]};
+	}
+
+	//the position of the first peer of {node} in the edge order, data per edge can be kept in arrays of edge_count()
+	size_t edge_begin(node_id node) const
+	{
+		return _offsets[node];
+	}
+
+	//the peers of node i are the nodes having i as a peer, such as the senders of the models received by i
+	sparse_topology transposed() const
+	{
+		std::vector<edge> edges;
+		edges.reserve(_targets.size());
+		for (node_id i = 0; i < node_count(); ++i)
+		{
+			for (auto peer : peers(i)) edges.emplace_back(peer, i);
+		}
+		return from_edges(node_count(), edges, true);
+	}
+
+	size_t node_count() const
+	{
+		return _offsets.size() - 1;
+	}
+
+	//directed edges, an undirected edge counts twice
+	size_t edge_count() const
+	{
+		return _targets.size();
+	}
+
+private:
+	static constexpr char edge_list_magic[4] = {'D', 'F', 'L', 'T'};
+	static constexpr uint32_t edge_list_version = 1;
+
+	static uint64_t edge_key(node_id lhs, node_id rhs)
+	{
+		if (lhs > rhs) std::swap(lhs, rhs);
+		return (uint64_t(lhs) << 32) | rhs;
+	}
+
+	//open addressing set of undirected edges, linear probing with backward shift deletion
+	class edge_hash_set
+	{
+	public:
+		explicit edge_hash_set(size_t expected_size)
+		{
+			size_t capacity = 16;
+			while (capacity < expected_size * 2) capacity *= 2;
+			_slots.assign(capacity, empty_slot);
+			_mask = capacity - 1;
+		}
+
+		//false if the edge already exists
+		bool insert(node_id lhs, node_id rhs)
+		{
+			const uint64_t key = edge_key(lhs, rhs);
+			size_t slot = find_slot(key);
+			if (_slots[slot] == key) return false;
+			_slots[slot] = key;
+			_size++;
+			LOG_IF(FATAL, _size * 2 > _slots.size()) << "edge_hash_set is full";
+			return true;
+		}
+
+		bool contains(node_id lhs, node_id rhs) const
+		{
+			const uint64_t key = edge_key(lhs, rhs);
+			return _slots[find_slot(key)] == key;
+		}
+
+		void erase(node_id lhs, node_id rhs)
+		{
+			size_t hole = find_slot(edge_key(lhs, rhs));
+			if (_slots[hole] == empty_slot) return;
+			_size--;
+			//move the following entries of the probe chain into the hole if the hole is between their home slot and themselves
+			for (size_t next = (hole + 1) & _mask; _slots[next] != empty_slot; next = (next + 1) & _mask)
+			{
+				const size_t home = home_slot(_slots[next]);
+				if (((next - home) & _mask) >= ((next - hole) & _mask))
+				{
+					_slots[hole] = _slots[next];
+					hole = next;
+				}
+			}
+			_slots[hole] = empty_slot;
+		}
+
+	private:
+		static constexpr uint64_t empty_slot = std::numeric_limits<uint64_t>::max();
+
+		size_t home_slot(uint64_t key) const
+		{
+			return size_t((key * 0x9E3779B97F4A7C15ULL) >> 32) & _mask;
+		}
+
+		size_t find_slot(uint64_t key) const
+		{
+			size_t slot = home_slot(key);
+			while (_slots[slot] != empty_slot && _slots[slot] != key) slot = (slot + 1) & _mask;
+			return slot;
+		}
+
+		std::vector<uint64_t> _slots;
+		size_t _mask;
+		size_t _size = 0;
+	};
+
+	template <typename T>
+	static void write_integer(std::ofstream& file, T value)
+	{
+		file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <typename T>
+	static T read_integer(std::ifstream& file)
+	{
+		T value = 0;
+		file.read(reinterpret_cast<char*>(&value), sizeof(T));
+		return value;
+	}
+
+	std::vector<size_t> _offsets;
+	std::vector<node_id> _targets;
+};
@@ -4,10 +4,23 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 class tmt
 {
 public:
+	//the cores this process may run on, fewer than hardware_concurrency() if the process is pinned (such as to a NUMA node)
+	static uint32_t AvailableThreadCount()
+	{
+#ifdef __linux__
+		cpu_set_t cpu_set;
+		if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) return CPU_COUNT(&cpu_set);
+#endif
+		return std::thread::hardware_concurrency();
+	}
+	
 	/** Use:
 	 *
      tmt::ParallelExecution([](uint32_t index, uint32_t thread_index, Data& data...)
@@ -23,7 +36,7 @@ public:
 	template <class Function, typename Count, typename ...T>
 	static void ParallelExecution(Function func, Count count, T* ...data)
 	{
-		uint32_t totalThread = std::thread::hardware_concurrency();
+		uint32_t totalThread = AvailableThreadCount();
 		ParallelExecution(totalThread, func, count, data...);
 	}
 	
@@ -47,7 +60,7 @@ public:
 	template <class Function, typename Count, typename ...T>
 	static void ParallelExecution_StepIncremental(Function func, Count count, T* ...data)
 	{
-		uint32_t totalThread = std::thread::hardware_concurrency();
+		uint32_t totalThread = AvailableThreadCount();
 		ParallelExecution_StepIncremental(totalThread, func, count, data...);
 	}
 	
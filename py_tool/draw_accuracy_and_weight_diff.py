@@ -1,16 +1,16 @@
 import pandas
 import matplotlib.pyplot as plt
 
-accuracy_file_path = 'accuracy.csv'
-accuracy_df = pandas.read_csv(accuracy_file_path, index_col=0, header=0)
+from simulation_result_reader import load_table
+
+accuracy_df = load_table('.', 'accuracy')
 
 print(accuracy_df)
 
 accuracy_x = accuracy_df.index
 accuracy_df_len = len(accuracy_df)
 
-weight_diff_file_path = 'model_weight_diff.csv'
-weight_diff_df = pandas.read_csv(weight_diff_file_path, index_col=0, header=0)
+weight_diff_df = load_table('.', 'model_weight_diff')
 
 print(weight_diff_df)
 
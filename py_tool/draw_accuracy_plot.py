@@ -1,8 +1,9 @@
 import pandas
 import matplotlib.pyplot as plt
 
-accuracy_file_path = 'accuracy.csv'
-accuracy_df = pandas.read_csv(accuracy_file_path, index_col=0, header=0)
+from simulation_result_reader import load_table
+
+accuracy_df = load_table('.', 'accuracy')
 
 print(accuracy_df)
 
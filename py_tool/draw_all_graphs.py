@@ -4,6 +4,8 @@ import sys
 import pandas
 import matplotlib.pyplot as plt
 
+from simulation_result_reader import load_table
+
 row = 6
 col = 4
 
@@ -78,12 +80,10 @@ if flag_generate_whole:
         final_weight_diff_df = pandas.DataFrame()
         is_first_dataframe = True
         for each_test_result_folder in subfolders:
-            accuracy_file_path = each_test_result_folder + '/accuracy.csv'
-            accuracy_df = pandas.read_csv(accuracy_file_path, index_col=0, header=0)
+            accuracy_df = load_table(each_test_result_folder, 'accuracy')
         # print(accuracy_df)
 
-            weight_diff_file_path = each_test_result_folder + '/model_weight_diff.csv'
-            weight_diff_df = pandas.read_csv(weight_diff_file_path, index_col=0, header=0)
+            weight_diff_df = load_table(each_test_result_folder, 'model_weight_diff')
         # print(weight_diff_df)
 
             if is_first_dataframe:
@@ -141,11 +141,9 @@ if flag_generate_for_each_result:
         assert len(subfolders) != 0
         for each_test_result_folder in subfolders:
             print("processing: " + each_test_result_folder)
-            accuracy_file_path = each_test_result_folder + '/accuracy.csv'
-            accuracy_df = pandas.read_csv(accuracy_file_path, index_col=0, header=0)
+            accuracy_df = load_table(each_test_result_folder, 'accuracy')
 
-            weight_diff_file_path = each_test_result_folder + '/model_weight_diff.csv'
-            weight_diff_df = pandas.read_csv(weight_diff_file_path, index_col=0, header=0)
+            weight_diff_df = load_table(each_test_result_folder, 'model_weight_diff')
 
             accuracy_x = accuracy_df.index
             accuracy_df_len = len(accuracy_df)
@@ -1,8 +1,9 @@
 import pandas
 import matplotlib.pyplot as plt
 
-file_path = 'model_weight_diff.csv'
-df = pandas.read_csv(file_path, index_col=0, header=0)
+from simulation_result_reader import load_table
+
+df = load_table('.', 'model_weight_diff')
 
 print(df)
 
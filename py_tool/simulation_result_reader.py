@@ -0,0 +1,134 @@
+import mmap
+import os
+import struct
+
+import numpy
+import pandas
+
+# reader of the simulation result file (simulation_result.bin) written by bin/simulation/simulation_output.hpp
+# the file is memory mapped, table values are read with numpy.frombuffer without copying the chunks.
+
+RESULT_FILE_NAME = 'simulation_result.bin'
+
+FILE_MAGIC = b'DFLSIMR\x00'
+INDEX_MAGIC = b'DFLSIDX\x00'
+HEADER_SIZE = 16
+CHUNK_HEADER_SIZE = 16
+TRAILER_SIZE = 16
+
+CHUNK_STREAM_DEFINITION = 1
+CHUNK_TABLE_BATCH = 2
+CHUNK_TEXT_BATCH = 3
+CHUNK_INDEX = 4
+
+STREAM_TABLE = 0
+STREAM_TEXT = 1
+
+
+class SimulationResult:
+    def __init__(self, path):
+        self.file = open(path, 'rb')
+        self.buffer = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_READ)
+        assert self.buffer[0:8] == FILE_MAGIC, path + ' is not a simulation result file'
+        self.streams = {}  # name -> (stream id, stream type, columns)
+        self.chunks = {}  # stream id -> [(chunk type, payload offset)]
+        for chunk_type, stream_id, offset in self._chunk_list():
+            if chunk_type == CHUNK_STREAM_DEFINITION:
+                self._read_definition(stream_id, offset)
+            elif chunk_type in (CHUNK_TABLE_BATCH, CHUNK_TEXT_BATCH):
+                self.chunks.setdefault(stream_id, []).append((chunk_type, offset))
+
+    def close(self):
+        self.buffer.close()
+        self.file.close()
+
+    def _chunk_list(self):
+        size = len(self.buffer)
+        # use the index if the file was closed properly
+        if size >= HEADER_SIZE + TRAILER_SIZE and self.buffer[size - 8:size] == INDEX_MAGIC:
+            index_offset, = struct.unpack_from('<Q', self.buffer, size - TRAILER_SIZE)
+            count, = struct.unpack_from('<Q', self.buffer, index_offset + CHUNK_HEADER_SIZE)
+            entries = numpy.frombuffer(self.buffer, dtype=numpy.dtype([('offset', '<u8'), ('type', '<u4'), ('stream', '<u4')]),
+                                       count=count, offset=index_offset + CHUNK_HEADER_SIZE + 8)
+            return [(int(e['type']), int(e['stream']), int(e['offset']) + CHUNK_HEADER_SIZE) for e in entries]
+
+        # otherwise scan the chunks, a partial chunk at the end is ignored
+        output = []
+        loc = HEADER_SIZE
+        while loc + CHUNK_HEADER_SIZE <= size:
+            chunk_type, stream_id, payload_size = struct.unpack_from('<IIQ', self.buffer, loc)
+            if loc + CHUNK_HEADER_SIZE + payload_size > size or chunk_type == CHUNK_INDEX:
+                break
+            output.append((chunk_type, stream_id, loc + CHUNK_HEADER_SIZE))
+            loc += CHUNK_HEADER_SIZE + payload_size
+        return output
+
+    def _read_string(self, offset):
+        length, = struct.unpack_from('<I', self.buffer, offset)
+        return self.buffer[offset + 4:offset + 4 + length].decode('utf-8'), offset + 4 + length
+
+    def _read_definition(self, stream_id, offset):
+        stream_type, = struct.unpack_from('<I', self.buffer, offset)
+        name, offset = self._read_string(offset + 4)
+        column_count, = struct.unpack_from('<I', self.buffer, offset)
+        offset += 4
+        columns = []
+        for _ in range(column_count):
+            column, offset = self._read_string(offset)
+            columns.append(column)
+        self.streams[name] = (stream_id, stream_type, columns)
+
+    def stream_names(self):
+        return list(self.streams.keys())
+
+    def read_table(self, name):
+        stream_id, stream_type, columns = self.streams[name]
+        assert stream_type == STREAM_TABLE, name + ' is not a table'
+        ticks = []
+        values = []
+        for chunk_type, offset in self.chunks.get(stream_id, []):
+            row_count, column_count = struct.unpack_from('<II', self.buffer, offset)
+            ticks.append(numpy.frombuffer(self.buffer, dtype='<i4', count=row_count, offset=offset + 8))
+            value_offset = offset + (8 + row_count * 4 + 7) // 8 * 8
+            values.append(numpy.frombuffer(self.buffer, dtype='<f4', count=row_count * column_count, offset=value_offset).reshape(row_count, column_count))
+        if len(ticks) == 0:
+            return pandas.DataFrame(columns=columns, index=pandas.Index([], name='tick'))
+        return pandas.DataFrame(numpy.concatenate(values), columns=columns, index=pandas.Index(numpy.concatenate(ticks), name='tick'))
+
+    def read_text(self, name):
+        stream_id, stream_type, columns = self.streams[name]
+        assert stream_type == STREAM_TEXT, name + ' is not a text stream'
+        lines = []
+        for chunk_type, offset in self.chunks.get(stream_id, []):
+            line_count, = struct.unpack_from('<I', self.buffer, offset)
+            offset += 4
+            for _ in range(line_count):
+                offset += 4  # tick
+                line, offset = self._read_string(offset)
+                lines.append(line)
+        return lines
+
+
+# read a table from the result folder, fall back to the csv written by older simulators
+def load_table(folder, name):
+    result_path = os.path.join(folder, RESULT_FILE_NAME)
+    if os.path.exists(result_path):
+        result = SimulationResult(result_path)
+        if name in result.streams:
+            return result.read_table(name)
+    return pandas.read_csv(os.path.join(folder, name + '.csv'), index_col=0, header=0)
+
+
+# read the lines of a text stream from the result folder, fall back to the txt written by older simulators
+# return None if the record does not exist
+def load_text_lines(folder, name):
+    result_path = os.path.join(folder, RESULT_FILE_NAME)
+    if os.path.exists(result_path):
+        result = SimulationResult(result_path)
+        if name in result.streams:
+            return result.read_text(name)
+    text_path = os.path.join(folder, name + '.txt')
+    if not os.path.exists(text_path):
+        return None
+    with open(text_path, 'r') as text_file:
+        return text_file.readlines()
@@ -8,9 +8,9 @@ import colorsys
 import os
 import re
 
+from simulation_result_reader import load_table, load_text_lines
+
 config_file_path = 'simulator_config.json'
-accuracy_file_path = 'accuracy.csv'
-peer_change_file_path = 'peer_change_record.txt'
 draw_from_tick = 0
 draw_per_tick = 1
 draw_stop_tick = 20000
@@ -22,13 +22,12 @@ topology = config_file_json['node_topology']
 peer_control_enabled = config_file_json['services']['peer_control_service']['enable']
 nodes = config_file_json['nodes']
 
-accuracy_df = pandas.read_csv(accuracy_file_path, index_col=0, header=0)
+accuracy_df = load_table('.', 'accuracy')
 
-peer_change_file_exists = os.path.exists(peer_change_file_path)
+peer_change_content = load_text_lines('.', 'peer_change_record')
+peer_change_file_exists = peer_change_content is not None
 peer_change_list = []
 if peer_change_file_exists:
-    peer_change_file = open(peer_change_file_path, "r+")
-    peer_change_content = peer_change_file.readlines()
     for line in peer_change_content:
         operation = 0
         result = re.findall('tick:\d+', line)
@@ -45,7 +44,6 @@ if peer_change_file_exists:
             operation = 2
         peer_change_list.append({'tick':tick, 'lhs_node':lhs_node, 'rhs_node':rhs_node, 'operation':operation})
 
-    peer_change_file.close()
 print(accuracy_df)
 
 total_tick = len(accuracy_df.index)
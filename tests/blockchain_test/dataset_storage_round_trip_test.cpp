@@ -0,0 +1,54 @@
+#include <set>
+#include <filesystem>
+
+#include "../../bin/dataset_storage.hpp"
+
+#define BOOST_TEST_MAIN
+
+#include <boost/test/included/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE (dataset_storage_test)
+	
+	//data {i}, label {i % 10}, written in two batches so the second batch appends to the existing labels
+	BOOST_AUTO_TEST_CASE (dataset_storage_round_trip)
+	{
+		const std::filesystem::path db_path = std::filesystem::temp_directory_path() / "dataset_storage_round_trip_db";
+		std::filesystem::remove_all(db_path);
+		
+		constexpr int sample_count = 50;
+		constexpr int hot_sample_capacity = 4; //most samples are read back from the database
+		dataset_storage<float> storage(db_path.string(), 10, hot_sample_capacity);
+		BOOST_CHECK(std::get<0>(storage.get_random_data(10)).empty());
+		
+		for (int batch = 0; batch < 2; ++batch)
+		{
+			std::vector<Ml::tensor_blob_like<float>> data, label;
+			for (int i = batch * sample_count / 2; i < (batch + 1) * sample_count / 2; ++i)
+			{
+				Ml::tensor_blob_like<float> single_data, single_label;
+				single_data.getShape() = {1};
+				single_data.getData() = {float(i)};
+				single_label.getShape() = {1};
+				single_label.getData() = {float(i % 10)};
+				data.push_back(single_data);
+				label.push_back(single_label);
+			}
+			storage.add_data(data, label);
+		}
+		
+		auto [data, label] = storage.get_random_data(500);
+		BOOST_REQUIRE(data.size() == 500 && label.size() == 500);
+		std::set<int> seen_samples;
+		for (size_t i = 0; i < data.size(); ++i)
+		{
+			BOOST_REQUIRE(data[i].getData().size() == 1 && label[i].getData().size() == 1);
+			const int value = int(data[i].getData()[0]);
+			BOOST_CHECK(value >= 0 && value < sample_count);
+			BOOST_CHECK(float(value % 10) == label[i].getData()[0]);
+			seen_samples.insert(value);
+		}
+		//both the hot tier and the database are read
+		BOOST_CHECK(seen_samples.size() > size_t(hot_sample_capacity));
+	}
+
+BOOST_AUTO_TEST_SUITE_END( )
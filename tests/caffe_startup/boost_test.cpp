@@ -64,7 +64,202 @@ BOOST_AUTO_TEST_SUITE (caffe_boost_unit_test)
 		BOOST_CHECK(normal_type == interpreter.normal);
 		BOOST_CHECK(diff_type == interpreter.compressed_by_diff);
 	}
-	
+
+	BOOST_AUTO_TEST_CASE (sparse_delta)
+	{
+		constexpr int TRAIN_BATCH_SIZE = 64;
+		const std::string train_dataset_path = "../../../dataset/MNIST/train-images.idx3-ubyte";
+		const std::string train_label_dataset_path = "../../../dataset/MNIST/train-labels.idx1-ubyte";
+		const std::string solver_path = "../../../dataset/MNIST/lenet_solver_memory.prototxt";
+
+		Ml::data_converter<float> train_dataset;
+		train_dataset.load_dataset_mnist(train_dataset_path,train_label_dataset_path);
+
+		Ml::MlCaffeModel<float, caffe::SGDSolver> model;
+		model.load_caffe_model(solver_path);
+
+		auto [train_data, train_label] = train_dataset.get_random_data(TRAIN_BATCH_SIZE);
+		auto parameter_before = model.get_parameter();
+		model.train(train_data,train_label);
+		auto parameter_after = model.get_parameter();
+
+		//top 1%: the kept weights are the weights after training, the others are unchanged
+		size_t total = 0, kept = 0;
+		Ml::caffe_parameter_net<float> residual;
+		auto update = Ml::model_compress::compress_by_sparse_delta(parameter_before, parameter_after, 0.01f, 0.0f, &residual, &total, &kept);
+		BOOST_CHECK(kept > 0 && kept <= total / 100 + parameter_after.getLayers().size());
+		BOOST_CHECK(update.size() < kept * (sizeof(float) + 4));
+		auto patched = parameter_before;
+		Ml::model_compress::decompress_by_sparse_delta(patched, update);
+		auto patch = Ml::model_compress::sparse_delta_to_patch(parameter_before, update);
+		auto patched_by_diff = parameter_before;
+		patched_by_diff.patch_weight(patch);
+		BOOST_CHECK(patched == patched_by_diff);
+
+		//error feedback: the residual and the update add up to the change
+		BOOST_CHECK((patched - parameter_before + residual).roughly_equal(parameter_after - parameter_before, 1e-6));
+
+		auto stream = Ml::model_interpreter<float>::generate_model_stream_by_sparse_delta(parameter_before, parameter_after, 0.01f);
+		auto [stream_patch, stream_type] = Ml::model_interpreter<float>::parse_model_stream(stream, &parameter_before);
+		BOOST_CHECK(stream_type == Ml::model_compress_type::compressed_by_diff);
+		auto patched_by_stream = parameter_before;
+		patched_by_stream.patch_weight(stream_patch);
+		BOOST_CHECK(patched_by_stream == patched);
+		
+		//a malformed update from a peer gives an empty model instead of stopping the node, the model is not changed
+		auto unchanged = parameter_before;
+		const std::string truncated = update.substr(0, update.size() / 2);
+		BOOST_CHECK(!Ml::model_compress::decompress_by_sparse_delta(unchanged, truncated));
+		BOOST_CHECK(unchanged == parameter_before);
+		BOOST_CHECK(Ml::model_compress::sparse_delta_to_patch(parameter_before, truncated).getLayers().empty());
+		
+		//a kept count far beyond the layer size and the bytes in the update
+		auto append_varint = [](std::string& output, uint64_t value)
+		{
+			for (; value >= 0x80; value >>= 7) output.push_back(char(value | 0x80));
+			output.push_back(char(value));
+		};
+		auto& layers = parameter_before.getLayers();
+		std::string oversized;
+		append_varint(oversized, layers.size());
+		append_varint(oversized, layers[0].size());
+		append_varint(oversized, uint64_t(1) << 60);
+		BOOST_CHECK(!Ml::model_compress::decompress_by_sparse_delta(unchanged, oversized));
+		std::string oversized_layers;
+		append_varint(oversized_layers, uint64_t(1) << 40);
+		BOOST_CHECK(!Ml::model_compress::decompress_by_sparse_delta(unchanged, oversized_layers));
+		BOOST_CHECK(unchanged == parameter_before);
+		
+		//the stream without the model of the receiver, and a truncated stream
+		auto [no_reference_patch, no_reference_type] = Ml::model_interpreter<float>::parse_model_stream(stream);
+		BOOST_CHECK(no_reference_patch.getLayers().empty());
+		const std::string truncated_stream = stream.substr(0, stream.size() / 2) + stream.substr(stream.size() - 4);
+		auto [truncated_patch, truncated_type] = Ml::model_interpreter<float>::parse_model_stream(truncated_stream, &parameter_before);
+		BOOST_CHECK(truncated_patch.getLayers().empty());
+	}
+
+	BOOST_AUTO_TEST_CASE (model_quantization)
+	{
+		const std::string solver_path = "../../../dataset/MNIST/lenet_solver_memory.prototxt";
+		Ml::MlCaffeModel<float, caffe::SGDSolver> model;
+		model.load_caffe_model(solver_path);
+		auto parameter = model.get_parameter();
+		auto data_normal = Ml::model_interpreter<float>::generate_model_stream_normal(parameter);
+
+		//{codec, size ratio to the raw stream, error relative to the largest weight of a layer}
+		for (auto [codec, size_ratio, error] : std::vector<std::tuple<Ml::model_codec, float, float>>{{Ml::model_codec::fp16, 0.55, 1e-3}, {Ml::model_codec::bf16, 0.55, 1e-2}, {Ml::model_codec::int8, 0.3, 1e-2}, {Ml::model_codec::int4, 0.2, 0.15}})
+		{
+			auto data = Ml::model_interpreter<float>::generate_model_stream_normal(parameter, codec, 1);
+			auto [decoded, type] = Ml::model_interpreter<float>::parse_model_stream(data);
+			std::cout << "codec " << int(codec) << " size:" << data.size() << "  raw size:" << data_normal.size() << std::endl;
+			BOOST_CHECK(type == Ml::model_compress_type::normal);
+			BOOST_CHECK(data.size() < data_normal.size() * size_ratio);
+			for (int i = 0; i < parameter.getLayers().size(); ++i)
+			{
+				const auto& expected = parameter.getLayers()[i].getBlob_p()->getData();
+				const auto& actual = decoded.getLayers()[i].getBlob_p()->getData();
+				BOOST_CHECK(expected.size() == actual.size());
+				BOOST_CHECK(parameter.getLayers()[i].getBlob_p()->getShape() == decoded.getLayers()[i].getBlob_p()->getShape());
+				float max_weight = 0, max_error = 0;
+				for (size_t j = 0; j < expected.size() && j < actual.size(); ++j)
+				{
+					max_weight = std::max(max_weight, std::fabs(expected[j]));
+					max_error = std::max(max_error, std::fabs(expected[j] - actual[j]));
+				}
+				BOOST_CHECK(max_error <= max_weight * error);
+			}
+		}
+
+		//the dropped weights of a compressed model are kept
+		auto parameter_after = parameter;
+		parameter_after.random(-1, 1);
+		auto data_compressed = Ml::model_interpreter<float>::generate_model_stream_by_compress_diff(parameter, parameter_after, 0.5, nullptr, nullptr, Ml::model_codec::int8, 1);
+		auto [diff_model, diff_type] = Ml::model_interpreter<float>::parse_model_stream(data_compressed);
+		BOOST_CHECK(diff_type == Ml::model_compress_type::compressed_by_diff);
+		auto reference = Ml::model_compress::compress_by_diff_get_model(parameter, parameter_after, 0.5);
+		const auto& reference_data = reference.getLayers()[1].getBlob_p()->getData();
+		const auto& diff_data = diff_model.getLayers()[1].getBlob_p()->getData();
+		for (size_t j = 0; j < reference_data.size(); ++j)
+		{
+			BOOST_CHECK(std::isnan(reference_data[j]) == std::isnan(diff_data[j]));
+		}
+		
+		//a corrupted layer size, an unknown codec or a truncated payload gives no model
+		using content_type = std::tuple<Ml::caffe_parameter_net<float>, uint8_t, std::vector<uint64_t>, std::vector<std::string>>;
+		const auto payload = Ml::model_quantization<float>::encode(parameter, Ml::model_codec::int8);
+		BOOST_CHECK(Ml::model_quantization<float>::decode(payload).has_value());
+		auto oversized = deserialize_wrap<boost::archive::binary_iarchive, content_type>(payload);
+		std::get<2>(oversized)[1] = uint64_t(1) << 62;
+		BOOST_CHECK(!Ml::model_quantization<float>::decode(serialize_wrap<boost::archive::binary_oarchive>(oversized).str()).has_value());
+		auto unknown_codec = deserialize_wrap<boost::archive::binary_iarchive, content_type>(payload);
+		std::get<1>(unknown_codec) = 99;
+		BOOST_CHECK(!Ml::model_quantization<float>::decode(serialize_wrap<boost::archive::binary_oarchive>(unknown_codec).str()).has_value());
+		BOOST_CHECK(!Ml::model_quantization<float>::decode(payload.substr(0, payload.size() / 2)).has_value());
+		auto [corrupted_model, corrupted_type] = Ml::model_interpreter<float>::parse_model_stream(data_compressed.substr(0, data_compressed.size() / 2) + data_compressed.substr(data_compressed.size() - 4));
+		BOOST_CHECK(corrupted_model.getLayers().empty());
+	}
+
+	BOOST_AUTO_TEST_CASE (model_container)
+	{
+		const std::string solver_path = "../../../dataset/MNIST/lenet_solver_memory.prototxt";
+		Ml::MlCaffeModel<float, caffe::SGDSolver> model;
+		model.load_caffe_model(solver_path);
+		auto parameter = model.get_parameter();
+
+		auto data = Ml::model_interpreter<float>::generate_model_stream_normal(parameter);
+		auto [decoded, type] = Ml::model_interpreter<float>::parse_model_stream(data);
+		BOOST_CHECK(type == Ml::model_compress_type::normal);
+		BOOST_CHECK(decoded == parameter);
+
+		//the weights are read in place
+		auto view = Ml::model_interpreter<float>::view_model_stream(data);
+		BOOST_REQUIRE(view);
+		BOOST_CHECK(view->layer_count() == parameter.getLayers().size());
+		for (size_t i = 0; i < view->layer_count(); ++i)
+		{
+			const auto& blob = parameter.getLayers()[i].getBlob_p();
+			BOOST_CHECK(view->name(i) == parameter.getLayers()[i].getName());
+			BOOST_CHECK(view->data(i).size() == blob->getData().size());
+			BOOST_CHECK(std::equal(view->data(i).begin(), view->data(i).end(), blob->getData().begin()));
+			BOOST_CHECK(reinterpret_cast<uintptr_t>(view->data(i).data()) % alignof(float) == 0);
+		}
+
+		//the streams of the previous versions are still parsed
+		auto legacy = serialize_wrap<boost::archive::binary_oarchive>(parameter).str();
+		legacy += std::string("\x01\0\0\0", 4);
+		auto [legacy_model, legacy_type] = Ml::model_interpreter<float>::parse_model_stream(legacy);
+		BOOST_CHECK(legacy_type == Ml::model_compress_type::normal);
+		BOOST_CHECK(legacy_model == parameter);
+
+		//a corrupted or truncated container is rejected
+		auto corrupted = data;
+		corrupted[corrupted.size() / 2] ^= 0x55;
+		BOOST_CHECK(!Ml::model_interpreter<float>::view_model_stream(corrupted));
+		BOOST_CHECK(!Ml::model_container_view<float>::open(data.data(), data.size() / 2));
+		
+		//hand-corrupted headers, not verifying the checksum: a huge layer count and a string size that overflows the bounds check
+		auto container = Ml::model_container<float>::write(parameter);
+		auto corrupt_header = [&container](auto modify)
+		{
+			auto output = container;
+			Ml::model_container_header header;
+			std::memcpy(&header, output.data(), sizeof(header));
+			modify(header);
+			std::memcpy(output.data(), &header, sizeof(header));
+			return output;
+		};
+		BOOST_CHECK(Ml::model_container_view<float>::open(container, false));
+		auto huge_layer_count = corrupt_header([](Ml::model_container_header& header) { header.layer_count = 0xffffffff; });
+		BOOST_CHECK(!Ml::model_container_view<float>::open(huge_layer_count, false));
+		auto overflowing_string_size = corrupt_header([](Ml::model_container_header& header) { header.string_size = ~uint64_t(0) - 100; });
+		BOOST_CHECK(!Ml::model_container_view<float>::open(overflowing_string_size, false));
+
+		//written from a flat buffer
+		std::vector<float> flat;
+		for (const auto& layer : parameter.getLayers()) flat.insert(flat.end(), layer.getBlob_p()->getData().begin(), layer.getBlob_p()->getData().end());
+		BOOST_CHECK(Ml::model_container<float>::write(parameter.getName(), Ml::model_container<float>::layout(parameter), flat.data()) == Ml::model_container<float>::write(parameter));
+	}
+
 	BOOST_AUTO_TEST_CASE (lz4_compress)
 	{
 		std::string data_raw = util::get_random_str(500000);
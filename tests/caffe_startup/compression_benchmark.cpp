@@ -0,0 +1,74 @@
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <ml_layer.hpp>
+#include <measure_time.hpp>
+#include <chunk_compression.hpp>
+
+//the compression ratio and the throughput of each codec and filter on the LeNet weights and on a compressed_by_diff update
+int main()
+{
+	google::InitGoogleLogging(std::filesystem::current_path().c_str());
+
+	constexpr int TRAIN_BATCH_SIZE = 64;
+	constexpr int REPEAT = 10;
+	const std::string train_dataset_path = "../../../dataset/MNIST/train-images.idx3-ubyte";
+	const std::string train_label_dataset_path = "../../../dataset/MNIST/train-labels.idx1-ubyte";
+	const std::string solver_path = "../../../dataset/MNIST/lenet_solver_memory.prototxt";
+
+	Ml::data_converter<float> train_dataset;
+	train_dataset.load_dataset_mnist(train_dataset_path, train_label_dataset_path);
+	Ml::MlCaffeModel<float, caffe::SGDSolver> model;
+	model.load_caffe_model(solver_path);
+
+	auto parameter_before = model.get_parameter();
+	auto [train_data, train_label] = train_dataset.get_random_data(TRAIN_BATCH_SIZE);
+	model.train(train_data, train_label);
+	auto parameter_after = model.get_parameter();
+
+	const std::vector<std::tuple<std::string, std::string>> payloads = {
+			{"model", Ml::model_container<float>::write(parameter_after)},
+			{"update", Ml::model_container<float>::write(Ml::model_compress::compress_by_diff_get_model(parameter_before, parameter_after, 0.5))}};
+
+	std::vector<std::tuple<std::string, compression_codec, int>> codecs = {{"lz4", compression_codec::lz4, 1}, {"lz4 fast", compression_codec::lz4, 8}};
+#if DFL_USE_ZSTD
+	codecs.insert(codecs.end(), {{"zstd 1", compression_codec::zstd, 1}, {"zstd 3", compression_codec::zstd, 3}, {"zstd 9", compression_codec::zstd, 9}});
+#endif
+	const std::vector<std::tuple<std::string, compression_filter>> filters = {{"none", compression_filter::none}, {"byte_shuffle", compression_filter::byte_shuffle}, {"bit_shuffle", compression_filter::bit_shuffle}};
+
+	std::cout << "threads: " << tmt::AvailableThreadCount() << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+	for (const auto& [payload_name, payload] : payloads)
+	{
+		std::cout << payload_name << ", " << payload.size() << " bytes" << std::endl;
+		for (const auto& [codec_name, codec, level] : codecs)
+		{
+			for (const auto& [filter_name, filter] : filters)
+			{
+				chunk_compression::options compression;
+				compression.codec = codec;
+				compression.level = level;
+				compression.filter = filter;
+				compression.element_size = sizeof(float);
+
+				std::string compressed;
+				measure_time compress_time;
+				for (int i = 0; i < REPEAT; ++i) compressed = chunk_compression::compress(payload, compression);
+				compress_time.stop();
+
+				std::optional<std::string> decompressed;
+				measure_time decompress_time;
+				for (int i = 0; i < REPEAT; ++i) decompressed = chunk_compression::decompress(compressed);
+				decompress_time.stop();
+				CHECK(decompressed && *decompressed == payload) << "round trip failed: " << codec_name << " " << filter_name;
+
+				const double bytes = double(payload.size()) * REPEAT;
+				std::cout << "    " << std::setw(10) << codec_name << std::setw(14) << filter_name
+				          << "  ratio: " << double(payload.size()) / compressed.size()
+				          << "  compress: " << bytes / compress_time.measure() << " GB/s"
+				          << "  decompress: " << bytes / decompress_time.measure() << " GB/s" << std::endl;
+			}
+		}
+	}
+	return 0;
+}
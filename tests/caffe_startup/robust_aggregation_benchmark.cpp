@@ -0,0 +1,65 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <functional>
+#include <filesystem>
+#include <ml_layer.hpp>
+#include <measure_time.hpp>
+
+//the time of each robust aggregation rule over N random models of P parameters, in layers of a LeNet-like size
+int main()
+{
+	google::InitGoogleLogging(std::filesystem::current_path().c_str());
+
+	using robust_aggregation = Ml::robust_aggregation<float>;
+	constexpr size_t LAYER_SIZE = 100000;
+	const std::vector<size_t> model_counts = {8, 32, 64};
+	const std::vector<size_t> parameter_counts = {500000, 5000000};
+
+	std::mt19937 random_engine(0);
+	std::normal_distribution<float> distribution(0, 1);
+
+	std::cout << "threads: " << tmt::AvailableThreadCount() << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+	for (size_t parameter_count : parameter_counts)
+	{
+		for (size_t model_count : model_counts)
+		{
+			std::vector<std::vector<float>> data(model_count, std::vector<float>(parameter_count));
+			for (auto& model : data)
+			{
+				for (auto& value : model) value = distribution(random_engine);
+			}
+
+			robust_aggregation::flat_models models;
+			for (size_t begin = 0; begin < parameter_count; begin += LAYER_SIZE) models.sizes.push_back(std::min(LAYER_SIZE, parameter_count - begin));
+			models.models.resize(model_count);
+			std::vector<float> output_data(parameter_count);
+			std::vector<float*> output;
+			for (size_t segment = 0, begin = 0; segment < models.sizes.size(); begin += models.sizes[segment], ++segment)
+			{
+				for (size_t m = 0; m < model_count; ++m) models.models[m].push_back(data[m].data() + begin);
+				output.push_back(output_data.data() + begin);
+			}
+
+			const size_t byzantine_count = model_count / 4;
+			const std::vector<std::tuple<std::string, std::function<void()>>> rules = {
+					{"median", [&]() { robust_aggregation::median_flat(models, output); }},
+					{"trimmed mean", [&]() { robust_aggregation::trimmed_mean_flat(models, 0.1, output); }},
+					{"krum", [&]() { robust_aggregation::krum_flat(models, byzantine_count, 1, output); }},
+					{"multi-krum", [&]() { robust_aggregation::krum_flat(models, byzantine_count, model_count - byzantine_count, output); }},
+					{"geometric median", [&]() { robust_aggregation::geometric_median_flat(models, output); }}};
+
+			std::cout << "N = " << model_count << ", P = " << parameter_count << std::endl;
+			for (const auto& [name, rule] : rules)
+			{
+				measure_time time;
+				rule();
+				time.stop();
+				std::cout << "    " << std::setw(18) << name << "  " << time.measure_ms() << " ms"
+				          << "  " << double(time.measure()) / double(model_count * parameter_count) << " ns/value" << std::endl;
+			}
+		}
+	}
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <iostream>
 
 #include <clustering/hierarchical_clustering.hpp>
+#include <clustering/nn_chain_clustering.hpp>
 
 int main()
 {
@@ -12,4 +13,17 @@ int main()
 	auto history = temp.process(points, 2);
 	std::cout << clustering::hierarchical_clustering::cluster_merge_summary::print_all_summary(history).str() << std::endl;
 	
+	std::vector<float> flat_points;
+	for (auto& point: points) flat_points.insert(flat_points.end(), {point.x, point.y});
+	auto distances = clustering::condensed_distance::euclidean(flat_points.data(), points.size(), 2);
+	for (auto method: {clustering::linkage::single, clustering::linkage::complete, clustering::linkage::average, clustering::linkage::ward})
+	{
+		auto clusters = clustering::nn_chain_clustering::process(distances, method);
+		for (auto& merge: clusters.merges)
+		{
+			std::cout << "merge " << merge.lhs << " with " << merge.rhs << " to " << merge.size << " points, dis: " << merge.distance << std::endl;
+		}
+		std::cout << std::endl;
+	}
+	
 }
\ No newline at end of file
@@ -9,6 +9,14 @@
 #include <configure_file.hpp>
 #include <duplicate_checker.hpp>
 #include <performance_profiler.hpp>
+#include <sparse_topology.hpp>
+#include <counter_rng.hpp>
+#include <shared_memory_ring.hpp>
+#include <chunk_compression.hpp>
+#include <clustering/nn_chain_clustering.hpp>
+#include "../../bin/simulation/ensemble_evaluator.hpp"
+#include "../../bin/simulation/ART_engine.hpp"
+#include <sys/wait.h>
 
 #define BOOST_TEST_MAIN
 
@@ -90,4 +98,320 @@ BOOST_AUTO_TEST_SUITE (miscellaneous_test)
 		std::this_thread::sleep_for(std::chrono::seconds(5));
 	}
 	
+	BOOST_AUTO_TEST_CASE (sparse_topology_test)
+	{
+		std::mt19937 rng(0);
+		measure_time measureTime;
+		measureTime.start();
+		auto topology = sparse_topology::random_regular(100000, 20, rng);
+		measureTime.stop();
+		std::cout << "random regular topology, 100k nodes, degree 20: " << measureTime.measure_ms() << "ms" << std::endl;
+		BOOST_CHECK(topology.edge_count() == 100000 * 20);
+		for (sparse_topology::node_id i = 0; i < topology.node_count(); ++i)
+		{
+			auto peers = topology.peers(i);
+			BOOST_CHECK(peers.size() == 20);
+			BOOST_CHECK(std::find(peers.begin(), peers.end(), i) == peers.end());
+			BOOST_CHECK(std::adjacent_find(peers.begin(), peers.end()) == peers.end());
+		}
+		
+		auto small_world = sparse_topology::small_world(1000, 10, 0.1, rng);
+		for (sparse_topology::node_id i = 0; i < small_world.node_count(); ++i)
+		{
+			for (auto peer : small_world.peers(i))
+			{
+				auto peer_peers = small_world.peers(peer);
+				BOOST_CHECK(std::binary_search(peer_peers.begin(), peer_peers.end(), i));
+			}
+		}
+		
+		auto scale_free = sparse_topology::scale_free(1000, 3, rng);
+		BOOST_CHECK(scale_free.edge_count() == (1000 - 3) * 3 * 2);
+		
+		auto out_degree = sparse_topology::random_out_degree(10, 9, rng);
+		BOOST_CHECK(out_degree.edge_count() == 90);
+		
+		scale_free.save_edge_list("./sparse_topology_test.bin");
+		auto loaded = sparse_topology::load_edge_list("./sparse_topology_test.bin");
+		BOOST_CHECK(loaded.directed_edges() == scale_free.directed_edges());
+		std::filesystem::remove("./sparse_topology_test.bin");
+		
+		//the transposed topology has the reversed edges
+		auto transposed = out_degree.transposed();
+		BOOST_CHECK(transposed.edge_count() == out_degree.edge_count());
+		BOOST_CHECK(transposed.transposed().directed_edges() == out_degree.directed_edges());
+		for (sparse_topology::node_id i = 0; i < 10; ++i)
+		{
+			for (auto peer : transposed.peers(i))
+			{
+				auto peers = out_degree.peers(peer);
+				BOOST_CHECK(std::find(peers.begin(), peers.end(), i) != peers.end());
+			}
+		}
+	}
+	
+	BOOST_AUTO_TEST_CASE (counter_rng_test)
+	{
+		//known answer of Philox4x32-10 with zero key and counter
+		counter_rng zero(0, 0, 0, 0);
+		BOOST_CHECK(zero() == 0x6627e8d5);
+		BOOST_CHECK(zero() == 0xe169c58d);
+		BOOST_CHECK(zero() == 0xbc57ac4c);
+		BOOST_CHECK(zero() == 0x9b00dbd8);
+		
+		//the same key and stream give the same numbers, different streams are different
+		counter_rng lhs(42, 1, 2, 3), rhs(42, 1, 2, 3), other(42, 1, 2, 4);
+		bool all_equal = true, any_different = false;
+		for (int i = 0; i < 100; ++i)
+		{
+			auto value = lhs();
+			all_equal = all_equal && value == rhs();
+			any_different = any_different || value != other();
+		}
+		BOOST_CHECK(all_equal);
+		BOOST_CHECK(any_different);
+		
+		std::uniform_int_distribution<int> distribution(0, 9);
+		for (int i = 0; i < 100; ++i)
+		{
+			int value = distribution(lhs);
+			BOOST_CHECK(value >= 0 && value <= 9);
+		}
+	}
+	
+	BOOST_AUTO_TEST_CASE (ART_engine_test)
+	{
+		//0->1, 0->2, 1->2: node 0 trains every tick and has no sender, nodes 1 and 2 train only in tick 0
+		const uint64_t seed = 42;
+		auto topology = sparse_topology::from_edges(3, {{0, 1}, {0, 2}, {1, 2}}, true);
+		const std::vector<std::vector<int>> intervals = {{1}, {1000}, {1000}};
+		ART_engine<> engine(topology, intervals, {1, 1, 2}, seed);
+		BOOST_REQUIRE(engine.senders(2).size() == 2 && engine.senders(2)[0] == 0 && engine.senders(2)[1] == 1);
+		
+		//the training step of (node, tick), drawn from the same stream as the engine
+		auto train = [seed](float value, uint32_t node, int tick)
+		{
+			counter_rng rng(seed, node, uint32_t(tick), 0);
+			std::uniform_int_distribution<uint32_t> interval_distribution(node, node); //one interval per node
+			interval_distribution(rng);
+			std::normal_distribution<float> train_distribution(0.01f, 0.005f);
+			return std::clamp(value + train_distribution(rng), 0.0f, 1.0f);
+		};
+		auto update_reputation = [](float reputation, float received, float self_value)
+		{
+			return reputation + 0.1f * (1.0f - std::fabs(received - self_value) - reputation);
+		};
+		
+		//tick 0: all nodes train, node 1 aggregates the model of 0, node 2 the models of 0 and 1
+		const float a0 = train(0, 0, 0), b0 = train(0, 1, 0), c0 = train(0, 2, 0);
+		const float v1 = (b0 + a0) / 2, v2 = (c0 + a0 + b0) / 3;
+		const float r10 = update_reputation(1, a0, v1), r20 = update_reputation(1, a0, v2), r21 = update_reputation(1, b0, v2);
+		engine.run_tick(0);
+		BOOST_CHECK_CLOSE(engine.values()[0], a0, 1e-4);
+		BOOST_CHECK_CLOSE(engine.values()[1], v1, 1e-4);
+		BOOST_CHECK_CLOSE(engine.values()[2], v2, 1e-4);
+		BOOST_CHECK_CLOSE(engine.reputation(1)[0], r10, 1e-4);
+		BOOST_CHECK_CLOSE(engine.reputation(2)[0], r20, 1e-4);
+		BOOST_CHECK_CLOSE(engine.reputation(2)[1], r21, 1e-4);
+		
+		//tick 1: only node 0 trains, node 1 aggregates it by reputation, node 2 waits for a second model
+		const float a1 = train(a0, 0, 1);
+		const float v1_next = (v1 + r10 * a1) / (1 + r10);
+		engine.run_tick(1);
+		BOOST_CHECK_CLOSE(engine.values()[0], a1, 1e-4);
+		BOOST_CHECK_CLOSE(engine.values()[1], v1_next, 1e-4);
+		BOOST_CHECK_CLOSE(engine.values()[2], v2, 1e-4);
+		BOOST_CHECK_CLOSE(engine.reputation(1)[0], update_reputation(r10, a1, v1_next), 1e-4);
+		BOOST_CHECK_CLOSE(engine.reputation(2)[1], r21, 1e-4);
+	}
+	
+	BOOST_AUTO_TEST_CASE (shared_memory_ring_test)
+	{
+		//a ring smaller than the messages, the child echoes the messages back
+		const size_t capacity = 1024;
+		const size_t ring_size = (shared_memory_ring::memory_size(capacity) + 63) / 64 * 64;
+		shared_memory memory(shared_memory_barrier::memory_size() + 2 * ring_size);
+		shared_memory_barrier barrier(memory.data(), 2);
+		shared_memory_ring to_child(memory.data() + shared_memory_barrier::memory_size(), capacity);
+		shared_memory_ring to_parent(memory.data() + shared_memory_barrier::memory_size() + ring_size, capacity);
+		
+		pid_t pid = fork();
+		BOOST_REQUIRE(pid >= 0);
+		if (pid == 0)
+		{
+			for (int i = 0; i < 10; ++i)
+			{
+				to_parent.write_message(to_child.read_message());
+			}
+			barrier.arrive_and_wait();
+			_exit(0);
+		}
+		
+		std::vector<std::string> messages;
+		for (int i = 0; i < 10; ++i)
+		{
+			messages.emplace_back(i * 500, char('a' + i));
+		}
+		std::thread writer([&]()
+		{
+			for (auto& message: messages) to_child.write_message(message);
+		});
+		for (auto& message: messages)
+		{
+			BOOST_CHECK(to_parent.read_message() == message);
+		}
+		writer.join();
+		barrier.arrive_and_wait();
+		BOOST_CHECK(!to_parent.has_message());
+		
+		int status = 0;
+		waitpid(pid, &status, 0);
+		BOOST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	
+	BOOST_AUTO_TEST_CASE (chunk_compression_test)
+	{
+		//float weights, several chunks above the parallel threshold, the last element is not whole
+		std::vector<float> weights(600 * 1024);
+		std::mt19937 rng(1);
+		std::normal_distribution<float> distribution(0, 0.05);
+		for (auto& weight: weights) weight = distribution(rng);
+		std::string data(reinterpret_cast<const char*>(weights.data()), weights.size() * sizeof(float) - 1);
+		
+		for (auto filter: {compression_filter::none, compression_filter::byte_shuffle, compression_filter::bit_shuffle})
+		{
+			chunk_compression::options compression;
+			compression.filter = filter;
+			compression.chunk_size = 100 * 1000 + 1;
+			auto compressed = chunk_compression::compress(data, compression);
+			BOOST_CHECK(chunk_compression::is_compressed(compressed));
+			auto decompressed = chunk_compression::decompress(compressed);
+			BOOST_REQUIRE(decompressed);
+			BOOST_CHECK(*decompressed == data);
+			
+			auto corrupted = compressed;
+			corrupted[corrupted.size() / 2] ^= 0x5a;
+			auto corrupted_output = chunk_compression::decompress(corrupted);
+			BOOST_CHECK(!corrupted_output || *corrupted_output != data);
+			BOOST_CHECK(!chunk_compression::decompress(compressed.substr(0, compressed.size() - 1)));
+		}
+		
+		//the shuffled floats compress better
+		chunk_compression::options shuffle;
+		shuffle.filter = compression_filter::byte_shuffle;
+		BOOST_CHECK(chunk_compression::compress(data, shuffle).size() < chunk_compression::compress(data, {}).size());
+		
+		//incompressible data is stored, empty data
+		auto random_str = util::get_random_str(10000);
+		BOOST_CHECK(chunk_compression::compress(random_str, {}).size() <= random_str.size() + 32);
+		BOOST_CHECK(chunk_compression::decompress(chunk_compression::compress(std::string(), {})) == std::string());
+		BOOST_CHECK(!chunk_compression::is_compressed(random_str));
+		
+		//a raw size in the header (at byte 16) beyond the limit or overflowing the chunk count is rejected before allocating
+		auto small = chunk_compression::compress(data.substr(0, 1000), {});
+		BOOST_CHECK(chunk_compression::decompress(small) == data.substr(0, 1000));
+		BOOST_CHECK(!chunk_compression::decompress(small, nullptr, 999));
+		for (uint64_t raw_size: {~uint64_t(0), uint64_t(1) << 40})
+		{
+			auto oversized = small;
+			std::memcpy(oversized.data() + 16, &raw_size, sizeof(raw_size));
+			BOOST_CHECK(!chunk_compression::decompress(oversized));
+			BOOST_CHECK(!chunk_compression::decompress(oversized, nullptr, ~uint64_t(0)));
+		}
+		
+		//a dictionary of similar payloads, required to decompress
+		std::vector<std::string> samples;
+		for (int i = 0; i < 32; ++i) samples.push_back(data.substr(i * 4096, 4096));
+		auto dictionary = compression_dictionary::train(samples);
+		chunk_compression::options with_dictionary;
+		with_dictionary.dictionary = &dictionary;
+		auto compressed = chunk_compression::compress(samples.back(), with_dictionary);
+		BOOST_CHECK(compressed.size() < chunk_compression::compress(samples.back(), {}).size());
+		BOOST_CHECK(chunk_compression::decompress(compressed, &dictionary) == samples.back());
+		BOOST_CHECK(!chunk_compression::decompress(compressed));
+	}
+	
+	BOOST_AUTO_TEST_CASE (nn_chain_clustering_test)
+	{
+		const std::vector<float> points = {0.0, 0.1, 0.0, 0.2, 10.0, 0.1, 10.0, 0.1};
+		auto distances = clustering::condensed_distance::euclidean(points.data(), 4, 2);
+		BOOST_CHECK(std::abs(distances(0, 1) - 0.1) < 1e-6);
+		BOOST_CHECK(distances(2, 3) == 0);
+		
+		for (auto method: {clustering::linkage::single, clustering::linkage::complete, clustering::linkage::average, clustering::linkage::ward})
+		{
+			auto clusters = clustering::nn_chain_clustering::process(distances, method);
+			BOOST_REQUIRE(clusters.merges.size() == 3);
+			BOOST_CHECK(clusters.merges[0].lhs == 2 && clusters.merges[0].rhs == 3);
+			BOOST_CHECK(clusters.merges[1].lhs == 0 && clusters.merges[1].rhs == 1);
+			BOOST_CHECK(clusters.merges[2].lhs == 4 && clusters.merges[2].rhs == 5 && clusters.merges[2].size == 4);
+			BOOST_CHECK(clusters.labels(2) == std::vector<size_t>({0, 0, 1, 1}));
+			BOOST_CHECK(clusters.majority_cluster(0.5).size() == 4);
+		}
+		
+		//ward: sqrt(2 * |a| * |b| / (|a| + |b|)) * |centroid a - centroid b|
+		auto ward = clustering::nn_chain_clustering::process(distances, clustering::linkage::ward);
+		BOOST_CHECK(std::abs(ward.merges[2].distance - std::sqrt(2.0 * (100.0 + 0.05 * 0.05))) < 1e-5);
+	}
+	
+	//predicts class (value + shift) % 3 with {confidence}, the other classes share the rest
+	struct ensemble_test_solver
+	{
+		int shift;
+		float confidence;
+		
+		std::vector<Ml::tensor_blob_like<float>> predict(const std::vector<Ml::tensor_blob_like<float>>& data)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			std::vector<Ml::tensor_blob_like<float>> output(data.size());
+			for (size_t i = 0; i < data.size(); ++i)
+			{
+				const int label = (int(data[i].getData()[0]) + shift) % 3;
+				output[i].getShape() = {3};
+				output[i].getData().assign(3, (1 - confidence) / 2);
+				output[i].getData()[label] = confidence;
+			}
+			return output;
+		}
+	};
+	
+	struct ensemble_test_node
+	{
+		std::shared_ptr<ensemble_test_solver> solver;
+	};
+	
+	BOOST_AUTO_TEST_CASE (ensemble_evaluator_test)
+	{
+		std::vector<Ml::tensor_blob_like<float>> data(23);
+		for (size_t i = 0; i < data.size(); ++i)
+		{
+			data[i].getShape() = {1};
+			data[i].getData() = {float(i)};
+		}
+		//two confident nodes predict value % 3, three unsure nodes predict (value + 1) % 3:
+		//the probability sum picks value % 3 (2 * 0.98 + 3 * 0.3 > 2 * 0.01 + 3 * 0.4), the vote picks (value + 1) % 3
+		std::vector<ensemble_test_node> nodes = {{std::make_shared<ensemble_test_solver>(ensemble_test_solver{0, 0.98f})}, {std::make_shared<ensemble_test_solver>(ensemble_test_solver{0, 0.98f})},
+		                                         {std::make_shared<ensemble_test_solver>(ensemble_test_solver{1, 0.4f})}, {std::make_shared<ensemble_test_solver>(ensemble_test_solver{1, 0.4f})}, {std::make_shared<ensemble_test_solver>(ensemble_test_solver{1, 0.4f})}};
+		std::vector<ensemble_test_node*> node_pointers;
+		for (auto& single_node: nodes) node_pointers.push_back(&single_node);
+		
+		std::string single_thread_sums;
+		for (uint32_t thread_count: {1u, 4u})
+		{
+			ensemble_evaluator<float> evaluator(data, 4);
+			evaluator.evaluate(node_pointers, thread_count);
+			auto by_probability = evaluator.predicted_labels_by_probability();
+			auto by_vote = evaluator.predicted_labels_by_vote();
+			BOOST_REQUIRE(by_probability.size() == data.size() && by_vote.size() == data.size());
+			for (size_t i = 0; i < data.size(); ++i)
+			{
+				BOOST_CHECK(by_probability[i].getData()[0] == float(i % 3));
+				BOOST_CHECK(by_vote[i].getData()[0] == float((i + 1) % 3));
+			}
+			//the sums are folded in node order for any thread count
+			if (thread_count == 1) single_thread_sums = evaluator.save_sums();
+			else BOOST_CHECK(evaluator.save_sums() == single_thread_sums);
+		}
+	}
+	
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
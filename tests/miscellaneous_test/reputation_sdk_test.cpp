@@ -0,0 +1,169 @@
+#include <cmath>
+#include <random>
+#include "../../bin/reputation_sdk/sample/reputation_005.cpp"
+
+#define BOOST_TEST_MAIN
+
+#include <boost/test/included/unit_test.hpp>
+
+namespace
+{
+	//layer 1 has an empty blob, like the layers without parameters
+	Ml::caffe_parameter_net<float> random_net(std::mt19937 &rng)
+	{
+		const std::vector<int> sizes = {6, 0, 4};
+		std::uniform_real_distribution<float> distribution(-1, 1);
+		Ml::caffe_parameter_net<float> output;
+		output.getLayers().resize(sizes.size());
+		for (size_t i = 0; i < sizes.size(); ++i)
+		{
+			auto &blob = output.getLayers()[i].getBlob_p();
+			blob.reset(new Ml::tensor_blob_like<float>());
+			if (sizes[i] == 0) continue;
+			blob->getShape() = {sizes[i]};
+			blob->getData().resize(sizes[i]);
+			for (auto &value: blob->getData()) value = distribution(rng);
+		}
+		return output;
+	}
+
+	//the copies of the arguments received by a v1 plugin, it sets the reputation of node_4 and lowers node_1
+	class recording_reputation : public reputation_interface<float>
+	{
+	public:
+		Ml::caffe_parameter_net<float> seen_current_model;
+		std::vector<Ml::caffe_parameter_net<float>> seen_models;
+		std::vector<std::string> seen_generators;
+		std::unordered_map<std::string, double> seen_reputation;
+		bool shares_blob_with_current_model = false;
+
+		void update_model(Ml::caffe_parameter_net<float> &current_model, double self_accuracy, const std::vector<updated_model<float>> &models, std::unordered_map<std::string, double> &reputation) override
+		{
+			seen_current_model = current_model * 1.0f;
+			for (auto &model: models)
+			{
+				seen_models.push_back(model.model_parameter * 1.0f);
+				seen_generators.push_back(model.generator_address);
+				for (size_t i = 0; i < model.model_parameter.getLayers().size(); ++i)
+				{
+					if (model.model_parameter.getLayers()[i].getBlob_p() == current_model.getLayers()[i].getBlob_p()) shares_blob_with_current_model = true;
+				}
+			}
+			seen_reputation = reputation;
+			reputation["node_1"] -= 0.1;
+			reputation["node_4"] = 0.3;
+		}
+	};
+
+	struct test_round
+	{
+		std::vector<std::string> node_names = {"node_0", "node_1", "node_2", "node_3", "node_4"};
+		std::vector<Ml::caffe_parameter_net<float>> received;
+		std::vector<uint32_t> generators = {1, 2, 3};
+		std::vector<double> accuracies = {0.9, 0.5, 0.7};
+		std::vector<double> reputation = {NAN, 0.6, 0.8, NAN, NAN};
+		Ml::caffe_parameter_net<float> current_model;
+
+		explicit test_round(std::mt19937 &rng)
+		{
+			current_model = random_net(rng);
+			for (size_t i = 0; i < generators.size(); ++i) received.push_back(random_net(rng));
+		}
+
+		reputation_round<float> make_round(Ml::caffe_parameter_net<float> &target_model)
+		{
+			reputation_round<float> output;
+			output.current_model = &target_model;
+			output.self_accuracy = 0.8;
+			output.models = Ml::robust_aggregation<float>::flatten(received.size(), [this](size_t index) -> const Ml::caffe_parameter_net<float> & { return received[index]; });
+			output.types.assign(received.size(), Ml::model_compress_type::normal);
+			output.accuracies = accuracies;
+			output.generators = generators;
+			output.reputation = reputation.data();
+			output.node_count = node_names.size();
+			output.node_names = &node_names;
+			return output;
+		}
+
+		std::vector<updated_model<float>> make_models() const
+		{
+			std::vector<updated_model<float>> output(received.size());
+			for (size_t i = 0; i < received.size(); ++i)
+			{
+				output[i].model_parameter = received[i] * 1.0f;
+				output[i].type = Ml::model_compress_type::normal;
+				output[i].accuracy = accuracies[i];
+				output[i].generator_address = node_names[generators[i]];
+			}
+			return output;
+		}
+	};
+}
+
+BOOST_AUTO_TEST_SUITE (reputation_sdk_test)
+
+	BOOST_AUTO_TEST_CASE (v1_adapter_same_as_v1_test)
+	{
+		std::mt19937 rng(17);
+		test_round data(rng);
+
+		//the v1 plugin called directly
+		reputation_implementation<float> plugin;
+		auto direct_model = data.current_model * 1.0f;
+		std::unordered_map<std::string, double> direct_reputation = {{"node_1", 0.6}, {"node_2", 0.8}};
+		plugin.update_model(direct_model, 0.8, data.make_models(), direct_reputation);
+
+		//through the adapter, current_model shares its blobs with a cached copy as the solver's parameter cache does
+		const auto original_model = data.current_model * 1.0f;
+		auto cached_model = data.current_model;
+		reputation_v1_adapter<float> adapter(boost::shared_ptr<reputation_interface<float>>(new reputation_implementation<float>()));
+		auto round = data.make_round(data.current_model);
+		adapter.update_model(round);
+
+		BOOST_CHECK(data.current_model == direct_model);
+		BOOST_CHECK(cached_model == original_model);
+		for (uint32_t node_id = 0; node_id < data.node_names.size(); ++node_id)
+		{
+			auto iter = direct_reputation.find(data.node_names[node_id]);
+			if (iter == direct_reputation.end())
+			{
+				BOOST_CHECK(std::isnan(data.reputation[node_id]));
+			}
+			else
+			{
+				BOOST_CHECK(data.reputation[node_id] == iter->second);
+			}
+		}
+		//node_3 had no reputation, the plugin lowers the generator of the worst model from the default 0
+		BOOST_CHECK(data.reputation[3] == 0);
+	}
+
+	BOOST_AUTO_TEST_CASE (v1_adapter_arguments_test)
+	{
+		std::mt19937 rng(23);
+		test_round data(rng);
+
+		auto *plugin = new recording_reputation();
+		reputation_v1_adapter<float> adapter{boost::shared_ptr<reputation_interface<float>>(plugin)};
+		const auto original_model = data.current_model * 1.0f;
+		auto round = data.make_round(data.current_model);
+		adapter.update_model(round);
+
+		//the received models are copied out of the views into separate blobs, current_model is not overwritten
+		BOOST_CHECK(!plugin->shares_blob_with_current_model);
+		BOOST_CHECK(plugin->seen_current_model == original_model);
+		BOOST_CHECK(data.current_model == original_model);
+		BOOST_REQUIRE(plugin->seen_models.size() == data.received.size());
+		for (size_t i = 0; i < data.received.size(); ++i) BOOST_CHECK(plugin->seen_models[i] == data.received[i]);
+		BOOST_CHECK((plugin->seen_generators == std::vector<std::string>{"node_1", "node_2", "node_3"}));
+
+		//NaN is "no reputation": absent in the map, and still NaN after the round unless the plugin sets it
+		BOOST_CHECK((plugin->seen_reputation == std::unordered_map<std::string, double>{{"node_1", 0.6}, {"node_2", 0.8}}));
+		BOOST_CHECK(std::isnan(data.reputation[0]));
+		BOOST_CHECK_CLOSE(data.reputation[1], 0.5, 1e-9);
+		BOOST_CHECK(data.reputation[2] == 0.8);
+		BOOST_CHECK(std::isnan(data.reputation[3]));
+		BOOST_CHECK(data.reputation[4] == 0.3);
+	}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,664 @@
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include "../../bin/simulation/simulation_output.hpp"
+#include "../../bin/simulation/simulation_scheduler.hpp"
+#include "../../bin/simulation/simulation_network.hpp"
+#include "../../bin/simulation/simulation_checkpoint.hpp"
+#include <sys/wait.h>
+
+#define BOOST_TEST_MAIN
+
+#include <boost/test/included/unit_test.hpp>
+
+namespace
+{
+	std::filesystem::path test_path(const std::string &name)
+	{
+		auto path = std::filesystem::temp_directory_path() / ("simulation_test_" + name);
+		std::filesystem::remove_all(path);
+		return path;
+	}
+
+	std::vector<char> read_file(const std::filesystem::path &path)
+	{
+		std::ifstream input(path, std::ios::binary);
+		return {std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+	}
+
+	std::vector<std::unique_ptr<node<float>>> make_nodes(size_t count)
+	{
+		std::vector<std::unique_ptr<node<float>>> output;
+		for (size_t i = 0; i < count; ++i)
+		{
+			output.emplace_back(new normal_node<float>(std::to_string(i), 1));
+			output.back()->id = i;
+		}
+		return output;
+	}
+
+	std::vector<node<float>*> node_pointers(const std::vector<std::unique_ptr<node<float>>> &nodes)
+	{
+		std::vector<node<float>*> output;
+		for (auto &single_node: nodes) output.push_back(single_node.get());
+		return output;
+	}
+
+	configuration_file::json network_config(double latency_min, double latency_max, double bandwidth)
+	{
+		configuration_file::json config;
+		config["enable"] = true;
+		config["latency_tick"] = configuration_file::json::array({latency_min, latency_max});
+		config["bandwidth_byte_per_tick"] = configuration_file::json::array({bandwidth, bandwidth});
+		config["drop_rate"] = 0.0;
+		return config;
+	}
+
+	simulation_network<float>::model_message network_message(const std::string &label)
+	{
+		return {label, Ml::model_compress_type::normal, {}, ""};
+	}
+
+	//{receiver, sender field of the message} in delivery order
+	std::vector<std::pair<std::string, std::string>> deliver_tick(simulation_network<float> &network, int tick)
+	{
+		std::vector<std::pair<std::string, std::string>> output;
+		network.deliver(tick, [&output](const std::string &receiver, simulation_network<float>::model_message &&message)
+		{
+			output.emplace_back(receiver, std::get<0>(message));
+		});
+		return output;
+	}
+
+	const std::string test_solver_proto = "../../../dataset/MNIST/lenet_solver_memory.prototxt";
+
+	void load_test_models(const std::vector<std::unique_ptr<node<float>>> &nodes, unsigned int seed)
+	{
+		for (auto &single_node: nodes) single_node->solver->load_caffe_model(test_solver_proto, seed + single_node->id);
+	}
+
+	//a state in every member saved by node_checkpoint, including a sparse update in the buffer
+	void fill_node_state(std::vector<std::unique_ptr<node<float>>> &nodes)
+	{
+		for (auto &single_node: nodes)
+		{
+			const uint32_t id = single_node->id;
+			auto parameter = single_node->solver->get_parameter();
+			single_node->next_train_tick = 10 + id;
+			single_node->buffer_size = 2 + id;
+			single_node->last_measured_accuracy = 0.5f + 0.1f * id;
+			single_node->last_measured_tick = 5 + id;
+			for (auto &peer: nodes)
+			{
+				if (peer == single_node) continue;
+				single_node->reputation_map[peer->name] = 0.25 * (peer->id + 1);
+				single_node->peers.emplace(peer->name, peer.get());
+			}
+			single_node->planned_peers.emplace(nodes[(id + 1) % nodes.size()]->name, nodes[(id + 1) % nodes.size()].get());
+			single_node->parameter_buffer.emplace_back(nodes[(id + 1) % nodes.size()]->name, Ml::model_compress_type::normal, parameter * 0.5f, "");
+			single_node->parameter_buffer.emplace_back(nodes[(id + 2) % nodes.size()]->name, Ml::model_compress_type::sparse_delta, Ml::caffe_parameter_net<float>(), std::string("sparse\0update", 13));
+			if (id == 0) single_node->sparse_residual = parameter * 0.25f;
+		}
+	}
+
+	void check_node_state(const node<float> &restored, const node<float> &original, const std::unordered_map<std::string, node<float> *> &restored_container)
+	{
+		auto restored_state = restored.solver->get_model_state();
+		auto original_state = original.solver->get_model_state();
+		BOOST_CHECK(restored_state.iter == original_state.iter);
+		BOOST_CHECK(restored_state.parameter == original_state.parameter);
+		BOOST_CHECK(restored_state.history == original_state.history);
+		BOOST_CHECK(restored.solver->get_parameter() == original.solver->get_parameter());
+		BOOST_CHECK(restored.next_train_tick == original.next_train_tick);
+		BOOST_CHECK(restored.buffer_size == original.buffer_size);
+		BOOST_CHECK(restored.reputation_map == original.reputation_map);
+		BOOST_CHECK(restored.parameter_buffer == original.parameter_buffer);
+		BOOST_CHECK(restored.sparse_residual == original.sparse_residual);
+		BOOST_CHECK(restored.last_measured_accuracy == original.last_measured_accuracy);
+		BOOST_CHECK(restored.last_measured_tick == original.last_measured_tick);
+
+		//the peers point to the restored nodes
+		BOOST_CHECK(restored.peers.size() == original.peers.size());
+		for (auto &[name, peer]: original.peers) BOOST_CHECK(restored.peers.contains(name) && restored.peers.at(name) == restored_container.at(name));
+		BOOST_CHECK(restored.planned_peers.size() == original.planned_peers.size());
+		for (auto &[name, peer]: original.planned_peers) BOOST_CHECK(restored.planned_peers.contains(name) && restored.planned_peers.at(name) == restored_container.at(name));
+	}
+
+	std::unordered_map<std::string, node<float> *> make_node_container(const std::vector<std::unique_ptr<node<float>>> &nodes)
+	{
+		std::unordered_map<std::string, node<float> *> output;
+		for (auto &single_node: nodes) output.emplace(single_node->name, single_node.get());
+		return output;
+	}
+
+	//the manifest of the checkpoints of version 1, before the models in flight were saved
+	class simulation_checkpoint_manifest_v1
+	{
+	public:
+		int tick = -1;
+		uint64_t result_file_size = 0;
+		std::unordered_map<std::string, std::string> node_files;
+		std::unordered_map<std::string, std::string> service_states;
+		uint64_t random_seed = 0;
+
+		template<class Archive>
+		void serialize(Archive & ar, const unsigned int version)
+		{
+			ar & tick;
+			ar & result_file_size;
+			ar & node_files;
+			ar & service_states;
+			ar & random_seed;
+		}
+	};
+}
+BOOST_CLASS_VERSION(simulation_checkpoint_manifest_v1, 1)
+
+BOOST_AUTO_TEST_SUITE (simulation_test)
+
+	BOOST_AUTO_TEST_CASE (output_reopen_append_test)
+	{
+		auto path = test_path("reopen.bin");
+		{
+			simulation_output output(path);
+			int accuracy = output.define_table("accuracy", {"node_0", "node_1"});
+			int log = output.define_text("log");
+			output.append_row(accuracy, 0, {0.1f, NAN});
+			output.append_text(log, 0, "first");
+			output.commit();
+			output.append_row(accuracy, 1, {0.2f, 0.3f});
+			output.close();
+		}
+		{
+			simulation_output output(path, true);
+			BOOST_CHECK(output.get_streams().size() == 2);
+			int log = output.define_text("log");
+			int accuracy = output.define_table("accuracy", {"node_0", "node_1"});
+			BOOST_CHECK(accuracy == 0);
+			BOOST_CHECK(log == 1);
+			output.append_row(accuracy, 2, {0.4f, 0.5f});
+			output.append_text(log, 2, "second");
+			int loss = output.define_table("loss", {"node_0"});
+			BOOST_CHECK(loss == 2);
+			output.append_row(loss, 2, {1.5f});
+		}
+
+		simulation_output_reader reader(path);
+		BOOST_REQUIRE(reader.get_streams().size() == 3);
+		BOOST_CHECK(reader.get_streams()[0].name == "accuracy");
+		BOOST_CHECK(reader.get_streams()[2].name == "loss");
+		const auto &accuracy = reader.get_table(0);
+		BOOST_CHECK((accuracy.ticks == std::vector<int>{0, 1, 2}));
+		BOOST_REQUIRE(accuracy.values.size() == 6);
+		BOOST_CHECK(accuracy.values[0] == 0.1f);
+		BOOST_CHECK(std::isnan(accuracy.values[1]));
+		BOOST_CHECK(accuracy.values[2] == 0.2f && accuracy.values[3] == 0.3f);
+		BOOST_CHECK(accuracy.values[4] == 0.4f && accuracy.values[5] == 0.5f);
+		BOOST_CHECK((reader.get_text(1).lines == std::vector<std::string>{"first", "second"}));
+		BOOST_CHECK((reader.get_text(1).ticks == std::vector<int>{0, 2}));
+		BOOST_CHECK((reader.get_table(2).ticks == std::vector<int>{2}));
+
+		//the old index is dropped, the trailer points to the only index chunk which lists every other chunk
+		auto content = read_file(path);
+		BOOST_REQUIRE(content.size() > simulation_output::HEADER_SIZE + simulation_output::TRAILER_SIZE);
+		BOOST_CHECK(std::memcmp(content.data() + content.size() - 8, simulation_output::INDEX_MAGIC, 8) == 0);
+		uint64_t index_offset, chunk_count = 0;
+		std::memcpy(&index_offset, content.data() + content.size() - simulation_output::TRAILER_SIZE, 8);
+		size_t loc = simulation_output::HEADER_SIZE;
+		while (loc < index_offset)
+		{
+			uint32_t type;
+			uint64_t payload_size;
+			std::memcpy(&type, content.data() + loc, 4);
+			std::memcpy(&payload_size, content.data() + loc + 8, 8);
+			BOOST_CHECK(type != simulation_output::index);
+			loc += simulation_output::CHUNK_HEADER_SIZE + payload_size;
+			++chunk_count;
+		}
+		BOOST_REQUIRE(loc == index_offset);
+		uint32_t index_type;
+		uint64_t entry_count;
+		std::memcpy(&index_type, content.data() + index_offset, 4);
+		std::memcpy(&entry_count, content.data() + index_offset + simulation_output::CHUNK_HEADER_SIZE, 8);
+		BOOST_CHECK(index_type == simulation_output::index);
+		BOOST_CHECK(entry_count == chunk_count);
+
+		std::filesystem::remove(path);
+	}
+
+	BOOST_AUTO_TEST_CASE (output_truncate_partial_row_test)
+	{
+		auto path = test_path("partial.bin");
+		uint64_t valid_size;
+		{
+			simulation_output output(path);
+			int accuracy = output.define_table("accuracy", {"node_0"});
+			output.append_row(accuracy, 0, {0.1f});
+			valid_size = output.flush();
+			output.append_row(accuracy, 1, {0.2f});
+			output.close();
+		}
+
+		//a crash while writing tick 1: the chunk header and a part of its payload are on the disk
+		std::filesystem::resize_file(path, valid_size + simulation_output::CHUNK_HEADER_SIZE + 4);
+		{
+			simulation_output output(path, true);
+			BOOST_CHECK(output.flush() == valid_size);
+			BOOST_CHECK(std::filesystem::file_size(path) == valid_size);
+			int accuracy = output.define_table("accuracy", {"node_0"});
+			output.append_row(accuracy, 2, {0.3f});
+		}
+
+		simulation_output_reader reader(path);
+		BOOST_REQUIRE(reader.get_streams().size() == 1);
+		const auto &accuracy = reader.get_table(0);
+		BOOST_CHECK((accuracy.ticks == std::vector<int>{0, 2}));
+		BOOST_CHECK((accuracy.values == std::vector<float>{0.1f, 0.3f}));
+
+		std::filesystem::remove(path);
+	}
+
+	BOOST_AUTO_TEST_CASE (output_stream_reuse_test)
+	{
+		auto path = test_path("reuse.bin");
+		{
+			simulation_output output(path);
+			int first = output.define_table("accuracy", {"node_0"});
+			int log = output.define_text("log");
+			int second = output.define_table("accuracy", {"node_0"});
+			BOOST_CHECK(first == second);
+			BOOST_CHECK(log != first);
+			BOOST_CHECK(output.define_text("log") == log);
+			BOOST_CHECK(output.get_streams().size() == 2);
+			output.append_row(first, 0, {0.1f});
+			output.append_row(second, 1, {0.2f});
+		}
+
+		//only one definition is written for a reused stream
+		simulation_output_reader reader(path);
+		BOOST_REQUIRE(reader.get_streams().size() == 2);
+		BOOST_CHECK((reader.get_table(0).ticks == std::vector<int>{0, 1}));
+
+		std::filesystem::remove(path);
+	}
+
+	BOOST_AUTO_TEST_CASE (output_row_width_check_test)
+	{
+		auto path = test_path("width.bin");
+
+		//the CHECK aborts the process, so the wrong row is appended in a child without the signal handler of boost test
+		pid_t pid = fork();
+		BOOST_REQUIRE(pid >= 0);
+		if (pid == 0)
+		{
+			std::signal(SIGABRT, SIG_DFL);
+			simulation_output output(path);
+			int accuracy = output.define_table("accuracy", {"node_0", "node_1"});
+			output.append_row(accuracy, 0, {0.1f});
+			_exit(0);
+		}
+
+		int status = 0;
+		waitpid(pid, &status, 0);
+		BOOST_CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+
+		std::filesystem::remove(path);
+	}
+
+	BOOST_AUTO_TEST_CASE (scheduler_overflow_test)
+	{
+		auto nodes = make_nodes(4);
+		auto pointers = node_pointers(nodes);
+		//wheel size 4: node 1 is in the wheel, nodes 0, 2 and 3 are in the overflow, node 3 shares the slot of node 1
+		nodes[0]->next_train_tick = 10;
+		nodes[1]->next_train_tick = 2;
+		nodes[2]->next_train_tick = 5;
+		nodes[3]->next_train_tick = 6;
+		simulation_scheduler<float> scheduler(pointers, 4);
+		scheduler.reset(0);
+		BOOST_CHECK(scheduler.pop_buffer_nodes().size() == 4);
+
+		BOOST_CHECK(scheduler.next_event_tick(0) == 2);
+		BOOST_CHECK(scheduler.pop_train_nodes(2) == std::vector<node<float>*>{pointers[1]});
+		nodes[1]->next_train_tick = 100;
+		scheduler.finish_tick(2);
+
+		//node 2 is moved into the wheel when tick 5 enters the horizon, node 3 is not popped with the old slot of node 1
+		BOOST_CHECK(scheduler.next_event_tick(2) == 5);
+		BOOST_CHECK(scheduler.pop_train_nodes(5) == std::vector<node<float>*>{pointers[2]});
+		nodes[2]->next_train_tick = 6;
+		scheduler.finish_tick(5);
+		BOOST_CHECK(scheduler.next_event_tick(5) == 6);
+		BOOST_CHECK((scheduler.pop_train_nodes(6) == std::vector<node<float>*>{pointers[2], pointers[3]}));
+		nodes[2]->next_train_tick = 0;
+		nodes[3]->next_train_tick = 1000;
+		scheduler.finish_tick(6);
+
+		//a next_train_tick in the past is scheduled at the next tick
+		BOOST_CHECK(scheduler.next_event_tick(6) == 7);
+		BOOST_CHECK(scheduler.pop_train_nodes(7) == std::vector<node<float>*>{pointers[2]});
+		nodes[2]->next_train_tick = 1000;
+		scheduler.finish_tick(7);
+
+		BOOST_CHECK(scheduler.next_event_tick(7) == 10);
+		BOOST_CHECK(scheduler.pop_train_nodes(10) == std::vector<node<float>*>{pointers[0]});
+		nodes[0]->next_train_tick = 1000;
+		scheduler.finish_tick(10);
+		BOOST_CHECK(scheduler.next_event_tick(10) == 100);
+		BOOST_CHECK(scheduler.pop_train_nodes(100) == std::vector<node<float>*>{pointers[1]});
+		nodes[1]->next_train_tick = 1000;
+		scheduler.finish_tick(100);
+		BOOST_CHECK((scheduler.pop_train_nodes(1000) == std::vector<node<float>*>{pointers[0], pointers[1], pointers[2], pointers[3]}));
+	}
+
+	BOOST_AUTO_TEST_CASE (scheduler_next_event_tick_test)
+	{
+		auto nodes = make_nodes(2);
+		auto pointers = node_pointers(nodes);
+		nodes[0]->next_train_tick = 3;
+		nodes[1]->next_train_tick = 40;
+		simulation_scheduler<float> scheduler(pointers, 8);
+		scheduler.reset(0);
+
+		//buffer candidates are checked in the next tick
+		BOOST_CHECK(scheduler.next_event_tick(0) == 1);
+		scheduler.pop_buffer_nodes();
+
+		//the empty slots 1 and 2 are skipped, then the overflow is used when the wheel is empty
+		BOOST_CHECK(scheduler.next_event_tick(0) == 3);
+		BOOST_CHECK(scheduler.pop_train_nodes(3).size() == 1);
+		nodes[0]->next_train_tick = simulation_scheduler<float>::NO_EVENT;
+		scheduler.finish_tick(3);
+		BOOST_CHECK(scheduler.next_event_tick(3) == 40);
+
+		scheduler.notify_buffer_changed(pointers[1]);
+		BOOST_CHECK(scheduler.next_event_tick(3) == 4);
+		BOOST_CHECK(scheduler.pop_buffer_nodes() == std::vector<node<float>*>{pointers[1]});
+
+		BOOST_CHECK(scheduler.pop_train_nodes(40).size() == 1);
+		nodes[1]->next_train_tick = simulation_scheduler<float>::NO_EVENT;
+		scheduler.finish_tick(40);
+		BOOST_CHECK(scheduler.next_event_tick(40) == simulation_scheduler<float>::NO_EVENT);
+	}
+
+	BOOST_AUTO_TEST_CASE (scheduler_random_order_test)
+	{
+		const size_t node_count = 50;
+		const int last_tick = 2000;
+		std::mt19937 rng(42);
+		std::uniform_int_distribution<int> start_distribution(0, 100);
+		std::uniform_int_distribution<int> interval_distribution(1, 40);
+		std::vector<int> start_tick(node_count);
+		std::vector<std::vector<int>> intervals(node_count);
+		for (size_t i = 0; i < node_count; ++i)
+		{
+			start_tick[i] = start_distribution(rng);
+			for (int j = 0; j < last_tick; ++j) intervals[i].push_back(interval_distribution(rng));
+		}
+
+		//the per-tick scan of all nodes used before the scheduler
+		std::vector<std::pair<int, uint32_t>> expected;
+		{
+			std::vector<int> next_train_tick = start_tick;
+			std::vector<size_t> train_count(node_count, 0);
+			for (int tick = 0; tick <= last_tick; ++tick)
+			{
+				for (uint32_t i = 0; i < node_count; ++i)
+				{
+					if (tick < next_train_tick[i]) continue;
+					expected.emplace_back(tick, i);
+					next_train_tick[i] = tick + intervals[i][train_count[i]++];
+				}
+			}
+		}
+
+		std::vector<std::pair<int, uint32_t>> output;
+		{
+			auto nodes = make_nodes(node_count);
+			auto pointers = node_pointers(nodes);
+			std::unordered_map<node<float>*, uint32_t> node_index;
+			for (uint32_t i = 0; i < node_count; ++i)
+			{
+				nodes[i]->next_train_tick = start_tick[i];
+				node_index.emplace(pointers[i], i);
+			}
+			std::vector<size_t> train_count(node_count, 0);
+			simulation_scheduler<float> scheduler(pointers, 8);
+			scheduler.reset(0);
+			for (int tick = 0; tick <= last_tick; tick = scheduler.next_event_tick(tick))
+			{
+				for (auto* single_node: scheduler.pop_train_nodes(tick))
+				{
+					uint32_t i = node_index.at(single_node);
+					output.emplace_back(tick, i);
+					single_node->next_train_tick = tick + intervals[i][train_count[i]++];
+				}
+				scheduler.pop_buffer_nodes();
+				scheduler.finish_tick(tick);
+			}
+		}
+
+		BOOST_CHECK(output.size() == expected.size());
+		BOOST_CHECK(output == expected);
+	}
+
+	BOOST_AUTO_TEST_CASE (network_mixed_latency_test)
+	{
+		simulation_random::set_seed(7);
+		auto nodes = make_nodes(4);
+		simulation_network<float> network, reference;
+		network.apply_config(network_config(1, 6, 0));
+		reference.apply_config(network_config(1, 6, 0));
+
+		//the arrival ticks are drawn from an identical network, a tie is delivered in sending order
+		std::vector<std::tuple<int, size_t, std::string, std::string>> expected;
+		std::map<std::pair<uint32_t, uint32_t>, int> link_latency;
+		std::vector<std::vector<std::pair<std::string, std::string>>> delivered;
+		for (int tick = 0; tick <= 20; ++tick)
+		{
+			delivered.push_back(deliver_tick(network, tick));
+			if (tick >= 10) continue;
+			for (auto &sender: nodes)
+			{
+				for (auto &receiver: nodes)
+				{
+					if (sender == receiver) continue;
+					std::string label = sender->name + "->" + receiver->name + "@" + std::to_string(tick);
+					auto arrival_tick = reference.schedule(tick, *sender, *receiver, 1000);
+					BOOST_REQUIRE(arrival_tick);
+					//unlimited bandwidth: the latency of a link does not change
+					auto [iter, inserted] = link_latency.emplace(std::make_pair(sender->id, receiver->id), *arrival_tick - tick);
+					BOOST_CHECK(iter->second == *arrival_tick - tick);
+					BOOST_CHECK(*arrival_tick - tick >= 1 && *arrival_tick - tick <= 6);
+					expected.emplace_back(*arrival_tick, expected.size(), receiver->name, label);
+					network.send(tick, *sender, *receiver, network_message(label), 1000);
+				}
+			}
+		}
+		BOOST_CHECK(network.next_arrival_tick() == simulation_network<float>::NO_ARRIVAL);
+
+		std::sort(expected.begin(), expected.end());
+		std::vector<std::vector<std::pair<std::string, std::string>>> expected_delivered(delivered.size());
+		for (auto &[arrival_tick, sequence, receiver, label]: expected) expected_delivered.at(arrival_tick).emplace_back(receiver, label);
+		BOOST_CHECK(delivered == expected_delivered);
+
+		//the case is only meaningful with different latencies and several models in one tick
+		std::set<int> latencies;
+		for (auto &[link, latency]: link_latency) latencies.insert(latency);
+		BOOST_CHECK(latencies.size() > 1);
+		BOOST_CHECK(std::any_of(delivered.begin(), delivered.end(), [](const auto &items) { return items.size() > 1; }));
+	}
+
+	BOOST_AUTO_TEST_CASE (network_delivery_order_test)
+	{
+		auto nodes = make_nodes(3);
+		simulation_network<float> network;
+		network.apply_config(network_config(2, 2, 100));
+
+		//finish = max(tick, link free at) + size / bandwidth, arrival = ceil(finish + latency)
+		network.send(0, *nodes[0], *nodes[1], network_message("ab_1"), 250); //finish 2.5, arrival 5
+		network.send(0, *nodes[0], *nodes[1], network_message("ab_2"), 250); //queued behind ab_1, finish 5, arrival 7
+		network.send(0, *nodes[0], *nodes[2], network_message("ac_1"), 100); //finish 1, arrival 3
+		BOOST_CHECK(deliver_tick(network, 0).empty());
+		network.send(1, *nodes[1], *nodes[2], network_message("bc_1"), 200); //finish 3, arrival 5
+		BOOST_CHECK(deliver_tick(network, 1).empty());
+		network.send(2, *nodes[2], *nodes[0], network_message("ca_1"), 50);  //finish 2.5, arrival 5
+		BOOST_CHECK(network.next_arrival_tick() == 3);
+
+		//a restored network delivers in the same order and keeps the link state
+		simulation_network<float> restored;
+		restored.apply_config(network_config(2, 2, 100));
+		restored.load_state(network.save_state());
+
+		for (auto *target: {&network, &restored})
+		{
+			using delivery = std::vector<std::pair<std::string, std::string>>;
+			BOOST_CHECK(deliver_tick(*target, 2).empty());
+			BOOST_CHECK((deliver_tick(*target, 3) == delivery{{"2", "ac_1"}}));
+			BOOST_CHECK(deliver_tick(*target, 4).empty());
+			BOOST_CHECK((deliver_tick(*target, 5) == delivery{{"1", "ab_1"}, {"2", "bc_1"}, {"0", "ca_1"}}));
+			BOOST_CHECK(target->next_arrival_tick() == 7);
+			BOOST_CHECK(deliver_tick(*target, 6).empty());
+			BOOST_CHECK((deliver_tick(*target, 7) == delivery{{"1", "ab_2"}}));
+			BOOST_CHECK(target->next_arrival_tick() == simulation_network<float>::NO_ARRIVAL);
+			BOOST_CHECK(target->schedule(0, *nodes[0], *nodes[1], 250) == 10);
+		}
+
+		auto statistics = network.pop_statistics();
+		BOOST_CHECK(statistics[0] == 6); //the 5 models and the last schedule
+		BOOST_CHECK(statistics[1] == 0);
+		BOOST_CHECK(statistics[2] == 5);
+		BOOST_CHECK(statistics[3] == 0);
+	}
+
+	BOOST_AUTO_TEST_CASE (network_zero_latency_test)
+	{
+		auto nodes = make_nodes(3);
+		simulation_network<float> network;
+		network.apply_config(network_config(0, 0, 0));
+
+		//without latency and bandwidth limit a model is delivered in the tick it is sent
+		network.send(3, *nodes[2], *nodes[0], network_message("ca"), 1000);
+		network.send(3, *nodes[0], *nodes[1], network_message("ab"), 1000);
+		network.send(3, *nodes[1], *nodes[0], network_message("ba"), 1000);
+		BOOST_CHECK(network.next_arrival_tick() == 3);
+		using delivery = std::vector<std::pair<std::string, std::string>>;
+		BOOST_CHECK((deliver_tick(network, 3) == delivery{{"0", "ca"}, {"1", "ab"}, {"0", "ba"}}));
+
+		//the transfer time alone moves a model to a later tick
+		network.apply_config(network_config(0, 0, 100));
+		network.send(4, *nodes[0], *nodes[1], network_message("ab"), 50);
+		network.send(4, *nodes[1], *nodes[2], network_message("bc"), 0);
+		BOOST_CHECK((deliver_tick(network, 4) == delivery{{"2", "bc"}}));
+		BOOST_CHECK((deliver_tick(network, 5) == delivery{{"1", "ab"}}));
+	}
+
+	BOOST_AUTO_TEST_CASE (checkpoint_round_trip_test)
+	{
+		auto checkpoint_path = test_path("checkpoint");
+		simulation_random::set_seed(11);
+		std::unordered_map<std::string, std::shared_ptr<service<float>>> services;
+
+		auto nodes = make_nodes(3);
+		auto pointers = node_pointers(nodes);
+		load_test_models(nodes, 1);
+		fill_node_state(nodes);
+		{
+			simulation_checkpoint<float> checkpoint(checkpoint_path);
+			checkpoint.save(20, 1000, pointers, services);
+			checkpoint.wait();
+
+			//only the changed node is written again, the file of its previous state is removed
+			nodes[0]->next_train_tick = 30;
+			checkpoint.save(30, 1234, pointers, services, "in flight");
+			checkpoint.wait();
+		}
+		BOOST_CHECK(std::filesystem::exists(checkpoint_path / "nodes" / "0.30.bin"));
+		BOOST_CHECK(!std::filesystem::exists(checkpoint_path / "nodes" / "0.20.bin"));
+		BOOST_CHECK(std::filesystem::exists(checkpoint_path / "nodes" / "1.20.bin"));
+		BOOST_CHECK(std::filesystem::exists(checkpoint_path / "nodes" / "2.20.bin"));
+		BOOST_CHECK(!std::filesystem::exists(checkpoint_path / "manifest.bin.tmp"));
+
+		//fresh nodes with other initial weights
+		auto restored_nodes = make_nodes(3);
+		auto restored_pointers = node_pointers(restored_nodes);
+		auto restored_container = make_node_container(restored_nodes);
+		load_test_models(restored_nodes, 100);
+		BOOST_REQUIRE(restored_nodes[0]->solver->get_parameter() != nodes[0]->solver->get_parameter());
+
+		simulation_checkpoint<float> checkpoint(checkpoint_path);
+		auto manifest = checkpoint.load_manifest();
+		BOOST_REQUIRE(manifest);
+		BOOST_CHECK(manifest->result_file_size == 1234);
+		BOOST_CHECK(manifest->random_seed == 11);
+		BOOST_CHECK(manifest->network_state == "in flight");
+		BOOST_CHECK(manifest->network_state_version == 2);
+		BOOST_CHECK(checkpoint.restore(*manifest, restored_pointers, restored_container, services) == 30);
+		for (size_t i = 0; i < nodes.size(); ++i) check_node_state(*restored_nodes[i], *nodes[i], restored_container);
+
+		std::filesystem::remove_all(checkpoint_path);
+	}
+
+	BOOST_AUTO_TEST_CASE (checkpoint_manifest_v1_test)
+	{
+		auto checkpoint_path = test_path("checkpoint_v1");
+		simulation_random::set_seed(13);
+		std::unordered_map<std::string, std::shared_ptr<service<float>>> services;
+
+		auto nodes = make_nodes(2);
+		auto pointers = node_pointers(nodes);
+		load_test_models(nodes, 1);
+		fill_node_state(nodes);
+		{
+			simulation_checkpoint<float> checkpoint(checkpoint_path);
+			checkpoint.save(8, 64, pointers, services);
+			checkpoint.wait();
+		}
+
+		//replace the manifest by a version 1 manifest of the same checkpoint
+		{
+			simulation_checkpoint<float> checkpoint(checkpoint_path);
+			auto manifest = checkpoint.load_manifest();
+			BOOST_REQUIRE(manifest);
+			simulation_checkpoint_manifest_v1 legacy_manifest;
+			legacy_manifest.tick = manifest->tick;
+			legacy_manifest.result_file_size = manifest->result_file_size;
+			legacy_manifest.node_files = manifest->node_files;
+			legacy_manifest.random_seed = manifest->random_seed;
+			auto content = serialize_wrap<boost::archive::binary_oarchive>(legacy_manifest).str();
+			std::ofstream output(checkpoint_path / "manifest.bin", std::ios::binary);
+			output.write(content.data(), content.size());
+		}
+
+		auto restored_nodes = make_nodes(2);
+		auto restored_pointers = node_pointers(restored_nodes);
+		auto restored_container = make_node_container(restored_nodes);
+		load_test_models(restored_nodes, 100);
+
+		simulation_checkpoint<float> checkpoint(checkpoint_path);
+		auto manifest = checkpoint.load_manifest();
+		BOOST_REQUIRE(manifest);
+		BOOST_CHECK(manifest->tick == 8);
+		BOOST_CHECK(manifest->result_file_size == 64);
+		BOOST_CHECK(manifest->random_seed == 13);
+		BOOST_CHECK(manifest->node_files.size() == 2);
+		BOOST_CHECK(manifest->network_state.empty());
+		BOOST_CHECK(manifest->network_state_version == 1);
+		BOOST_CHECK(checkpoint.restore(*manifest, restored_pointers, restored_container, services) == 8);
+		for (size_t i = 0; i < nodes.size(); ++i) check_node_state(*restored_nodes[i], *nodes[i], restored_container);
+
+		//an empty network state of an old checkpoint is accepted
+		simulation_network<float> network;
+		network.load_state(manifest->network_state, manifest->network_state_version);
+		BOOST_CHECK(network.next_arrival_tick() == simulation_network<float>::NO_ARRIVAL);
+
+		std::filesystem::remove_all(checkpoint_path);
+	}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,8 @@
 // Created by tyd.
 //
 
+#include <thread>
+#include <atomic>
 #include <lmdb.h>
 
 #include <caffe/util/io.hpp>
@@ -12,6 +14,11 @@
 
 #include <ml_layer/ml_abs.hpp>
 #include <ml_layer/caffe.hpp>
+#include <ml_layer/caffe_pool.hpp>
+#include <ml_layer/model_reduction.hpp>
+#include <ml_layer/robust_aggregation.hpp>
+#include <ml_layer/model_similarity.hpp>
+#include <ml_layer/evaluation_cache.hpp>
 #include <ml_layer/tensor_blob_like.hpp>
 #include <ml_layer/fed_avg_buffer.hpp>
 #include <ml_layer/data_convert.hpp>
@@ -141,7 +148,40 @@ BOOST_AUTO_TEST_CASE (fed_avg_buffer)
 	
 	BOOST_CHECK(parameter == parameter0);
 	BOOST_CHECK(parameter == parameter1);
-	BOOST_CHECK(parameter != parameter2);
+	BOOST_CHECK(parameter == parameter2); //the running sum is in double, the average of the same model is exact
+	
+	//weighted, the evicted models are subtracted
+	auto parameter_zero = parameter;
+	parameter_zero.set_all(0);
+	Ml::fed_avg_buffer<Ml::caffe_parameter_net<float>> weighted_buffer(2);
+	weighted_buffer.add(parameter_zero, 5.0);
+	weighted_buffer.add(parameter, 1.0);
+	weighted_buffer.add(parameter_zero, 3.0);
+	BOOST_CHECK(weighted_buffer.average() == parameter / 4);
+	
+	//NaN is skipped by average_ignore
+	auto parameter_nan = parameter;
+	parameter_nan.set_all(NAN);
+	Ml::fed_avg_buffer<Ml::caffe_parameter_net<float>> nan_buffer(3);
+	nan_buffer.add(parameter_nan);
+	nan_buffer.add(parameter, 2.0);
+	BOOST_CHECK(nan_buffer.average_ignore() == parameter);
+	nan_buffer.add(parameter_nan);
+	nan_buffer.add(parameter_nan);
+	auto parameter_all_nan = nan_buffer.average_ignore();
+	BOOST_CHECK(std::isnan(parameter_all_nan.getLayers()[1].getBlob_p()->getData()[0]));
+	
+	//an infinite model does not poison the running sum after it is evicted
+	auto parameter_inf = parameter;
+	parameter_inf.set_all(INFINITY);
+	Ml::fed_avg_buffer<Ml::caffe_parameter_net<float>> inf_buffer(2);
+	inf_buffer.add(parameter_inf);
+	inf_buffer.add(parameter);
+	BOOST_CHECK(inf_buffer.average_ignore() == parameter);
+	BOOST_CHECK(std::isnan(inf_buffer.average().getLayers()[1].getBlob_p()->getData()[0]));
+	inf_buffer.add(parameter);
+	BOOST_CHECK(inf_buffer.average() == parameter);
+	BOOST_CHECK(inf_buffer.average_ignore() == parameter);
 }
 
 static uint32_t swap_endian(uint32_t val)
@@ -323,4 +363,237 @@ BOOST_AUTO_TEST_CASE (caffe_ext_predict)
 	std::cout << "predict accuracy: " << float (correct_count) / all_count << std::endl;
 }
 
+BOOST_AUTO_TEST_CASE (pooled_model)
+{
+	const std::string solver_path = "../../../dataset/MNIST/lenet_solver_memory.prototxt";
+	Ml::data_converter<float> dataset;
+	dataset.load_dataset_mnist("../../../dataset/MNIST/train-images.idx3-ubyte", "../../../dataset/MNIST/train-labels.idx1-ubyte");
+	
+	//a pooled model trains the same as a model owning its solver
+	Ml::MlCaffeModel<float,caffe::SGDSolver> model1;
+	model1.load_caffe_model(solver_path);
+	Ml::MlCaffeModelPooled<float,caffe::SGDSolver> pooled1, pooled2;
+	pooled1.load_caffe_model(solver_path);
+	pooled2.load_caffe_model(solver_path);
+	pooled1.set_model_state(model1.get_model_state());
+	auto pooled2_state = pooled2.get_model_state();
+	
+	for (int repeat = 0; repeat < 5; ++repeat)
+	{
+		auto [train_x, train_y] = dataset.get_random_data(64);
+		model1.train(train_x, train_y, false);
+		pooled1.train(train_x, train_y, false);
+	}
+	auto state1 = model1.get_model_state();
+	auto pooled_state1 = pooled1.get_model_state();
+	BOOST_CHECK(state1.iter == pooled_state1.iter);
+	BOOST_CHECK(state1.parameter == pooled_state1.parameter);
+	BOOST_CHECK(state1.history == pooled_state1.history);
+	BOOST_CHECK(model1.get_parameter() == pooled1.get_parameter());
+	
+	//the other model sharing the pool is not changed
+	BOOST_CHECK(pooled2.get_model_state().parameter == pooled2_state.parameter);
+	
+	auto [test_x, test_y] = dataset.get_random_data(100);
+	BOOST_CHECK(model1.evaluation(test_x, test_y) == pooled1.evaluation(test_x, test_y));
+}
+
+BOOST_AUTO_TEST_CASE (parameter_version_cache)
+{
+	Ml::MlCaffeModel<float,caffe::SGDSolver> model1;
+	model1.load_caffe_model("../../../dataset/MNIST/lenet_solver_memory.prototxt");
+	
+	//unchanged model returns the cached parameter
+	auto version = model1.get_version();
+	auto parameter1 = model1.get_parameter();
+	auto parameter2 = model1.get_parameter();
+	BOOST_CHECK(model1.get_version() == version);
+	BOOST_CHECK(parameter1.getLayers()[1].getBlob_p() == parameter2.getLayers()[1].getBlob_p());
+	
+	//modifying a copy does not change the cached parameter
+	auto parameter_copy = parameter1;
+	parameter_copy.set_all(0);
+	BOOST_CHECK(model1.get_parameter() == parameter1);
+	BOOST_CHECK(parameter_copy != parameter1);
+	
+	//set_parameter changes the version
+	model1.set_parameter(parameter_copy);
+	BOOST_CHECK(model1.get_version() != version);
+	BOOST_CHECK(model1.get_parameter() == parameter_copy);
+}
+
+BOOST_AUTO_TEST_CASE (model_reduction)
+{
+	Ml::MlCaffeModel<float,caffe::SGDSolver> model1;
+	model1.load_caffe_model("../../../dataset/MNIST/lenet_solver_memory.prototxt");
+	
+	std::vector<Ml::caffe_parameter_net<float>> models;
+	auto serial_sum = model1.get_parameter();
+	serial_sum.set_all(0);
+	for (int i = 0; i < 37; ++i)
+	{
+		auto model = model1.get_parameter();
+		model.random(-1, 1);
+		serial_sum = serial_sum + model;
+		models.push_back(model);
+	}
+	
+	for (uint32_t thread_count : {1, 3, 8})
+	{
+		auto sum = Ml::model_reduction<float>::sum(models.size(), [&models](size_t index) -> const Ml::caffe_parameter_net<float>& {return models[index];}, thread_count);
+		auto average = Ml::model_reduction<float>::average(models.size(), [&models](size_t index) -> const Ml::caffe_parameter_net<float>& {return models[index];}, thread_count);
+		BOOST_CHECK(sum.roughly_equal(serial_sum, 1e-4));
+		BOOST_CHECK(average.roughly_equal(serial_sum / float(models.size()), 1e-5));
+	}
+	
+	//random() on the copies does not change the model
+	BOOST_CHECK(model1.get_parameter() != models[0]);
+}
+
+BOOST_AUTO_TEST_CASE (robust_aggregation)
+{
+	Ml::MlCaffeModel<float,caffe::SGDSolver> model1;
+	model1.load_caffe_model("../../../dataset/MNIST/lenet_solver_memory.prototxt");
+	
+	//5 honest models and 2 malicious models
+	auto honest = model1.get_parameter();
+	std::vector<Ml::caffe_parameter_net<float>> models(5, honest);
+	for (int i = 0; i < 2; ++i)
+	{
+		auto model = honest;
+		model.random(-100, 100);
+		models.push_back(model);
+	}
+	auto get_model = [&models](size_t index) -> const Ml::caffe_parameter_net<float>& {return models[index];};
+	
+	for (uint32_t thread_count : {1, 3})
+	{
+		BOOST_CHECK(Ml::robust_aggregation<float>::median(models.size(), get_model, thread_count) == honest);
+		BOOST_CHECK(Ml::robust_aggregation<float>::trimmed_mean(models.size(), get_model, 0.3, thread_count) == honest);
+		BOOST_CHECK(Ml::robust_aggregation<float>::krum(models.size(), get_model, 2, 1, thread_count) == honest);
+		BOOST_CHECK(Ml::robust_aggregation<float>::krum(models.size(), get_model, 2, 5, thread_count) == honest);
+		BOOST_CHECK(Ml::robust_aggregation<float>::geometric_median(models.size(), get_model, 100, 1e-6, thread_count).roughly_equal(honest, 1e-3));
+	}
+	
+	//NaN is skipped by the median
+	auto dropped = honest;
+	dropped.set_all(NAN);
+	models.push_back(dropped);
+	BOOST_CHECK(Ml::robust_aggregation<float>::median(models.size(), get_model) == honest);
+}
+
+BOOST_AUTO_TEST_CASE (model_similarity)
+{
+	Ml::MlCaffeModel<float,caffe::SGDSolver> model1;
+	model1.load_caffe_model("../../../dataset/MNIST/lenet_solver_memory.prototxt");
+	
+	auto parameter = model1.get_parameter();
+	auto other = parameter;
+	other.random(-1, 1);
+	std::vector<Ml::caffe_parameter_net<float>> models = {parameter, parameter * 2, parameter * -1, other};
+	auto get_model = [&models](size_t index) -> const Ml::caffe_parameter_net<float>& {return models[index];};
+	
+	auto similarity = Ml::model_similarity<float>::compute(models.size(), get_model, 2);
+	const size_t count = models.size();
+	BOOST_CHECK(similarity.count == count);
+	BOOST_CHECK(std::abs(similarity.cosine[0 * count + 1] - 1) < 1e-9);
+	BOOST_CHECK(std::abs(similarity.cosine[0 * count + 2] + 1) < 1e-9);
+	BOOST_CHECK(std::abs(similarity.norm[1] - 2 * similarity.norm[0]) < 1e-6 * similarity.norm[0]);
+	BOOST_CHECK(std::abs(similarity.l2[0 * count + 1] - similarity.norm[0]) < 1e-6 * similarity.norm[0]);
+	BOOST_CHECK(similarity.sign_agreement[0 * count + 1] == 1);
+	BOOST_CHECK(similarity.sign_agreement[0 * count + 2] < 0.5);
+	
+	//against the caffe_parameter_net operators
+	auto diff = parameter - other;
+	double l2 = 0;
+	for (const auto& layer: diff.getLayers())
+	{
+		if (!layer.getBlob_p()) continue;
+		for (float value: layer.getBlob_p()->getData()) l2 += double(value) * double(value);
+	}
+	BOOST_CHECK(std::abs(similarity.l2[0 * count + 3] - std::sqrt(l2)) < 1e-4 * std::sqrt(l2));
+	BOOST_CHECK(similarity.l2[3 * count + 0] == similarity.l2[0 * count + 3]);
+	
+	//the same for any thread count
+	BOOST_CHECK(Ml::model_similarity<float>::compute(models.size(), get_model, 1).dot == similarity.dot);
+	
+	//near identical models: one weight differs by 1e-6, far below the cancellation error of ||a||^2 + ||b||^2 - 2a.b
+	auto nearly = parameter * 1.0f;
+	auto& nearly_data = nearly.getLayers()[1].getBlob_p()->getData();
+	nearly_data[0] += 1e-6f;
+	const double expected = std::abs(double(nearly_data[0]) - double(parameter.getLayers()[1].getBlob_p()->getData()[0]));
+	std::vector<Ml::caffe_parameter_net<float>> near_models = {parameter, nearly, parameter * 1.0f};
+	auto near_similarity = Ml::model_similarity<float>::compute(near_models.size(), [&near_models](size_t index) -> const Ml::caffe_parameter_net<float>& {return near_models[index];});
+	BOOST_CHECK(expected > 0);
+	BOOST_CHECK(std::abs(near_similarity.l2[0 * 3 + 1] - expected) < 1e-6 * expected);
+	BOOST_CHECK(near_similarity.l2[0 * 3 + 2] == 0);
+}
+
+BOOST_AUTO_TEST_CASE (evaluation_cache)
+{
+	Ml::MlCaffeModel<float,caffe::SGDSolver> model1;
+	model1.load_caffe_model("../../../dataset/MNIST/lenet_solver_memory.prototxt");
+	
+	auto parameter = model1.get_parameter();
+	auto copy = parameter;
+	auto other = parameter;
+	other.random(-1, 1);
+	using cache_type = Ml::evaluation_cache<float>;
+	BOOST_CHECK(cache_type::content_hash(parameter) == cache_type::content_hash(copy));
+	BOOST_CHECK(cache_type::content_hash(parameter) != cache_type::content_hash(other));
+	
+	cache_type cache(2);
+	std::atomic<int> evaluate_count = 0;
+	auto evaluate = [&evaluate_count](float accuracy){ return [&evaluate_count, accuracy](){ evaluate_count++; return cache_type::result{accuracy, 1}; }; };
+	BOOST_CHECK(cache.get_or_evaluate(parameter, 1, evaluate(0.5)).accuracy == 0.5f);
+	BOOST_CHECK(cache.get_or_evaluate(copy, 1, evaluate(0.6)).accuracy == 0.5f);
+	BOOST_CHECK(cache.get_or_evaluate(parameter, 2, evaluate(0.7)).accuracy == 0.7f);
+	BOOST_CHECK(evaluate_count == 2 && cache.hit_count() == 1 && cache.miss_count() == 2);
+	
+	//the oldest entry is dropped beyond the capacity
+	cache.get_or_evaluate(other, 1, evaluate(0.8));
+	BOOST_CHECK(cache.size() == 2);
+	BOOST_CHECK(cache.get_or_evaluate(parameter, 1, evaluate(0.9)).accuracy == 0.9f);
+	
+	//many threads asking for the same key evaluate it once
+	cache.clear();
+	evaluate_count = 0;
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 8; ++i)
+	{
+		threads.emplace_back([&cache, &evaluate_count, &parameter]()
+		{
+			cache.get_or_evaluate(parameter, 3, [&evaluate_count]()
+			{
+				evaluate_count++;
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				return cache_type::result{0.4, 1};
+			});
+		});
+	}
+	for (auto& thread: threads) thread.join();
+	BOOST_CHECK(evaluate_count == 1);
+	
+	//a failed evaluation is not cached
+	BOOST_CHECK_THROW(cache.get_or_evaluate(parameter, 4, []() -> cache_type::result { throw std::runtime_error("failed"); }), std::runtime_error);
+	BOOST_CHECK(cache.get_or_evaluate(parameter, 4, evaluate(0.3)).accuracy == 0.3f);
+
+	//a failed entry does not take a place in the eviction order
+	cache_type small_cache(2);
+	BOOST_CHECK_THROW(small_cache.get_or_evaluate(uint64_t(1), 1, []() -> cache_type::result { throw std::runtime_error("failed"); }), std::runtime_error);
+	small_cache.get_or_evaluate(uint64_t(1), 1, evaluate(0.1));
+	small_cache.get_or_evaluate(uint64_t(2), 1, evaluate(0.2));
+	small_cache.get_or_evaluate(uint64_t(3), 1, evaluate(0.3));
+	BOOST_CHECK(small_cache.size() == 2);
+	BOOST_CHECK(small_cache.get_or_evaluate(uint64_t(2), 1, evaluate(0.9)).accuracy == 0.2f);
+	BOOST_CHECK(small_cache.get_or_evaluate(uint64_t(3), 1, evaluate(0.9)).accuracy == 0.3f);
+
+	//a key computed by the caller, such as a SHA-256 string
+	Ml::evaluation_cache<float, std::string> digest_cache;
+	BOOST_CHECK(digest_cache.get_or_evaluate(std::string("digest a"), 1, evaluate(0.5)).accuracy == 0.5f);
+	BOOST_CHECK(digest_cache.get_or_evaluate(std::string("digest b"), 1, evaluate(0.6)).accuracy == 0.6f);
+	BOOST_CHECK(digest_cache.get_or_evaluate(std::string("digest a"), 1, evaluate(0.7)).accuracy == 0.5f);
+	BOOST_CHECK(digest_cache.hit_count() == 1 && digest_cache.miss_count() == 2);
+}
+
 BOOST_AUTO_TEST_SUITE_END( )
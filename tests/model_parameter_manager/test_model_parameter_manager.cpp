@@ -89,6 +89,33 @@ int main()
     }
 
 
+//    reopen test: the newest version is decoded from the nearest keyframe and the deltas after it
+
+    pass=true;
+
+    main_model_parameter_manager.reset();
+    main_model_parameter_manager.reset(new model_parameter_manager("./model_db"));
+
+    parameter_got=main_model_parameter_manager->get_model_parameter_net_newest<float>(node_hash_1);
+    if (!parameter_got || parameter_got.value()!=parameter_stored_container.back())
+    {
+        pass=false;
+        std::cout<<"failed reopen test: newest version mismatch"<<std::endl;
+    }
+
+    parameter_got_history=main_model_parameter_manager->get_model_parameter_net_history<float>(node_hash_1,parameter_got_history.value()[5].first,parameter_got_history.value()[7].first);
+    if (!parameter_got_history || parameter_got_history.value().front().second!=parameter_stored_container[5] || parameter_got_history.value().back().second!=parameter_stored_container[7])
+    {
+        pass=false;
+        std::cout<<"failed reopen test: history range mismatch"<<std::endl;
+    }
+
+    if (pass)
+    {
+        std::cout<<"pass reopen test"<<std::endl;
+    }
+
+
 //    reset function test 1: single
 
     pass=true;